@@ -0,0 +1,213 @@
+/*
+ * device_table.c - Latest fix per device, lock-free reads.
+ * Slots are claimed once with a CAS on the id and never removed, so a
+ * probe sequence never changes under a reader. Each slot carries a
+ * sequence counter (seqlock): writers make it odd, store the record and
+ * make it even again; readers copy the record between two loads of the
+ * counter and retry if it moved. Writers to the same device serialise on
+ * the counter, writers to different devices never touch the same line.
+ */
+
+#include "device_table.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpu_relax()     _mm_pause()
+#else
+#define cpu_relax()     ((void)0)
+#endif
+
+
+static uint32_t hash_id(uint64_t id)
+{
+    id ^= id >> 33;
+    id *= 0xFF51AFD7ED558CCDull;
+    id ^= id >> 33;
+    return (uint32_t)id;
+}
+
+/*
+ * find_slot - Probes for the device, claiming a free slot when create is set.
+ * @return  the slot, NULL if absent (or the table is full).
+ *
+ */
+static DEVSLOT *find_slot(DEVICE_TABLE *t, uint64_t id, int create)
+{
+    uint32_t i = hash_id(id) & t->mask;
+
+    for (uint32_t n = 0; n <= t->mask; n++, i = (i + 1) & t->mask)
+    {
+        DEVSLOT  *s = &t->slot[i];
+        uint64_t  k = atomic_load_explicit(&s->id, memory_order_acquire);
+
+        if (k == id) return s;
+        if (k != 0) continue;
+        if (!create) return NULL;
+
+        if (atomic_fetch_add_explicit(&t->count, 1, memory_order_relaxed) >= t->limit)
+        {
+            atomic_fetch_sub_explicit(&t->count, 1, memory_order_relaxed);
+            return NULL;
+        }
+        if (atomic_compare_exchange_strong_explicit(&s->id, &k, id, memory_order_acq_rel, memory_order_acquire))
+        {
+            return s;
+        }
+        atomic_fetch_sub_explicit(&t->count, 1, memory_order_relaxed);
+        if (k == id) return s;                  // another writer added the same device
+    }
+    return NULL;
+}
+
+/*
+ * read_slot - Consistent copy of a slot's record.
+ * @return  0, -1 if the slot was never written.
+ *
+ */
+static int read_slot(const DEVSLOT *s, FIXRECORD *rec)
+{
+    DEVSLOT  *w = (DEVSLOT *)s;                 // atomic loads only, C11 wants non-const
+    uint64_t  copy[DEVTAB_WORDS];
+    uint32_t  before, after;
+
+    for (;;)
+    {
+        before = atomic_load_explicit(&w->seq, memory_order_acquire);
+        if (before == 0) return -1;
+        if (before & 1)
+        {
+            cpu_relax();
+            continue;
+        }
+
+        for (size_t i = 0; i < DEVTAB_WORDS; i++)
+        {
+            copy[i] = atomic_load_explicit(&w->word[i], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&w->seq, memory_order_relaxed);
+
+        if (before == after) break;
+    }
+
+    memcpy(rec, copy, sizeof(FIXRECORD));
+    return 0;
+}
+
+
+/*
+ * devtab_init - Sizes the table for the given number of devices.
+ * @return  0, -1 if out of memory.
+ *
+ */
+int devtab_init(DEVICE_TABLE *t, uint32_t devices)
+{
+    uint32_t capacity = 64;
+
+    memset(t, 0, sizeof(DEVICE_TABLE));
+    if (devices > 0x40000000u) return -1;
+    while (capacity < devices * 2) capacity <<= 1;
+
+    t->slot = aligned_alloc(64, (size_t)capacity * sizeof(DEVSLOT));
+    if (!t->slot) return -1;
+    memset(t->slot, 0, (size_t)capacity * sizeof(DEVSLOT));
+
+    t->mask  = capacity - 1;
+    t->limit = capacity / 2;
+    atomic_init(&t->count, 0);
+    return 0;
+}
+
+void devtab_free(DEVICE_TABLE *t)
+{
+    free(t->slot);
+    memset(t, 0, sizeof(DEVICE_TABLE));
+}
+
+/*
+ * devtab_update - Stores the latest fix of a device (id != 0).
+ * A record older than the stored one (utc_ms) is dropped, so fixes that
+ * arrive out of order through parallel decoders never move a device back.
+ * @return  0 stored, 1 older than the stored record, -1 table full.
+ *
+ */
+int devtab_update(DEVICE_TABLE *t, uint64_t id, const FIXRECORD *rec)
+{
+    DEVSLOT  *s;
+    uint64_t  copy[DEVTAB_WORDS];
+    uint32_t  seq;
+
+    if (id == 0 || !(s = find_slot(t, id, 1))) return -1;
+
+    memcpy(copy, rec, sizeof(FIXRECORD));
+
+    // lock: even -> odd
+    seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    for (;;)
+    {
+        if (!(seq & 1) && atomic_compare_exchange_weak_explicit(&s->seq, &seq, seq + 1,
+                                                                memory_order_acquire, memory_order_relaxed))
+        {
+            break;
+        }
+        cpu_relax();
+        seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    }
+
+    if (seq != 0 && rec->utc_ms != 0 &&
+        (int64_t)atomic_load_explicit(&s->word[0], memory_order_relaxed) > rec->utc_ms)
+    {
+        atomic_store_explicit(&s->seq, seq, memory_order_release);      // nothing written, readers keep their copy
+        return 1;
+    }
+
+    // record stores may not move above the odd counter
+    atomic_thread_fence(memory_order_release);
+    for (size_t i = 0; i < DEVTAB_WORDS; i++)
+    {
+        atomic_store_explicit(&s->word[i], copy[i], memory_order_relaxed);
+    }
+
+    seq += 2;
+    if (seq == 0) seq = 2;                      // 0 is reserved for "never written"
+    atomic_store_explicit(&s->seq, seq, memory_order_release);
+    return 0;
+}
+
+/*
+ * devtab_lookup - Copies the latest fix of a device, never blocks writers.
+ * @return  0, -1 if the device has no record.
+ *
+ */
+int devtab_lookup(const DEVICE_TABLE *t, uint64_t id, FIXRECORD *rec)
+{
+    const DEVSLOT *s;
+
+    if (id == 0 || !(s = find_slot((DEVICE_TABLE *)t, id, 0))) return -1;
+    return read_slot(s, rec);
+}
+
+uint32_t devtab_count(const DEVICE_TABLE *t)
+{
+    return atomic_load_explicit(&((DEVICE_TABLE *)t)->count, memory_order_relaxed);
+}
+
+/*
+ * devtab_scan - Visits every device with a consistent copy of its record
+ * (each record is consistent on its own, the scan is not a snapshot).
+ *
+ */
+void devtab_scan(const DEVICE_TABLE *t, devtab_visit visit, void *ctx)
+{
+    FIXRECORD rec;
+
+    for (uint32_t i = 0; i <= t->mask; i++)
+    {
+        DEVSLOT  *s = &t->slot[i];
+        uint64_t  id = atomic_load_explicit(&s->id, memory_order_acquire);
+
+        if (id != 0 && read_slot(s, &rec) == 0) visit(id, &rec, ctx);
+    }
+}
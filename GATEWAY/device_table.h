@@ -0,0 +1,48 @@
+/*
+ * device_table.h
+ *
+ * Latest FIXRECORD of every device, keyed by device id. Open addressing
+ * with one seqlock per slot: the decode pipeline updates in place while
+ * any number of readers copy records without taking a lock or writing to
+ * shared memory, so lookups scale with the number of cores.
+ */
+
+#ifndef INC_DEVICE_TABLE_H_
+#define INC_DEVICE_TABLE_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "fix_record.h"
+
+#define DEVTAB_WORDS        (sizeof(FIXRECORD) / sizeof(uint64_t))
+
+// DEVSLOT: one cache line, so updates of one device never slow readers of another
+typedef struct
+{
+    _Alignas(64) _Atomic uint64_t   id;                 // 0 = free, set once
+    _Atomic uint32_t    seq;                            // odd while written, 0 = no record yet
+    uint32_t            reserved;
+    _Atomic uint64_t    word[DEVTAB_WORDS];             // the FIXRECORD
+} DEVSLOT;
+
+typedef struct
+{
+    DEVSLOT             *slot;
+    uint32_t            mask;                           // capacity - 1, capacity is a power of 2
+    uint32_t            limit;                          // devices accepted (load factor 1/2)
+    _Atomic uint32_t    count;
+} DEVICE_TABLE;
+
+typedef void (*devtab_visit)(uint64_t id, const FIXRECORD *rec, void *ctx);
+
+
+// Public function declarations
+int      devtab_init(DEVICE_TABLE *t, uint32_t devices);
+void     devtab_free(DEVICE_TABLE *t);
+
+int      devtab_update(DEVICE_TABLE *t, uint64_t id, const FIXRECORD *rec);
+int      devtab_lookup(const DEVICE_TABLE *t, uint64_t id, FIXRECORD *rec);
+uint32_t devtab_count(const DEVICE_TABLE *t);
+void     devtab_scan(const DEVICE_TABLE *t, devtab_visit visit, void *ctx);
+
+#endif /* INC_DEVICE_TABLE_H_ */
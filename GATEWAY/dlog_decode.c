@@ -0,0 +1,168 @@
+/*
+ * dlog_decode.c - Decoder of the deferred binary log (NMEA/gps_dlog.c).
+ * The format strings come from the same gps_dlog_msgs.h table the firmware
+ * was built with. A frame is only taken when its checksum matches; at any
+ * other byte the decoder moves on by one and counts it as skipped.
+ */
+
+#include "dlog_decode.h"
+#include <stdio.h>
+#include <string.h>
+
+typedef struct
+{
+    const char  *name;
+    uint8_t     nargs;
+    const char  *format;
+} DLOG_MESSAGE;
+
+#define DLOG_ENTRY(id, nargs, fmt) { #id, nargs, fmt },
+static const DLOG_MESSAGE message[DLOG_COUNT] = { DLOG_MESSAGES(DLOG_ENTRY) };
+#undef DLOG_ENTRY
+
+
+static int get_varint(const unsigned char *p, size_t len, size_t *at, uint32_t *v)
+{
+    *v = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        if (*at >= len) return 0;                   // need more bytes
+
+        unsigned char c = p[(*at)++];
+
+        *v |= (uint32_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) return 1;
+    }
+    return -1;
+}
+
+/*
+ * parse_frame - Decodes the frame at the start of p.
+ * @return  frame length, 0 if p holds only part of it, -1 if it is not a frame.
+ *
+ */
+static int parse_frame(const unsigned char *p, size_t len, DLOG_EVENT *ev)
+{
+    size_t  at = 3;
+    uint8_t sum = 0;
+
+    if (p[0] != DLOG_SYNC) return -1;
+    if (len < 2) return 0;
+    if (p[1] >= DLOG_COUNT) return -1;
+    if (len < 3) return 0;
+
+    for (int i = 0; i < message[p[1]].nargs; i++)
+    {
+        int r = get_varint(p, len, &at, &ev->arg[i]);
+
+        if (r <= 0) return r;
+    }
+    if (at >= len) return 0;
+
+    for (size_t i = 0; i < at; i++) sum = (uint8_t)(sum + p[i]);
+    if (p[at] != sum) return -1;
+
+    ev->id  = p[1];
+    ev->seq = p[2];
+    return (int)at + 1;
+}
+
+static void take_event(DLOG_DECODER *d, const DLOG_EVENT *ev)
+{
+    unsigned gap = 0;
+
+    if (d->have_seq && ev->seq != d->seq)
+    {
+        gap = (uint8_t)(ev->seq - d->seq);
+        d->missing += gap;
+    }
+    d->have_seq = 1;
+    d->seq      = (uint8_t)(ev->seq + 1);
+    d->events++;
+    if (d->event) d->event(d->ctx, ev, gap);
+}
+
+/*
+ * consume - Decodes every complete frame in the buffer.
+ * With at_end set a partial frame left at the end counts as skipped bytes.
+ *
+ */
+static void consume(DLOG_DECODER *d, int at_end)
+{
+    size_t at = 0;
+
+    while (at < d->len)
+    {
+        DLOG_EVENT ev = { 0, 0, { 0, 0, 0 } };
+        int        n = parse_frame(d->buf + at, d->len - at, &ev);
+
+        if (n == 0 && !at_end) break;
+        if (n <= 0)
+        {
+            at++;
+            d->skipped++;
+            continue;
+        }
+        take_event(d, &ev);
+        at += (size_t)n;
+    }
+    memmove(d->buf, d->buf + at, d->len - at);
+    d->len -= at;
+}
+
+void dlog_decoder_init(DLOG_DECODER *d, dlog_event_fn event, void *ctx)
+{
+    memset(d, 0, sizeof(DLOG_DECODER));
+    d->event = event;
+    d->ctx   = ctx;
+}
+
+/*
+ * dlog_decode - Feeds len bytes of a capture; complete frames are passed
+ * to the event callback, a partial one waits for the next call.
+ *
+ */
+void dlog_decode(DLOG_DECODER *d, const unsigned char *data, size_t len)
+{
+    while (len > 0)
+    {
+        size_t n = sizeof(d->buf) - d->len;
+
+        if (n > len) n = len;
+        memcpy(d->buf + d->len, data, n);
+        d->len += n;
+        data   += n;
+        len    -= n;
+        consume(d, 0);
+    }
+}
+
+/*
+ * dlog_decode_end - End of the capture: a partial frame left over is
+ * counted as skipped bytes.
+ *
+ */
+void dlog_decode_end(DLOG_DECODER *d)
+{
+    consume(d, 1);
+}
+
+/*
+ * dlog_name - Message id as in gps_dlog_msgs.h, "?" for an unknown one.
+ *
+ */
+const char *dlog_name(uint8_t id)
+{
+    return id < DLOG_COUNT ? message[id].name : "?";
+}
+
+/*
+ * dlog_format - The event's text, its message format applied to the arguments.
+ * @return  as snprintf.
+ *
+ */
+int dlog_format(char *out, size_t size, const DLOG_EVENT *ev)
+{
+    if (ev->id >= DLOG_COUNT) return snprintf(out, size, "?");
+    return snprintf(out, size, message[ev->id].format, ev->arg[0], ev->arg[1], ev->arg[2]);
+}
@@ -0,0 +1,49 @@
+/*
+ * dlog_decode.h
+ *
+ * Decoder of the deferred binary log (NMEA/gps_dlog.c), shared by
+ * dlog_tool and the tests. Captures are fed in pieces of any size; bytes
+ * that are not part of a valid frame (other output sharing the UART, line
+ * errors) are skipped and gaps in the event sequence are counted.
+ */
+
+#ifndef INC_DLOG_DECODE_H_
+#define INC_DLOG_DECODE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "gps_dlog.h"
+
+// DLOG_EVENT: one decoded frame, arguments beyond the message's count are 0
+typedef struct
+{
+    uint8_t     id;
+    uint8_t     seq;
+    uint32_t    arg[3];
+} DLOG_EVENT;
+
+// called per event; missing: events lost just before it (sequence gap)
+typedef void (*dlog_event_fn)(void *ctx, const DLOG_EVENT *ev, unsigned missing);
+
+typedef struct
+{
+    unsigned char   buf[4096];
+    size_t          len;
+    int             have_seq;
+    uint8_t         seq;
+    unsigned long   events, skipped, missing;
+
+    dlog_event_fn   event;
+    void            *ctx;
+} DLOG_DECODER;
+
+
+// Public function declarations
+void        dlog_decoder_init(DLOG_DECODER *d, dlog_event_fn event, void *ctx);
+void        dlog_decode(DLOG_DECODER *d, const unsigned char *data, size_t len);
+void        dlog_decode_end(DLOG_DECODER *d);
+
+const char *dlog_name(uint8_t id);
+int         dlog_format(char *out, size_t size, const DLOG_EVENT *ev);
+
+#endif /* INC_DLOG_DECODE_H_ */
@@ -0,0 +1,58 @@
+/*
+ * dlog_tool.c - Command line front end of dlog_decode.c.
+ *
+ *   dlog_tool [capture]...      (stdin when no file is given)
+ *
+ * Prints one line per event of the deferred binary log (NMEA/gps_dlog.c)
+ * and the gaps in the event sequence; bytes that are not part of a valid
+ * frame are skipped.
+ */
+
+#include "dlog_decode.h"
+#include <stdio.h>
+
+
+static void print_event(void *ctx, const DLOG_EVENT *ev, unsigned missing)
+{
+    char text[256];
+
+    (void)ctx;
+    if (missing) printf("---- %u events missing\n", missing);
+    dlog_format(text, sizeof(text), ev);
+    printf("%3u %-16s %s\n", ev->seq, dlog_name(ev->id), text);
+}
+
+static void decode_file(DLOG_DECODER *d, FILE *f)
+{
+    unsigned char buf[4096];
+    size_t        n;
+
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) dlog_decode(d, buf, n);
+}
+
+int main(int argc, char **argv)
+{
+    static DLOG_DECODER d;
+
+    dlog_decoder_init(&d, print_event, NULL);
+    if (argc < 2)
+    {
+        decode_file(&d, stdin);
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        FILE *f = fopen(argv[i], "rb");
+
+        if (!f)
+        {
+            perror(argv[i]);
+            return 1;
+        }
+        decode_file(&d, f);
+        fclose(f);
+    }
+    dlog_decode_end(&d);
+
+    fprintf(stderr, "%lu events, %lu missing, %lu bytes skipped\n", d.events, d.missing, d.skipped);
+    return 0;
+}
@@ -0,0 +1,437 @@
+/*
+ * fix_bloom.c - Per-block spatial Bloom filters over fix logs.
+ * Each positioned fix adds its fine and its coarse cell to the block's
+ * filter (one filter, the level is part of the key), k bits per key by
+ * double hashing. A query enumerates the cells of its region at the finest
+ * level that needs at most FIXBLOOM_MAX_PROBES of them and reads a block
+ * only when its time range and box overlap the query and the filter holds
+ * one of the cells; the records of a block that is read are checked
+ * exactly, so false positives cost a read, never a wrong answer. Blocks
+ * past the index (the log grew, the partial tail block) are always read.
+ */
+
+#include "fix_bloom.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BUILD_BLOCKS        256                     // log blocks per read while building
+
+typedef struct
+{
+    uint64_t    h1, h2;
+} CELL_HASH;
+
+
+static uint64_t mix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+static int32_t floor_div(int32_t v, int32_t size)
+{
+    return v >= 0 ? v / size : -(int32_t)((-(int64_t)v + size - 1) / size);
+}
+
+static CELL_HASH cell_hash(int level, int32_t row, int32_t col)
+{
+    uint64_t  key = ((uint64_t)(uint32_t)row << 32) | (uint32_t)col;
+    CELL_HASH h;
+
+    h.h1 = mix64(key ^ ((uint64_t)level << 62));
+    h.h2 = mix64(h.h1) | 1;                         // odd: the k probes never repeat a bit early
+    return h;
+}
+
+static void bloom_add(uint64_t *bits, uint32_t words, uint32_t hashes, CELL_HASH h)
+{
+    uint64_t m = (uint64_t)words * 64;
+
+    for (uint32_t i = 0; i < hashes; i++)
+    {
+        uint64_t bit = (h.h1 + i * h.h2) % m;
+        bits[bit / 64] |= 1ull << (bit % 64);
+    }
+}
+
+static int bloom_test(const uint64_t *bits, uint32_t words, uint32_t hashes, CELL_HASH h)
+{
+    uint64_t m = (uint64_t)words * 64;
+
+    for (uint32_t i = 0; i < hashes; i++)
+    {
+        uint64_t bit = (h.h1 + i * h.h2) % m;
+        if (!(bits[bit / 64] & (1ull << (bit % 64)))) return 0;
+    }
+    return 1;
+}
+
+static uint64_t block_hash(const void *block)
+{
+    const uint8_t *p = block;
+    uint64_t       h = 0, w;
+
+    for (size_t i = 0; i < FIXLOG_BLOCK; i += sizeof(w))
+    {
+        memcpy(&w, p + i, sizeof(w));
+        h = mix64(h ^ w);
+    }
+    return h;
+}
+
+static uint64_t log_check(uint64_t first, uint64_t last)
+{
+    return first ^ mix64(last);
+}
+
+static ssize_t read_full(int fd, void *data, size_t len, off_t offset)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t r = pread(fd, (uint8_t *)data + done, len - done, offset + (off_t)done);
+
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return -1;
+        if (r == 0) break;
+        done += (size_t)r;
+    }
+    return (ssize_t)done;
+}
+
+/*
+ * index_block - Summary and filter of one log block.
+ * @return  records in the block, -1 if it is not a fix log block.
+ *
+ */
+static int index_block(const FIXBLOOM_HEADER *hdr, const void *block, FIXBLOOM_ENTRY *e, uint64_t *bits)
+{
+    const FIXLOG_RECORD *rec;
+    int                  count = fixlog_block_records(block, &rec);
+
+    memset(e, 0, sizeof(FIXBLOOM_ENTRY));
+    memset(bits, 0, hdr->words * sizeof(uint64_t));
+    if (count < 0) return -1;
+
+    for (int i = 0; i < count; i++)
+    {
+        const FIXRECORD *f = &rec[i].fix;
+
+        if ((f->present & GPS_HAS_POSITION) != GPS_HAS_POSITION) continue;
+
+        if (e->positioned++ == 0)
+        {
+            e->min_lat = e->max_lat = f->latitude;
+            e->min_lon = e->max_lon = f->longitude;
+        }
+        if (f->latitude < e->min_lat) e->min_lat = f->latitude;
+        if (f->latitude > e->max_lat) e->max_lat = f->latitude;
+        if (f->longitude < e->min_lon) e->min_lon = f->longitude;
+        if (f->longitude > e->max_lon) e->max_lon = f->longitude;
+
+        if (f->utc_ms)
+        {
+            if (e->timed++ == 0) e->first_ms = e->last_ms = f->utc_ms;
+            if (f->utc_ms < e->first_ms) e->first_ms = f->utc_ms;
+            if (f->utc_ms > e->last_ms) e->last_ms = f->utc_ms;
+        }
+
+        int32_t coarse = hdr->cell_size * (int32_t)hdr->coarse;
+
+        bloom_add(bits, hdr->words, hdr->hashes,
+                  cell_hash(0, floor_div(f->latitude, hdr->cell_size), floor_div(f->longitude, hdr->cell_size)));
+        bloom_add(bits, hdr->words, hdr->hashes,
+                  cell_hash(1, floor_div(f->latitude, coarse), floor_div(f->longitude, coarse)));
+    }
+    return count;
+}
+
+/*
+ * fixbloom_build - Indexes the blocks of a fix log into index_path
+ * (written aside and renamed, so readers never see half an index). Every
+ * block is indexed, also the partial ones a reopened log leaves behind,
+ * but a partial last block: the log writer is still filling it. The
+ * filter gets m = -n ln p / ln^2 2 bits for n = 2 * cells keys (both
+ * levels) and k = m / n ln 2 hashes.
+ * @return  0, -1 on error (errno set).
+ *
+ */
+int fixbloom_build(const char *log_path, const char *index_path, const FIXBLOOM_CONFIG *cfg)
+{
+    FIXBLOOM_HEADER hdr;
+    FIXBLOOM_ENTRY  e;
+    double          p = cfg && cfg->fp_rate > 0 && cfg->fp_rate < 1 ? cfg->fp_rate : FIXBLOOM_FP_DEFAULT;
+    double          n = 2.0 * (cfg && cfg->cells ? cfg->cells : FIXLOG_PER_BLOCK);
+    double          m = ceil(-n * log(p) / (M_LN2 * M_LN2));
+    uint8_t         *buf = NULL;
+    uint64_t        *bits = NULL;
+    char            tmp[4096];
+    FILE            *out = NULL;
+    int             fd, rc = -1;
+    off_t           offset = 0;
+    struct stat     sb;
+    uint64_t        total, first = 0, last = 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic     = FIXBLOOM_MAGIC;
+    hdr.cell_size = cfg && cfg->cell_size > 0 ? cfg->cell_size : FIXBLOOM_CELL_DEFAULT;
+    hdr.coarse    = FIXBLOOM_COARSE;
+    hdr.words     = (uint32_t)((m + 63) / 64);
+    hdr.hashes    = (uint32_t)lround((double)hdr.words * 64 / n * M_LN2);
+    if (hdr.hashes < 1) hdr.hashes = 1;
+    if (hdr.hashes > FIXBLOOM_MAX_HASHES) hdr.hashes = FIXBLOOM_MAX_HASHES;
+
+    if ((fd = open(log_path, O_RDONLY | O_CLOEXEC)) < 0) return -1;
+    if (fstat(fd, &sb) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    total = (uint64_t)sb.st_size / FIXLOG_BLOCK;          // what the log grows by meanwhile stays out
+    snprintf(tmp, sizeof(tmp), "%s.tmp", index_path);
+
+    buf  = malloc((size_t)BUILD_BLOCKS * FIXLOG_BLOCK);
+    bits = malloc(hdr.words * sizeof(uint64_t));
+    if (!buf || !bits || !(out = fopen(tmp, "wb"))) goto done;
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1) goto done;
+
+    while (hdr.blocks < total)
+    {
+        size_t  want = total - hdr.blocks < BUILD_BLOCKS ? (size_t)(total - hdr.blocks) : BUILD_BLOCKS;
+        ssize_t got = read_full(fd, buf, want * FIXLOG_BLOCK, offset);
+        size_t  blocks;
+
+        if (got < 0) goto done;
+        blocks = (size_t)got / FIXLOG_BLOCK;
+
+        for (size_t i = 0; i < blocks; i++)
+        {
+            int count = index_block(&hdr, buf + i * FIXLOG_BLOCK, &e, bits);
+
+            // the last block, if partial, is still being filled: it stays unindexed
+            if (hdr.blocks + 1 == total && count >= 0 && (size_t)count < FIXLOG_PER_BLOCK) break;
+
+            if (fwrite(&e, sizeof(e), 1, out) != 1 || fwrite(bits, sizeof(uint64_t), hdr.words, out) != hdr.words)
+            {
+                goto done;
+            }
+            last = block_hash(buf + i * FIXLOG_BLOCK);
+            if (hdr.blocks++ == 0) first = last;
+        }
+        offset += (off_t)(blocks * FIXLOG_BLOCK);
+        if (blocks < want) break;                       // truncated meanwhile
+    }
+    hdr.log_check = hdr.blocks ? log_check(first, last) : 0;
+
+    if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&hdr, sizeof(hdr), 1, out) != 1) goto done;
+    if (fflush(out) != 0 || fsync(fileno(out)) != 0) goto done;
+    rc = 0;
+
+done:
+    if (out && fclose(out) != 0) rc = -1;
+    if (rc == 0 && rename(tmp, index_path) != 0) rc = -1;
+    if (rc != 0 && out) unlink(tmp);
+    free(buf);
+    free(bits);
+    close(fd);
+    return rc;
+}
+
+/*
+ * same_log - The log still holds the blocks the index was built from:
+ * long enough, and the first and last indexed block hash as they did.
+ *
+ */
+static int same_log(const FIXBLOOM *b)
+{
+    uint8_t  block[FIXLOG_BLOCK];
+    uint64_t first;
+
+    if (b->hdr.blocks == 0) return 1;
+    if (read_full(b->fd, block, FIXLOG_BLOCK, 0) != FIXLOG_BLOCK) return 0;
+    first = block_hash(block);
+    if (read_full(b->fd, block, FIXLOG_BLOCK, (off_t)((b->hdr.blocks - 1) * FIXLOG_BLOCK)) != FIXLOG_BLOCK) return 0;
+    return log_check(first, block_hash(block)) == b->hdr.log_check;
+}
+
+/*
+ * fixbloom_open - Loads the index and opens its log for queries.
+ * @return  0, -1 on error or if the index does not belong to a fix log
+ *          (EINVAL) or was not built from this one (ESTALE: rebuild it).
+ *
+ */
+int fixbloom_open(FIXBLOOM *b, const char *log_path, const char *index_path)
+{
+    FILE  *in = fopen(index_path, "rb");
+    size_t words;
+
+    memset(b, 0, sizeof(FIXBLOOM));
+    b->fd = -1;
+    if (!in) return -1;
+
+    if (fread(&b->hdr, sizeof(b->hdr), 1, in) != 1 || b->hdr.magic != FIXBLOOM_MAGIC ||
+        b->hdr.cell_size <= 0 || b->hdr.words == 0 || b->hdr.hashes == 0 || b->hdr.hashes > FIXBLOOM_MAX_HASHES)
+    {
+        fclose(in);
+        errno = EINVAL;
+        return -1;
+    }
+
+    words    = (size_t)b->hdr.words;
+    b->entry = malloc((size_t)b->hdr.blocks * sizeof(FIXBLOOM_ENTRY) + 1);
+    b->bits  = malloc((size_t)b->hdr.blocks * words * sizeof(uint64_t) + 1);
+    if (!b->entry || !b->bits) goto fail;
+
+    for (uint64_t i = 0; i < b->hdr.blocks; i++)
+    {
+        if (fread(&b->entry[i], sizeof(FIXBLOOM_ENTRY), 1, in) != 1 ||
+            fread(&b->bits[i * words], sizeof(uint64_t), words, in) != words)
+        {
+            errno = EINVAL;
+            goto fail;
+        }
+    }
+    fclose(in);
+
+    if ((b->fd = open(log_path, O_RDONLY | O_CLOEXEC)) < 0)
+    {
+        fixbloom_close(b);
+        return -1;
+    }
+    if (!same_log(b))
+    {
+        fixbloom_close(b);
+        errno = ESTALE;
+        return -1;
+    }
+    return 0;
+
+fail:
+    fclose(in);
+    fixbloom_close(b);
+    return -1;
+}
+
+void fixbloom_close(FIXBLOOM *b)
+{
+    if (b->fd >= 0) close(b->fd);
+    free(b->entry);
+    free(b->bits);
+    memset(b, 0, sizeof(FIXBLOOM));
+    b->fd = -1;
+}
+
+/*
+ * query_cells - Hashes of the region's cells at the finest level that
+ * needs at most FIXBLOOM_MAX_PROBES of them.
+ * @return  number of cells, 0 if even the coarse level needs more (the
+ *          filters can not help, only time and box prune).
+ *
+ */
+static uint32_t query_cells(const FIXBLOOM_HEADER *hdr, const FIXBLOOM_QUERY *q, CELL_HASH *cell)
+{
+    for (int level = 0; level < 2; level++)
+    {
+        int32_t  size = level ? hdr->cell_size * (int32_t)hdr->coarse : hdr->cell_size;
+        int32_t  row0 = floor_div(q->min.latitude, size), row1 = floor_div(q->max.latitude, size);
+        int32_t  col0 = floor_div(q->min.longitude, size), col1 = floor_div(q->max.longitude, size);
+        uint64_t n = (uint64_t)(row1 - row0 + 1) * (uint64_t)(col1 - col0 + 1);
+        uint32_t count = 0;
+
+        if (n > FIXBLOOM_MAX_PROBES) continue;
+
+        for (int32_t r = row0; r <= row1; r++)
+        {
+            for (int32_t c = col0; c <= col1; c++) cell[count++] = cell_hash(level, r, c);
+        }
+        return count;
+    }
+    return 0;
+}
+
+static int record_matches(const FIXRECORD *f, const FIXBLOOM_QUERY *q, int timed)
+{
+    if ((f->present & GPS_HAS_POSITION) != GPS_HAS_POSITION) return 0;
+    if (f->latitude < q->min.latitude || f->latitude > q->max.latitude) return 0;
+    if (f->longitude < q->min.longitude || f->longitude > q->max.longitude) return 0;
+    return !timed || (f->utc_ms && f->utc_ms >= q->from_ms && f->utc_ms < q->to_ms);
+}
+
+/*
+ * fixbloom_query - Fixes of the log inside q's box (and time range). With
+ * visit NULL the query stops at the first match (existence), else visit
+ * gets every match until it returns nonzero.
+ * @return  matches found, -1 on a read error.
+ *
+ */
+long fixbloom_query(FIXBLOOM *b, const FIXBLOOM_QUERY *q, fixbloom_visit visit, void *ctx, FIXBLOOM_STATS *st)
+{
+    CELL_HASH      cell[FIXBLOOM_MAX_PROBES];
+    uint8_t        block[FIXLOG_BLOCK];
+    FIXBLOOM_STATS s;
+    uint32_t       cells = query_cells(&b->hdr, q, cell);
+    int            timed = q->to_ms > q->from_ms;
+    int            stop = 0;
+
+    memset(&s, 0, sizeof(s));
+
+    for (uint64_t i = 0; !stop; i++)
+    {
+        const FIXLOG_RECORD *rec;
+        ssize_t              got;
+        int                  count;
+        uint64_t             found = s.matches;
+
+        if (i < b->hdr.blocks)
+        {
+            const FIXBLOOM_ENTRY *e = &b->entry[i];
+            const uint64_t       *bits = &b->bits[i * b->hdr.words];
+            uint32_t              c = 0;
+
+            if (e->positioned == 0 || (timed && (e->timed == 0 || e->last_ms < q->from_ms || e->first_ms >= q->to_ms)))
+            {
+                s.skipped_time++;
+                continue;
+            }
+            if (e->max_lat < q->min.latitude || e->min_lat > q->max.latitude ||
+                e->max_lon < q->min.longitude || e->min_lon > q->max.longitude)
+            {
+                s.skipped_box++;
+                continue;
+            }
+            while (c < cells && !bloom_test(bits, b->hdr.words, b->hdr.hashes, cell[c])) c++;
+            if (cells && c == cells)
+            {
+                s.skipped_bloom++;
+                continue;
+            }
+        }
+
+        got = read_full(b->fd, block, FIXLOG_BLOCK, (off_t)(i * FIXLOG_BLOCK));
+        if (got < 0) return -1;
+        if (got < FIXLOG_BLOCK) break;                  // end of the log
+        s.read++;
+
+        if ((count = fixlog_block_records(block, &rec)) < 0) continue;
+        for (int r = 0; r < count && !stop; r++)
+        {
+            if (!record_matches(&rec[r].fix, q, timed)) continue;
+            s.matches++;
+            stop = visit ? visit(&rec[r], ctx) != 0 : 1;
+        }
+        if (s.matches == found) s.false_positives++;
+    }
+
+    s.blocks = (uint64_t)lseek(b->fd, 0, SEEK_END) / FIXLOG_BLOCK;
+    if (st) *st = s;
+    return (long)s.matches;
+}
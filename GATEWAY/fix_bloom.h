@@ -0,0 +1,94 @@
+/*
+ * fix_bloom.h
+ *
+ * Block index of fix logs (fix_log.h) for sparse region queries ("was any
+ * device inside R during month M"). For every log block but a partial last
+ * one (still being filled) a side file keeps the time range, the bounding box and a Bloom filter of the grid
+ * cells (of the fixed-point LOCATION) its fixes fall in, at a fine and a
+ * coarse cell size. A query reads only the blocks whose filter holds one
+ * of R's cells; min/max boxes alone overlap almost every region once
+ * devices roam. The filter size follows from the cells expected per block
+ * and the false positive rate asked for. The index carries a hash of the
+ * first and the last block it covers, so it is not used with another log.
+ */
+
+#ifndef INC_FIX_BLOOM_H_
+#define INC_FIX_BLOOM_H_
+
+#include <stdint.h>
+#include "fix_log.h"
+
+#define FIXBLOOM_MAGIC          0x32494246u         // "FBI2"
+#define FIXBLOOM_CELL_DEFAULT   10000               // fine cell, degrees * GPS_COORD_SCALE (~1.1 km)
+#define FIXBLOOM_COARSE         16                  // coarse cell = fine cell * this
+#define FIXBLOOM_FP_DEFAULT     0.01                // per block and probed cell
+#define FIXBLOOM_MAX_PROBES     64                  // query cells probed; more: coarse cells, then box only
+#define FIXBLOOM_MAX_HASHES     16
+
+// zero fields take the defaults
+typedef struct
+{
+    int32_t     cell_size;                          // fine cell, degrees * GPS_COORD_SCALE
+    double      fp_rate;                            // false positive rate of one probe
+    uint32_t    cells;                              // distinct fine cells expected per block (default FIXLOG_PER_BLOCK)
+} FIXBLOOM_CONFIG;
+
+// index file: FIXBLOOM_HEADER, then per block a FIXBLOOM_ENTRY and words * uint64_t filter bits
+typedef struct
+{
+    uint32_t    magic;
+    int32_t     cell_size;
+    uint32_t    coarse;                             // FIXBLOOM_COARSE at build time
+    uint32_t    words;                              // filter size, 64 bit words per block
+    uint32_t    hashes;
+    uint32_t    reserved;
+    uint64_t    blocks;                             // log blocks indexed, from the start of the log
+    uint64_t    log_check;                          // hash of the first and the last indexed block
+} FIXBLOOM_HEADER;
+
+typedef struct
+{
+    int64_t     first_ms, last_ms;                  // utc range of the positioned fixes with a time
+    int32_t     min_lat, min_lon;                   // bounding box, degrees * GPS_COORD_SCALE
+    int32_t     max_lat, max_lon;
+    uint32_t    positioned;                         // fixes with a position, 0: nothing to find
+    uint32_t    timed;                              // of which with a utc time
+} FIXBLOOM_ENTRY;
+
+typedef struct
+{
+    LOCATION    min, max;                           // region, degrees * GPS_COORD_SCALE
+    int64_t     from_ms, to_ms;                     // [from, to), to <= from: any time
+} FIXBLOOM_QUERY;
+
+typedef struct
+{
+    uint64_t    blocks;                             // in the log
+    uint64_t    skipped_time;
+    uint64_t    skipped_box;
+    uint64_t    skipped_bloom;
+    uint64_t    read;                               // blocks read (unindexed tail included)
+    uint64_t    false_positives;                    // read without a match
+    uint64_t    matches;
+} FIXBLOOM_STATS;
+
+typedef struct
+{
+    FIXBLOOM_HEADER hdr;
+    FIXBLOOM_ENTRY  *entry;
+    uint64_t        *bits;                          // hdr.words per block
+    int             fd;                             // the log
+} FIXBLOOM;
+
+// a matching fix, nonzero stops the query
+typedef int (*fixbloom_visit)(const FIXLOG_RECORD *rec, void *ctx);
+
+
+// Public function declarations
+int  fixbloom_build(const char *log_path, const char *index_path, const FIXBLOOM_CONFIG *cfg);
+
+int  fixbloom_open(FIXBLOOM *b, const char *log_path, const char *index_path);
+long fixbloom_query(FIXBLOOM *b, const FIXBLOOM_QUERY *q, fixbloom_visit visit, void *ctx, FIXBLOOM_STATS *st);
+void fixbloom_close(FIXBLOOM *b);
+
+#endif /* INC_FIX_BLOOM_H_ */
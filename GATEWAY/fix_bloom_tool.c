@@ -0,0 +1,119 @@
+/*
+ * fix_bloom_tool.c - Command line front end of fix_bloom.c.
+ *
+ *   fixbloom [options] <fix log> <index>
+ *
+ *   -b                  (re)build the index first
+ *   -c cell             fine cell size, degrees (default 0.01)
+ *   -p rate             false positive rate per probe (default 0.01)
+ *   -n cells            distinct fine cells expected per block
+ *   -r lat0,lon0,lat1,lon1
+ *                       region to query, degrees
+ *   -f ms -t ms         time range of the query, utc ms [from, to)
+ *   -e                  existence only: stop at the first match
+ *   -v                  print the matching fixes
+ */
+
+#include "fix_bloom.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+
+static int print_fix(const FIXLOG_RECORD *rec, void *ctx)
+{
+    (void)ctx;
+    printf("%016llx %lld %.6f %.6f\n", (unsigned long long)rec->device, (long long)rec->fix.utc_ms,
+           (double)rec->fix.latitude / GPS_COORD_SCALE, (double)rec->fix.longitude / GPS_COORD_SCALE);
+    return 0;
+}
+
+static int count_fix(const FIXLOG_RECORD *rec, void *ctx)
+{
+    (void)rec;
+    (void)ctx;
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: fixbloom [-b] [-c cell] [-p rate] [-n cells] [-r lat0,lon0,lat1,lon1 [-f ms] [-t ms] [-e] [-v]]\n"
+                    "                log index\n");
+}
+
+int main(int argc, char **argv)
+{
+    FIXBLOOM_CONFIG cfg;
+    FIXBLOOM_QUERY  q;
+    FIXBLOOM_STATS  st;
+    FIXBLOOM        b;
+    struct timespec t0, t1;
+    double          lat0, lon0, lat1, lon1;
+    int             build = 0, region = 0, exists = 0, verbose = 0, opt;
+    long            found;
+
+    memset(&cfg, 0, sizeof(cfg));
+    memset(&q, 0, sizeof(q));
+
+    while ((opt = getopt(argc, argv, "bc:p:n:r:f:t:ev")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b': build         = 1; break;
+            case 'c': cfg.cell_size = (int32_t)(atof(optarg) * GPS_COORD_SCALE); break;
+            case 'p': cfg.fp_rate   = atof(optarg); break;
+            case 'n': cfg.cells     = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'r': region        = sscanf(optarg, "%lf,%lf,%lf,%lf", &lat0, &lon0, &lat1, &lon1) == 4; break;
+            case 'f': q.from_ms     = strtoll(optarg, NULL, 10); break;
+            case 't': q.to_ms       = strtoll(optarg, NULL, 10); break;
+            case 'e': exists        = 1; break;
+            case 'v': verbose       = 1; break;
+            default:  usage(); return 2;
+        }
+    }
+    if (argc - optind != 2 || (!build && !region))
+    {
+        usage();
+        return 2;
+    }
+
+    if (build && fixbloom_build(argv[optind], argv[optind + 1], &cfg) != 0)
+    {
+        perror("fixbloom: build");
+        return 1;
+    }
+    if (!region) return 0;
+
+    if (fixbloom_open(&b, argv[optind], argv[optind + 1]) != 0)
+    {
+        if (errno == ESTALE) fprintf(stderr, "fixbloom: the index was not built from this log, rebuild it (-b)\n");
+        else perror("fixbloom");
+        return 1;
+    }
+    q.min.latitude  = (int32_t)((lat0 < lat1 ? lat0 : lat1) * GPS_COORD_SCALE);
+    q.max.latitude  = (int32_t)((lat0 < lat1 ? lat1 : lat0) * GPS_COORD_SCALE);
+    q.min.longitude = (int32_t)((lon0 < lon1 ? lon0 : lon1) * GPS_COORD_SCALE);
+    q.max.longitude = (int32_t)((lon0 < lon1 ? lon1 : lon0) * GPS_COORD_SCALE);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    found = fixbloom_query(&b, &q, exists ? NULL : verbose ? print_fix : count_fix, NULL, &st);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (found < 0)
+    {
+        perror("fixbloom: query");
+        fixbloom_close(&b);
+        return 1;
+    }
+
+    fprintf(stderr, "%ld matches%s; %llu of %llu blocks read (%llu false positives), skipped %llu by time, "
+                    "%llu by box, %llu by filter; %.3f s\n",
+            found, exists ? " (stopped at the first)" : "",
+            (unsigned long long)st.read, (unsigned long long)st.blocks, (unsigned long long)st.false_positives,
+            (unsigned long long)st.skipped_time, (unsigned long long)st.skipped_box,
+            (unsigned long long)st.skipped_bloom,
+            (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9);
+    fixbloom_close(&b);
+    return found > 0 ? 0 : 3;
+}
@@ -0,0 +1,400 @@
+/*
+ * fix_log.c - Asynchronous group-commit fix logger.
+ * The append path is one store into the thread's own ring and one release
+ * store of its head: no lock, no syscall, no wait. The writer thread wakes
+ * every commit interval, moves whatever the rings hold into block aligned
+ * buffer space and writes every full block plus the partial last one in a
+ * single pwrite. The partial block stays in memory and is written again,
+ * fuller, at the same offset by the next commit, so the file never holds
+ * gaps and readers only need the count in each block header.
+ */
+
+#define _GNU_SOURCE
+#include "fix_log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(FIXLOG_BLOCK_HEADER) == 16, "FIXLOG_BLOCK_HEADER must stay 16 bytes");
+_Static_assert(FIXLOG_PER_BLOCK <= UINT16_MAX, "block count field too small");
+
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+static FIXLOG_BLOCK_HEADER *tail_block(FIXLOG *log)
+{
+    return (FIXLOG_BLOCK_HEADER *)(log->buf + (size_t)log->blocks * FIXLOG_BLOCK);
+}
+
+/*
+ * commit - Writes the full blocks and the partial tail block of the buffer.
+ * On success the tail block moves to the front of the buffer so later
+ * records extend it. On failure the buffer is kept for the next commit,
+ * unless it is full, in which case its full blocks are given up as lost.
+ * @return  0 on success, -1 on a write error.
+ *
+ */
+static int commit(FIXLOG *log)
+{
+    FIXLOG_BLOCK_HEADER *tail = tail_block(log);
+    uint32_t             n = log->blocks + (tail->count ? 1u : 0u);
+    size_t               len = (size_t)n * FIXLOG_BLOCK;
+    size_t               done = 0;
+
+    if (n == 0) return 0;
+
+    while (done < len)
+    {
+        ssize_t w = pwrite(log->fd, log->buf + done, len - done, (off_t)(log->offset + done));
+
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0)
+        {
+            atomic_store_explicit(&log->error, w < 0 ? errno : EIO, memory_order_relaxed);
+            if (log->blocks == log->cfg.batch_blocks)
+            {
+                log->lost += log->seq - log->lost - atomic_load_explicit(&log->written, memory_order_relaxed);
+                log->blocks = 0;
+                memset(log->buf, 0, sizeof(FIXLOG_BLOCK_HEADER));
+            }
+            return -1;
+        }
+        done += (size_t)w;
+    }
+
+    log->offset += (uint64_t)log->blocks * FIXLOG_BLOCK;
+    if (log->blocks && tail->count)
+    {
+        memcpy(log->buf, tail, FIXLOG_BLOCK);
+    }
+    else if (log->blocks)
+    {
+        memset(log->buf, 0, sizeof(FIXLOG_BLOCK_HEADER));
+    }
+    log->blocks = 0;
+    atomic_store_explicit(&log->written, log->seq - log->lost, memory_order_release);
+    return 0;
+}
+
+static void place(FIXLOG *log, const FIXLOG_RECORD *rec)
+{
+    FIXLOG_BLOCK_HEADER *b = tail_block(log);
+
+    if (b->count == 0)
+    {
+        memset(b, 0, FIXLOG_BLOCK);
+        b->magic       = FIXLOG_BLOCK_MAGIC;
+        b->record_size = (uint16_t)sizeof(FIXLOG_RECORD);
+        b->first_seq   = log->seq;
+    }
+    memcpy((FIXLOG_RECORD *)(b + 1) + b->count, rec, sizeof(*rec));
+    b->count++;
+    log->seq++;
+
+    if (b->count == FIXLOG_PER_BLOCK)
+    {
+        log->blocks++;
+        tail_block(log)->count = 0;
+        if (log->blocks == log->cfg.batch_blocks)
+        {
+            commit(log);
+        }
+    }
+}
+
+/*
+ * drain - Moves every record the producers have published into the buffer.
+ * @return  number of records taken.
+ *
+ */
+static uint64_t drain(FIXLOG *log)
+{
+    uint32_t count = atomic_load_explicit(&log->producer_count, memory_order_acquire);
+    uint64_t taken = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        FIXLOG_PRODUCER *p = log->producer[i];
+        uint32_t         tail = atomic_load_explicit(&p->tail, memory_order_relaxed);
+        uint32_t         head = atomic_load_explicit(&p->head, memory_order_acquire);
+
+        for (; tail != head; tail++)
+        {
+            place(log, &p->ring[tail & p->mask]);
+            taken++;
+        }
+        atomic_store_explicit(&p->tail, tail, memory_order_release);
+    }
+    if (taken)
+    {
+        atomic_fetch_add_explicit(&log->appended, taken, memory_order_relaxed);
+    }
+    return taken;
+}
+
+static void sync_log(FIXLOG *log, uint64_t now)
+{
+    uint64_t written = atomic_load_explicit(&log->written, memory_order_relaxed);
+
+    log->last_sync = now;
+    if (written == atomic_load_explicit(&log->durable, memory_order_relaxed)) return;
+
+    if (fdatasync(log->fd) < 0)
+    {
+        atomic_store_explicit(&log->error, errno, memory_order_relaxed);
+        return;
+    }
+    atomic_store_explicit(&log->durable, written, memory_order_release);
+    if (written + log->lost == log->seq)
+    {
+        atomic_store_explicit(&log->pending_since, 0, memory_order_relaxed);
+    }
+}
+
+static void *writer_main(void *arg)
+{
+    FIXLOG          *log = arg;
+    struct timespec  deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    while (atomic_load_explicit(&log->running, memory_order_acquire))
+    {
+        uint64_t now;
+
+        deadline.tv_nsec += (long)log->cfg.commit_ms * 1000000L;
+        while (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+
+        now = now_ms();
+        if (drain(log) && atomic_load_explicit(&log->pending_since, memory_order_relaxed) == 0)
+        {
+            atomic_store_explicit(&log->pending_since, now, memory_order_relaxed);
+        }
+        commit(log);
+        if (log->cfg.fsync_ms == 0 || now - log->last_sync >= log->cfg.fsync_ms)
+        {
+            sync_log(log, now);
+        }
+
+        // fell behind (stalled disk): next commit as soon as possible
+        if ((uint64_t)deadline.tv_sec * 1000u + (uint64_t)deadline.tv_nsec / 1000000u + log->cfg.commit_ms < now_ms())
+        {
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+        }
+    }
+
+    drain(log);
+    commit(log);
+    sync_log(log, now_ms());
+    return NULL;
+}
+
+/**
+ * Opens (or appends to) a log file and starts its writer thread.
+ * With cfg->direct the file is opened with O_DIRECT; file systems that
+ * refuse it get a buffered file instead, fixlog_stats() tells which.
+ * @param log  Logger to initialise.
+ * @param cfg  Path and tuning; zero fields take the defaults.
+ * @return     0 on success, -1 on error (errno set).
+ */
+int fixlog_open(FIXLOG *log, const FIXLOG_CONFIG *cfg)
+{
+    int   flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+    off_t end;
+    void  *buf;
+
+    memset(log, 0, sizeof(*log));
+    log->cfg = *cfg;
+    if (log->cfg.commit_ms == 0)    log->cfg.commit_ms = 5;
+    if (log->cfg.ring_records == 0) log->cfg.ring_records = 16384;
+    if (log->cfg.batch_blocks < 2)  log->cfg.batch_blocks = 256;
+    if (log->cfg.ring_records & (log->cfg.ring_records - 1))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    log->fd = -1;
+    if (cfg->direct)
+    {
+        log->fd = open(cfg->path, flags | O_DIRECT, 0644);
+        log->direct = log->fd >= 0;
+    }
+    if (log->fd < 0)
+    {
+        log->fd = open(cfg->path, flags, 0644);
+    }
+    if (log->fd < 0) return -1;
+
+    end = lseek(log->fd, 0, SEEK_END);
+    if (end < 0 || posix_memalign(&buf, FIXLOG_BLOCK, ((size_t)log->cfg.batch_blocks + 1) * FIXLOG_BLOCK) != 0)
+    {
+        if (end >= 0) errno = ENOMEM;
+        close(log->fd);
+        return -1;
+    }
+    log->buf    = buf;
+    log->offset = ((uint64_t)end + FIXLOG_BLOCK - 1) & ~(uint64_t)(FIXLOG_BLOCK - 1);
+    memset(log->buf, 0, sizeof(FIXLOG_BLOCK_HEADER));
+    log->last_sync = now_ms();
+
+    pthread_mutex_init(&log->lock, NULL);
+    atomic_store(&log->running, 1);
+    if (pthread_create(&log->writer, NULL, writer_main, log) != 0)
+    {
+        pthread_mutex_destroy(&log->lock);
+        free(log->buf);
+        close(log->fd);
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Registers the calling thread as a producer. Each decode thread takes one
+ * producer and is the only thread appending to it.
+ * @return  the producer, NULL when FIXLOG_MAX_PRODUCERS are taken or out of memory.
+ */
+FIXLOG_PRODUCER *fixlog_producer(FIXLOG *log)
+{
+    FIXLOG_PRODUCER *p = NULL;
+    uint32_t         count;
+    void             *mem;
+
+    pthread_mutex_lock(&log->lock);
+    count = atomic_load_explicit(&log->producer_count, memory_order_relaxed);
+    if (count < FIXLOG_MAX_PRODUCERS && posix_memalign(&mem, 64, sizeof(*p)) == 0)
+    {
+        p = mem;
+        memset(p, 0, sizeof(*p));
+        p->mask = log->cfg.ring_records - 1;
+        p->ring = malloc((size_t)log->cfg.ring_records * sizeof(FIXLOG_RECORD));
+        if (p->ring)
+        {
+            log->producer[count] = p;
+            atomic_store_explicit(&log->producer_count, count + 1, memory_order_release);
+        }
+        else
+        {
+            free(p);
+            p = NULL;
+        }
+    }
+    pthread_mutex_unlock(&log->lock);
+    return p;
+}
+
+/**
+ * Queues one fix. Never blocks: when the writer has fallen a whole ring
+ * behind the record is dropped and counted.
+ * @return  0 queued, -1 dropped.
+ */
+int fixlog_append(FIXLOG_PRODUCER *p, uint64_t device, const FIXRECORD *rec)
+{
+    uint32_t       head = atomic_load_explicit(&p->head, memory_order_relaxed);
+    FIXLOG_RECORD  *slot;
+
+    if (head - atomic_load_explicit(&p->tail, memory_order_acquire) > p->mask)
+    {
+        atomic_fetch_add_explicit(&p->dropped, 1, memory_order_relaxed);
+        return -1;
+    }
+    slot = &p->ring[head & p->mask];
+    slot->device = device;
+    slot->fix    = *rec;
+    atomic_store_explicit(&p->head, head + 1, memory_order_release);
+    return 0;
+}
+
+/**
+ * Reports progress. appended - durable records would be lost by a crash
+ * now; lag_ms is how long the oldest of them has been waiting (counted
+ * from when the writer picked it up, at most one commit interval after
+ * it was appended).
+ */
+void fixlog_stats(FIXLOG *log, FIXLOG_STATS *st)
+{
+    uint32_t count = atomic_load_explicit(&log->producer_count, memory_order_acquire);
+    uint64_t since = atomic_load_explicit(&log->pending_since, memory_order_relaxed);
+    uint64_t now = now_ms();
+
+    memset(st, 0, sizeof(*st));
+    for (uint32_t i = 0; i < count; i++)
+    {
+        st->dropped += atomic_load_explicit(&log->producer[i]->dropped, memory_order_relaxed);
+    }
+    st->durable  = atomic_load_explicit(&log->durable, memory_order_acquire);
+    st->written  = atomic_load_explicit(&log->written, memory_order_acquire);
+    st->appended = atomic_load_explicit(&log->appended, memory_order_relaxed);
+    st->lost     = log->lost;
+    st->lag_ms   = since && now > since ? (uint32_t)(now - since) : 0;
+    st->direct   = log->direct;
+    st->error    = atomic_load_explicit(&log->error, memory_order_relaxed);
+}
+
+/**
+ * Stops the writer after it has written and synced everything appended
+ * so far, then frees the producers. No producer may append any more.
+ * @return  0 on success, -1 if any write or sync failed.
+ */
+int fixlog_close(FIXLOG *log)
+{
+    uint32_t count = atomic_load_explicit(&log->producer_count, memory_order_acquire);
+    int      err;
+
+    atomic_store_explicit(&log->running, 0, memory_order_release);
+    pthread_join(log->writer, NULL);
+
+    err = atomic_load_explicit(&log->error, memory_order_relaxed);
+    if (close(log->fd) < 0 && err == 0) err = errno;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        free(log->producer[i]->ring);
+        free(log->producer[i]);
+    }
+    pthread_mutex_destroy(&log->lock);
+    free(log->buf);
+    log->buf = NULL;
+    log->fd  = -1;
+
+    if (err)
+    {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Validates one FIXLOG_BLOCK read back from a log file.
+ * @param block  FIXLOG_BLOCK bytes.
+ * @param rec    Set to the first record.
+ * @return       number of records in the block, -1 if it is not a log block.
+ */
+int fixlog_block_records(const void *block, const FIXLOG_RECORD **rec)
+{
+    const FIXLOG_BLOCK_HEADER *b = block;
+
+    if (b->magic != FIXLOG_BLOCK_MAGIC || b->record_size != sizeof(FIXLOG_RECORD) || b->count > FIXLOG_PER_BLOCK)
+    {
+        return -1;
+    }
+    *rec = (const FIXLOG_RECORD *)(b + 1);
+    return b->count;
+}
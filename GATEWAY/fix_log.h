@@ -0,0 +1,108 @@
+/*
+ * fix_log.h
+ *
+ * Asynchronous fix logger. Decode threads append records to their own
+ * lock-free ring and never wait: a full ring drops and counts the record.
+ * One writer thread drains the rings, packs 4 KiB blocks and commits them
+ * as a group every commit interval with large aligned writes (O_DIRECT
+ * when the file system allows it), syncing every fsync interval.
+ */
+
+#ifndef INC_FIX_LOG_H_
+#define INC_FIX_LOG_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "fix_record.h"
+
+#define FIXLOG_BLOCK            4096
+#define FIXLOG_BLOCK_MAGIC      0x31425846u         // "FXB1"
+#define FIXLOG_PER_BLOCK        ((FIXLOG_BLOCK - sizeof(FIXLOG_BLOCK_HEADER)) / sizeof(FIXLOG_RECORD))
+#define FIXLOG_MAX_PRODUCERS    64
+
+// FIXLOG_RECORD: one logged fix
+typedef struct
+{
+    uint64_t    device;
+    FIXRECORD   fix;
+} FIXLOG_RECORD;
+
+// file = FIXLOG_BLOCKs: header, count records, zero padding
+typedef struct
+{
+    uint32_t    magic;
+    uint16_t    count;
+    uint16_t    record_size;                        // sizeof(FIXLOG_RECORD)
+    uint64_t    first_seq;                          // commit order of the first record
+} FIXLOG_BLOCK_HEADER;
+
+typedef struct
+{
+    const char  *path;
+    uint8_t     direct;                             // try O_DIRECT
+    uint32_t    commit_ms;                          // group commit interval (default 5)
+    uint32_t    fsync_ms;                           // 0 = sync every commit
+    uint32_t    ring_records;                       // per producer, power of 2 (default 16384)
+    uint32_t    batch_blocks;                       // blocks per write (default 256 = 1 MiB)
+} FIXLOG_CONFIG;
+
+// FIXLOG_PRODUCER: single producer / single consumer ring of one thread
+typedef struct
+{
+    _Alignas(64) _Atomic uint32_t   head;           // written by the producer
+    _Alignas(64) _Atomic uint32_t   tail;           // written by the writer
+    _Alignas(64) _Atomic uint64_t   dropped;
+    uint32_t        mask;
+    FIXLOG_RECORD   *ring;
+} FIXLOG_PRODUCER;
+
+typedef struct
+{
+    uint64_t    appended;                           // taken by the writer
+    uint64_t    dropped;                            // rings full
+    uint64_t    written;                            // handed to the kernel
+    uint64_t    durable;                            // synced
+    uint64_t    lost;                               // given up after write errors
+    uint32_t    lag_ms;                             // age of the oldest record not yet synced
+    uint8_t     direct;                             // O_DIRECT in use
+    int         error;                              // errno of the last failed write / sync
+} FIXLOG_STATS;
+
+typedef struct
+{
+    FIXLOG_CONFIG       cfg;
+    int                 fd;
+    uint8_t             direct;
+    uint64_t            offset;                     // file offset of buf (block aligned)
+
+    uint8_t             *buf;                       // batch_blocks + tail block, block aligned
+    uint32_t            blocks;                     // full blocks in buf
+    uint64_t            seq;                        // records placed in buf so far
+    uint64_t            lost;
+
+    FIXLOG_PRODUCER     *producer[FIXLOG_MAX_PRODUCERS];
+    _Atomic uint32_t    producer_count;
+    pthread_mutex_t     lock;                       // producer registration
+
+    pthread_t           writer;
+    _Atomic int         running;
+
+    uint64_t            last_sync;                  // ms
+
+    _Atomic uint64_t    pending_since;              // ms, pickup of the oldest unsynced record
+    _Atomic uint64_t    appended, written, durable;
+    _Atomic int         error;
+} FIXLOG;
+
+
+// Public function declarations
+int              fixlog_open(FIXLOG *log, const FIXLOG_CONFIG *cfg);
+FIXLOG_PRODUCER *fixlog_producer(FIXLOG *log);
+int              fixlog_append(FIXLOG_PRODUCER *p, uint64_t device, const FIXRECORD *rec);
+void             fixlog_stats(FIXLOG *log, FIXLOG_STATS *st);
+int              fixlog_close(FIXLOG *log);
+
+int              fixlog_block_records(const void *block, const FIXLOG_RECORD **rec);
+
+#endif /* INC_FIX_LOG_H_ */
@@ -0,0 +1,62 @@
+/*
+ * fix_record.c - Conversion of a decoded epoch into a FIXRECORD.
+ */
+
+#include "fix_record.h"
+#include <string.h>
+
+
+/**
+ * Converts an RMC date and a packed GGA time to ms since the Unix epoch.
+ * @return  ms, 0 if the date is not set.
+ */
+int64_t fix_utc_ms(const DATE *date, uint32_t time)
+{
+    if (!date || date->year == 0 || date->month < 1 || date->month > 12 || date->day < 1) return 0;
+
+    // days from civil (proleptic Gregorian), March based year
+    int64_t  y   = (int64_t)date->year - (date->month <= 2);
+    int64_t  era = (y >= 0 ? y : y - 399) / 400;
+    int64_t  yoe = y - era * 400;
+    int64_t  mp  = (date->month + 9) % 12;
+    int64_t  doy = (153 * mp + 2) / 5 + date->day - 1;
+    int64_t  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t  days = era * 146097 + doe - 719468;
+
+    return days * 86400000LL + (int64_t)DECODE_HOUR(time) * 3600000LL + (int64_t)DECODE_MIN(time) * 60000LL +
+           (int64_t)DECODE_SEC(time) * 1000LL + (int64_t)DECODE_CSEC(time) * 10LL;
+}
+
+/**
+ * Fills a FIXRECORD from a decoded epoch, only the present fields are copied.
+ */
+void fix_record_from_gps(FIXRECORD *rec, const GPSSTRUCT *gps)
+{
+    const GGASTRUCT *gga = &gps->ggastruct;
+    const RMCSTRUCT *rmc = &gps->rmcstruct;
+
+    memset(rec, 0, sizeof(FIXRECORD));
+    rec->present = (uint16_t)(gga->present | rmc->present);
+
+    if ((rec->present & (GPS_HAS_TIME | GPS_HAS_DATE)) == (GPS_HAS_TIME | GPS_HAS_DATE))
+    {
+        rec->utc_ms = fix_utc_ms(&rmc->date, gga->time.time);
+    }
+    if (gga->present & GPS_HAS_LATITUDE)  rec->latitude    = gga->location.latitude;
+    if (gga->present & GPS_HAS_LONGITUDE) rec->longitude   = gga->location.longitude;
+    if (gga->present & GPS_HAS_ALTITUDE)  rec->altitude_mm = gga->altitude.altitude;
+    if (gga->present & GPS_HAS_HDOP)      rec->hdop        = gga->hdop;
+    if (gga->present & GPS_HAS_NUMSAT)    rec->numsat      = gga->numsat;
+    if (gga->present & GPS_HAS_FIX)       rec->fix         = (uint8_t)gga->is_fix_valid;
+
+    if (rmc->present & GPS_HAS_SPEED)
+    {
+        int32_t knots100 = rmc->speed_knots / 10;
+        rec->speed = (knots100 < 0) ? 0 : (knots100 > 0xFFFF) ? 0xFFFF : (uint16_t)knots100;
+    }
+    if (rmc->present & GPS_HAS_COURSE)
+    {
+        int32_t course = rmc->course % 36000;
+        rec->course = (uint16_t)(course < 0 ? course + 36000 : course);
+    }
+}
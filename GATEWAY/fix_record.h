@@ -0,0 +1,46 @@
+/*
+ * fix_record.h
+ *
+ * Compact, self contained fix of one device as the gateway stores and
+ * ships it (tables, indexes, rollups, logs): 32 bytes, fixed point.
+ */
+
+#ifndef INC_FIX_RECORD_H_
+#define INC_FIX_RECORD_H_
+
+#include <stdint.h>
+#include "NMEA.h"
+
+typedef struct
+{
+    int64_t     utc_ms;                 // ms since 1970-01-01, 0 if the receiver gave no date/time
+    int32_t     latitude;               // degrees * GPS_COORD_SCALE
+    int32_t     longitude;
+    int32_t     altitude_mm;
+    uint16_t    speed;                  // knots * 100
+    uint16_t    course;                 // degrees * 100
+    uint16_t    hdop;                   // x100
+    uint16_t    present;                // GPS_HAS_* of the fields above
+    uint8_t     numsat;
+    uint8_t     fix;                    // GGA fix valid
+    uint16_t    reserved;
+} FIXRECORD;
+
+typedef char fix_record_size_check[(sizeof(FIXRECORD) == 32) ? 1 : -1];
+
+#define TRACK_MAGIC         0x314B5254u         // "TRK1"
+
+// track file: TRACK_HEADER then FIXRECORDs in time order (little endian)
+typedef struct
+{
+    uint32_t    magic;
+    uint32_t    record_size;                    // sizeof(FIXRECORD)
+    uint64_t    device_id;                      // 0 when the file mixes devices
+} TRACK_HEADER;
+
+
+// Public function declarations
+int64_t fix_utc_ms(const DATE *date, uint32_t time);
+void    fix_record_from_gps(FIXRECORD *rec, const GPSSTRUCT *gps);
+
+#endif /* INC_FIX_RECORD_H_ */
@@ -0,0 +1,690 @@
+/*
+ * fix_sort.c - External merge sort of fix logs into per-device tracks.
+ * Run generation: the logs are cut into io_size units of whole blocks,
+ * workers take units from a shared counter, collect the records in a
+ * private buffer of memory / threads bytes and, when it is full, sort it
+ * and write it out as one run. Merging: a binary heap over the head
+ * record of every run; each run gets an equal share of the budget as
+ * read buffer, so reads stay large however many runs there are. With more
+ * runs than fan_in, groups of fan_in runs are first merged into longer
+ * runs (in parallel), then the last pass writes the track files.
+ */
+
+#include "fix_sort.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define MIN_RUN_BYTES   (1u << 20)
+#define MIN_READ_BYTES  (64u << 10)
+
+typedef char fixsort_memory_check[(FIXSORT_MEMORY_MIN >= MIN_RUN_BYTES + MIN_READ_BYTES) ? 1 : -1];
+
+typedef struct
+{
+    int         file;
+    off_t       offset;
+    size_t      len;
+} SORT_UNIT;
+
+typedef struct
+{
+    char        *path;
+    uint64_t    count;
+} SORT_RUN;
+
+typedef struct
+{
+    SORT_RUN    *run;
+    uint32_t    count, cap;
+} SORT_RUNS;
+
+typedef struct
+{
+    const FIXSORT_CONFIG    *cfg;
+    const char              *tmp_dir;
+    pthread_mutex_t         lock;
+    int                     error;                  // errno of the first failure
+
+    // run generation
+    int                     *fd;
+    SORT_UNIT               *unit;
+    size_t                  units, next;
+    size_t                  run_records;
+    uint64_t                records, bad_blocks;
+
+    // intermediate merges
+    SORT_RUNS               *in, *out;
+    uint32_t                groups, next_group;
+    size_t                  merge_memory;
+
+    SORT_RUNS               runs;
+    uint32_t                run_seq;
+} SORT_JOB;
+
+typedef struct
+{
+    int             fd;
+    FIXLOG_RECORD   *buf;
+    size_t          len, at, cap;
+    uint64_t        left;                           // records not read yet
+} SORT_READER;
+
+typedef struct
+{
+    int         fd;
+    uint8_t     *buf;
+    size_t      len, cap;
+} SORT_OUT;
+
+typedef int (*sort_sink)(void *ctx, const FIXLOG_RECORD *rec);
+
+typedef struct
+{
+    SORT_OUT        out;
+    const char      *dir;
+    uint64_t        device;
+    int64_t         last_ms;
+    uint8_t         open;
+    uint64_t        devices, duplicates;
+} TRACK_SINK;
+
+
+static void fail(SORT_JOB *job, int err)
+{
+    pthread_mutex_lock(&job->lock);
+    if (!job->error) job->error = err ? err : EIO;
+    pthread_mutex_unlock(&job->lock);
+}
+
+static int record_cmp(const void *a, const void *b)
+{
+    const FIXLOG_RECORD *x = a, *y = b;
+
+    if (x->device != y->device) return x->device < y->device ? -1 : 1;
+    if (x->fix.utc_ms != y->fix.utc_ms) return x->fix.utc_ms < y->fix.utc_ms ? -1 : 1;
+    return 0;
+}
+
+static int write_full(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    while (len)
+    {
+        ssize_t w = write(fd, p, len);
+
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        p   += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+static ssize_t read_full(int fd, void *data, size_t len, off_t offset)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t r = offset >= 0 ? pread(fd, (uint8_t *)data + done, len - done, offset + (off_t)done)
+                                : read(fd, (uint8_t *)data + done, len - done);
+
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return -1;
+        if (r == 0) break;
+        done += (size_t)r;
+    }
+    return (ssize_t)done;
+}
+
+/*************************************** runs ***************************************/
+
+/*
+ * new_run - Creates the next run file and registers it in runs.
+ * @return  open descriptor, -1 on error.
+ *
+ */
+static int new_run(SORT_JOB *job, SORT_RUNS *runs, uint64_t count, uint32_t *index)
+{
+    char  path[4096];
+    int   fd = -1;
+
+    pthread_mutex_lock(&job->lock);
+    snprintf(path, sizeof(path), "%s/fixsort.%ld.%u.run", job->tmp_dir, (long)getpid(), job->run_seq++);
+    if (runs->count == runs->cap)
+    {
+        uint32_t  cap = runs->cap ? runs->cap * 2 : 64;
+        SORT_RUN  *grown = realloc(runs->run, cap * sizeof(SORT_RUN));
+
+        if (!grown) goto done;
+        runs->run = grown;
+        runs->cap = cap;
+    }
+    runs->run[runs->count].path = strdup(path);
+    if (!runs->run[runs->count].path) goto done;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        free(runs->run[runs->count].path);
+        goto done;
+    }
+    runs->run[runs->count].count = count;
+    *index = runs->count++;
+
+done:
+    pthread_mutex_unlock(&job->lock);
+    return fd;
+}
+
+static void drop_runs(SORT_RUNS *runs)
+{
+    for (uint32_t i = 0; i < runs->count; i++)
+    {
+        unlink(runs->run[i].path);
+        free(runs->run[i].path);
+    }
+    free(runs->run);
+    memset(runs, 0, sizeof(*runs));
+}
+
+static int write_run(SORT_JOB *job, FIXLOG_RECORD *rec, size_t n)
+{
+    uint32_t index;
+    int      fd, rc;
+
+    qsort(rec, n, sizeof(FIXLOG_RECORD), record_cmp);
+
+    fd = new_run(job, &job->runs, n, &index);
+    if (fd < 0) return -1;
+    rc = write_full(fd, rec, n * sizeof(FIXLOG_RECORD));
+    if (close(fd) != 0) rc = -1;
+    return rc;
+}
+
+static void *run_worker(void *arg)
+{
+    SORT_JOB        *job = arg;
+    FIXLOG_RECORD   *rec = malloc(job->run_records * sizeof(FIXLOG_RECORD));
+    uint8_t         *io = malloc(job->cfg->io_size);
+    size_t          n = 0;
+    uint64_t        records = 0, bad = 0;
+
+    if (!rec || !io)
+    {
+        fail(job, ENOMEM);
+        goto done;
+    }
+
+    for (;;)
+    {
+        SORT_UNIT *u;
+        ssize_t    got;
+
+        pthread_mutex_lock(&job->lock);
+        u = job->next < job->units && !job->error ? &job->unit[job->next++] : NULL;
+        pthread_mutex_unlock(&job->lock);
+        if (!u) break;
+
+        got = read_full(job->fd[u->file], io, u->len, u->offset);
+        if (got < 0)
+        {
+            fail(job, errno);
+            break;
+        }
+
+        for (size_t off = 0; off + FIXLOG_BLOCK <= (size_t)got; off += FIXLOG_BLOCK)
+        {
+            const FIXLOG_RECORD *r;
+            int                  k = fixlog_block_records(io + off, &r);
+
+            if (k < 0)
+            {
+                bad++;
+                continue;
+            }
+            for (int i = 0; i < k; i++)
+            {
+                if (n == job->run_records)
+                {
+                    if (write_run(job, rec, n) != 0)
+                    {
+                        fail(job, errno);
+                        goto done;
+                    }
+                    n = 0;
+                }
+                memcpy(&rec[n++], &r[i], sizeof(FIXLOG_RECORD));
+            }
+            records += (uint64_t)k;
+        }
+        if ((size_t)got % FIXLOG_BLOCK) bad++;     // torn tail of a log
+    }
+    if (n && write_run(job, rec, n) != 0) fail(job, errno);
+
+done:
+    pthread_mutex_lock(&job->lock);
+    job->records    += records;
+    job->bad_blocks += bad;
+    pthread_mutex_unlock(&job->lock);
+    free(rec);
+    free(io);
+    return NULL;
+}
+
+/*************************************** k-way merge ***************************************/
+
+static int reader_fill(SORT_READER *r)
+{
+    size_t  want = r->cap < r->left ? r->cap : (size_t)r->left;
+    ssize_t got = read_full(r->fd, r->buf, want * sizeof(FIXLOG_RECORD), -1);
+
+    if (got < 0) return -1;
+    if ((size_t)got != want * sizeof(FIXLOG_RECORD))
+    {
+        errno = EIO;                                // run file shorter than written
+        return -1;
+    }
+    r->len   = want;
+    r->at    = 0;
+    r->left -= want;
+    return 0;
+}
+
+static int heap_less(SORT_READER *r, uint32_t a, uint32_t b)
+{
+    return record_cmp(&r[a].buf[r[a].at], &r[b].buf[r[b].at]) < 0;
+}
+
+static void sift_down(SORT_READER *r, uint32_t *heap, uint32_t size, uint32_t i)
+{
+    for (;;)
+    {
+        uint32_t best = i, l = 2 * i + 1, rt = l + 1;
+
+        if (l < size && heap_less(r, heap[l], heap[best])) best = l;
+        if (rt < size && heap_less(r, heap[rt], heap[best])) best = rt;
+        if (best == i) return;
+
+        uint32_t t = heap[i];
+        heap[i]    = heap[best];
+        heap[best] = t;
+        i = best;
+    }
+}
+
+/*
+ * merge - Streams the union of n sorted runs, in order, into sink.
+ * memory is shared out evenly as read buffers.
+ * @return  0 on success, -1 on error (errno set).
+ *
+ */
+static int merge(const SORT_RUN *run, uint32_t n, size_t memory, sort_sink sink, void *ctx)
+{
+    SORT_READER *r = calloc(n, sizeof(SORT_READER));
+    uint32_t    *heap = calloc(n, sizeof(uint32_t));
+    size_t      cap = memory / n / sizeof(FIXLOG_RECORD);
+    uint32_t    size = 0, opened = 0;
+    int         rc = -1;
+
+    if (cap * sizeof(FIXLOG_RECORD) < MIN_READ_BYTES) cap = MIN_READ_BYTES / sizeof(FIXLOG_RECORD);
+    if (!r || !heap) goto done;
+
+    for (; opened < n; opened++)
+    {
+        SORT_READER *s = &r[opened];
+
+        s->fd   = open(run[opened].path, O_RDONLY | O_CLOEXEC);
+        s->cap  = cap;
+        s->left = run[opened].count;
+        s->buf  = malloc(cap * sizeof(FIXLOG_RECORD));
+        if (s->fd < 0 || !s->buf)
+        {
+            if (s->fd >= 0) close(s->fd);
+            free(s->buf);
+            goto done;
+        }
+        posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        if (s->left)
+        {
+            if (reader_fill(s) != 0)
+            {
+                opened++;
+                goto done;
+            }
+            heap[size++] = opened;
+        }
+    }
+    for (uint32_t i = size / 2; i-- > 0;) sift_down(r, heap, size, i);
+
+    while (size)
+    {
+        SORT_READER *s = &r[heap[0]];
+
+        if (sink(ctx, &s->buf[s->at]) != 0) goto done;
+
+        if (++s->at == s->len)
+        {
+            if (s->left == 0)
+            {
+                heap[0] = heap[--size];
+            }
+            else if (reader_fill(s) != 0)
+            {
+                goto done;
+            }
+        }
+        sift_down(r, heap, size, 0);
+    }
+    rc = 0;
+
+done:
+    for (uint32_t i = 0; i < opened; i++)
+    {
+        close(r[i].fd);
+        free(r[i].buf);
+    }
+    free(r);
+    free(heap);
+    return rc;
+}
+
+static int out_flush(SORT_OUT *o)
+{
+    int rc = write_full(o->fd, o->buf, o->len);
+
+    o->len = 0;
+    return rc;
+}
+
+static int out_write(SORT_OUT *o, const void *data, size_t len)
+{
+    if (o->len + len > o->cap && out_flush(o) != 0) return -1;
+    memcpy(o->buf + o->len, data, len);
+    o->len += len;
+    return 0;
+}
+
+static int run_sink(void *ctx, const FIXLOG_RECORD *rec)
+{
+    return out_write(ctx, rec, sizeof(*rec));
+}
+
+static int track_close(TRACK_SINK *t)
+{
+    int rc = out_flush(&t->out);
+
+    if (close(t->out.fd) != 0) rc = -1;
+    t->open = 0;
+    return rc;
+}
+
+static int track_sink(void *ctx, const FIXLOG_RECORD *rec)
+{
+    TRACK_SINK *t = ctx;
+
+    if (t->open && rec->device == t->device)
+    {
+        if (rec->fix.utc_ms != 0 && rec->fix.utc_ms == t->last_ms)       // without a time nothing repeats
+        {
+            t->duplicates++;
+            return 0;
+        }
+    }
+    else
+    {
+        TRACK_HEADER h = { TRACK_MAGIC, sizeof(FIXRECORD), rec->device };
+        char         path[4096];
+
+        if (t->open && track_close(t) != 0) return -1;
+
+        snprintf(path, sizeof(path), "%s/%llu.trk", t->dir, (unsigned long long)rec->device);
+        t->out.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (t->out.fd < 0) return -1;
+        t->open   = 1;
+        t->device = rec->device;
+        t->devices++;
+        if (out_write(&t->out, &h, sizeof(h)) != 0) return -1;
+    }
+    t->last_ms = rec->fix.utc_ms;
+    return out_write(&t->out, &rec->fix, sizeof(FIXRECORD));
+}
+
+static void *merge_worker(void *arg)
+{
+    SORT_JOB *job = arg;
+    SORT_OUT  out = { -1, NULL, 0, 0 };
+
+    out.cap = job->cfg->io_size;
+    out.buf = malloc(out.cap);
+    if (!out.buf)
+    {
+        fail(job, ENOMEM);
+        return NULL;
+    }
+
+    for (;;)
+    {
+        uint32_t  g, first, n, index;
+        uint64_t  total = 0;
+        int       rc;
+
+        pthread_mutex_lock(&job->lock);
+        g = job->next_group < job->groups && !job->error ? job->next_group++ : UINT32_MAX;
+        pthread_mutex_unlock(&job->lock);
+        if (g == UINT32_MAX) break;
+
+        first = g * job->cfg->fan_in;
+        n     = job->in->count - first < job->cfg->fan_in ? job->in->count - first : job->cfg->fan_in;
+        for (uint32_t i = 0; i < n; i++) total += job->in->run[first + i].count;
+
+        out.fd = new_run(job, job->out, total, &index);
+        if (out.fd < 0)
+        {
+            fail(job, errno);
+            break;
+        }
+        rc = merge(&job->in->run[first], n, job->merge_memory, run_sink, &out);
+        if (rc == 0) rc = out_flush(&out);
+        if (close(out.fd) != 0) rc = -1;
+        if (rc != 0)
+        {
+            fail(job, errno);
+            break;
+        }
+        for (uint32_t i = 0; i < n; i++) unlink(job->in->run[first + i].path);
+    }
+    free(out.buf);
+    return NULL;
+}
+
+/*
+ * run_threads - Runs fn on up to threads threads and waits for them.
+ * @return  0 if at least one thread ran, -1 otherwise.
+ *
+ */
+static int run_threads(SORT_JOB *job, int threads, void *(*fn)(void *))
+{
+    pthread_t *tid = calloc((size_t)threads, sizeof(pthread_t));
+    int        started = 0;
+
+    if (!tid) return -1;
+    for (; started < threads; started++)
+    {
+        if (pthread_create(&tid[started], NULL, fn, job) != 0) break;
+    }
+    for (int t = 0; t < started; t++) pthread_join(tid[t], NULL);
+    free(tid);
+    return started ? 0 : -1;
+}
+
+/*************************************** driver ***************************************/
+
+static int split_logs(SORT_JOB *job, const char *const *paths, int count, FIXSORT_STATS *st)
+{
+    size_t cap = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        struct stat s;
+
+        job->fd[i] = open(paths[i], O_RDONLY | O_CLOEXEC);
+        if (job->fd[i] < 0 || fstat(job->fd[i], &s) != 0)
+        {
+            st->failed++;
+            continue;
+        }
+        posix_fadvise(job->fd[i], 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        for (off_t off = 0; off < s.st_size; off += (off_t)job->cfg->io_size)
+        {
+            if (job->units == cap)
+            {
+                SORT_UNIT *grown;
+
+                cap   = cap ? cap * 2 : 256;
+                grown = realloc(job->unit, cap * sizeof(SORT_UNIT));
+                if (!grown) return -1;
+                job->unit = grown;
+            }
+            job->unit[job->units].file   = i;
+            job->unit[job->units].offset = off;
+            job->unit[job->units].len    = (size_t)(s.st_size - off) < job->cfg->io_size ? (size_t)(s.st_size - off)
+                                                                                      : job->cfg->io_size;
+            job->units++;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Sorts fix logs into one track file per device.
+ * Records of one device come out in utc_ms order; records repeating a
+ * device's previous utc_ms are dropped, records without a time (utc_ms 0)
+ * are all kept. io_size is reduced to what the memory budget leaves after
+ * one run buffer. Run files are removed whatever the outcome.
+ * @param paths  Fix log files (fix_log.h format).
+ * @param count  Number of paths.
+ * @param cfg    Directories and budget.
+ * @param st     Filled with what was done.
+ * @return       0 on success, -1 on error (errno set, EINVAL for a memory
+ *               budget below FIXSORT_MEMORY_MIN).
+ */
+int fixsort_build(const char *const *paths, int count, const FIXSORT_CONFIG *cfg, FIXSORT_STATS *st)
+{
+    FIXSORT_CONFIG c = *cfg;
+    SORT_JOB       job;
+    TRACK_SINK     track;
+    int            rc = -1;
+
+    memset(st, 0, sizeof(*st));
+    memset(&job, 0, sizeof(job));
+    memset(&track, 0, sizeof(track));
+    if (!c.memory)  c.memory  = FIXSORT_MEMORY_DEFAULT;
+    if (!c.out_dir || c.memory < FIXSORT_MEMORY_MIN)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!c.io_size) c.io_size = FIXSORT_IO_DEFAULT;
+    if (c.threads <= 0) c.threads = 1;
+    if (c.fan_in < 2)   c.fan_in  = FIXSORT_FAN_IN;
+    c.io_size = (c.io_size + FIXLOG_BLOCK - 1) / FIXLOG_BLOCK * FIXLOG_BLOCK;
+
+    // a small budget takes the read buffer down, never below zero
+    if (c.io_size > c.memory - MIN_RUN_BYTES) c.io_size = (c.memory - MIN_RUN_BYTES) / FIXLOG_BLOCK * FIXLOG_BLOCK;
+
+    // every worker holds a run buffer and a read buffer
+    if (c.memory / (size_t)c.threads < MIN_RUN_BYTES + c.io_size)
+    {
+        c.threads = (int)(c.memory / (MIN_RUN_BYTES + c.io_size));
+        if (c.threads < 1) c.threads = 1;
+    }
+
+    job.cfg         = &c;
+    job.tmp_dir     = c.tmp_dir ? c.tmp_dir : c.out_dir;
+    job.run_records = (c.memory / (size_t)c.threads - c.io_size) / sizeof(FIXLOG_RECORD);
+    if (job.run_records * sizeof(FIXLOG_RECORD) < MIN_RUN_BYTES) job.run_records = MIN_RUN_BYTES / sizeof(FIXLOG_RECORD);
+    pthread_mutex_init(&job.lock, NULL);
+
+    job.fd = malloc((size_t)(count > 0 ? count : 1) * sizeof(int));
+    if (!job.fd) goto done;
+    for (int i = 0; i < count; i++) job.fd[i] = -1;
+
+    if (split_logs(&job, paths, count, st) != 0) goto done;
+    if (run_threads(&job, c.threads, run_worker) != 0) goto done;
+    st->records    = job.records;
+    st->bad_blocks = job.bad_blocks;
+    st->runs       = job.runs.count;
+    if (job.error) goto done;
+
+    // intermediate passes until one merge can take every run
+    while (job.runs.count > c.fan_in)
+    {
+        SORT_RUNS next = { NULL, 0, 0 };
+        int       threads;
+
+        job.in           = &job.runs;
+        job.out          = &next;
+        job.groups       = (job.runs.count + c.fan_in - 1) / c.fan_in;
+        job.next_group   = 0;
+        threads          = (uint32_t)c.threads < job.groups ? c.threads : (int)job.groups;
+        job.merge_memory = c.memory / (size_t)threads - c.io_size;
+
+        rc = run_threads(&job, threads, merge_worker);
+        drop_runs(&job.runs);
+        job.runs = next;
+        st->passes++;
+        if (rc != 0 || job.error) goto done;
+        rc = -1;
+    }
+
+    track.dir     = c.out_dir;
+    track.out.cap = c.io_size;
+    track.out.buf = malloc(track.out.cap);
+    if (!track.out.buf) goto done;
+    if (job.runs.count == 0)
+    {
+        rc = 0;
+        goto done;
+    }
+
+    if (merge(job.runs.run, job.runs.count, c.memory - c.io_size, track_sink, &track) != 0)
+    {
+        job.error = errno;
+        if (track.open) track_close(&track);
+        goto done;
+    }
+    st->passes++;
+    if (track.open && track_close(&track) != 0) goto done;
+    rc = 0;
+
+done:
+    if (rc != 0 && !job.error) job.error = errno ? errno : EIO;
+    st->devices    = track.devices;
+    st->duplicates = track.duplicates;
+
+    drop_runs(&job.runs);
+    for (int i = 0; job.fd && i < count; i++)
+    {
+        if (job.fd[i] >= 0) close(job.fd[i]);
+    }
+    free(job.fd);
+    free(job.unit);
+    free(track.out.buf);
+    pthread_mutex_destroy(&job.lock);
+
+    if (job.error)
+    {
+        errno = job.error;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * fix_sort.h
+ *
+ * External merge sort of fix logs (fix_log.h) into per-device track files
+ * (fix_record.h TRACK_HEADER + FIXRECORDs in time order). Worker threads
+ * cut the logs into sorted runs of (device, utc_ms) that fit the memory
+ * budget and write each with one large sequential write; runs are merged
+ * FIXSORT_FAN_IN at a time until one k-way merge can write the tracks.
+ * Input size is bounded by temporary disk space, not by memory.
+ */
+
+#ifndef INC_FIX_SORT_H_
+#define INC_FIX_SORT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "fix_log.h"
+
+#define FIXSORT_MEMORY_DEFAULT  ((size_t)1 << 30)   // buffer budget of the whole sort
+#define FIXSORT_IO_DEFAULT      (8u << 20)          // bytes per read
+#define FIXSORT_FAN_IN          256                 // runs merged at once
+#define FIXSORT_MEMORY_MIN      ((size_t)2 << 20)   // one run buffer and one read buffer
+
+// zero fields take the defaults
+typedef struct
+{
+    const char  *out_dir;                           // <device>.trk, replaced if present
+    const char  *tmp_dir;                           // run files (default: out_dir)
+    size_t      memory;
+    size_t      io_size;
+    int         threads;                            // run generation and intermediate merges
+    uint32_t    fan_in;
+} FIXSORT_CONFIG;
+
+typedef struct
+{
+    uint64_t    records;                            // read from the logs
+    uint64_t    duplicates;                         // same device and utc_ms (not 0), dropped
+    uint64_t    devices;                            // track files written
+    uint64_t    bad_blocks;                         // not fix log blocks, skipped
+    uint32_t    runs;                               // initial sorted runs
+    uint32_t    passes;                             // merge passes, the final one included
+    int         failed;                             // logs that could not be opened
+} FIXSORT_STATS;
+
+
+// Public function declarations
+int fixsort_build(const char *const *paths, int count, const FIXSORT_CONFIG *cfg, FIXSORT_STATS *st);
+
+#endif /* INC_FIX_SORT_H_ */
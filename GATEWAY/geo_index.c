@@ -0,0 +1,556 @@
+/*
+ * geo_index.c - Uniform grid index of live device positions.
+ * Cells are addressed by (row, column) of a fixed-point lat/lon grid and
+ * hashed into buckets; each bucket heads a doubly linked list of entries
+ * (entries of other cells sharing the bucket are skipped by cell key).
+ * Entries are kept dense, a removal moves the last entry into the hole.
+ * Distances are great-circle (haversine) on the mean Earth radius.
+ */
+
+#include "geo_index.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define EARTH_RADIUS        6371008.8                       // m
+#define RAD_PER_UNIT        (M_PI / 180.0 / GPS_COORD_SCALE)
+#define LAT_SPAN            (180 * GPS_COORD_SCALE)
+#define LON_SPAN            (360 * GPS_COORD_SCALE)
+
+
+static uint32_t hash64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDull;
+    x ^= x >> 33;
+    return (uint32_t)x;
+}
+
+static uint32_t cell_row(const GEO_INDEX *g, int32_t latitude)
+{
+    uint32_t cy = (uint32_t)(latitude + LAT_SPAN / 2) / (uint32_t)g->cell_size;
+
+    return cy < g->rows ? cy : g->rows - 1;
+}
+
+static uint32_t cell_col(const GEO_INDEX *g, int32_t longitude)
+{
+    uint32_t cx = (uint32_t)(longitude + LON_SPAN / 2) / (uint32_t)g->cell_size;
+
+    return cx < g->cols ? cx : g->cols - 1;
+}
+
+static uint64_t cell_key(const GEO_INDEX *g, uint32_t cy, uint32_t cx)
+{
+    return (uint64_t)cy * g->cols + cx;
+}
+
+static int valid_location(const LOCATION *loc)
+{
+    return loc->latitude >= -LAT_SPAN / 2 && loc->latitude <= LAT_SPAN / 2 &&
+           loc->longitude >= -LON_SPAN / 2 && loc->longitude <= LON_SPAN / 2;
+}
+
+static double distance(const LOCATION *a, const LOCATION *b)
+{
+    double phi1 = a->latitude * RAD_PER_UNIT;
+    double phi2 = b->latitude * RAD_PER_UNIT;
+    double s1   = sin((phi2 - phi1) / 2);
+    double s2   = sin((double)(b->longitude - a->longitude) * RAD_PER_UNIT / 2);
+    double h    = s1 * s1 + cos(phi1) * cos(phi2) * s2 * s2;
+
+    return 2 * EARTH_RADIUS * asin(sqrt(h < 1 ? h : 1));
+}
+
+
+/*************************************** entries ***************************************/
+
+/* slot of the id, or the free slot where it would go */
+static uint32_t *id_slot(GEO_INDEX *g, uint64_t id)
+{
+    uint32_t i = hash64(id) & g->id_mask;
+
+    while (g->id_map[i] != GEO_NONE && g->entry[g->id_map[i]].id != id) i = (i + 1) & g->id_mask;
+    return &g->id_map[i];
+}
+
+/* backward shift deletion, keeps every probe chain unbroken */
+static void id_unmap(GEO_INDEX *g, uint32_t *slot)
+{
+    uint32_t i = (uint32_t)(slot - g->id_map);
+    uint32_t j = i;
+
+    for (;;)
+    {
+        j = (j + 1) & g->id_mask;
+        if (g->id_map[j] == GEO_NONE) break;
+
+        uint32_t home = hash64(g->entry[g->id_map[j]].id) & g->id_mask;
+
+        // the entry at j stays if its home lies cyclically in (i, j]
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+
+        g->id_map[i] = g->id_map[j];
+        i = j;
+    }
+    g->id_map[i] = GEO_NONE;
+}
+
+static void link_entry(GEO_INDEX *g, uint32_t e)
+{
+    uint32_t *head = &g->bucket[hash64(g->entry[e].cell) & g->bucket_mask];
+
+    g->entry[e].prev = GEO_NONE;
+    g->entry[e].next = *head;
+    if (*head != GEO_NONE) g->entry[*head].prev = e;
+    *head = e;
+}
+
+static void unlink_entry(GEO_INDEX *g, uint32_t e)
+{
+    GEO_ENTRY *en = &g->entry[e];
+
+    if (en->prev != GEO_NONE) g->entry[en->prev].next = en->next;
+    else g->bucket[hash64(en->cell) & g->bucket_mask] = en->next;
+    if (en->next != GEO_NONE) g->entry[en->next].prev = en->prev;
+}
+
+static int update_locked(GEO_INDEX *g, uint64_t id, const LOCATION *loc)
+{
+    uint32_t *slot;
+    uint64_t  cell;
+    uint32_t  e;
+
+    if (!valid_location(loc)) return -1;
+
+    slot = id_slot(g, id);
+    cell = cell_key(g, cell_row(g, loc->latitude), cell_col(g, loc->longitude));
+
+    if (*slot == GEO_NONE)
+    {
+        if (g->count == g->capacity) return -1;
+
+        e = g->count++;
+        g->entry[e].id       = id;
+        g->entry[e].location = *loc;
+        g->entry[e].cell     = cell;
+        link_entry(g, e);
+        *slot = e;
+        return 0;
+    }
+
+    e = *slot;
+    g->entry[e].location = *loc;
+    if (g->entry[e].cell != cell)
+    {
+        unlink_entry(g, e);
+        g->entry[e].cell = cell;
+        link_entry(g, e);
+        g->moves++;
+    }
+    return 0;
+}
+
+
+/*************************************** queries ***************************************/
+
+static void add_hit(GEO_HIT *hit, const GEO_ENTRY *en, double dist)
+{
+    hit->id       = en->id;
+    hit->location = en->location;
+    hit->dist     = (float)dist;
+}
+
+/* box filter of one entry, longitude range may wrap over 180 */
+static int in_box(const LOCATION *p, const LOCATION *min, const LOCATION *max)
+{
+    if (p->latitude < min->latitude || p->latitude > max->latitude) return 0;
+    if (min->longitude <= max->longitude) return p->longitude >= min->longitude && p->longitude <= max->longitude;
+    return p->longitude >= min->longitude || p->longitude <= max->longitude;
+}
+
+/*
+ * column range of a longitude span: [cx0, cx0 + ncols) modulo cols
+ *
+ */
+static void col_range(const GEO_INDEX *g, int32_t lon_min, int32_t lon_max, uint32_t *cx0, uint32_t *ncols)
+{
+    uint32_t c0 = cell_col(g, lon_min);
+    uint32_t c1 = cell_col(g, lon_max);
+
+    *cx0   = c0;
+    *ncols = (c1 >= c0 && lon_min <= lon_max) ? c1 - c0 + 1 : g->cols - c0 + c1 + 1;
+    if (*ncols > g->cols) *ncols = g->cols;
+}
+
+/* max-heap of the k best hits by distance */
+static void heap_push(GEO_HIT *heap, uint32_t *n, uint32_t k, const GEO_ENTRY *en, double dist)
+{
+    uint32_t i;
+
+    if (*n == k)
+    {
+        if (dist >= heap[0].dist) return;
+
+        // replace the worst and sift down
+        i = 0;
+        for (;;)
+        {
+            uint32_t c = 2 * i + 1;
+
+            if (c >= k) break;
+            if (c + 1 < k && heap[c + 1].dist > heap[c].dist) c++;
+            if (heap[c].dist <= (float)dist) break;
+            heap[i] = heap[c];
+            i = c;
+        }
+        add_hit(&heap[i], en, dist);
+        return;
+    }
+
+    i = (*n)++;
+    while (i > 0 && heap[(i - 1) / 2].dist < (float)dist)
+    {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    add_hit(&heap[i], en, dist);
+}
+
+static int hit_cmp(const void *a, const void *b)
+{
+    float da = ((const GEO_HIT *)a)->dist, db = ((const GEO_HIT *)b)->dist;
+
+    return (da > db) - (da < db);
+}
+
+/* box hit, optionally within radius of centre */
+static int box_hit(GEO_HIT *hit, const GEO_ENTRY *en, const LOCATION *min, const LOCATION *max,
+                   const LOCATION *centre, float radius)
+{
+    double d = 0;
+
+    if (!in_box(&en->location, min, max)) return 0;
+    if (centre && (d = distance(centre, &en->location)) > radius) return 0;
+
+    add_hit(hit, en, d);
+    return 1;
+}
+
+/*
+ * box_scan - Visits the cells overlapping the box, or every device when
+ * the box covers more cells than there are devices. Lock held by caller.
+ *
+ */
+static uint32_t box_scan(GEO_INDEX *g, const LOCATION *min, const LOCATION *max,
+                         const LOCATION *centre, float radius, GEO_HIT *hit, uint32_t max_hits)
+{
+    uint32_t n = 0, cy0, cy1, cx0, ncols;
+
+    cy0 = cell_row(g, min->latitude);
+    cy1 = cell_row(g, max->latitude);
+    col_range(g, min->longitude, max->longitude, &cx0, &ncols);
+
+    if ((uint64_t)(cy1 - cy0 + 1) * ncols > g->count)
+    {
+        for (uint32_t e = 0; e < g->count && n < max_hits; e++)
+        {
+            n += (uint32_t)box_hit(&hit[n], &g->entry[e], min, max, centre, radius);
+        }
+        return n;
+    }
+
+    for (uint32_t cy = cy0; cy <= cy1; cy++)
+    {
+        for (uint32_t i = 0; i < ncols; i++)
+        {
+            uint64_t cell = cell_key(g, cy, (cx0 + i) % g->cols);
+
+            for (uint32_t e = g->bucket[hash64(cell) & g->bucket_mask]; e != GEO_NONE && n < max_hits; e = g->entry[e].next)
+            {
+                if (g->entry[e].cell == cell) n += (uint32_t)box_hit(&hit[n], &g->entry[e], min, max, centre, radius);
+            }
+        }
+    }
+    return n;
+}
+
+/*
+ * nearest_cell - Pushes the devices of one cell within max_radius.
+ *
+ */
+static void nearest_cell(GEO_INDEX *g, uint64_t cell, const LOCATION *centre, float max_radius,
+                         GEO_HIT *heap, uint32_t *n, uint32_t k)
+{
+    for (uint32_t e = g->bucket[hash64(cell) & g->bucket_mask]; e != GEO_NONE; e = g->entry[e].next)
+    {
+        if (g->entry[e].cell != cell) continue;
+
+        double d = distance(centre, &g->entry[e].location);
+        if (max_radius <= 0 || d <= max_radius) heap_push(heap, n, k, &g->entry[e], d);
+    }
+}
+
+
+/*
+ * geo_init - Index for up to the given number of devices.
+ * @param cell_size  grid step in degrees * GPS_COORD_SCALE, 0 = GEO_CELL_DEFAULT;
+ *                   about the typical query radius works best.
+ * @return  0, -1 on bad size or out of memory.
+ *
+ */
+int geo_init(GEO_INDEX *g, uint32_t devices, int32_t cell_size)
+{
+    uint32_t buckets = 64, ids = 64;
+
+    memset(g, 0, sizeof(GEO_INDEX));
+    if (cell_size == 0) cell_size = GEO_CELL_DEFAULT;
+    if (cell_size < 100 || cell_size > LAT_SPAN || devices == 0 || devices > 0x40000000u) return -1;
+
+    while (buckets < devices) buckets <<= 1;
+    while (ids < devices * 2) ids <<= 1;
+
+    g->cell_size   = cell_size;
+    g->rows        = (uint32_t)((LAT_SPAN + cell_size - 1) / cell_size);
+    g->cols        = (uint32_t)((LON_SPAN + cell_size - 1) / cell_size);
+    g->capacity    = devices;
+    g->bucket_mask = buckets - 1;
+    g->id_mask     = ids - 1;
+
+    g->entry  = malloc((size_t)devices * sizeof(GEO_ENTRY));
+    g->bucket = malloc((size_t)buckets * sizeof(uint32_t));
+    g->id_map = malloc((size_t)ids * sizeof(uint32_t));
+    if (!g->entry || !g->bucket || !g->id_map || pthread_rwlock_init(&g->lock, NULL) != 0)
+    {
+        free(g->entry);
+        free(g->bucket);
+        free(g->id_map);
+        memset(g, 0, sizeof(GEO_INDEX));
+        return -1;
+    }
+
+    memset(g->bucket, 0xFF, (size_t)buckets * sizeof(uint32_t));
+    memset(g->id_map, 0xFF, (size_t)ids * sizeof(uint32_t));
+    return 0;
+}
+
+void geo_free(GEO_INDEX *g)
+{
+    if (!g->entry) return;
+
+    pthread_rwlock_destroy(&g->lock);
+    free(g->entry);
+    free(g->bucket);
+    free(g->id_map);
+    memset(g, 0, sizeof(GEO_INDEX));
+}
+
+/*
+ * geo_update - Sets the position of a device, adding it if new.
+ * @return  0, -1 on an invalid location or a full index.
+ *
+ */
+int geo_update(GEO_INDEX *g, uint64_t id, const LOCATION *loc)
+{
+    int rc;
+
+    pthread_rwlock_wrlock(&g->lock);
+    rc = update_locked(g, id, loc);
+    pthread_rwlock_unlock(&g->lock);
+    return rc;
+}
+
+/*
+ * geo_update_batch - Applies n fixes under one lock (e.g. per decoded block).
+ * @return  number of fixes rejected.
+ *
+ */
+int geo_update_batch(GEO_INDEX *g, const uint64_t *id, const LOCATION *loc, uint32_t n)
+{
+    int rejected = 0;
+
+    pthread_rwlock_wrlock(&g->lock);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (update_locked(g, id[i], &loc[i]) != 0) rejected++;
+    }
+    pthread_rwlock_unlock(&g->lock);
+    return rejected;
+}
+
+/*
+ * geo_remove - Drops a device (went offline, stale position).
+ * @return  0, -1 if unknown.
+ *
+ */
+int geo_remove(GEO_INDEX *g, uint64_t id)
+{
+    uint32_t *slot;
+    uint32_t  e, last;
+
+    pthread_rwlock_wrlock(&g->lock);
+
+    slot = id_slot(g, id);
+    if (*slot == GEO_NONE)
+    {
+        pthread_rwlock_unlock(&g->lock);
+        return -1;
+    }
+
+    e = *slot;
+    unlink_entry(g, e);
+    id_unmap(g, slot);
+
+    // keep the entries dense
+    last = --g->count;
+    if (e != last)
+    {
+        GEO_ENTRY *en = &g->entry[e];
+
+        *en = g->entry[last];
+        if (en->prev != GEO_NONE) g->entry[en->prev].next = e;
+        else g->bucket[hash64(en->cell) & g->bucket_mask] = e;
+        if (en->next != GEO_NONE) g->entry[en->next].prev = e;
+        *id_slot(g, en->id) = e;
+    }
+
+    pthread_rwlock_unlock(&g->lock);
+    return 0;
+}
+
+/*
+ * geo_box - Devices inside [min, max]; min->longitude > max->longitude
+ * means the box crosses the antimeridian.
+ * @return  number of hits written (at most max_hits).
+ *
+ */
+uint32_t geo_box(GEO_INDEX *g, const LOCATION *min, const LOCATION *max, GEO_HIT *hit, uint32_t max_hits)
+{
+    uint32_t n;
+
+    if (!valid_location(min) || !valid_location(max) || min->latitude > max->latitude) return 0;
+
+    pthread_rwlock_rdlock(&g->lock);
+    n = box_scan(g, min, max, NULL, 0, hit, max_hits);
+    pthread_rwlock_unlock(&g->lock);
+    return n;
+}
+
+/*
+ * geo_radius - Devices within radius (m) of centre, unordered.
+ * @return  number of hits written (at most max_hits).
+ *
+ */
+uint32_t geo_radius(GEO_INDEX *g, const LOCATION *centre, float radius, GEO_HIT *hit, uint32_t max_hits)
+{
+    LOCATION min, max;
+    double   dlat, dlon, cos_edge;
+    uint32_t n;
+
+    if (!valid_location(centre) || radius <= 0) return 0;
+
+    // bounding box of the circle
+    dlat = radius / (EARTH_RADIUS * RAD_PER_UNIT);
+    min.latitude = (int32_t)fmax(centre->latitude - dlat - 1, -LAT_SPAN / 2);
+    max.latitude = (int32_t)fmin(centre->latitude + dlat + 1, LAT_SPAN / 2);
+    cos_edge = cos(fmax(fabs((double)min.latitude), fabs((double)max.latitude)) * RAD_PER_UNIT);
+    dlon = (cos_edge > 1e-9) ? dlat / cos_edge : LON_SPAN;
+
+    if (dlon >= LON_SPAN / 2 || max.latitude == LAT_SPAN / 2 || min.latitude == -LAT_SPAN / 2)
+    {
+        min.longitude = -LON_SPAN / 2;
+        max.longitude = LON_SPAN / 2;
+    }
+    else
+    {
+        int32_t lo = centre->longitude - (int32_t)dlon - 1;
+        int32_t hi = centre->longitude + (int32_t)dlon + 1;
+
+        min.longitude = lo < -LON_SPAN / 2 ? lo + LON_SPAN : lo;
+        max.longitude = hi >  LON_SPAN / 2 ? hi - LON_SPAN : hi;
+    }
+
+    pthread_rwlock_rdlock(&g->lock);
+    n = box_scan(g, &min, &max, centre, radius, hit, max_hits);
+    pthread_rwlock_unlock(&g->lock);
+    return n;
+}
+
+/*
+ * geo_nearest - The k devices closest to centre, nearest first.
+ * Searches rings of cells outwards until no unvisited cell can hold a
+ * closer device, falling back to a full scan when the rings outgrow it.
+ * @param max_radius  m, 0 = unlimited.
+ * @return  number of hits written to hit[0..k).
+ *
+ */
+uint32_t geo_nearest(GEO_INDEX *g, const LOCATION *centre, uint32_t k, float max_radius, GEO_HIT *hit)
+{
+    uint32_t n = 0, ccy, ccx, visited = 0;
+    double   cos_c;
+
+    if (!valid_location(centre) || k == 0) return 0;
+
+    pthread_rwlock_rdlock(&g->lock);
+
+    ccy   = cell_row(g, centre->latitude);
+    ccx   = cell_col(g, centre->longitude);
+    cos_c = cos(centre->latitude * RAD_PER_UNIT);
+
+    for (uint32_t r = 0; ; r++)
+    {
+        uint32_t side = 2 * r + 1;
+
+        if (side > g->cols || (uint64_t)visited + 4ull * side > 4ull * g->count + 64)
+        {
+            // rings wrap or cost more than the devices: scan everything
+            n = 0;
+            for (uint32_t e = 0; e < g->count; e++)
+            {
+                double d = distance(centre, &g->entry[e].location);
+                if (max_radius <= 0 || d <= max_radius) heap_push(hit, &n, k, &g->entry[e], d);
+            }
+            break;
+        }
+
+        // the ring: rows ccy - r .. ccy + r, full rows at the top/bottom, two columns between
+        for (int64_t dy = -(int64_t)r; dy <= (int64_t)r; dy++)
+        {
+            int64_t cy = (int64_t)ccy + dy;
+
+            if (cy < 0 || cy >= g->rows) continue;
+            uint32_t step = (dy == -(int64_t)r || dy == (int64_t)r) ? 1 : (r ? 2 * r : 1);
+            for (uint32_t i = 0; i < side; i += step)
+            {
+                uint32_t cx = (ccx + g->cols - r + i) % g->cols;
+                nearest_cell(g, cell_key(g, (uint32_t)cy, cx), centre, max_radius, hit, &n, k);
+            }
+        }
+        visited += r ? 8 * r : 1;
+
+        // distance from the centre to the nearest point outside the searched square
+        double lat_lo = ((double)ccy - r) * g->cell_size - LAT_SPAN / 2;
+        double lat_hi = ((double)ccy + r + 1) * g->cell_size - LAT_SPAN / 2;
+        double lon_lo = ((double)ccx - r) * g->cell_size - LON_SPAN / 2;
+        double lon_hi = ((double)ccx + r + 1) * g->cell_size - LON_SPAN / 2;
+        double reach  = INFINITY;
+
+        if (lat_lo > -LAT_SPAN / 2) reach = fmin(reach, (centre->latitude - lat_lo) * RAD_PER_UNIT * EARTH_RADIUS);
+        if (lat_hi <  LAT_SPAN / 2) reach = fmin(reach, (lat_hi - centre->latitude) * RAD_PER_UNIT * EARTH_RADIUS);
+
+        // hav(d) >= cos(phi1) cos(phi2) hav(dlon), phi2 anywhere in the searched rows
+        double cos_min = cos(fmin(fmax(fabs(lat_lo), fabs(lat_hi)), LAT_SPAN / 2) * RAD_PER_UNIT);
+        double dlon    = fmin(centre->longitude - lon_lo, lon_hi - centre->longitude) * RAD_PER_UNIT;
+        double s       = sin(dlon / 2);
+        reach = fmin(reach, 2 * EARTH_RADIUS * asin(sqrt(fmin(cos_c * cos_min * s * s, 1.0))));
+
+        if (n == k && hit[0].dist <= reach) break;
+        if (max_radius > 0 && reach >= max_radius) break;
+        if (lat_lo <= -LAT_SPAN / 2 && lat_hi >= LAT_SPAN / 2 && side >= g->cols) break;
+    }
+
+    pthread_rwlock_unlock(&g->lock);
+
+    qsort(hit, n, sizeof(GEO_HIT), hit_cmp);
+    return n;
+}
@@ -0,0 +1,68 @@
+/*
+ * geo_index.h
+ *
+ * Live spatial index of moving devices: a uniform grid of fixed-point
+ * LOCATION cells, hashed so only occupied cells cost memory. A fix moves
+ * its device between cell lists only when the cell changes; radius, box
+ * and k-nearest queries visit the cells they overlap instead of every
+ * device. One rwlock: queries run in parallel, updates are short.
+ */
+
+#ifndef INC_GEO_INDEX_H_
+#define INC_GEO_INDEX_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "NMEA.h"
+
+#define GEO_CELL_DEFAULT        10000               // cell size, degrees * GPS_COORD_SCALE (~1.1 km)
+#define GEO_NONE                0xFFFFFFFFu
+
+typedef struct
+{
+    uint64_t    id;
+    LOCATION    location;
+    uint64_t    cell;
+    uint32_t    next, prev;                         // cell list
+} GEO_ENTRY;
+
+typedef struct
+{
+    uint64_t    id;
+    LOCATION    location;
+    float       dist;                               // m from the query centre (box: 0)
+} GEO_HIT;
+
+typedef struct
+{
+    int32_t     cell_size;                          // degrees * GPS_COORD_SCALE
+    uint32_t    cols, rows;
+
+    GEO_ENTRY   *entry;                             // dense, [0, count)
+    uint32_t    capacity;
+    uint32_t    count;
+
+    uint32_t    *bucket;                            // first entry of the cells hashed here
+    uint32_t    bucket_mask;
+    uint32_t    *id_map;                            // device id -> entry (linear probing)
+    uint32_t    id_mask;
+
+    uint64_t    moves;                              // updates that changed cell
+
+    pthread_rwlock_t lock;
+} GEO_INDEX;
+
+
+// Public function declarations
+int      geo_init(GEO_INDEX *g, uint32_t devices, int32_t cell_size);
+void     geo_free(GEO_INDEX *g);
+
+int      geo_update(GEO_INDEX *g, uint64_t id, const LOCATION *loc);
+int      geo_update_batch(GEO_INDEX *g, const uint64_t *id, const LOCATION *loc, uint32_t n);
+int      geo_remove(GEO_INDEX *g, uint64_t id);
+
+uint32_t geo_box(GEO_INDEX *g, const LOCATION *min, const LOCATION *max, GEO_HIT *hit, uint32_t max_hits);
+uint32_t geo_radius(GEO_INDEX *g, const LOCATION *centre, float radius, GEO_HIT *hit, uint32_t max_hits);
+uint32_t geo_nearest(GEO_INDEX *g, const LOCATION *centre, uint32_t k, float max_radius, GEO_HIT *hit);
+
+#endif /* INC_GEO_INDEX_H_ */
@@ -0,0 +1,579 @@
+/*
+ * heatmap.c - Parallel density aggregation of track files and NMEA logs.
+ * Inputs are mapped and cut into HEAT_CHUNK work units (whole records for
+ * track files, whole lines for NMEA logs); workers take units from a
+ * shared counter and bin into private grids, so the hot loop touches no
+ * shared memory. NMEA is located with nmea_index and only sentences with
+ * a good checksum are decoded (GGA gives the position, the last RMC the
+ * date, speed and course).
+ */
+
+#include "heatmap.h"
+#include "nmea_scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TILE_CELLS      (HEAT_TILE * HEAT_TILE)
+#define SPAN_BATCH      1024
+
+typedef struct
+{
+    const char  *base;
+    size_t      begin, end;
+    int         track;
+} HEAT_UNIT;
+
+typedef struct
+{
+    HEAT_UNIT           *unit;
+    size_t              count;
+    size_t              next;
+    pthread_mutex_t     lock;
+    const HEAT_FILTER   *filter;
+} HEAT_WORK;
+
+typedef struct
+{
+    HEAT_WORK   *work;
+    HEAT_GRID   grid;
+} HEAT_WORKER;
+
+
+static void add_saturated(uint32_t *dst, uint32_t v)
+{
+    *dst = (*dst > UINT32_MAX - v) ? UINT32_MAX : *dst + v;
+}
+
+
+/*
+ * heat_grid_init - Empty grid covering [min, max] with square cells.
+ * @return  0, -1 on a bad box or out of memory.
+ *
+ */
+int heat_grid_init(HEAT_GRID *g, const LOCATION *min, const LOCATION *max, int32_t cell)
+{
+    int64_t width  = (int64_t)max->longitude - min->longitude;
+    int64_t height = (int64_t)max->latitude - min->latitude;
+
+    memset(g, 0, sizeof(HEAT_GRID));
+    if (cell <= 0 || width <= 0 || height <= 0) return -1;
+
+    g->min     = *min;
+    g->cell    = cell;
+    g->cols    = (uint32_t)((width + cell - 1) / cell);
+    g->rows    = (uint32_t)((height + cell - 1) / cell);
+    g->tiles_x = (g->cols + HEAT_TILE - 1) / HEAT_TILE;
+    g->tiles_y = (g->rows + HEAT_TILE - 1) / HEAT_TILE;
+    g->tile    = calloc((size_t)g->tiles_x * g->tiles_y, sizeof(uint32_t *));
+
+    return g->tile ? 0 : -1;
+}
+
+/* empty grid with the geometry of proto */
+static int grid_like(HEAT_GRID *g, const HEAT_GRID *proto)
+{
+    memset(g, 0, sizeof(HEAT_GRID));
+    g->min     = proto->min;
+    g->cell    = proto->cell;
+    g->cols    = proto->cols;
+    g->rows    = proto->rows;
+    g->tiles_x = proto->tiles_x;
+    g->tiles_y = proto->tiles_y;
+    g->tile    = calloc((size_t)g->tiles_x * g->tiles_y, sizeof(uint32_t *));
+
+    return g->tile ? 0 : -1;
+}
+
+void heat_grid_free(HEAT_GRID *g)
+{
+    if (g->tile)
+    {
+        for (size_t i = 0; i < (size_t)g->tiles_x * g->tiles_y; i++) free(g->tile[i]);
+        free(g->tile);
+    }
+    memset(g, 0, sizeof(HEAT_GRID));
+}
+
+/*
+ * heat_merge - Adds src into dst (same geometry) and frees src.
+ * Tiles only src has are moved, not copied.
+ *
+ */
+void heat_merge(HEAT_GRID *dst, HEAT_GRID *src)
+{
+    for (size_t i = 0; i < (size_t)dst->tiles_x * dst->tiles_y; i++)
+    {
+        if (!src->tile[i]) continue;
+
+        if (!dst->tile[i])
+        {
+            dst->tile[i] = src->tile[i];
+            src->tile[i] = NULL;
+            continue;
+        }
+        for (uint32_t c = 0; c < TILE_CELLS; c++) add_saturated(&dst->tile[i][c], src->tile[i][c]);
+    }
+
+    dst->binned   += src->binned;
+    dst->filtered += src->filtered;
+    dst->outside  += src->outside;
+    heat_grid_free(src);
+}
+
+/*
+ * heat_filter_pass - Applies the filter, a record needs a position.
+ * Bounds on a field the record does not have reject it.
+ *
+ */
+int heat_filter_pass(const HEAT_FILTER *f, const FIXRECORD *rec)
+{
+    if ((rec->present & GPS_HAS_POSITION) != GPS_HAS_POSITION) return 0;
+    if (!f) return 1;
+
+    if ((f->from_ms || f->to_ms) && rec->utc_ms == 0) return 0;
+    if (f->from_ms && rec->utc_ms < f->from_ms) return 0;
+    if (f->to_ms && rec->utc_ms >= f->to_ms) return 0;
+
+    if ((f->min_speed || f->max_speed) && !(rec->present & GPS_HAS_SPEED)) return 0;
+    if (rec->speed < f->min_speed) return 0;
+    if (f->max_speed && rec->speed > f->max_speed) return 0;
+
+    if (f->max_hdop && (!(rec->present & GPS_HAS_HDOP) || rec->hdop > f->max_hdop)) return 0;
+    if (f->min_sats && (!(rec->present & GPS_HAS_NUMSAT) || rec->numsat < f->min_sats)) return 0;
+    if (f->need_fix && !rec->fix) return 0;
+    return 1;
+}
+
+/*
+ * heat_add - Bins one record.
+ *
+ */
+void heat_add(HEAT_GRID *g, const HEAT_FILTER *f, const FIXRECORD *rec)
+{
+    if (!heat_filter_pass(f, rec))
+    {
+        g->filtered++;
+        return;
+    }
+
+    int64_t  dx = (int64_t)rec->longitude - g->min.longitude;
+    int64_t  dy = (int64_t)rec->latitude - g->min.latitude;
+    uint32_t col, row;
+
+    if (dx < 0 || dy < 0 || dx / g->cell >= g->cols || dy / g->cell >= g->rows)
+    {
+        g->outside++;
+        return;
+    }
+    col = (uint32_t)(dx / g->cell);
+    row = (uint32_t)(dy / g->cell);
+
+    uint32_t **tile = &g->tile[(size_t)(row / HEAT_TILE) * g->tiles_x + col / HEAT_TILE];
+    if (!*tile && !(*tile = calloc(TILE_CELLS, sizeof(uint32_t))))
+    {
+        g->outside++;
+        return;
+    }
+
+    uint32_t *c = &(*tile)[(row % HEAT_TILE) * HEAT_TILE + col % HEAT_TILE];
+    if (*c != UINT32_MAX) (*c)++;
+    g->binned++;
+}
+
+/*
+ * heat_add_nmea - Bins every GGA of a buffer of complete lines.
+ *
+ */
+void heat_add_nmea(HEAT_GRID *g, const HEAT_FILTER *f, const char *buf, size_t len)
+{
+    NMEA_SPAN    span[SPAN_BATCH];
+    NMEA_HISTORY gga_hist, rmc_hist;
+    GPSSTRUCT    gps;
+    FIXRECORD    rec;
+    char         line[NMEA_SENTENCE_MAX + 1];
+    size_t       done;
+
+    initGPS(&gps);
+    initHistory(&gga_hist);
+    initHistory(&rmc_hist);
+
+    while (len > 0)
+    {
+        size_t n = nmea_index(buf, len, span, SPAN_BATCH, &done);
+
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t l = span[i].end - span[i].start;
+
+            if (!(span[i].flags & NMEA_SPAN_CHECKSUM_OK) || (span[i].flags & NMEA_SPAN_BAD_CHARS)) continue;
+            if (l < 7 || l > NMEA_SENTENCE_MAX) continue;
+
+            memcpy(line, buf + span[i].start, l);
+            line[l] = '\0';
+
+            if (memcmp(line + 3, "RMC,", 4) == 0)
+            {
+                decodeRMCIncremental(line, &gps.rmcstruct, &rmc_hist);
+            }
+            else if (memcmp(line + 3, "GGA,", 4) == 0)
+            {
+                decodeGGAIncremental(line, &gps.ggastruct, &gga_hist);
+                fix_record_from_gps(&rec, &gps);
+                heat_add(g, f, &rec);
+            }
+        }
+
+        if (done == 0) break;                   // only an unterminated sentence is left
+        buf += done;
+        len -= done;
+    }
+}
+
+
+/*************************************** parallel driver ***************************************/
+
+static void run_unit(HEAT_GRID *g, const HEAT_FILTER *f, const HEAT_UNIT *u)
+{
+    if (!u->track)
+    {
+        heat_add_nmea(g, f, u->base + u->begin, u->end - u->begin);
+        return;
+    }
+
+    FIXRECORD rec;
+    for (size_t off = u->begin; off + sizeof(FIXRECORD) <= u->end; off += sizeof(FIXRECORD))
+    {
+        memcpy(&rec, u->base + off, sizeof(FIXRECORD));
+        heat_add(g, f, &rec);
+    }
+}
+
+static void *heat_worker(void *arg)
+{
+    HEAT_WORKER *w = arg;
+    HEAT_WORK   *work = w->work;
+
+    for (;;)
+    {
+        size_t i;
+
+        pthread_mutex_lock(&work->lock);
+        i = work->next++;
+        pthread_mutex_unlock(&work->lock);
+
+        if (i >= work->count) break;
+        run_unit(&w->grid, work->filter, &work->unit[i]);
+    }
+    return NULL;
+}
+
+/* next line start at or after pos (pos itself if it starts a line) */
+static size_t line_start(const char *base, size_t len, size_t pos)
+{
+    if (pos == 0 || pos >= len) return pos < len ? pos : len;
+
+    const char *nl = memchr(base + pos - 1, '\n', len - pos + 1);
+    return nl ? (size_t)(nl - base) + 1 : len;
+}
+
+/*
+ * split_file - Appends the work units of one mapped file.
+ * @return  number of units, -1 out of memory.
+ *
+ */
+static long split_file(HEAT_WORK *work, size_t *cap, const char *base, size_t len)
+{
+    size_t begin = 0, step = HEAT_CHUNK;
+    int    track = 0;
+    long   units = 0;
+
+    if (len >= sizeof(TRACK_HEADER))
+    {
+        TRACK_HEADER h;
+
+        memcpy(&h, base, sizeof(h));
+        if (h.magic == TRACK_MAGIC && h.record_size == sizeof(FIXRECORD))
+        {
+            track = 1;
+            begin = sizeof(TRACK_HEADER);
+            step  = HEAT_CHUNK / sizeof(FIXRECORD) * sizeof(FIXRECORD);
+        }
+    }
+
+    while (begin < len)
+    {
+        size_t end = (len - begin > step) ? begin + step : len;
+
+        if (!track) end = line_start(base, len, end);
+
+        if (work->count == *cap)
+        {
+            size_t     ncap = *cap ? *cap * 2 : 64;
+            HEAT_UNIT *u    = realloc(work->unit, ncap * sizeof(HEAT_UNIT));
+
+            if (!u) return -1;
+            work->unit = u;
+            *cap = ncap;
+        }
+        work->unit[work->count++] = (HEAT_UNIT){ base, begin, end, track };
+        units++;
+        begin = end;
+    }
+    return units;
+}
+
+/*
+ * heat_aggregate - Bins all inputs into out (initialised by the caller).
+ * Track files are recognised by their header, anything else is read as
+ * an NMEA log. threads <= 0 uses one.
+ * @return  number of inputs that could not be read, -1 on allocation failure.
+ *
+ */
+int heat_aggregate(const char *const *paths, int count, int threads, const HEAT_FILTER *f, HEAT_GRID *out)
+{
+    HEAT_WORK    work;
+    HEAT_WORKER  *worker;
+    pthread_t    *tid;
+    void         **map  = calloc((size_t)(count > 0 ? count : 1), sizeof(void *));
+    size_t       *size  = calloc((size_t)(count > 0 ? count : 1), sizeof(size_t));
+    size_t       cap = 0;
+    int          failed = 0, rc = 0;
+
+    if (threads <= 0) threads = 1;
+    memset(&work, 0, sizeof(work));
+    work.filter = f;
+    pthread_mutex_init(&work.lock, NULL);
+
+    worker = calloc((size_t)threads, sizeof(HEAT_WORKER));
+    tid    = calloc((size_t)threads, sizeof(pthread_t));
+    if (!map || !size || !worker || !tid)
+    {
+        rc = -1;
+        goto done;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        struct stat st;
+        int         fd = open(paths[i], O_RDONLY);
+
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            if (fd >= 0) close(fd);
+            failed++;
+            continue;
+        }
+        if (st.st_size == 0)
+        {
+            close(fd);
+            continue;
+        }
+
+        map[i] = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map[i] == MAP_FAILED)
+        {
+            map[i] = NULL;
+            failed++;
+            continue;
+        }
+        size[i] = (size_t)st.st_size;
+        madvise(map[i], size[i], MADV_SEQUENTIAL);
+
+        if (split_file(&work, &cap, map[i], size[i]) < 0)
+        {
+            rc = -1;
+            goto done;
+        }
+    }
+
+    // private grids, then one merge pass
+    int started = 0;
+    for (; started < threads; started++)
+    {
+        worker[started].work = &work;
+        if (grid_like(&worker[started].grid, out) != 0) break;
+        if (pthread_create(&tid[started], NULL, heat_worker, &worker[started]) != 0)
+        {
+            heat_grid_free(&worker[started].grid);
+            break;
+        }
+    }
+    if (started == 0) rc = -1;
+    for (int t = 0; t < started; t++)
+    {
+        pthread_join(tid[t], NULL);
+        heat_merge(out, &worker[t].grid);
+    }
+
+done:
+    for (int i = 0; i < count && map; i++)
+    {
+        if (map[i]) munmap(map[i], size[i]);
+    }
+    pthread_mutex_destroy(&work.lock);
+    free(work.unit);
+    free(map);
+    free(size);
+    free(worker);
+    free(tid);
+    return rc < 0 ? rc : failed;
+}
+
+
+/*************************************** tiles ***************************************/
+
+/*
+ * build_level - Next coarser level: cells twice as large, 2x2 sums.
+ *
+ */
+static int build_level(const HEAT_GRID *src, HEAT_GRID *dst)
+{
+    HEAT_GRID half = *src;
+
+    half.cell    = src->cell * 2;
+    half.cols    = (src->cols + 1) / 2;
+    half.rows    = (src->rows + 1) / 2;
+    half.tiles_x = (src->tiles_x + 1) / 2;
+    half.tiles_y = (src->tiles_y + 1) / 2;
+    if (grid_like(dst, &half) != 0) return -1;
+
+    for (uint32_t ty = 0; ty < src->tiles_y; ty++)
+    {
+        for (uint32_t tx = 0; tx < src->tiles_x; tx++)
+        {
+            const uint32_t *s = src->tile[(size_t)ty * src->tiles_x + tx];
+            uint32_t      **d = &dst->tile[(size_t)(ty / 2) * dst->tiles_x + tx / 2];
+
+            if (!s) continue;
+            if (!*d && !(*d = calloc(TILE_CELLS, sizeof(uint32_t)))) return -1;
+
+            // this child covers one quarter of the parent tile
+            uint32_t ox = (tx % 2) * (HEAT_TILE / 2), oy = (ty % 2) * (HEAT_TILE / 2);
+            for (uint32_t y = 0; y < HEAT_TILE; y++)
+            {
+                for (uint32_t x = 0; x < HEAT_TILE; x++)
+                {
+                    add_saturated(&(*d)[(oy + y / 2) * HEAT_TILE + ox + x / 2], s[y * HEAT_TILE + x]);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * write_level - One file per non empty tile, rows north first:
+ * <dir>/<level>/<tx>_<ty>.pgm (log scaled greyscale) or .u32 (raw counts).
+ * ty counts tiles from the north edge.
+ *
+ */
+static int write_level(const HEAT_GRID *g, const char *dir, int level, int raw, FILE *index)
+{
+    char     path[4096];
+    uint32_t max = 0;
+    uint32_t row[HEAT_TILE];
+    uint8_t  pix[HEAT_TILE];
+
+    snprintf(path, sizeof(path), "%s/%d", dir, level);
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) return -1;
+
+    for (size_t i = 0; i < (size_t)g->tiles_x * g->tiles_y; i++)
+    {
+        for (uint32_t c = 0; g->tile[i] && c < TILE_CELLS; c++) max = g->tile[i][c] > max ? g->tile[i][c] : max;
+    }
+    fprintf(index, "%d %ld %ld %ld %lu %lu %lu\n", level, (long)g->cell, (long)g->min.latitude, (long)g->min.longitude,
+            (unsigned long)g->tiles_x, (unsigned long)g->tiles_y, (unsigned long)max);
+
+    double scale = max ? 255.0 / log1p((double)max) : 0;
+
+    for (uint32_t ty = 0; ty < g->tiles_y; ty++)
+    {
+        for (uint32_t tx = 0; tx < g->tiles_x; tx++)
+        {
+            const uint32_t *t = g->tile[(size_t)ty * g->tiles_x + tx];
+            FILE           *fp;
+
+            if (!t) continue;
+
+            snprintf(path, sizeof(path), "%s/%d/%lu_%lu.%s", dir, level, (unsigned long)tx,
+                     (unsigned long)(g->tiles_y - 1 - ty), raw ? "u32" : "pgm");
+            if (!(fp = fopen(path, "wb"))) return -1;
+            if (!raw) fprintf(fp, "P5\n%d %d\n255\n", HEAT_TILE, HEAT_TILE);
+
+            for (int y = HEAT_TILE - 1; y >= 0; y--)
+            {
+                const uint32_t *r = &t[y * HEAT_TILE];
+
+                if (raw)
+                {
+                    for (int x = 0; x < HEAT_TILE; x++)
+                    {
+                        uint8_t *b = (uint8_t *)&row[x];
+                        b[0] = (uint8_t)r[x];
+                        b[1] = (uint8_t)(r[x] >> 8);
+                        b[2] = (uint8_t)(r[x] >> 16);
+                        b[3] = (uint8_t)(r[x] >> 24);
+                    }
+                    fwrite(row, sizeof(uint32_t), HEAT_TILE, fp);
+                }
+                else
+                {
+                    for (int x = 0; x < HEAT_TILE; x++) pix[x] = (uint8_t)(log1p((double)r[x]) * scale + 0.5);
+                    fwrite(pix, 1, HEAT_TILE, fp);
+                }
+            }
+            if (fclose(fp) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * heat_write_tiles - Writes levels 0 (the grid) to levels - 1 and an
+ * index file <dir>/tiles.txt, one line per level:
+ * "level cell min_latitude min_longitude tiles_x tiles_y max_count".
+ * @return  0, -1 on an I/O or allocation error.
+ *
+ */
+int heat_write_tiles(HEAT_GRID *g, const char *dir, int levels, int raw)
+{
+    char      path[4096];
+    FILE      *index;
+    HEAT_GRID level[2];
+    int       rc = 0;
+
+    if (levels < 1) levels = 1;
+    if (levels > HEAT_MAX_LEVELS) levels = HEAT_MAX_LEVELS;
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) return -1;
+    snprintf(path, sizeof(path), "%s/tiles.txt", dir);
+    if (!(index = fopen(path, "w"))) return -1;
+
+    const HEAT_GRID *cur = g;
+    memset(level, 0, sizeof(level));
+
+    for (int l = 0; l < levels && rc == 0; l++)
+    {
+        rc = write_level(cur, dir, l, raw, index);
+        if (rc != 0 || l + 1 == levels || (cur->tiles_x == 1 && cur->tiles_y == 1)) break;
+
+        HEAT_GRID *next = &level[l % 2];
+        heat_grid_free(next);
+        rc  = build_level(cur, next);
+        cur = next;
+    }
+
+    heat_grid_free(&level[0]);
+    heat_grid_free(&level[1]);
+    if (fclose(index) != 0) rc = -1;
+    return rc;
+}
@@ -0,0 +1,59 @@
+/*
+ * heatmap.h
+ *
+ * Density aggregation of archived fixes into integer count grids.
+ * The finest grid is cut into HEAT_TILE x HEAT_TILE tiles allocated on
+ * first use, so a world wide grid only costs memory where devices went.
+ * Every worker thread bins into its own grid, the grids are summed at the
+ * end and coarser levels are built by 2x2 summing for tile output.
+ */
+
+#ifndef INC_HEATMAP_H_
+#define INC_HEATMAP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "fix_record.h"
+
+#define HEAT_TILE               256                 // cells per tile side
+#define HEAT_CELL_DEFAULT       1000                // degrees * GPS_COORD_SCALE (~110 m)
+#define HEAT_CHUNK              (8u << 20)          // input bytes per work unit
+#define HEAT_MAX_LEVELS         12
+
+// HEAT_FILTER: 0 disables a bound
+typedef struct
+{
+    int64_t     from_ms, to_ms;                     // utc_ms range, [from, to)
+    uint16_t    min_speed, max_speed;               // knots * 100
+    uint16_t    max_hdop;                           // x100
+    uint8_t     min_sats;
+    uint8_t     need_fix;                           // drop epochs without a valid GGA fix
+} HEAT_FILTER;
+
+typedef struct
+{
+    LOCATION    min;                                // south west corner
+    int32_t     cell;                               // degrees * GPS_COORD_SCALE
+    uint32_t    cols, rows;                         // cells
+    uint32_t    tiles_x, tiles_y;
+    uint32_t    **tile;                             // tiles_x * tiles_y, NULL = empty; row 0 = south
+
+    uint64_t    binned;
+    uint64_t    filtered;                           // rejected by the filter
+    uint64_t    outside;                            // outside the grid
+} HEAT_GRID;
+
+
+// Public function declarations
+int      heat_grid_init(HEAT_GRID *g, const LOCATION *min, const LOCATION *max, int32_t cell);
+void     heat_grid_free(HEAT_GRID *g);
+void     heat_merge(HEAT_GRID *dst, HEAT_GRID *src);
+
+int      heat_filter_pass(const HEAT_FILTER *f, const FIXRECORD *rec);
+void     heat_add(HEAT_GRID *g, const HEAT_FILTER *f, const FIXRECORD *rec);
+void     heat_add_nmea(HEAT_GRID *g, const HEAT_FILTER *f, const char *buf, size_t len);
+
+int      heat_aggregate(const char *const *paths, int count, int threads, const HEAT_FILTER *f, HEAT_GRID *out);
+int      heat_write_tiles(HEAT_GRID *g, const char *dir, int levels, int raw);
+
+#endif /* INC_HEATMAP_H_ */
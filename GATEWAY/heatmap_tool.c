@@ -0,0 +1,119 @@
+/*
+ * heatmap_tool.c - Command line front end of heatmap.c.
+ *
+ *   heatmap [options] -o <dir> <track file | NMEA log>...
+ *
+ *   -j threads          worker threads (default: online CPUs)
+ *   -c cell             finest cell, degrees * 1e6 (default 1000)
+ *   -b lat0,lon0,lat1,lon1  box in degrees (default: the world)
+ *   -f from -t to       utc range, ms since 1970
+ *   -s min -S max       speed range, knots * 100
+ *   -n sats             minimum satellites
+ *   -d hdop             maximum HDOP * 100
+ *   -F                  valid GGA fix only
+ *   -l levels           pyramid levels to write (default 1)
+ *   -r                  raw uint32 tiles instead of greyscale PGM
+ */
+
+#include "heatmap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+static int parse_box(const char *arg, LOCATION *min, LOCATION *max)
+{
+    double lat0, lon0, lat1, lon1;
+
+    if (sscanf(arg, "%lf,%lf,%lf,%lf", &lat0, &lon0, &lat1, &lon1) != 4) return -1;
+    if (lat0 >= lat1 || lon0 >= lon1) return -1;
+
+    min->latitude  = (int32_t)(lat0 * GPS_COORD_SCALE);
+    min->longitude = (int32_t)(lon0 * GPS_COORD_SCALE);
+    max->latitude  = (int32_t)(lat1 * GPS_COORD_SCALE);
+    max->longitude = (int32_t)(lon1 * GPS_COORD_SCALE);
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: heatmap [-j threads] [-c cell] [-b lat0,lon0,lat1,lon1] [-f from_ms] [-t to_ms]\n"
+                    "               [-s min_speed] [-S max_speed] [-n sats] [-d hdop] [-F] [-l levels] [-r]\n"
+                    "               -o dir files...\n");
+}
+
+int main(int argc, char **argv)
+{
+    HEAT_FILTER     filter;
+    HEAT_GRID       grid;
+    LOCATION        min = { .latitude = -90 * GPS_COORD_SCALE, .longitude = -180 * GPS_COORD_SCALE };
+    LOCATION        max = { .latitude =  90 * GPS_COORD_SCALE, .longitude =  180 * GPS_COORD_SCALE };
+    const char      *dir = NULL;
+    int             threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int             levels = 1, raw = 0, opt;
+    int32_t         cell = HEAT_CELL_DEFAULT;
+    struct timespec t0, t1;
+
+    memset(&filter, 0, sizeof(filter));
+
+    while ((opt = getopt(argc, argv, "j:c:b:f:t:s:S:n:d:Fl:ro:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j': threads          = atoi(optarg); break;
+            case 'c': cell             = (int32_t)atol(optarg); break;
+            case 'f': filter.from_ms   = atoll(optarg); break;
+            case 't': filter.to_ms     = atoll(optarg); break;
+            case 's': filter.min_speed = (uint16_t)atoi(optarg); break;
+            case 'S': filter.max_speed = (uint16_t)atoi(optarg); break;
+            case 'n': filter.min_sats  = (uint8_t)atoi(optarg); break;
+            case 'd': filter.max_hdop  = (uint16_t)atoi(optarg); break;
+            case 'F': filter.need_fix  = 1; break;
+            case 'l': levels           = atoi(optarg); break;
+            case 'r': raw              = 1; break;
+            case 'o': dir              = optarg; break;
+            case 'b':
+                if (parse_box(optarg, &min, &max) == 0) break;
+                fprintf(stderr, "heatmap: bad box '%s'\n", optarg);
+                return 2;
+            default:
+                usage();
+                return 2;
+        }
+    }
+    if (!dir || optind >= argc)
+    {
+        usage();
+        return 2;
+    }
+
+    if (heat_grid_init(&grid, &min, &max, cell) != 0)
+    {
+        fprintf(stderr, "heatmap: bad grid\n");
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int failed = heat_aggregate((const char *const *)&argv[optind], argc - optind, threads, &filter, &grid);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (failed < 0)
+    {
+        fprintf(stderr, "heatmap: out of memory\n");
+        heat_grid_free(&grid);
+        return 1;
+    }
+
+    double sec = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    fprintf(stderr, "heatmap: %llu binned, %llu filtered, %llu outside, %d unreadable, %.2f s\n",
+            (unsigned long long)grid.binned, (unsigned long long)grid.filtered,
+            (unsigned long long)grid.outside, failed, sec);
+
+    int rc = heat_write_tiles(&grid, dir, levels, raw);
+    if (rc != 0) fprintf(stderr, "heatmap: could not write tiles to %s\n", dir);
+
+    heat_grid_free(&grid);
+    return (rc != 0 || failed) ? 1 : 0;
+}
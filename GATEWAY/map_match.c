@@ -0,0 +1,629 @@
+/*
+ * map_match.c - Online HMM map matching (Newson & Krumm model).
+ * Emission: Gaussian in the fix -> road distance, sigma scaled by HDOP,
+ * plus a heading term when the device moves. Transition: exponential in
+ * the difference between the route distance (bounded Dijkstra on the
+ * graph) and the straight line distance of consecutive fixes. Viterbi runs
+ * incrementally over a window of MM_WINDOW fixes per device: the best
+ * current state is reported at once, the fixed-lag state when it leaves
+ * the window.
+ */
+
+#include "map_match.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define NEG_INF             (-1e300)
+#define MAX_CELLS           (1u << 22)
+#define MIN_CELL_M          100.0
+#define PI                  3.14159265358979323846
+
+
+/*************************************** Graph ***************************************/
+
+static void graph_cells(const MM_GRAPH *g, double xa, double ya, double xb, double yb,
+                        uint32_t *c0, uint32_t *c1, uint32_t *r0, uint32_t *r1)
+{
+    double lo_x = (xa < xb ? xa : xb) - g->x0, hi_x = (xa > xb ? xa : xb) - g->x0;
+    double lo_y = (ya < yb ? ya : yb) - g->y0, hi_y = (ya > yb ? ya : yb) - g->y0;
+
+    lo_x = lo_x < 0 ? 0 : lo_x / g->cell;
+    lo_y = lo_y < 0 ? 0 : lo_y / g->cell;
+    hi_x = hi_x < 0 ? 0 : hi_x / g->cell;
+    hi_y = hi_y < 0 ? 0 : hi_y / g->cell;
+
+    *c0 = lo_x >= g->cols ? g->cols - 1 : (uint32_t)lo_x;
+    *c1 = hi_x >= g->cols ? g->cols - 1 : (uint32_t)hi_x;
+    *r0 = lo_y >= g->rows ? g->rows - 1 : (uint32_t)lo_y;
+    *r1 = hi_y >= g->rows ? g->rows - 1 : (uint32_t)hi_y;
+}
+
+/**
+ * Builds the in-memory graph: local plane, edge lengths, adjacency and grid index.
+ * @return  0 on success, -1 on bad input or allocation failure.
+ */
+int mm_graph_build(MM_GRAPH *g, const MM_FILE_NODE *node, uint32_t node_count,
+                   const MM_FILE_EDGE *edge, uint32_t edge_count)
+{
+    memset(g, 0, sizeof(MM_GRAPH));
+    if (node_count == 0 || edge_count == 0) return -1;
+
+    int32_t lat_min = node[0].latitude, lat_max = lat_min;
+    int32_t lon_min = node[0].longitude, lon_max = lon_min;
+
+    for (uint32_t i = 1; i < node_count; i++)
+    {
+        if (node[i].latitude  < lat_min) lat_min = node[i].latitude;
+        if (node[i].latitude  > lat_max) lat_max = node[i].latitude;
+        if (node[i].longitude < lon_min) lon_min = node[i].longitude;
+        if (node[i].longitude > lon_max) lon_max = node[i].longitude;
+    }
+
+    // metres per degree of latitude / longitude at the centre of the area
+    double phi = (lat_min / 2.0 + lat_max / 2.0) / GPS_COORD_SCALE * PI / 180;
+
+    g->lat0  = (int32_t)(((int64_t)lat_min + lat_max) / 2);
+    g->lon0  = (int32_t)(((int64_t)lon_min + lon_max) / 2);
+    g->m_lat = (111132.954 - 559.822 * cos(2 * phi) + 1.175 * cos(4 * phi)) / GPS_COORD_SCALE;
+    g->m_lon = (111412.84 * cos(phi) - 93.5 * cos(3 * phi) + 0.118 * cos(5 * phi)) / GPS_COORD_SCALE;
+
+    g->node_count = node_count;
+    g->edge_count = edge_count;
+    g->x          = malloc(node_count * sizeof(double));
+    g->y          = malloc(node_count * sizeof(double));
+    g->edge       = malloc(edge_count * sizeof(MM_EDGE));
+    g->adj_start  = calloc(node_count + 1, sizeof(uint32_t));
+    g->adj        = malloc(2 * (size_t)edge_count * sizeof(MM_ARC));
+
+    if (!g->x || !g->y || !g->edge || !g->adj_start || !g->adj)
+    {
+        mm_graph_free(g);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < node_count; i++)
+    {
+        g->x[i] = (double)(node[i].longitude - g->lon0) * g->m_lon;
+        g->y[i] = (double)(node[i].latitude  - g->lat0) * g->m_lat;
+    }
+
+    for (uint32_t i = 0; i < edge_count; i++)
+    {
+        MM_EDGE *e = &g->edge[i];
+
+        if (edge[i].from >= node_count || edge[i].to >= node_count)
+        {
+            mm_graph_free(g);
+            return -1;
+        }
+
+        double dx = g->x[edge[i].to] - g->x[edge[i].from];
+        double dy = g->y[edge[i].to] - g->y[edge[i].from];
+        double b  = atan2(dx, dy) * 180 / PI;
+
+        e->from    = edge[i].from;
+        e->to      = edge[i].to;
+        e->flags   = edge[i].flags;
+        e->length  = (float)sqrt(dx * dx + dy * dy);
+        e->bearing = (float)(b < 0 ? b + 360 : b);
+
+        g->adj_start[e->from + 1]++;
+        if (!(e->flags & MM_EDGE_ONEWAY)) g->adj_start[e->to + 1]++;
+    }
+
+    // adjacency, CSR
+    for (uint32_t i = 0; i < node_count; i++) g->adj_start[i + 1] += g->adj_start[i];
+    {
+        uint32_t *fill = malloc(node_count * sizeof(uint32_t));
+
+        if (!fill)
+        {
+            mm_graph_free(g);
+            return -1;
+        }
+        memcpy(fill, g->adj_start, node_count * sizeof(uint32_t));
+        for (uint32_t i = 0; i < edge_count; i++)
+        {
+            MM_EDGE *e = &g->edge[i];
+
+            g->adj[fill[e->from]++] = (MM_ARC){ e->to, i, e->length };
+            if (!(e->flags & MM_EDGE_ONEWAY)) g->adj[fill[e->to]++] = (MM_ARC){ e->from, i, e->length };
+        }
+        free(fill);
+    }
+
+    // grid index
+    double x_min = g->x[0], x_max = x_min, y_min = g->y[0], y_max = y_min;
+
+    for (uint32_t i = 1; i < node_count; i++)
+    {
+        if (g->x[i] < x_min) x_min = g->x[i];
+        if (g->x[i] > x_max) x_max = g->x[i];
+        if (g->y[i] < y_min) y_min = g->y[i];
+        if (g->y[i] > y_max) y_max = g->y[i];
+    }
+
+    g->x0   = x_min;
+    g->y0   = y_min;
+    g->cell = MIN_CELL_M;
+    if ((x_max - x_min) * (y_max - y_min) / (g->cell * g->cell) > MAX_CELLS)
+    {
+        g->cell = sqrt((x_max - x_min) * (y_max - y_min) / MAX_CELLS);
+    }
+    g->cols = (uint32_t)((x_max - x_min) / g->cell) + 1;
+    g->rows = (uint32_t)((y_max - y_min) / g->cell) + 1;
+
+    g->cell_start = calloc((size_t)g->cols * g->rows + 1, sizeof(uint32_t));
+    if (!g->cell_start)
+    {
+        mm_graph_free(g);
+        return -1;
+    }
+
+    // two passes: count, then fill (edges listed in every cell of their bounding box)
+    for (int pass = 0; pass < 2; pass++)
+    {
+        uint32_t *fill = NULL;
+
+        if (pass == 1)
+        {
+            size_t cells = (size_t)g->cols * g->rows;
+
+            for (size_t c = 0; c < cells; c++) g->cell_start[c + 1] += g->cell_start[c];
+            g->cell_edge = malloc((g->cell_start[cells] ? g->cell_start[cells] : 1) * sizeof(uint32_t));
+            fill         = malloc(cells * sizeof(uint32_t));
+            if (!g->cell_edge || !fill)
+            {
+                free(fill);
+                mm_graph_free(g);
+                return -1;
+            }
+            memcpy(fill, g->cell_start, cells * sizeof(uint32_t));
+        }
+
+        for (uint32_t i = 0; i < edge_count; i++)
+        {
+            const MM_EDGE *e = &g->edge[i];
+            uint32_t c0, c1, r0, r1;
+
+            graph_cells(g, g->x[e->from], g->y[e->from], g->x[e->to], g->y[e->to], &c0, &c1, &r0, &r1);
+            for (uint32_t r = r0; r <= r1; r++)
+            {
+                for (uint32_t c = c0; c <= c1; c++)
+                {
+                    if (pass == 0) g->cell_start[(size_t)r * g->cols + c + 1]++;
+                    else           g->cell_edge[fill[(size_t)r * g->cols + c]++] = i;
+                }
+            }
+        }
+        free(fill);
+    }
+
+    return 0;
+}
+
+/**
+ * Loads a graph file (MM_FILE_HEADER, nodes, edges) and builds it.
+ * @return  0 on success, -1 on error.
+ */
+int mm_graph_load(MM_GRAPH *g, const char *path)
+{
+    MM_FILE_HEADER hdr;
+    MM_FILE_NODE   *node = NULL;
+    MM_FILE_EDGE   *edge = NULL;
+    FILE           *f    = fopen(path, "rb");
+    int            ret   = -1;
+
+    memset(g, 0, sizeof(MM_GRAPH));
+    if (!f) return -1;
+
+    if (fread(&hdr, sizeof(hdr), 1, f) == 1 && hdr.magic == MM_FILE_MAGIC &&
+        hdr.node_count > 0 && hdr.node_count < (1u << 28) && hdr.edge_count > 0 && hdr.edge_count < (1u << 28))
+    {
+        node = malloc(hdr.node_count * sizeof(MM_FILE_NODE));
+        edge = malloc(hdr.edge_count * sizeof(MM_FILE_EDGE));
+
+        if (node && edge &&
+            fread(node, sizeof(MM_FILE_NODE), hdr.node_count, f) == hdr.node_count &&
+            fread(edge, sizeof(MM_FILE_EDGE), hdr.edge_count, f) == hdr.edge_count)
+        {
+            ret = mm_graph_build(g, node, hdr.node_count, edge, hdr.edge_count);
+        }
+    }
+
+    free(node);
+    free(edge);
+    fclose(f);
+    return ret;
+}
+
+/**
+ * Writes a graph file that mm_graph_load reads back.
+ * @return  0 on success, -1 on error.
+ */
+int mm_graph_save(const char *path, const MM_FILE_NODE *node, uint32_t node_count,
+                  const MM_FILE_EDGE *edge, uint32_t edge_count)
+{
+    MM_FILE_HEADER hdr = { MM_FILE_MAGIC, node_count, edge_count, 0 };
+    FILE           *f  = fopen(path, "wb");
+    int            ok;
+
+    if (!f) return -1;
+
+    ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+         fwrite(node, sizeof(MM_FILE_NODE), node_count, f) == node_count &&
+         fwrite(edge, sizeof(MM_FILE_EDGE), edge_count, f) == edge_count;
+
+    return (fclose(f) == 0 && ok) ? 0 : -1;
+}
+
+void mm_graph_free(MM_GRAPH *g)
+{
+    free(g->x);
+    free(g->y);
+    free(g->edge);
+    free(g->adj_start);
+    free(g->adj);
+    free(g->cell_start);
+    free(g->cell_edge);
+    memset(g, 0, sizeof(MM_GRAPH));
+}
+
+
+/*************************************** Route Search ***************************************/
+
+#define TABLE_SIZE      (MM_SEARCH_NODES * 2)
+
+static void search_reset(MM_MATCHER *m)
+{
+    if (++m->stamp == 0)
+    {
+        memset(m->key_stamp, 0, sizeof(m->key_stamp));
+        m->stamp = 1;
+    }
+    m->heap_len = 0;
+}
+
+/* slot of a node in the distance table, -1 if the table is full */
+static int search_slot(MM_MATCHER *m, uint32_t node, int insert)
+{
+    uint32_t h = (node * 2654435761u) & (TABLE_SIZE - 1);
+
+    for (int probe = 0; probe < TABLE_SIZE; probe++, h = (h + 1) & (TABLE_SIZE - 1))
+    {
+        if (m->key_stamp[h] != m->stamp)
+        {
+            if (!insert) return -1;
+            m->key_stamp[h] = m->stamp;
+            m->key[h]       = node;
+            m->dist[h]      = (float)1e30;
+            return (int)h;
+        }
+        if (m->key[h] == node) return (int)h;
+    }
+    return -1;
+}
+
+static float search_dist(MM_MATCHER *m, uint32_t node)
+{
+    int s = search_slot(m, node, 0);
+
+    return s < 0 ? (float)1e30 : m->dist[s];
+}
+
+static void heap_push(MM_MATCHER *m, float d, uint32_t node)
+{
+    int i = m->heap_len;
+
+    if (i == MM_SEARCH_NODES) return;           // bounded: the far part of the search is dropped
+    m->heap_len++;
+
+    while (i > 0 && m->heap[(i - 1) / 2].d > d)
+    {
+        m->heap[i] = m->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    m->heap[i].d    = d;
+    m->heap[i].node = node;
+}
+
+static void heap_pop(MM_MATCHER *m)
+{
+    int n = --m->heap_len, i = 0;
+
+    while (2 * i + 1 < n)
+    {
+        int c = 2 * i + 1;
+
+        if (c + 1 < n && m->heap[c + 1].d < m->heap[c].d) c++;
+        if (m->heap[n].d <= m->heap[c].d) break;
+        m->heap[i] = m->heap[c];
+        i = c;
+    }
+    m->heap[i] = m->heap[n];
+}
+
+static void relax(MM_MATCHER *m, uint32_t node, float d)
+{
+    int s = search_slot(m, node, 1);
+
+    if (s >= 0 && d < m->dist[s])
+    {
+        m->dist[s] = d;
+        heap_push(m, d, node);
+    }
+}
+
+/* distances from a road position to every node within limit metres */
+static void search_from(MM_MATCHER *m, const MM_CAND *a, float limit)
+{
+    const MM_GRAPH *g = m->graph;
+    const MM_EDGE  *e = &g->edge[a->edge];
+
+    search_reset(m);
+    relax(m, e->to, (1 - a->t) * e->length);
+    if (!(e->flags & MM_EDGE_ONEWAY)) relax(m, e->from, a->t * e->length);
+
+    while (m->heap_len > 0)
+    {
+        float    d    = m->heap[0].d;
+        uint32_t node = m->heap[0].node;
+
+        heap_pop(m);
+        if (d > limit) break;
+        if (d > search_dist(m, node)) continue;         // stale entry
+
+        for (uint32_t k = g->adj_start[node]; k < g->adj_start[node + 1]; k++)
+        {
+            relax(m, g->adj[k].node, d + g->adj[k].length);
+        }
+    }
+}
+
+/* route length a -> b after search_from(a), 1e30 if not reachable */
+static float route_to(MM_MATCHER *m, const MM_CAND *a, const MM_CAND *b)
+{
+    const MM_EDGE *e = &m->graph->edge[b->edge];
+    float         r  = (float)1e30, v;
+
+    if (a->edge == b->edge)
+    {
+        if (!(e->flags & MM_EDGE_ONEWAY))     return fabsf(b->t - a->t) * e->length;
+        if (b->t >= a->t)                     return (b->t - a->t) * e->length;
+    }
+
+    v = search_dist(m, e->from) + b->t * e->length;
+    if (v < r) r = v;
+    if (!(e->flags & MM_EDGE_ONEWAY))
+    {
+        v = search_dist(m, e->to) + (1 - b->t) * e->length;
+        if (v < r) r = v;
+    }
+    return r;
+}
+
+
+/*************************************** Matching ***************************************/
+
+/* the max road positions closest to (x, y) within radius, nearest first */
+static int find_candidates(const MM_GRAPH *g, double x, double y, double radius, MM_CAND *out, int max)
+{
+    uint32_t c0, c1, r0, r1;
+    int      n = 0;
+
+    graph_cells(g, x - radius, y - radius, x + radius, y + radius, &c0, &c1, &r0, &r1);
+
+    for (uint32_t r = r0; r <= r1; r++)
+    {
+        for (uint32_t c = c0; c <= c1; c++)
+        {
+            size_t cell = (size_t)r * g->cols + c;
+
+            for (uint32_t k = g->cell_start[cell]; k < g->cell_start[cell + 1]; k++)
+            {
+                uint32_t      id = g->cell_edge[k];
+                const MM_EDGE *e = &g->edge[id];
+                int           dup = 0;
+
+                for (int i = 0; i < n && !dup; i++) dup = (out[i].edge == id);
+                if (dup) continue;
+
+                double ax = g->x[e->from], ay = g->y[e->from];
+                double vx = g->x[e->to] - ax, vy = g->y[e->to] - ay;
+                double l2 = vx * vx + vy * vy;
+                double t  = l2 > 0 ? ((x - ax) * vx + (y - ay) * vy) / l2 : 0;
+
+                if (t < 0) t = 0;
+                if (t > 1) t = 1;
+
+                double px = ax + t * vx, py = ay + t * vy;
+                double d  = sqrt((x - px) * (x - px) + (y - py) * (y - py));
+
+                if (d > radius || (n == max && d >= out[n - 1].dist)) continue;
+
+                // insertion into the sorted list
+                int i = (n < max) ? n++ : n - 1;
+                while (i > 0 && out[i - 1].dist > d)
+                {
+                    out[i] = out[i - 1];
+                    i--;
+                }
+                out[i] = (MM_CAND){ id, (float)t, (float)px, (float)py, (float)d };
+            }
+        }
+    }
+    return n;
+}
+
+static double emission(const MM_MATCHER *m, const MM_CAND *c, const GPSSTRUCT *fix)
+{
+    const GGASTRUCT *gga   = &fix->ggastruct;
+    const RMCSTRUCT *rmc   = &fix->rmcstruct;
+    double          sigma  = m->sigma;
+    double          z, le;
+
+    if ((gga->present & GPS_HAS_HDOP) && gga->hdop > 100) sigma *= gga->hdop / 100.0;
+
+    z  = c->dist / sigma;
+    le = -0.5 * z * z;
+
+    if ((rmc->present & (GPS_HAS_SPEED | GPS_HAS_COURSE)) == (GPS_HAS_SPEED | GPS_HAS_COURSE) &&
+        rmc->speed_knots > m->heading_knots)
+    {
+        const MM_EDGE *e    = &m->graph->edge[c->edge];
+        double        diff  = fabs(fmod(rmc->course / 100.0 - e->bearing + 540.0, 360.0) - 180.0);
+
+        if (!(e->flags & MM_EDGE_ONEWAY) && diff > 90) diff = 180 - diff;    // driven the other way
+        z   = diff / m->heading_sigma;
+        le -= 0.5 * z * z;
+    }
+    return le;
+}
+
+static void fill_match(const MM_MATCHER *m, const MM_CAND *c, MM_MATCH *out)
+{
+    const MM_GRAPH *g = m->graph;
+    double         lat = g->lat0 + c->y / g->m_lat;
+    double         lon = g->lon0 + c->x / g->m_lon;
+
+    out->valid              = 1;
+    out->edge               = c->edge;
+    out->offset             = c->t * g->edge[c->edge].length;
+    out->dist               = c->dist;
+    out->location.latitude  = (int32_t)(lat >= 0 ? lat + 0.5 : lat - 0.5);
+    out->location.longitude = (int32_t)(lon >= 0 ? lon + 0.5 : lon - 0.5);
+    out->location.NS        = out->location.latitude < 0 ? 'S' : 'N';
+    out->location.EW        = out->location.longitude < 0 ? 'W' : 'E';
+    out->location.padding   = 0;
+}
+
+
+void mm_init(MM_MATCHER *m, const MM_GRAPH *g)
+{
+    memset(m, 0, sizeof(MM_MATCHER));
+
+    m->graph         = g;
+    m->sigma         = 5.0f;
+    m->beta          = 10.0f;
+    m->radius        = 50.0f;
+    m->heading_sigma = 45.0f;
+    m->heading_knots = 3000;
+}
+
+void mm_device_init(MM_DEVICE *d)
+{
+    memset(d, 0, sizeof(MM_DEVICE));
+}
+
+/**
+ * Matches one decoded fix of a device.
+ * @param now     Best road position for this fix (filtered, available at once).
+ * @param lagged  Smoothed position of the fix MM_WINDOW - 1 epochs ago, once the
+ *                window is full (may be NULL).
+ * @return        0 matched, -1 no valid fix or no road within the radius.
+ */
+int mm_update(MM_MATCHER *m, MM_DEVICE *d, const GPSSTRUCT *fix, MM_MATCH *now, MM_MATCH *lagged)
+{
+    const MM_GRAPH *g = m->graph;
+    MM_STEP        *prev = &d->step[d->head];
+    uint8_t        idx   = (uint8_t)((d->head + 1) % MM_WINDOW);
+    MM_STEP        *s    = &d->step[idx];
+    double         em[MM_MAX_CANDIDATES];
+    double         best = NEG_INF;
+    int            best_i = 0;
+
+    now->valid = 0;
+    if (lagged) lagged->valid = 0;
+
+    if ((fix->ggastruct.present & GPS_HAS_POSITION) != GPS_HAS_POSITION || !fix->ggastruct.is_fix_valid) return -1;
+
+    s->x     = (float)((fix->ggastruct.location.longitude - g->lon0) * g->m_lon);
+    s->y     = (float)((fix->ggastruct.location.latitude  - g->lat0) * g->m_lat);
+    s->count = (uint8_t)find_candidates(g, s->x, s->y, m->radius, s->cand, MM_MAX_CANDIDATES);
+
+    if (s->count == 0)
+    {
+        if (d->count) d->breaks++;
+        d->count = 0;
+        return -1;
+    }
+
+    for (int b = 0; b < s->count; b++)
+    {
+        em[b]       = emission(m, &s->cand[b], fix);
+        s->score[b] = NEG_INF;
+        s->back[b]  = 0;
+    }
+
+    if (d->count > 0)
+    {
+        float gc    = hypotf(s->x - prev->x, s->y - prev->y);
+        float limit = 2 * gc + 2 * m->radius;
+
+        for (int a = 0; a < prev->count; a++)
+        {
+            if (prev->score[a] <= NEG_INF) continue;
+            search_from(m, &prev->cand[a], limit);
+
+            for (int b = 0; b < s->count; b++)
+            {
+                float r = route_to(m, &prev->cand[a], &s->cand[b]);
+
+                if (r > limit) continue;
+
+                double v = prev->score[a] - fabsf(r - gc) / m->beta + em[b];
+                if (v > s->score[b])
+                {
+                    s->score[b] = v;
+                    s->back[b]  = (uint8_t)a;
+                }
+            }
+        }
+
+        for (int b = 0; b < s->count; b++) if (s->score[b] > best) best = s->score[b];
+        if (best <= NEG_INF)
+        {
+            d->breaks++;                                // no route between the fixes: new chain
+            d->count = 0;
+        }
+    }
+
+    if (d->count == 0)
+    {
+        for (int b = 0; b < s->count; b++) s->score[b] = em[b];
+    }
+
+    // normalise so the scores do not drift
+    best = NEG_INF;
+    for (int b = 0; b < s->count; b++)
+    {
+        if (s->score[b] > best)
+        {
+            best   = s->score[b];
+            best_i = b;
+        }
+    }
+    for (int b = 0; b < s->count; b++) if (s->score[b] > NEG_INF) s->score[b] -= best;
+
+    d->head = idx;
+    if (d->count < MM_WINDOW) d->count++;
+
+    fill_match(m, &s->cand[best_i], now);
+
+    if (lagged && d->count == MM_WINDOW)
+    {
+        int     c = best_i;
+        uint8_t k = idx;
+
+        for (int i = 1; i < MM_WINDOW; i++)
+        {
+            c = d->step[k].back[c];
+            k = (uint8_t)((k + MM_WINDOW - 1) % MM_WINDOW);
+        }
+        fill_match(m, &d->step[k].cand[c], lagged);
+    }
+
+    return 0;
+}
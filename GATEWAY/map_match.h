@@ -0,0 +1,155 @@
+/*
+ * map_match.h
+ *
+ * Streaming HMM map matching of decoded fixes onto a local road graph.
+ * The graph is loaded from a compact binary file and indexed by a uniform
+ * grid; each device keeps a short Viterbi window, so a matched position is
+ * available as soon as its fix is decoded and memory per device is fixed.
+ */
+
+#ifndef INC_MAP_MATCH_H_
+#define INC_MAP_MATCH_H_
+
+#include <stdint.h>
+#include "NMEA.h"
+
+#define MM_FILE_MAGIC           0x31524752u         // "RGR1"
+
+#define MM_MAX_CANDIDATES       8                   // road positions considered per fix
+#define MM_WINDOW               8                   // fixes kept per device (fixed lag)
+#define MM_SEARCH_NODES         4096                // route search bound (nodes touched)
+
+#define MM_EDGE_ONEWAY          0x01                // only from -> to
+
+/* binary file: MM_FILE_HEADER, node_count MM_FILE_NODE, edge_count MM_FILE_EDGE (little endian) */
+typedef struct
+{
+    uint32_t    magic;
+    uint32_t    node_count;
+    uint32_t    edge_count;
+    uint32_t    reserved;
+} MM_FILE_HEADER;
+
+typedef struct
+{
+    int32_t     latitude;                           // degrees * GPS_COORD_SCALE
+    int32_t     longitude;
+} MM_FILE_NODE;
+
+typedef struct
+{
+    uint32_t    from;
+    uint32_t    to;
+    uint32_t    flags;                              // MM_EDGE_*
+} MM_FILE_EDGE;
+
+// MM_EDGE: straight segment, curved roads are chains of edges
+typedef struct
+{
+    uint32_t    from;
+    uint32_t    to;
+    uint32_t    flags;
+    float       length;                             // m
+    float       bearing;                            // degrees from north, from -> to
+} MM_EDGE;
+
+typedef struct
+{
+    uint32_t    node;
+    uint32_t    edge;
+    float       length;
+} MM_ARC;
+
+typedef struct
+{
+    uint32_t    node_count;
+    uint32_t    edge_count;
+    double      *x, *y;                             // node positions, m on the local plane
+    MM_EDGE     *edge;
+
+    uint32_t    *adj_start;                         // node_count + 1, arcs leaving each node
+    MM_ARC      *adj;
+
+    /* uniform grid over the bounding box, edges listed in every cell they cross */
+    double      x0, y0;
+    double      cell;                               // cell size, m
+    uint32_t    cols, rows;
+    uint32_t    *cell_start;                        // cols * rows + 1
+    uint32_t    *cell_edge;
+
+    /* local plane: x = (lon - lon0) * m_lon, y = (lat - lat0) * m_lat */
+    int32_t     lat0, lon0;
+    double      m_lat, m_lon;                       // metres per µdeg
+} MM_GRAPH;
+
+// MM_CAND: one road position for a fix
+typedef struct
+{
+    uint32_t    edge;
+    float       t;                                  // 0..1 along the edge
+    float       x, y;
+    float       dist;                               // fix -> road, m
+} MM_CAND;
+
+typedef struct
+{
+    MM_CAND     cand[MM_MAX_CANDIDATES];
+    double      score[MM_MAX_CANDIDATES];            // best log probability of a path ending here
+    uint8_t     back[MM_MAX_CANDIDATES];            // candidate of the previous step on that path
+    uint8_t     count;
+    float       x, y;                               // the fix
+} MM_STEP;
+
+// MM_DEVICE: Viterbi window of one device, fixed size
+typedef struct
+{
+    MM_STEP     step[MM_WINDOW];
+    uint8_t     head;                               // newest step
+    uint8_t     count;                              // steps in the current chain
+    uint32_t    breaks;                             // chain restarts (no road / no route)
+} MM_DEVICE;
+
+// MM_MATCH: matched position
+typedef struct
+{
+    uint8_t     valid;
+    uint32_t    edge;
+    float       offset;                             // m from the edge's from node
+    float       dist;                               // fix -> road, m
+    LOCATION    location;
+} MM_MATCH;
+
+// MM_MATCHER: parameters + route search scratch, one per thread
+typedef struct
+{
+    const MM_GRAPH  *graph;
+
+    float       sigma;                              // GPS noise at HDOP 1, m
+    float       beta;                               // route / straight line mismatch scale, m
+    float       radius;                             // candidate search radius, m
+    float       heading_sigma;                      // degrees, used above heading_knots
+    int32_t     heading_knots;                      // speed_knots (x1000)
+
+    /* bounded Dijkstra */
+    uint32_t    stamp;
+    uint32_t    key[MM_SEARCH_NODES * 2];
+    uint32_t    key_stamp[MM_SEARCH_NODES * 2];
+    float       dist[MM_SEARCH_NODES * 2];
+    struct { float d; uint32_t node; } heap[MM_SEARCH_NODES];
+    int         heap_len;
+} MM_MATCHER;
+
+
+// Public function declarations
+int  mm_graph_build(MM_GRAPH *g, const MM_FILE_NODE *node, uint32_t node_count,
+                    const MM_FILE_EDGE *edge, uint32_t edge_count);
+int  mm_graph_load(MM_GRAPH *g, const char *path);
+int  mm_graph_save(const char *path, const MM_FILE_NODE *node, uint32_t node_count,
+                   const MM_FILE_EDGE *edge, uint32_t edge_count);
+void mm_graph_free(MM_GRAPH *g);
+
+void mm_init(MM_MATCHER *m, const MM_GRAPH *g);
+void mm_device_init(MM_DEVICE *d);
+int  mm_update(MM_MATCHER *m, MM_DEVICE *d, const GPSSTRUCT *fix, MM_MATCH *now, MM_MATCH *lagged);
+
+#endif /* INC_MAP_MATCH_H_ */
@@ -0,0 +1,902 @@
+/*
+ * nmea_archive.c - Field aware lossless codec for raw NMEA logs.
+ *
+ * Every line is described by a few symbols, coded with an adaptive binary
+ * range coder whose contexts are (sentence type, field number):
+ *
+ *   kind      literal line, '$' sentence or '!' sentence
+ *   ending    "\r\n", "\n" or none (last line of the input)
+ *   checksum  regenerated upper case, lower case, or stored
+ *   type      id of a sentence type seen before in the block, or a new name
+ *   fields    field count (flag if it equals the previous sentence of the type)
+ *   op        per field, against the same field of the previous sentence of
+ *             the same type (and page: GSV 2 of 3 against the last GSV 2):
+ *               SAME     identical bytes
+ *               DELTA    number with the same shape, zigzag difference
+ *               NUMBER   number with a new shape: shape + value
+ *               LITERAL  length + bytes
+ *
+ * A field that keeps its op and residual from sentence to sentence (a
+ * constant time step, a fixed unit, a slowly moving coordinate) costs a
+ * fraction of a bit. Literal lines keep anything that is not a well formed
+ * sentence, so the original bytes always come back exactly.
+ */
+
+#include "nmea_archive.h"
+#include "NMEA.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define KIND_LITERAL    0
+#define KIND_DOLLAR     1
+#define KIND_BANG       2
+
+#define END_CRLF        0
+#define END_LF          1
+#define END_NONE        2
+
+#define CS_UPPER        0
+#define CS_LOWER        1
+#define CS_STORED       2
+
+#define OP_SAME         0
+#define OP_DELTA        1
+#define OP_NUMBER       2
+#define OP_LITERAL      3
+
+#define SHAPE_NONE      0xFF                    // field is not a number
+#define BODY_MAX        (NMEAZ_LINE_MAX - 2)    // longest body (between '$' and '*'), both directions
+
+#define PROB_BITS       18                      // hashed context table: 2^18 probabilities
+#define PROB_INIT       1024                    // p(0) = 0.5 with 11-bit probabilities
+#define PROB_SHIFT      4                       // adaptation speed
+
+// context families, combined with the type / field they apply to
+enum
+{
+    CTX_KIND = 1, CTX_END, CTX_CS, CTX_NEWTYPE, CTX_TYPEID, CTX_SAMECOUNT, CTX_COUNT,
+    CTX_OP, CTX_DELTA, CTX_NUMBER, CTX_SHAPE, CTX_LITLEN, CTX_LITBYTE, CTX_RAWCS, CTX_TYPELEN
+};
+
+// previous sentence of one type, kept identically by encoder and decoder
+typedef struct
+{
+    char        body[NMEAZ_LINE_MAX];           // fields joined by ',' (type name first)
+    uint8_t     nfields;
+    uint8_t     off[NMEA_MAX_FIELDS];
+    uint8_t     len[NMEA_MAX_FIELDS];
+    uint8_t     shape[NMEA_MAX_FIELDS];
+    uint64_t    value[NMEA_MAX_FIELDS];
+} NMEAZ_TYPE;
+
+// range coder + models, one per block
+typedef struct
+{
+    int             decoding;
+
+    /* encoder */
+    uint8_t         *out;
+    size_t          pos;
+    size_t          cap;
+    uint64_t        low;
+    uint8_t         cache;
+    uint64_t        cache_size;
+
+    /* decoder */
+    const uint8_t   *in;
+    const uint8_t   *end;
+    uint32_t        code;
+
+    uint32_t        range;
+    uint16_t        prob[1u << PROB_BITS];
+
+    /* sentence state */
+    NMEAZ_TYPE      type[NMEAZ_MAX_TYPES];
+    int             ntypes;
+    uint32_t        prev_type;
+} NMEAZ_CODER;
+
+static const uint64_t pow10_table[20] =
+{
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+
+/*************************************** Utility Functions ***************************************/
+
+static uint32_t fnv1a(const char *p, size_t n)
+{
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        h ^= (uint8_t)p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int hexval(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static uint32_t ctx_hash(uint32_t a, uint32_t b)
+{
+    uint32_t h = (a ^ 0x9E3779B9u) * 0x85EBCA6Bu;
+
+    h ^= b * 0xC2B2AE35u;
+    h ^= h >> 15;
+    h *= 0x27D4EB2Fu;
+    return h ^ (h >> 13);
+}
+
+static uint32_t ctx_of(uint32_t family, uint32_t type, uint32_t field)
+{
+    return ctx_hash(family, (type << 8) | field);
+}
+
+
+/*************************************** Range Coder ***************************************/
+
+static void coder_init(NMEAZ_CODER *c)
+{
+    for (size_t i = 0; i < (1u << PROB_BITS); i++) c->prob[i] = PROB_INIT;
+
+    c->range      = 0xFFFFFFFFu;
+    c->cache_size = 1;
+    c->prev_type  = 0xFF;
+
+    if (c->decoding)
+    {
+        for (int i = 0; i < 5; i++) c->code = (c->code << 8) | (c->in < c->end ? *c->in++ : 0);
+    }
+}
+
+static void shift_low(NMEAZ_CODER *c)
+{
+    if ((uint32_t)c->low < 0xFF000000u || (c->low >> 32) != 0)
+    {
+        uint8_t carry = (uint8_t)(c->low >> 32);
+        uint8_t temp  = c->cache;
+
+        do
+        {
+            if (c->pos < c->cap) c->out[c->pos] = (uint8_t)(temp + carry);
+            c->pos++;
+            temp = 0xFF;
+        } while (--c->cache_size != 0);
+
+        c->cache = (uint8_t)(c->low >> 24);
+    }
+    c->cache_size++;
+    c->low = (c->low & 0x00FFFFFFu) << 8;
+}
+
+static void coder_flush(NMEAZ_CODER *c)
+{
+    for (int i = 0; i < 5; i++) shift_low(c);
+}
+
+/* codes one bit under the given context: encodes `bit`, or returns the decoded one */
+static int code_bit(NMEAZ_CODER *c, uint32_t ctx, int bit)
+{
+    uint16_t *p     = &c->prob[ctx >> (32 - PROB_BITS)];
+    uint32_t bound  = (c->range >> 11) * *p;
+
+    if (c->decoding) bit = c->code >= bound;
+
+    if (!bit)
+    {
+        c->range = bound;
+        *p += (uint16_t)((2048 - *p) >> PROB_SHIFT);
+    }
+    else
+    {
+        if (c->decoding) c->code -= bound;
+        else c->low += bound;
+        c->range -= bound;
+        *p -= (uint16_t)(*p >> PROB_SHIFT);
+    }
+
+    while (c->range < (1u << 24))
+    {
+        c->range <<= 8;
+        if (c->decoding) c->code = (c->code << 8) | (c->in < c->end ? *c->in++ : 0);
+        else shift_low(c);
+    }
+    return bit;
+}
+
+/* nbits wide symbol, MSB first, each bit under its own tree node */
+static uint32_t code_tree(NMEAZ_CODER *c, uint32_t ctx, int nbits, uint32_t v)
+{
+    uint32_t node = 1;
+
+    for (int i = nbits - 1; i >= 0; i--)
+    {
+        node = (node << 1) | (uint32_t)code_bit(c, ctx_hash(ctx, node), (int)((v >> i) & 1));
+    }
+    return node - (1u << nbits);
+}
+
+/* unsigned integer: bit length, then the bits below the leading one */
+static uint64_t code_uint(NMEAZ_CODER *c, uint32_t ctx, uint64_t v)
+{
+    uint32_t n = 0;
+    uint64_t r;
+
+    while (n < 64 && (v >> n)) n++;
+    n = code_tree(c, ctx, 7, n);
+    if (n > 64) n = 64;                         // only corrupt input gets here
+    if (n == 0) return 0;
+
+    r = 1;
+    for (int i = (int)n - 2; i >= 0; i--)
+    {
+        r = (r << 1) | (uint64_t)code_bit(c, ctx_hash(ctx, (n << 8) | (uint32_t)i), (int)((v >> i) & 1));
+    }
+    return r;
+}
+
+/* bytes under an order-1 context */
+static void code_bytes(NMEAZ_CODER *c, uint32_t ctx, char *p, int n)
+{
+    uint32_t prev = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        p[i] = (char)code_tree(c, ctx_hash(ctx, prev), 8, (uint8_t)p[i]);
+        prev = (uint8_t)p[i];
+    }
+}
+
+
+/*************************************** Field Model ***************************************/
+
+/*
+ * parse_number - [-]digits[.digits] -> shape byte + integer value.
+ * shape: bit 7 sign, bits 3-6 integer digits, bits 0-2 0 = no '.', k = '.' + k-1 digits
+ *
+ */
+static uint8_t parse_number(const char *p, int len, uint64_t *value)
+{
+    int      i = 0, intd = 0, fracd = 0, dot = 0, sign = 0;
+    uint64_t v = 0;
+
+    if (len > 0 && p[0] == '-')
+    {
+        sign = 1;
+        i    = 1;
+    }
+    for (; i < len && p[i] >= '0' && p[i] <= '9'; i++, intd++) v = v * 10 + (uint64_t)(p[i] - '0');
+    if (i < len && p[i] == '.')
+    {
+        dot = 1;
+        for (i++; i < len && p[i] >= '0' && p[i] <= '9'; i++, fracd++) v = v * 10 + (uint64_t)(p[i] - '0');
+    }
+
+    if (i != len || intd + fracd == 0 || intd > 15 || fracd > 6 || intd + fracd > 19) return SHAPE_NONE;
+
+    *value = v;
+    return (uint8_t)((sign << 7) | (intd << 3) | (dot ? fracd + 1 : 0));
+}
+
+/* prints a number back with exactly the digits of its shape */
+static int format_number(char *out, uint8_t shape, uint64_t v)
+{
+    int intd  = (shape >> 3) & 0x0F;
+    int fracd = (shape & 0x07) ? (shape & 0x07) - 1 : 0;
+    int n     = 0;
+
+    if (shape == SHAPE_NONE || intd + fracd == 0 || intd + fracd > 19 || v >= pow10_table[intd + fracd]) return -1;
+
+    if (shape & 0x80) out[n++] = '-';
+    for (int d = intd + fracd - 1; d >= fracd; d--) out[n++] = (char)('0' + (v / pow10_table[d]) % 10);
+    if (shape & 0x07)
+    {
+        out[n++] = '.';
+        for (int d = fracd - 1; d >= 0; d--) out[n++] = (char)('0' + (v / pow10_table[d]) % 10);
+    }
+    return n;
+}
+
+
+/* keeps a sentence body as the prediction for the next one of its type */
+static void remember(NMEAZ_TYPE *t, const char *body, int body_len)
+{
+    NMEA_FIELD field[NMEA_MAX_FIELDS];
+
+    memmove(t->body, body, (size_t)body_len);
+    t->body[body_len] = '\0';
+    t->nfields = (uint8_t)nmea_tokenize(t->body, field, NMEA_MAX_FIELDS);
+
+    for (int i = 0; i < t->nfields; i++)
+    {
+        t->off[i]   = (uint8_t)(field[i].ptr - t->body);
+        t->len[i]   = field[i].len;
+        t->shape[i] = parse_number(field[i].ptr, field[i].len, &t->value[i]);
+    }
+}
+
+/* a 1 or 2 digit field, -1 if it is not one */
+static int small_number(const NMEA_FIELD *f)
+{
+    int v = 0;
+
+    if (f->len < 1 || f->len > 2) return -1;
+    for (int i = 0; i < f->len; i++)
+    {
+        if (f->ptr[i] < '0' || f->ptr[i] > '9') return -1;
+        v = v * 10 + (f->ptr[i] - '0');
+    }
+    return v;
+}
+
+/*
+ * find_type - The type a sentence is predicted from.
+ * Messages sent as several sentences ("total,number" in fields 1 and 2:
+ * GSV, TXT, multi-sentence AIS) get a type per sentence number, so page 2
+ * is predicted from the last page 2 and not from page 1. With the table
+ * full, another page of the same name is still better than a literal line.
+ * @return  type id, -1 for a new type (or a literal line when the table is full).
+ *
+ */
+static int find_type(NMEAZ_CODER *c, const NMEA_FIELD *field, int nfields)
+{
+    int total  = nfields > 2 ? small_number(&field[1]) : -1;
+    int number = nfields > 2 ? small_number(&field[2]) : -1;
+    int paged  = number >= 1 && number <= total;
+    int other  = -1;
+
+    for (int i = 0; i < c->ntypes; i++)
+    {
+        const NMEAZ_TYPE *t = &c->type[i];
+
+        if (t->len[0] != field[0].len || memcmp(t->body, field[0].ptr, field[0].len)) continue;
+        if (!paged || (t->nfields > 2 && t->len[2] == field[2].len && !memcmp(t->body + t->off[2], field[2].ptr, field[2].len)))
+        {
+            return i;
+        }
+        other = i;
+    }
+    return c->ntypes < NMEAZ_MAX_TYPES ? -1 : other;
+}
+
+
+/*
+ * sentence_layout - Checks that a line is a sentence the codec can rebuild byte for byte.
+ * @return  body length (between the start char and '*'), -1 if the line must stay literal.
+ *
+ */
+static int sentence_layout(const char *line, int len, NMEA_FIELD *field, int *nfields, int *ending)
+{
+    if (len < 4 || len > NMEAZ_LINE_MAX || (line[0] != '$' && line[0] != '!')) return -1;
+    if (line[1] == '$' || line[1] == '!') return -1;
+
+    int n    = nmea_tokenize(line, field, NMEA_MAX_FIELDS);
+    int body = n - 1;
+
+    for (int i = 0; i < n; i++) body += field[i].len;
+
+    // the tokenizer stopped at the '*' (and not at a CR, a NUL or the field limit)
+    if (n >= NMEA_MAX_FIELDS || body > BODY_MAX || line[1 + body] != '*') return -1;
+
+    int rest = len - (body + 2);                // after '*'
+    const char *p = line + body + 2;
+
+    if (rest < 2 || hexval(p[0]) < 0 || hexval(p[1]) < 0) return -1;
+    if      (rest == 2)                                 *ending = END_NONE;
+    else if (rest == 3 && p[2] == '\n')                 *ending = END_LF;
+    else if (rest == 4 && p[2] == '\r' && p[3] == '\n') *ending = END_CRLF;
+    else return -1;
+
+    *nfields = n;
+    return body;
+}
+
+
+/*************************************** Block Coding ***************************************/
+
+/* the symbols common to both directions, in coding order */
+static int code_kind(NMEAZ_CODER *c, int kind)
+{
+    return (int)code_tree(c, ctx_of(CTX_KIND, c->prev_type, 0), 2, (uint32_t)kind);
+}
+
+static void encode_line(NMEAZ_CODER *c, const char *line, int len)
+{
+    NMEA_FIELD field[NMEA_MAX_FIELDS];
+    char       copy[NMEAZ_LINE_MAX + 1];
+    int        nfields = 0, ending = 0, id = -1;
+    int        body = -1;
+
+    // the tokenizer needs a terminated string, the block is not one
+    if (len <= NMEAZ_LINE_MAX)
+    {
+        memcpy(copy, line, (size_t)len);
+        copy[len] = '\0';
+        body = sentence_layout(copy, len, field, &nfields, &ending);
+    }
+    if (body >= 0)
+    {
+        id = find_type(c, field, nfields);
+        if (id < 0 && c->ntypes == NMEAZ_MAX_TYPES) body = -1;
+    }
+
+    if (body < 0)
+    {
+        code_kind(c, KIND_LITERAL);
+        code_uint(c, ctx_of(CTX_LITLEN, 0, 0), (uint64_t)len);
+        code_bytes(c, ctx_of(CTX_LITBYTE, 0, 0), (char *)line, len);
+        return;
+    }
+
+    const char *cs  = copy + body + 2;
+    uint8_t     sum = 0;
+    int         mode;
+
+    for (int i = 1; i <= body; i++) sum ^= (uint8_t)copy[i];
+
+    if      (cs[0] == "0123456789ABCDEF"[sum >> 4] && cs[1] == "0123456789ABCDEF"[sum & 15]) mode = CS_UPPER;
+    else if (cs[0] == "0123456789abcdef"[sum >> 4] && cs[1] == "0123456789abcdef"[sum & 15]) mode = CS_LOWER;
+    else mode = CS_STORED;
+
+    code_kind(c, copy[0] == '$' ? KIND_DOLLAR : KIND_BANG);
+    code_tree(c, ctx_of(CTX_END, c->prev_type, 0), 2, (uint32_t)ending);
+    code_tree(c, ctx_of(CTX_CS, c->prev_type, 0), 2, (uint32_t)mode);
+
+    if (!code_bit(c, ctx_of(CTX_NEWTYPE, c->prev_type, 0), id < 0))
+    {
+        code_tree(c, ctx_of(CTX_TYPEID, c->prev_type, 0), 5, (uint32_t)id);
+    }
+    else
+    {
+        // a new type: everything is literal against an empty previous sentence
+        id = c->ntypes++;
+        memset(&c->type[id], 0, sizeof(NMEAZ_TYPE));
+        code_uint(c, ctx_of(CTX_TYPELEN, 0, 0), field[0].len);
+        code_bytes(c, ctx_of(CTX_LITBYTE, 0, 0), (char *)field[0].ptr, field[0].len);
+    }
+
+    NMEAZ_TYPE *t = &c->type[id];
+    uint32_t    T = (uint32_t)id;
+
+    if (!code_bit(c, ctx_of(CTX_SAMECOUNT, T, 0), t->nfields == nfields))
+    {
+        code_tree(c, ctx_of(CTX_COUNT, T, 0), 5, (uint32_t)nfields);
+    }
+
+    for (int i = 1; i < nfields; i++)
+    {
+        uint64_t value;
+        uint8_t  shape = parse_number(field[i].ptr, field[i].len, &value);
+        int      op;
+
+        if (i < t->nfields && t->len[i] == field[i].len && !memcmp(t->body + t->off[i], field[i].ptr, field[i].len))
+            op = OP_SAME;
+        else if (shape != SHAPE_NONE && i < t->nfields && t->shape[i] == shape)
+            op = OP_DELTA;
+        else if (shape != SHAPE_NONE)
+            op = OP_NUMBER;
+        else
+            op = OP_LITERAL;
+
+        code_tree(c, ctx_of(CTX_OP, T, (uint32_t)i), 2, (uint32_t)op);
+
+        switch (op)
+        {
+            case OP_DELTA:
+                {
+                    int64_t d = (int64_t)(value - t->value[i]);
+                    code_uint(c, ctx_of(CTX_DELTA, T, (uint32_t)i), ((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+                    break;
+                }
+            case OP_NUMBER:
+                code_tree(c, ctx_of(CTX_SHAPE, T, (uint32_t)i), 8, shape);
+                code_uint(c, ctx_of(CTX_NUMBER, T, (uint32_t)i), value);
+                break;
+            case OP_LITERAL:
+                code_uint(c, ctx_of(CTX_LITLEN, T, (uint32_t)i), field[i].len);
+                code_bytes(c, ctx_of(CTX_LITBYTE, T, (uint32_t)i), (char *)field[i].ptr, field[i].len);
+                break;
+        }
+    }
+
+    if (mode == CS_STORED) code_tree(c, ctx_of(CTX_RAWCS, 0, 0), 16, (uint32_t)(((uint8_t)cs[0] << 8) | (uint8_t)cs[1]));
+
+    remember(t, copy + 1, body);
+    c->prev_type = T;
+}
+
+
+static int decode_line(NMEAZ_CODER *c, char *out, size_t room)
+{
+    int kind = code_kind(c, 0);
+
+    if (kind == KIND_LITERAL)
+    {
+        uint64_t len = code_uint(c, ctx_of(CTX_LITLEN, 0, 0), 0);
+
+        if (len > room) return -1;
+        code_bytes(c, ctx_of(CTX_LITBYTE, 0, 0), out, (int)len);
+        return (int)len;
+    }
+    if (kind != KIND_DOLLAR && kind != KIND_BANG) return -1;
+
+    int ending = (int)code_tree(c, ctx_of(CTX_END, c->prev_type, 0), 2, 0);
+    int mode   = (int)code_tree(c, ctx_of(CTX_CS, c->prev_type, 0), 2, 0);
+    int id;
+
+    char body[BODY_MAX + 32];                   // room for one number past the limit
+    int  n;
+
+    if (ending > END_NONE || mode > CS_STORED) return -1;
+
+    if (!code_bit(c, ctx_of(CTX_NEWTYPE, c->prev_type, 0), 0))
+    {
+        id = (int)code_tree(c, ctx_of(CTX_TYPEID, c->prev_type, 0), 5, 0);
+        if (id >= c->ntypes) return -1;
+        n = c->type[id].len[0];
+        memcpy(body, c->type[id].body, (size_t)n);
+    }
+    else
+    {
+        uint64_t len = code_uint(c, ctx_of(CTX_TYPELEN, 0, 0), 0);
+
+        if (c->ntypes == NMEAZ_MAX_TYPES || len > BODY_MAX) return -1;
+        id = c->ntypes++;
+        memset(&c->type[id], 0, sizeof(NMEAZ_TYPE));
+        n = (int)len;
+        code_bytes(c, ctx_of(CTX_LITBYTE, 0, 0), body, n);
+    }
+
+    NMEAZ_TYPE *t = &c->type[id];
+    uint32_t    T = (uint32_t)id;
+    int         nfields = t->nfields;
+
+    if (!code_bit(c, ctx_of(CTX_SAMECOUNT, T, 0), 0))
+    {
+        nfields = (int)code_tree(c, ctx_of(CTX_COUNT, T, 0), 5, 0);
+    }
+    if (nfields < 1 || nfields >= NMEA_MAX_FIELDS) return -1;
+
+    for (int i = 1; i < nfields; i++)
+    {
+        int op = (int)code_tree(c, ctx_of(CTX_OP, T, (uint32_t)i), 2, 0);
+        int k;
+
+        if (n >= BODY_MAX) return -1;
+        body[n++] = ',';
+
+        switch (op)
+        {
+            case OP_SAME:
+                if (i >= t->nfields || n + t->len[i] > BODY_MAX) return -1;
+                memcpy(body + n, t->body + t->off[i], t->len[i]);
+                n += t->len[i];
+                break;
+            case OP_DELTA:
+                {
+                    uint64_t z = code_uint(c, ctx_of(CTX_DELTA, T, (uint32_t)i), 0);
+                    uint64_t d = (z >> 1) ^ (uint64_t)-(int64_t)(z & 1);
+
+                    if (i >= t->nfields || (k = format_number(body + n, t->shape[i], t->value[i] + d)) < 0) return -1;
+                    n += k;
+                    break;
+                }
+            case OP_NUMBER:
+                {
+                    uint8_t  shape = (uint8_t)code_tree(c, ctx_of(CTX_SHAPE, T, (uint32_t)i), 8, 0);
+                    uint64_t value = code_uint(c, ctx_of(CTX_NUMBER, T, (uint32_t)i), 0);
+
+                    if ((k = format_number(body + n, shape, value)) < 0) return -1;
+                    n += k;
+                    break;
+                }
+            case OP_LITERAL:
+                {
+                    uint64_t len = code_uint(c, ctx_of(CTX_LITLEN, T, (uint32_t)i), 0);
+
+                    if (n + (int64_t)len > BODY_MAX) return -1;
+                    code_bytes(c, ctx_of(CTX_LITBYTE, T, (uint32_t)i), body + n, (int)len);
+                    n += (int)len;
+                    break;
+                }
+        }
+    }
+    if (n > BODY_MAX) return -1;
+
+    size_t need = (size_t)n + 4 + (ending == END_CRLF ? 2 : ending == END_LF ? 1 : 0);
+    if (need > room) return -1;
+
+    char *q = out;
+    *q++ = (kind == KIND_DOLLAR) ? '$' : '!';
+    memcpy(q, body, (size_t)n);
+    q += n;
+    *q++ = '*';
+
+    if (mode == CS_STORED)
+    {
+        uint32_t raw = code_tree(c, ctx_of(CTX_RAWCS, 0, 0), 16, 0);
+        *q++ = (char)(raw >> 8);
+        *q++ = (char)raw;
+    }
+    else
+    {
+        const char *digits = (mode == CS_LOWER) ? "0123456789abcdef" : "0123456789ABCDEF";
+        uint8_t     sum    = 0;
+
+        for (int i = 0; i < n; i++) sum ^= (uint8_t)body[i];
+        *q++ = digits[sum >> 4];
+        *q++ = digits[sum & 15];
+    }
+    if (ending == END_CRLF) *q++ = '\r';
+    if (ending != END_NONE) *q++ = '\n';
+
+    remember(t, body, n);
+    c->prev_type = T;
+
+    return (int)(q - out);
+}
+
+
+long nmeaz_compress_block(const char *raw, size_t len, uint8_t *out, size_t out_cap)
+{
+    NMEAZ_CODER  *c = calloc(1, sizeof(NMEAZ_CODER));
+    NMEAZ_HEADER hdr;
+    size_t       pos = 0;
+    long         ret = -1;
+
+    if (!c || len > 0xFFFFFFFFu || out_cap < sizeof(NMEAZ_HEADER))
+    {
+        free(c);
+        return -1;
+    }
+
+    c->out = out + sizeof(NMEAZ_HEADER);
+    c->cap = out_cap - sizeof(NMEAZ_HEADER);
+    coder_init(c);
+
+    while (pos < len)
+    {
+        const char *nl  = memchr(raw + pos, '\n', len - pos);
+        size_t      end = nl ? (size_t)(nl - raw) + 1 : len;
+
+        encode_line(c, raw + pos, (int)(end - pos));
+        pos = end;
+    }
+    coder_flush(c);
+
+    hdr.raw_len  = (uint32_t)len;
+    hdr.checksum = fnv1a(raw, len);
+
+    if (c->pos < len && c->pos <= c->cap)
+    {
+        hdr.magic    = NMEAZ_MAGIC;
+        hdr.comp_len = (uint32_t)c->pos;
+        ret = (long)(sizeof(hdr) + c->pos);
+    }
+    else if (len <= out_cap - sizeof(hdr))
+    {
+        // incompressible (not NMEA at all): store the block as is
+        hdr.magic    = NMEAZ_MAGIC_STORED;
+        hdr.comp_len = (uint32_t)len;
+        memcpy(out + sizeof(hdr), raw, len);
+        ret = (long)(sizeof(hdr) + len);
+    }
+    if (ret > 0) memcpy(out, &hdr, sizeof(hdr));
+
+    free(c);
+    return ret;
+}
+
+
+long nmeaz_decompress_block(const uint8_t *in, size_t in_len, char *out, size_t out_cap)
+{
+    NMEAZ_HEADER hdr;
+
+    if (in_len < sizeof(hdr)) return -1;
+    memcpy(&hdr, in, sizeof(hdr));
+    if (hdr.comp_len > in_len - sizeof(hdr) || hdr.raw_len > out_cap) return -1;
+
+    if (hdr.magic == NMEAZ_MAGIC_STORED)
+    {
+        if (hdr.comp_len != hdr.raw_len) return -1;
+        memcpy(out, in + sizeof(hdr), hdr.raw_len);
+        return fnv1a(out, hdr.raw_len) == hdr.checksum ? (long)hdr.raw_len : -1;
+    }
+    if (hdr.magic != NMEAZ_MAGIC) return -1;
+
+    NMEAZ_CODER *c   = calloc(1, sizeof(NMEAZ_CODER));
+    size_t       pos = 0;
+
+    if (!c) return -1;
+
+    c->decoding = 1;
+    c->in       = in + sizeof(hdr);
+    c->end      = c->in + hdr.comp_len;
+    coder_init(c);
+
+    while (pos < hdr.raw_len)
+    {
+        int n = decode_line(c, out + pos, hdr.raw_len - pos);
+
+        if (n <= 0) break;
+        pos += (size_t)n;
+    }
+    free(c);
+
+    if (pos != hdr.raw_len || fnv1a(out, pos) != hdr.checksum) return -1;
+
+    return (long)pos;
+}
+
+
+size_t nmeaz_bound(size_t raw_len)
+{
+    // a block that does not shrink is stored
+    return sizeof(NMEAZ_HEADER) + raw_len;
+}
+
+
+/*************************************** File Level ***************************************/
+
+/**
+ * Compresses a log into independent blocks cut at line boundaries.
+ * @return  0 on success, -1 on error.
+ */
+int nmeaz_compress_file(FILE *in, FILE *out, size_t block_size)
+{
+    if (!block_size) block_size = NMEAZ_BLOCK_SIZE;
+
+    char    *raw  = malloc(block_size);
+    uint8_t *comp = malloc(nmeaz_bound(block_size));
+    size_t   have = 0;
+    int      ret  = 0;
+
+    if (!raw || !comp) ret = -1;
+
+    while (ret == 0)
+    {
+        have += fread(raw + have, 1, block_size - have, in);
+        if (have == 0) break;
+
+        // cut after the last complete line, unless the block holds no line end at all
+        size_t cut = have;
+        if (have == block_size)
+        {
+            while (cut > 0 && raw[cut - 1] != '\n') cut--;
+            if (cut == 0) cut = have;
+        }
+
+        long n = nmeaz_compress_block(raw, cut, comp, nmeaz_bound(block_size));
+        if (n < 0 || fwrite(comp, 1, (size_t)n, out) != (size_t)n) ret = -1;
+
+        memmove(raw, raw + cut, have - cut);
+        have -= cut;
+        if (have == 0 && feof(in)) break;
+    }
+
+    free(raw);
+    free(comp);
+    return ret;
+}
+
+
+// parallel decompression: one batch of blocks, workers take the next undone block
+typedef struct
+{
+    uint8_t         **comp;
+    char            **raw;
+    NMEAZ_HEADER    *hdr;
+    int             count;
+    int             next;
+    int             failed;
+    pthread_mutex_t lock;
+} NMEAZ_BATCH;
+
+static void *decompress_worker(void *arg)
+{
+    NMEAZ_BATCH *b = arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&b->lock);
+        int i = b->next++;
+        pthread_mutex_unlock(&b->lock);
+        if (i >= b->count) break;
+
+        if (nmeaz_decompress_block(b->comp[i], sizeof(NMEAZ_HEADER) + b->hdr[i].comp_len,
+                                   b->raw[i], b->hdr[i].raw_len) < 0)
+        {
+            b->failed = 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Decompresses a file with up to `threads` blocks decoded at the same time.
+ * Blocks are read and written in order, in batches of 4 blocks per thread.
+ * @return  0 on success, -1 on error or corrupt input.
+ */
+int nmeaz_decompress_file(FILE *in, FILE *out, int threads)
+{
+    if (threads < 1) threads = 1;
+
+    int          cap = threads * 4;
+    NMEAZ_BATCH  b;
+    pthread_t    *tid = calloc((size_t)threads, sizeof(pthread_t));
+    int          ret  = 0;
+
+    memset(&b, 0, sizeof(b));
+    b.comp = calloc((size_t)cap, sizeof(uint8_t *));
+    b.raw  = calloc((size_t)cap, sizeof(char *));
+    b.hdr  = calloc((size_t)cap, sizeof(NMEAZ_HEADER));
+    pthread_mutex_init(&b.lock, NULL);
+
+    if (!tid || !b.comp || !b.raw || !b.hdr) ret = -1;
+
+    while (ret == 0)
+    {
+        b.count  = 0;
+        b.next   = 0;
+        b.failed = 0;
+
+        while (b.count < cap)
+        {
+            NMEAZ_HEADER *h = &b.hdr[b.count];
+
+            if (fread(h, sizeof(NMEAZ_HEADER), 1, in) != 1) break;
+            if (h->magic != NMEAZ_MAGIC && h->magic != NMEAZ_MAGIC_STORED)
+            {
+                ret = -1;
+                break;
+            }
+
+            uint8_t *c = realloc(b.comp[b.count], sizeof(NMEAZ_HEADER) + h->comp_len);
+            char    *r = realloc(b.raw[b.count], h->raw_len ? h->raw_len : 1);
+            if (c) b.comp[b.count] = c;
+            if (r) b.raw[b.count]  = r;
+            if (!c || !r || fread(c + sizeof(NMEAZ_HEADER), 1, h->comp_len, in) != h->comp_len)
+            {
+                ret = -1;
+                break;
+            }
+            memcpy(c, h, sizeof(NMEAZ_HEADER));
+            b.count++;
+        }
+        if (ret || b.count == 0) break;
+
+        int nt = (threads < b.count) ? threads : b.count;
+        for (int t = 0; t < nt; t++) pthread_create(&tid[t], NULL, decompress_worker, &b);
+        for (int t = 0; t < nt; t++) pthread_join(tid[t], NULL);
+
+        if (b.failed) ret = -1;
+        for (int i = 0; i < b.count && ret == 0; i++)
+        {
+            if (fwrite(b.raw[i], 1, b.hdr[i].raw_len, out) != b.hdr[i].raw_len) ret = -1;
+        }
+    }
+
+    for (int i = 0; i < cap; i++)
+    {
+        if (b.comp) free(b.comp[i]);
+        if (b.raw)  free(b.raw[i]);
+    }
+    free(b.comp);
+    free(b.raw);
+    free(b.hdr);
+    free(tid);
+    pthread_mutex_destroy(&b.lock);
+
+    return ret;
+}
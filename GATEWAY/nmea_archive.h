@@ -0,0 +1,43 @@
+/*
+ * nmea_archive.h
+ *
+ * Lossless, NMEA aware compression of raw receiver logs.
+ * Sentences are split with nmea_tokenize, each field is predicted from the
+ * same field of the previous sentence of the same type and only the residual
+ * is stored. Checksums are regenerated on decode; anything that does not
+ * look like a well formed sentence is kept as a literal line, so the
+ * original bytes always come back exactly.
+ */
+
+#ifndef INC_NMEA_ARCHIVE_H_
+#define INC_NMEA_ARCHIVE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define NMEAZ_MAGIC         0x315A4D4Eu         // "NMZ1", range coded block
+#define NMEAZ_MAGIC_STORED  0x305A4D4Eu         // "NMZ0", block kept as is
+#define NMEAZ_BLOCK_SIZE    (1u << 20)          // raw bytes per block (default)
+#define NMEAZ_LINE_MAX      256                 // longer lines are stored as literals
+#define NMEAZ_MAX_TYPES     32                  // sentence types tracked per block
+
+// NMEAZ_HEADER: precedes every block, blocks are independent of each other
+typedef struct
+{
+    uint32_t    magic;
+    uint32_t    raw_len;                        // bytes after decompression
+    uint32_t    comp_len;                       // payload bytes following the header
+    uint32_t    checksum;                       // FNV-1a of the raw bytes
+} NMEAZ_HEADER;
+
+
+// Public function declarations
+size_t nmeaz_bound(size_t raw_len);
+long   nmeaz_compress_block(const char *raw, size_t len, uint8_t *out, size_t out_cap);
+long   nmeaz_decompress_block(const uint8_t *in, size_t in_len, char *out, size_t out_cap);
+
+int    nmeaz_compress_file(FILE *in, FILE *out, size_t block_size);
+int    nmeaz_decompress_file(FILE *in, FILE *out, int threads);
+
+#endif /* INC_NMEA_ARCHIVE_H_ */
@@ -0,0 +1,341 @@
+/*
+ * nmea_scan.c - Vectorised structural pass over raw NMEA logs.
+ * Stage 1 classifies the buffer 64 bytes at a time (AVX2, SSE2 or a scalar
+ * loop, picked at run time); stage 2 finds the sentences from the masks,
+ * jumping from one structural character to the next.
+ * Build with -DNMEA_SCAN_NO_SIMD to force the scalar classifier.
+ */
+
+#include "nmea_scan.h"
+#include <string.h>
+#include <pthread.h>
+
+#if !defined(NMEA_SCAN_NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define NMEA_SCAN_X86
+#include <immintrin.h>
+#endif
+
+#define WINDOW_BLOCKS   64                      // masks kept on the stack by nmea_index (4 KiB of input)
+#define NO_STAR         0xFFFFFFFFu
+
+
+/*************************************** Stage 1 ***************************************/
+
+static void classify_scalar(const uint8_t *p, size_t blocks, NMEA_SCAN_MASKS *m)
+{
+    for (size_t b = 0; b < blocks; b++, p += NMEA_SCAN_BLOCK, m++)
+    {
+        memset(m, 0, sizeof(*m));
+
+        for (int i = 0; i < NMEA_SCAN_BLOCK; i++)
+        {
+            uint64_t bit = 1ULL << i;
+            uint8_t  c   = p[i];
+
+            if      (c == '$' || c == '!')   m->start |= bit;
+            else if (c == ',')               m->comma |= bit;
+            else if (c == '*')               m->star  |= bit;
+            else if (c == '\r' || c == '\n') m->eol   |= bit;
+            else if (c < 0x20 || c >= 0x7F)  m->invalid |= bit;
+        }
+    }
+}
+
+#ifdef NMEA_SCAN_X86
+
+__attribute__((target("sse2")))
+static void classify_sse2(const uint8_t *p, size_t blocks, NMEA_SCAN_MASKS *m)
+{
+    const __m128i dollar = _mm_set1_epi8('$'), bang  = _mm_set1_epi8('!');
+    const __m128i comma  = _mm_set1_epi8(','), star  = _mm_set1_epi8('*');
+    const __m128i cr     = _mm_set1_epi8('\r'), lf   = _mm_set1_epi8('\n');
+    const __m128i space  = _mm_set1_epi8(0x20), del  = _mm_set1_epi8(0x7F);
+
+    for (size_t b = 0; b < blocks; b++, p += NMEA_SCAN_BLOCK, m++)
+    {
+        uint64_t s = 0, c = 0, a = 0, e = 0, x = 0;
+
+        for (int i = 0; i < NMEA_SCAN_BLOCK; i += 16)
+        {
+            __m128i  v   = _mm_loadu_si128((const __m128i *)(p + i));
+            __m128i  eol = _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf));
+            // signed compare: below 0x20 or 0x80..0xFF
+            __m128i  bad = _mm_andnot_si128(eol, _mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del)));
+
+            s |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, dollar), _mm_cmpeq_epi8(v, bang))) << i;
+            c |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, comma)) << i;
+            a |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, star)) << i;
+            e |= (uint64_t)(uint16_t)_mm_movemask_epi8(eol) << i;
+            x |= (uint64_t)(uint16_t)_mm_movemask_epi8(bad) << i;
+        }
+        m->start   = s;
+        m->comma   = c;
+        m->star    = a;
+        m->eol     = e;
+        m->invalid = x;
+    }
+}
+
+__attribute__((target("avx2")))
+static void classify_avx2(const uint8_t *p, size_t blocks, NMEA_SCAN_MASKS *m)
+{
+    const __m256i dollar = _mm256_set1_epi8('$'), bang  = _mm256_set1_epi8('!');
+    const __m256i comma  = _mm256_set1_epi8(','), star  = _mm256_set1_epi8('*');
+    const __m256i cr     = _mm256_set1_epi8('\r'), lf   = _mm256_set1_epi8('\n');
+    const __m256i space  = _mm256_set1_epi8(0x20), del  = _mm256_set1_epi8(0x7F);
+
+    for (size_t b = 0; b < blocks; b++, p += NMEA_SCAN_BLOCK, m++)
+    {
+        uint64_t s = 0, c = 0, a = 0, e = 0, x = 0;
+
+        for (int i = 0; i < NMEA_SCAN_BLOCK; i += 32)
+        {
+            __m256i  v   = _mm256_loadu_si256((const __m256i *)(p + i));
+            __m256i  eol = _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf));
+            // signed compare: below 0x20 or 0x80..0xFF
+            __m256i  bad = _mm256_andnot_si256(eol, _mm256_or_si256(_mm256_cmpgt_epi8(space, v), _mm256_cmpeq_epi8(v, del)));
+
+            s |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, dollar), _mm256_cmpeq_epi8(v, bang))) << i;
+            c |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, comma)) << i;
+            a |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, star)) << i;
+            e |= (uint64_t)(uint32_t)_mm256_movemask_epi8(eol) << i;
+            x |= (uint64_t)(uint32_t)_mm256_movemask_epi8(bad) << i;
+        }
+        m->start   = s;
+        m->comma   = c;
+        m->star    = a;
+        m->eol     = e;
+        m->invalid = x;
+    }
+}
+
+#endif /* NMEA_SCAN_X86 */
+
+typedef void (*classify_fn)(const uint8_t *p, size_t blocks, NMEA_SCAN_MASKS *m);
+
+static pthread_once_t scan_once = PTHREAD_ONCE_INIT;
+static int            scan_impl = NMEA_SCAN_SCALAR;
+static classify_fn    classify  = classify_scalar;
+
+/* runs once: the heatmap workers all scan from the start */
+static void pick_impl(void)
+{
+#ifdef NMEA_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        scan_impl = NMEA_SCAN_AVX2;
+        classify  = classify_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        scan_impl = NMEA_SCAN_SSE2;
+        classify  = classify_sse2;
+    }
+#endif
+}
+
+/**
+ * Picks the widest classifier the CPU supports (once, thread safe).
+ * @return  NMEA_SCAN_SCALAR, NMEA_SCAN_SSE2 or NMEA_SCAN_AVX2.
+ */
+int nmea_scan_impl(void)
+{
+    pthread_once(&scan_once, pick_impl);
+    return scan_impl;
+}
+
+/**
+ * Stage 1: classifies len bytes into (len + 63) / 64 mask blocks.
+ * Bits past the end of the buffer are zero.
+ */
+void nmea_scan(const char *buf, size_t len, NMEA_SCAN_MASKS *masks)
+{
+    const uint8_t *p    = (const uint8_t *)buf;
+    size_t         full = len / NMEA_SCAN_BLOCK;
+    size_t         rem  = len % NMEA_SCAN_BLOCK;
+
+    nmea_scan_impl();
+
+    classify(p, full, masks);
+
+    if (rem)
+    {
+        uint8_t  tail[NMEA_SCAN_BLOCK] = { 0 };
+        uint64_t keep = (1ULL << rem) - 1;
+
+        memcpy(tail, p + full * NMEA_SCAN_BLOCK, rem);
+        classify(tail, 1, &masks[full]);
+        masks[full].start   &= keep;
+        masks[full].comma   &= keep;
+        masks[full].star    &= keep;
+        masks[full].eol     &= keep;
+        masks[full].invalid &= keep;
+    }
+}
+
+
+/*************************************** Stage 2 ***************************************/
+
+// bits of one mask member set in [from, to), positions relative to the window
+#define RANGE_BITS(m, member, from, to, out)                                            \
+    do                                                                                  \
+    {                                                                                   \
+        size_t _f = (from), _t = (to);                                                  \
+        (out) = 0;                                                                      \
+        while (_f < _t)                                                                 \
+        {                                                                               \
+            size_t   _w   = _f / 64;                                                    \
+            size_t   _end = (_w + 1) * 64 < _t ? (_w + 1) * 64 : _t;                    \
+            uint64_t _bits = (m)[_w].member >> (_f % 64);                              \
+            if (_end - _f < 64) _bits &= (1ULL << (_end - _f)) - 1;                     \
+            (out) += (uint32_t)__builtin_popcountll(_bits);                             \
+            _f = _end;                                                                  \
+        }                                                                               \
+    } while (0)
+
+static int hexval(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static uint8_t xor_bytes(const char *p, size_t n)
+{
+    uint64_t acc = 0, w;
+    size_t   i   = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        memcpy(&w, p + i, 8);
+        acc ^= w;
+    }
+    acc ^= acc >> 32;
+    acc ^= acc >> 16;
+    acc ^= acc >> 8;
+
+    uint8_t sum = (uint8_t)acc;
+    for (; i < n; i++) sum ^= (uint8_t)p[i];
+    return sum;
+}
+
+/**
+ * Stage 2: finds the complete sentences of a buffer (up to 4 GiB).
+ * A sentence runs from '$' or '!' to the next CR/LF; a new '$' before the
+ * line end drops the unfinished one. Bytes outside sentences are skipped.
+ * @param spans      Output array.
+ * @param max_spans  Its size.
+ * @param consumed   Bytes fully handled; the rest (an unterminated sentence,
+ *                   or sentences that did not fit in spans) should be passed again.
+ * @return           Number of spans written.
+ */
+size_t nmea_index(const char *buf, size_t len, NMEA_SPAN *spans, size_t max_spans, size_t *consumed)
+{
+    NMEA_SCAN_MASKS m[WINDOW_BLOCKS];
+    size_t          n = 0;
+
+    int      in_sentence = 0;
+    uint32_t s_start = 0, s_star = NO_STAR, commas = 0, bad = 0;
+    size_t   mark = 0;                          // commas / invalid bytes are counted up to here
+
+    if (len > 0xFFFFFFFFu) len = 0xFFFFFFFFu;
+
+    for (size_t base = 0; base < len; base += WINDOW_BLOCKS * NMEA_SCAN_BLOCK)
+    {
+        size_t wlen = len - base < WINDOW_BLOCKS * NMEA_SCAN_BLOCK ? len - base : WINDOW_BLOCKS * NMEA_SCAN_BLOCK;
+        size_t nb   = (wlen + NMEA_SCAN_BLOCK - 1) / NMEA_SCAN_BLOCK;
+
+        nmea_scan(buf + base, wlen, m);
+
+        for (size_t b = 0; b < nb; b++)
+        {
+            uint64_t events = m[b].start | m[b].star | m[b].eol;
+
+            while (events)
+            {
+                int      bit = __builtin_ctzll(events);
+                uint64_t one = 1ULL << bit;
+                size_t   rel = b * NMEA_SCAN_BLOCK + (size_t)bit;
+                uint32_t pos = (uint32_t)(base + rel);
+                uint32_t cnt;
+
+                events &= events - 1;
+
+                if (m[b].start & one)
+                {
+                    in_sentence = 1;
+                    s_start     = pos;
+                    s_star      = NO_STAR;
+                    commas      = 0;
+                    bad         = 0;
+                    mark        = rel + 1;
+                    continue;
+                }
+                if (!in_sentence) continue;
+
+                // bring the counts up to this event
+                if (s_star == NO_STAR)
+                {
+                    RANGE_BITS(m, comma, mark, rel, cnt);
+                    commas += cnt;
+                }
+                RANGE_BITS(m, invalid, mark, rel, cnt);
+                bad  += cnt;
+                mark  = rel;
+
+                if (m[b].star & one)
+                {
+                    if (s_star == NO_STAR) s_star = pos;
+                    continue;
+                }
+
+                // line end: the sentence is complete
+                if (n == max_spans)
+                {
+                    *consumed = s_start;
+                    return n;
+                }
+
+                NMEA_SPAN *s = &spans[n++];
+
+                s->start      = s_start;
+                s->end        = pos;
+                s->star       = (s_star == NO_STAR) ? pos : s_star;
+                s->num_fields = (uint8_t)(commas + 1 > 255 ? 255 : commas + 1);
+                s->flags      = bad ? NMEA_SPAN_BAD_CHARS : 0;
+
+                if (s_star == NO_STAR || pos - s_star < 3 || hexval(buf[s_star + 1]) < 0 || hexval(buf[s_star + 2]) < 0)
+                {
+                    s->flags |= NMEA_SPAN_NO_CHECKSUM;
+                }
+                else if (xor_bytes(buf + s_start + 1, s_star - s_start - 1) ==
+                         (uint8_t)(hexval(buf[s_star + 1]) * 16 + hexval(buf[s_star + 2])))
+                {
+                    s->flags |= NMEA_SPAN_CHECKSUM_OK;
+                }
+
+                in_sentence = 0;
+            }
+        }
+
+        // the open sentence continues in the next window: count what is left of this one
+        if (in_sentence)
+        {
+            uint32_t cnt;
+
+            if (s_star == NO_STAR)
+            {
+                RANGE_BITS(m, comma, mark, wlen, cnt);
+                commas += cnt;
+            }
+            RANGE_BITS(m, invalid, mark, wlen, cnt);
+            bad  += cnt;
+        }
+        mark = 0;
+    }
+
+    *consumed = in_sentence ? s_start : len;
+    return n;
+}
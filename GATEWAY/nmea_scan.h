@@ -0,0 +1,52 @@
+/*
+ * nmea_scan.h
+ *
+ * Bulk classification of raw NMEA logs. Stage 1 turns each 64 byte block
+ * into bitmasks of the structural characters ('$'/'!', ',', '*', CR/LF) and
+ * of the bytes that can not appear in a sentence; stage 2 walks the masks
+ * to find the sentences, their field count and checksum, without looking
+ * at the other bytes again.
+ */
+
+#ifndef INC_NMEA_SCAN_H_
+#define INC_NMEA_SCAN_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NMEA_SCAN_BLOCK         64              // bytes per mask word
+
+// NMEA_SCAN_MASKS: bit i of each word is byte i of the block
+typedef struct
+{
+    uint64_t    start;                          // '$' or '!'
+    uint64_t    comma;
+    uint64_t    star;
+    uint64_t    eol;                            // CR or LF
+    uint64_t    invalid;                        // control characters (but CR/LF), bytes >= 0x7F
+} NMEA_SCAN_MASKS;
+
+// NMEA_SPAN flags
+#define NMEA_SPAN_CHECKSUM_OK   0x01
+#define NMEA_SPAN_NO_CHECKSUM   0x02            // no '*' or no two hex digits after it
+#define NMEA_SPAN_BAD_CHARS     0x04            // invalid bytes between start and line end
+
+// NMEA_SPAN: one sentence found by nmea_index, offsets into the scanned buffer
+typedef struct
+{
+    uint32_t    start;                          // the '$' / '!'
+    uint32_t    star;                           // the '*' (== end when there is none)
+    uint32_t    end;                            // first CR/LF after the sentence
+    uint8_t     num_fields;                     // as nmea_tokenize would return
+    uint8_t     flags;
+} NMEA_SPAN;
+
+enum { NMEA_SCAN_SCALAR = 0, NMEA_SCAN_SSE2, NMEA_SCAN_AVX2 };
+
+
+// Public function declarations
+int    nmea_scan_impl(void);
+void   nmea_scan(const char *buf, size_t len, NMEA_SCAN_MASKS *masks);
+size_t nmea_index(const char *buf, size_t len, NMEA_SPAN *spans, size_t max_spans, size_t *consumed);
+
+#endif /* INC_NMEA_SCAN_H_ */
@@ -0,0 +1,542 @@
+/*
+ * ntrip.c - NTRIP client for Linux gateways.
+ * Connects to a caster (NTRIP v1 or v2), validates the RTCM3 frames of the
+ * correction stream and paces them into the receiver tx path without ever
+ * using more than the configured share of the UART bandwidth.
+ */
+
+#include "ntrip.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#define CRC24Q_POLY     0x1864CFBu
+
+enum { CHUNK_SIZE = 0, CHUNK_EXT, CHUNK_SIZE_LF, CHUNK_DATA, CHUNK_DATA_CR, CHUNK_DATA_LF };
+
+static uint32_t crc24q_table[256];
+static int      crc24q_ready = 0;
+
+
+/**
+ * Computes the CRC-24Q used by RTCM3 over a buffer.
+ * @param data  Bytes to protect (preamble + length + payload).
+ * @param len   Number of bytes.
+ * @return      24-bit CRC.
+ */
+uint32_t rtcm_crc24q(const uint8_t *data, int len)
+{
+    uint32_t crc = 0;
+
+    if (!crc24q_ready)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i << 16;
+            for (int b = 0; b < 8; b++)
+            {
+                c <<= 1;
+                if (c & 0x1000000u) c ^= CRC24Q_POLY;
+            }
+            crc24q_table[i] = c & 0xFFFFFFu;
+        }
+        crc24q_ready = 1;
+    }
+
+    for (int i = 0; i < len; i++)
+    {
+        crc = ((crc << 8) & 0xFFFFFFu) ^ crc24q_table[((crc >> 16) ^ data[i]) & 0xFF];
+    }
+
+    return crc;
+}
+
+
+static uint32_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+
+/* base64 for the Basic authorization header */
+static void base64(const char *in, char *out, size_t out_size)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t len = strlen(in);
+    size_t o   = 0;
+
+    for (size_t i = 0; i < len && o + 4 < out_size; i += 3)
+    {
+        uint32_t v = (uint32_t)(uint8_t)in[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)(uint8_t)in[i + 1] << 8;
+        if (i + 2 < len) v |= (uint32_t)(uint8_t)in[i + 2];
+
+        out[o++] = alphabet[(v >> 18) & 63];
+        out[o++] = alphabet[(v >> 12) & 63];
+        out[o++] = (i + 1 < len) ? alphabet[(v >> 6) & 63] : '=';
+        out[o++] = (i + 2 < len) ? alphabet[v & 63] : '=';
+    }
+    out[o] = '\0';
+}
+
+
+/*
+ * send_gga - Reports the position to the caster. VRS casters compute the
+ * corrections for it and drop clients that stop reporting.
+ * @return  0 (also when there is nothing to send), -1 on a send error.
+ *
+ */
+static int send_gga(NTRIP_CLIENT *c, uint32_t now)
+{
+    size_t len = strlen(c->gga);
+
+    if (len == 0 || c->fd < 0 || !c->streaming) return 0;
+    if (send(c->fd, c->gga, len, MSG_NOSIGNAL) != (ssize_t)len) return -1;
+
+    c->last_gga_ms = now;
+    c->stats.gga_sent++;
+    return 0;
+}
+
+
+/*
+ * enqueue - Queues a validated frame.
+ * A frame of a message type that is still waiting is replaced: only the
+ * newest correction of each type is worth the link time.
+ *
+ */
+static void enqueue(NTRIP_CLIENT *c, const uint8_t *frame, int len, uint32_t now)
+{
+    uint16_t  type   = (uint16_t)((frame[3] << 4) | (frame[4] >> 4));
+    RTCM_SLOT *slot  = NULL;
+    RTCM_SLOT *oldest = NULL;
+
+    for (int i = 0; i < NTRIP_QUEUE_SLOTS; i++)
+    {
+        RTCM_SLOT *s = &c->queue[i];
+
+        if (!s->used)
+        {
+            if (!slot) slot = s;
+            continue;
+        }
+        if (s->sent) continue;                      // already half way out, must finish
+
+        if (s->type == type)
+        {
+            c->stats.superseded++;
+            slot = s;
+            break;
+        }
+        if (!oldest || (int32_t)(s->order - oldest->order) < 0) oldest = s;
+    }
+
+    if (!slot)
+    {
+        if (!oldest) return;                        // every slot is being sent, cannot happen with > 1 slot
+        c->stats.overflow++;
+        slot = oldest;
+    }
+
+    memcpy(slot->data, frame, (size_t)len);
+    slot->len        = (uint16_t)len;
+    slot->sent       = 0;
+    slot->type       = type;
+    slot->arrival_ms = now;
+    slot->order      = c->next_order++;
+    slot->used       = 1;
+}
+
+
+/* drops n bytes from the front of the frame buffer, then anything up to the next preamble */
+static void frame_shift(NTRIP_CLIENT *c, int n)
+{
+    while (n < c->frame_len && c->frame[n] != RTCM_PREAMBLE)
+    {
+        n++;
+        c->stats.resyncs++;
+    }
+    c->frame_len -= n;
+    memmove(c->frame, c->frame + n, (size_t)c->frame_len);
+}
+
+
+/*
+ * rtcm_bytes - RTCM3 framer: finds preambles, checks length and CRC.
+ * A false preamble only costs one byte: the search restarts right after it,
+ * over the bytes that were already collected.
+ *
+ */
+static void rtcm_bytes(NTRIP_CLIENT *c, const uint8_t *data, int len, uint32_t now)
+{
+    for (int i = 0; i < len; i++)
+    {
+        if (c->frame_len == 0 && data[i] != RTCM_PREAMBLE)
+        {
+            c->stats.resyncs++;
+            continue;
+        }
+        c->frame[c->frame_len++] = data[i];
+
+        while (c->frame_len >= 3)
+        {
+            int payload = ((c->frame[1] & 0x03) << 8) | c->frame[2];
+            int total   = 3 + payload + 3;
+
+            if (c->frame[1] & 0xFC)                 // reserved bits must be zero
+            {
+                frame_shift(c, 1);
+                continue;
+            }
+            if (c->frame_len < total) break;
+
+            if (rtcm_crc24q(c->frame, total - 3) ==
+                (((uint32_t)c->frame[total - 3] << 16) | ((uint32_t)c->frame[total - 2] << 8) | c->frame[total - 1]))
+            {
+                if (payload >= 2) enqueue(c, c->frame, total, now);
+                c->stats.frames++;
+                frame_shift(c, total);
+            }
+            else
+            {
+                c->stats.crc_errors++;
+                frame_shift(c, 1);
+            }
+        }
+    }
+}
+
+
+/*
+ * body_bytes - Removes the v2 chunked transfer encoding, if any.
+ *
+ */
+static void body_bytes(NTRIP_CLIENT *c, const uint8_t *data, int len, uint32_t now)
+{
+    if (!c->chunked)
+    {
+        rtcm_bytes(c, data, len, now);
+        return;
+    }
+
+    int i = 0;
+    while (i < len)
+    {
+        uint8_t b = data[i];
+
+        switch (c->chunk_state)
+        {
+            case CHUNK_SIZE:
+                if      (b >= '0' && b <= '9') c->chunk_left = c->chunk_left * 16 + (uint32_t)(b - '0');
+                else if (b >= 'a' && b <= 'f') c->chunk_left = c->chunk_left * 16 + (uint32_t)(b - 'a' + 10);
+                else if (b >= 'A' && b <= 'F') c->chunk_left = c->chunk_left * 16 + (uint32_t)(b - 'A' + 10);
+                else if (b == '\r')            c->chunk_state = CHUNK_SIZE_LF;
+                else                           c->chunk_state = CHUNK_EXT;     // ";extension"
+                i++;
+                break;
+            case CHUNK_EXT:
+                if (b == '\r') c->chunk_state = CHUNK_SIZE_LF;
+                i++;
+                break;
+            case CHUNK_SIZE_LF:
+                c->chunk_state = c->chunk_left ? CHUNK_DATA : CHUNK_DATA_CR;
+                i++;
+                break;
+            case CHUNK_DATA:
+                {
+                    int n = len - i;
+                    if ((uint32_t)n > c->chunk_left) n = (int)c->chunk_left;
+                    rtcm_bytes(c, data + i, n, now);
+                    c->chunk_left -= (uint32_t)n;
+                    i += n;
+                    if (c->chunk_left == 0) c->chunk_state = CHUNK_DATA_CR;
+                    break;
+                }
+            case CHUNK_DATA_CR:
+                c->chunk_state = CHUNK_DATA_LF;
+                i++;
+                break;
+            case CHUNK_DATA_LF:
+                c->chunk_state = CHUNK_SIZE;
+                c->chunk_left  = 0;
+                i++;
+                break;
+        }
+    }
+}
+
+
+/**
+ * Feeds bytes received from the caster.
+ * @return  0 on success, -1 if the caster refused the request.
+ */
+int ntrip_feed(NTRIP_CLIENT *c, const uint8_t *data, int len, uint32_t now)
+{
+    if (!c->streaming)
+    {
+        int   i;
+
+        for (i = 0; i < len && c->header_len < NTRIP_HEADER_MAX - 1; i++)
+        {
+            c->header[c->header_len++] = (char)data[i];
+            c->header[c->header_len]   = '\0';
+            if (c->header_len >= 4 && !memcmp(c->header + c->header_len - 4, "\r\n\r\n", 4)) break;
+
+            // a v1 caster answers "ICY 200 OK\r\n" and goes straight to data
+            if (!strncmp(c->header, "ICY ", 4) && !memcmp(c->header + c->header_len - 2, "\r\n", 2)) break;
+        }
+
+        if (i == len)
+        {
+            if (c->header_len >= NTRIP_HEADER_MAX - 1) return -1;
+            return 0;
+        }
+
+        if (strncmp(c->header, "ICY 200", 7) != 0 &&
+            !(strncmp(c->header, "HTTP/1.", 7) == 0 && strncmp(c->header + 8, " 200", 4) == 0))
+        {
+            return -1;
+        }
+
+        for (char *p = c->header; *p; p++)
+        {
+            if (strncasecmp(p, "transfer-encoding:", 18) == 0)
+            {
+                char *v = p + 18;
+                while (*v == ' ') v++;
+                if (strncasecmp(v, "chunked", 7) == 0) c->chunked = 1;
+            }
+        }
+
+        c->streaming = 1;
+        if (send_gga(c, now) < 0) return -1;
+
+        data += i + 1;
+        len  -= i + 1;
+        if (len <= 0) return 0;
+    }
+
+    body_bytes(c, data, len, now);
+    return 0;
+}
+
+
+/**
+ * Paces queued frames into the writer.
+ * The link budget is a token bucket at headroom_pct of baud / 10 bytes per second;
+ * a frame is only started when it fits, so it reaches the receiver in one piece.
+ * @return  Number of bytes written.
+ */
+int ntrip_service(NTRIP_CLIENT *c, uint32_t now)
+{
+    uint32_t rate    = c->cfg.baud / 10 * c->cfg.headroom_pct / 100;   // bytes per second
+    uint32_t burst   = rate / 10;                                      // 100 ms worth of link time
+    uint32_t elapsed = now - c->last_refill_ms;
+    int      written = 0;
+
+    if (burst < RTCM_MAX_FRAME) burst = RTCM_MAX_FRAME;
+
+    uint64_t add = (uint64_t)rate * elapsed + c->refill_rem;
+    c->refill_rem     = (uint32_t)(add % 1000);
+    c->tokens         = (uint32_t)((c->tokens + add / 1000 > burst) ? burst : c->tokens + add / 1000);
+    c->last_refill_ms = now;
+
+    for (;;)
+    {
+        RTCM_SLOT *next = NULL;
+
+        for (int i = 0; i < NTRIP_QUEUE_SLOTS; i++)
+        {
+            RTCM_SLOT *s = &c->queue[i];
+
+            if (!s->used) continue;
+            if (!s->sent && (now - s->arrival_ms) > c->cfg.max_age_ms)
+            {
+                s->used = 0;
+                c->stats.stale++;
+                continue;
+            }
+            if (!next || (int32_t)(s->order - next->order) < 0) next = s;
+        }
+
+        if (!next) break;
+        if (!next->sent && c->tokens < next->len) break;
+
+        int want = next->len - next->sent;
+        if ((uint32_t)want > c->tokens) want = (int)c->tokens;
+
+        int n = c->cfg.write ? c->cfg.write(c->cfg.ctx, next->data + next->sent, want) : want;
+        if (n <= 0) break;
+
+        next->sent += (uint16_t)n;
+        c->tokens  -= (uint32_t)n;
+        written    += n;
+        c->stats.bytes_written += (uint32_t)n;
+
+        if (next->sent == next->len) next->used = 0;
+        if (n < want) break;                        // tx path is full, try again later
+    }
+
+    return written;
+}
+
+
+/**
+ * Sets up a client without connecting it: defaults for the zero fields of
+ * cfg, an empty queue and a full link budget from now on. ntrip_connect
+ * does this itself; call it directly to drive ntrip_feed / ntrip_service.
+ */
+void ntrip_init(NTRIP_CLIENT *c, const NTRIP_CONFIG *cfg, uint32_t now)
+{
+    memset(c, 0, sizeof(NTRIP_CLIENT));
+    c->cfg = *cfg;
+    c->fd  = -1;
+    if (!c->cfg.headroom_pct)    c->cfg.headroom_pct    = NTRIP_DEFAULT_HEADROOM;
+    if (!c->cfg.max_age_ms)      c->cfg.max_age_ms      = NTRIP_DEFAULT_MAX_AGE;
+    if (!c->cfg.gga_interval_ms) c->cfg.gga_interval_ms = NTRIP_DEFAULT_GGA_MS;
+    c->last_refill_ms = now;
+    c->last_gga_ms    = now;
+    ntrip_set_gga(c, cfg->gga);
+}
+
+
+/**
+ * Replaces the position report, e.g. with each new fix of a moving rover.
+ * It goes out with the next periodic report; NULL or "" stops the reports.
+ */
+void ntrip_set_gga(NTRIP_CLIENT *c, const char *gga)
+{
+    snprintf(c->gga, sizeof(c->gga), "%s", gga ? gga : "");
+}
+
+
+/**
+ * Connects to the caster and sends the request for the mountpoint.
+ * @return  0 on success, -1 on error.
+ */
+int ntrip_connect(NTRIP_CLIENT *c, const NTRIP_CONFIG *cfg)
+{
+    struct addrinfo hints, *res, *ai;
+    char   port[8];
+    char   request[1024];
+    char   auth[256] = "";
+    int    n;
+
+    ntrip_init(c, cfg, now_ms());
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%u", cfg->port);
+
+    if (getaddrinfo(cfg->host, port, &hints, &res) != 0) return -1;
+
+    for (ai = res; ai; ai = ai->ai_next)
+    {
+        c->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (c->fd < 0) continue;
+        if (connect(c->fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(c->fd);
+        c->fd = -1;
+    }
+    freeaddrinfo(res);
+    if (c->fd < 0) return -1;
+
+    if (cfg->user)
+    {
+        char credentials[160], encoded[224];
+
+        snprintf(credentials, sizeof(credentials), "%s:%s", cfg->user, cfg->password ? cfg->password : "");
+        base64(credentials, encoded, sizeof(encoded));
+        snprintf(auth, sizeof(auth), "Authorization: Basic %s\r\n", encoded);
+    }
+
+    if (cfg->version == 2)
+    {
+        n = snprintf(request, sizeof(request),
+                     "GET /%s HTTP/1.1\r\nHost: %s\r\nNtrip-Version: Ntrip/2.0\r\n"
+                     "User-Agent: NTRIP GPS-module/1.0\r\nConnection: close\r\n%s\r\n",
+                     cfg->mountpoint, cfg->host, auth);
+    }
+    else
+    {
+        n = snprintf(request, sizeof(request),
+                     "GET /%s HTTP/1.0\r\nUser-Agent: NTRIP GPS-module/1.0\r\n%s\r\n",
+                     cfg->mountpoint, auth);
+    }
+
+    if (n <= 0 || n >= (int)sizeof(request) || send(c->fd, request, (size_t)n, MSG_NOSIGNAL) != n)
+    {
+        ntrip_close(c);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Waits up to timeout_ms for caster data, then paces the queue.
+ * While frames are waiting the wait is shortened so pacing stays smooth,
+ * and it never outlasts the next position report.
+ * @return  Bytes written to the receiver, -1 when the connection is gone.
+ */
+int ntrip_poll(NTRIP_CLIENT *c, int timeout_ms)
+{
+    struct pollfd pfd = { c->fd, POLLIN, 0 };
+    uint8_t       buf[4096];
+    uint32_t      now;
+
+    for (int i = 0; i < NTRIP_QUEUE_SLOTS; i++)
+    {
+        if (c->queue[i].used && timeout_ms > 10) timeout_ms = 10;
+    }
+
+    if (c->fd < 0) return -1;
+
+    if (c->gga[0] && c->streaming)
+    {
+        uint32_t since = now_ms() - c->last_gga_ms;
+        int      until = since >= c->cfg.gga_interval_ms ? 0 : (int)(c->cfg.gga_interval_ms - since);
+
+        if (timeout_ms < 0 || timeout_ms > until) timeout_ms = until;
+    }
+
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready < 0) return -1;
+
+    if (ready && (pfd.revents & (POLLIN | POLLHUP | POLLERR)))
+    {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+
+        if (n <= 0 || ntrip_feed(c, buf, (int)n, now_ms()) < 0)
+        {
+            ntrip_close(c);
+            return -1;
+        }
+    }
+
+    now = now_ms();
+    if (c->gga[0] && c->streaming && now - c->last_gga_ms >= c->cfg.gga_interval_ms && send_gga(c, now) < 0)
+    {
+        ntrip_close(c);
+        return -1;
+    }
+
+    return ntrip_service(c, now);
+}
+
+
+void ntrip_close(NTRIP_CLIENT *c)
+{
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+}
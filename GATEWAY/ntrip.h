@@ -0,0 +1,116 @@
+/*
+ * ntrip.h
+ *
+ * NTRIP v1/v2 client (Linux): pulls RTCM3 corrections from a caster,
+ * validates the frames and paces them into a receiver's tx path
+ */
+
+#ifndef INC_NTRIP_H_
+#define INC_NTRIP_H_
+
+#include <stdint.h>
+
+#define RTCM_PREAMBLE           0xD3
+#define RTCM_MAX_FRAME          (3 + 1023 + 3)      // header + payload + CRC-24Q
+
+#define NTRIP_QUEUE_SLOTS       32                  // frames waiting for link capacity
+#define NTRIP_HEADER_MAX        2048                // HTTP/ICY response header
+
+#define NTRIP_DEFAULT_HEADROOM  50                  // % of the UART the corrections may use
+#define NTRIP_DEFAULT_MAX_AGE   2000                // ms, older corrections are useless for RTK
+#define NTRIP_DEFAULT_GGA_MS    10000               // position report interval, VRS casters drop silent clients
+#define NTRIP_GGA_MAX           128
+
+// writer into the receiver tx path (e.g. Uart_write_span), returns the bytes accepted
+typedef int (*ntrip_writer)(void *ctx, const uint8_t *data, int len);
+
+typedef struct
+{
+    const char      *host;
+    uint16_t        port;
+    const char      *mountpoint;
+    const char      *user;              // NULL: no authorization
+    const char      *password;
+    int             version;            // 1 (ICY) or 2 (HTTP/1.1, chunked)
+    const char      *gga;               // optional position report for VRS casters ("$GPGGA...\r\n")
+    uint32_t        gga_interval_ms;    // resend it this often, update it with ntrip_set_gga
+
+    uint32_t        baud;               // receiver UART baud rate
+    uint8_t         headroom_pct;       // share of the UART bandwidth for corrections
+    uint32_t        max_age_ms;         // drop frames that waited longer than this
+
+    ntrip_writer    write;
+    void            *ctx;
+} NTRIP_CONFIG;
+
+// RTCM_SLOT: one validated frame waiting to be sent
+typedef struct
+{
+    uint8_t     data[RTCM_MAX_FRAME];
+    uint16_t    len;
+    uint16_t    sent;                   // bytes already accepted by the writer
+    uint16_t    type;                   // RTCM message number
+    uint32_t    arrival_ms;
+    uint32_t    order;                  // arrival order, FIFO between message types
+    uint8_t     used;
+} RTCM_SLOT;
+
+typedef struct
+{
+    uint32_t    frames;                 // valid frames received
+    uint32_t    crc_errors;
+    uint32_t    resyncs;                // bytes skipped looking for a preamble
+    uint32_t    superseded;             // replaced by a newer frame of the same type
+    uint32_t    stale;                  // dropped for age
+    uint32_t    overflow;               // dropped because the queue was full
+    uint32_t    bytes_written;
+    uint32_t    gga_sent;
+} NTRIP_STATS;
+
+typedef struct
+{
+    NTRIP_CONFIG    cfg;
+    int             fd;
+
+    /* position reports */
+    char            gga[NTRIP_GGA_MAX];
+    uint32_t        last_gga_ms;
+
+    /* response parsing */
+    char            header[NTRIP_HEADER_MAX];
+    int             header_len;
+    uint8_t         streaming;          // header accepted, payload follows
+    uint8_t         chunked;            // v2 chunked transfer encoding
+    int             chunk_state;
+    uint32_t        chunk_left;
+
+    /* RTCM framing */
+    uint8_t         frame[RTCM_MAX_FRAME];
+    int             frame_len;
+
+    /* pacing */
+    RTCM_SLOT       queue[NTRIP_QUEUE_SLOTS];
+    uint32_t        next_order;
+    uint32_t        tokens;             // bytes the link can take now
+    uint32_t        refill_rem;         // sub-byte remainder of the refill
+    uint32_t        last_refill_ms;
+
+    NTRIP_STATS     stats;
+} NTRIP_CLIENT;
+
+
+// Public function declarations
+uint32_t rtcm_crc24q(const uint8_t *data, int len);
+
+int  ntrip_connect(NTRIP_CLIENT *c, const NTRIP_CONFIG *cfg);
+int  ntrip_poll(NTRIP_CLIENT *c, int timeout_ms);
+void ntrip_set_gga(NTRIP_CLIENT *c, const char *gga);
+void ntrip_close(NTRIP_CLIENT *c);
+
+/* lower level, used by ntrip_poll: feed caster bytes / pace the queue with an explicit clock
+ * (without a connection, start with ntrip_init instead of ntrip_connect) */
+void ntrip_init(NTRIP_CLIENT *c, const NTRIP_CONFIG *cfg, uint32_t now_ms);
+int  ntrip_feed(NTRIP_CLIENT *c, const uint8_t *data, int len, uint32_t now_ms);
+int  ntrip_service(NTRIP_CLIENT *c, uint32_t now_ms);
+
+#endif /* INC_NTRIP_H_ */
@@ -0,0 +1,548 @@
+/*
+ * rollup.c - Incremental minute / hour / day rollups of decoded fixes.
+ *
+ * A fix is added to its minute bucket. When the minute head moves into a
+ * new hour, every hour that is over is closed: its bucket is set to the
+ * sum of its minute buckets (the same for days from hours). A late fix
+ * whose hour (day) is already closed is added to that bucket directly,
+ * so every level stays exact as long as the fix is inside its window.
+ * Queries read closed buckets as stored and sum the open ones from the
+ * level below.
+ */
+
+#include "rollup.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define EARTH_RADIUS        6371008.8                       // m
+#define RAD_PER_UNIT        (M_PI / 180.0 / GPS_COORD_SCALE)
+
+static const int64_t  level_seconds[ROLLUP_LEVELS] = { 60, 3600, 86400 };
+static const uint32_t level_length[ROLLUP_LEVELS]  = { ROLLUP_MINUTES, ROLLUP_HOURS, ROLLUP_DAYS };
+
+typedef char rollup_window_check[(ROLLUP_MINUTES >= 120 && ROLLUP_HOURS >= 48) ? 1 : -1];
+
+
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDull;
+    x ^= x >> 33;
+    return x;
+}
+
+static int64_t floor_div(int64_t a, int64_t b)
+{
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+static uint32_t slot(int level, int64_t bucket)
+{
+    return (uint32_t)(bucket % level_length[level]);
+}
+
+static int in_window(const ROLLUP_LEVEL *lv, int level, int64_t bucket)
+{
+    return bucket <= lv->head && bucket > lv->head - level_length[level];
+}
+
+static uint64_t sum_get(const ROLLUP_LEVEL *lv, const void *column, uint32_t i)
+{
+    return lv->wide ? ((const uint64_t *)column)[i] : ((const uint32_t *)column)[i];
+}
+
+/* a 32 bit column saturates instead of wrapping */
+static void sum_add(const ROLLUP_LEVEL *lv, void *column, uint32_t i, uint64_t v)
+{
+    if (lv->wide)
+    {
+        ((uint64_t *)column)[i] += v;
+    }
+    else
+    {
+        uint64_t sum = ((uint32_t *)column)[i] + v;
+        ((uint32_t *)column)[i] = sum > UINT32_MAX ? UINT32_MAX : (uint32_t)sum;
+    }
+}
+
+static void clear_bucket(ROLLUP_LEVEL *lv, uint32_t i)
+{
+    size_t width = lv->wide ? sizeof(uint64_t) : sizeof(uint32_t);
+
+    memset((uint8_t *)lv->epochs + i * width, 0, width);
+    memset((uint8_t *)lv->fixed + i * width, 0, width);
+    memset((uint8_t *)lv->sat_sum + i * width, 0, width);
+    memset((uint8_t *)lv->distance_dm + i * width, 0, width);
+    lv->max_speed[i] = 0;
+}
+
+static void add_point(ROLLUP_POINT *dst, const ROLLUP_POINT *src)
+{
+    dst->epochs      += src->epochs;
+    dst->fixed       += src->fixed;
+    dst->sat_sum     += src->sat_sum;
+    dst->distance_dm += src->distance_dm;
+    if (src->max_speed > dst->max_speed) dst->max_speed = src->max_speed;
+}
+
+static void store_add(ROLLUP_LEVEL *lv, uint32_t i, const ROLLUP_POINT *p)
+{
+    sum_add(lv, lv->epochs, i, p->epochs);
+    sum_add(lv, lv->fixed, i, p->fixed);
+    sum_add(lv, lv->sat_sum, i, p->sat_sum);
+    sum_add(lv, lv->distance_dm, i, p->distance_dm);
+    if (p->max_speed > lv->max_speed[i]) lv->max_speed[i] = p->max_speed;
+}
+
+static void load_point(const ROLLUP_LEVEL *lv, uint32_t i, ROLLUP_POINT *p)
+{
+    p->epochs      = sum_get(lv, lv->epochs, i);
+    p->fixed       = sum_get(lv, lv->fixed, i);
+    p->sat_sum     = sum_get(lv, lv->sat_sum, i);
+    p->distance_dm = sum_get(lv, lv->distance_dm, i);
+    p->max_speed   = lv->max_speed[i];
+}
+
+
+/*************************************** series ***************************************/
+
+/* device 0 is the fleet: 64 bit sums */
+static size_t columns_size(uint64_t device)
+{
+    size_t width = device ? sizeof(uint32_t) : sizeof(uint64_t);
+    size_t size  = 0;
+
+    for (int l = 0; l < ROLLUP_LEVELS; l++) size += (size_t)level_length[l] * (4 * width + sizeof(uint16_t));
+    return size;
+}
+
+static ROLLUP_SERIES *series_new(uint64_t device)
+{
+    ROLLUP_SERIES *s = calloc(1, sizeof(ROLLUP_SERIES));
+    size_t         width = device ? sizeof(uint32_t) : sizeof(uint64_t);
+    uint8_t       *p;
+
+    if (!s || !(s->columns = calloc(1, columns_size(device))))
+    {
+        free(s);
+        return NULL;
+    }
+    s->device = device;
+
+    // the sum columns first, then the 16 bit ones, so everything stays aligned
+    p = s->columns;
+    for (int l = 0; l < ROLLUP_LEVELS; l++)
+    {
+        size_t n = level_length[l];
+
+        s->level[l].wide        = device == 0;
+        s->level[l].epochs      = p;  p += n * width;
+        s->level[l].fixed       = p;  p += n * width;
+        s->level[l].sat_sum     = p;  p += n * width;
+        s->level[l].distance_dm = p;  p += n * width;
+    }
+    for (int l = 0; l < ROLLUP_LEVELS; l++)
+    {
+        s->level[l].max_speed = (uint16_t *)p;
+        p += (size_t)level_length[l] * sizeof(uint16_t);
+    }
+    return s;
+}
+
+static void series_free(ROLLUP_SERIES *s)
+{
+    if (!s) return;
+    free(s->columns);
+    free(s);
+}
+
+/* moves the head of a level forward, clearing the buckets it enters */
+static void advance_level(ROLLUP_SERIES *s, int level, int64_t head)
+{
+    ROLLUP_LEVEL *lv = &s->level[level];
+    int64_t       from = lv->head + 1;
+
+    if (head <= lv->head) return;
+    if (head - from >= level_length[level]) from = head - level_length[level] + 1;
+
+    for (int64_t b = from; b <= head; b++) clear_bucket(lv, slot(level, b));
+    lv->head = head;
+}
+
+/* sum of a bucket, open buckets from the level below */
+static void bucket_value(const ROLLUP_SERIES *s, int level, int64_t bucket, ROLLUP_POINT *p)
+{
+    const ROLLUP_LEVEL *lv = &s->level[level];
+
+    memset(p, 0, sizeof(ROLLUP_POINT));
+    p->start = bucket * level_seconds[level];
+
+    if (!s->started) return;
+    if (level == 0 || bucket <= lv->closed)
+    {
+        if (in_window(lv, level, bucket)) load_point(lv, slot(level, bucket), p);
+        return;
+    }
+
+    int64_t ratio = level_seconds[level] / level_seconds[level - 1];
+    for (int64_t c = bucket * ratio; c < (bucket + 1) * ratio; c++)
+    {
+        ROLLUP_POINT child;
+
+        bucket_value(s, level - 1, c, &child);
+        add_point(p, &child);
+    }
+}
+
+/*
+ * compact - Closes the coarse buckets that ended before minute bucket
+ * `minute`. Coarsest level first: a level is only moved forward after the
+ * levels above have read what they need from it.
+ *
+ */
+static void compact(ROLLUP_SERIES *s, int64_t minute)
+{
+    int64_t t = minute * level_seconds[0];
+
+    for (int l = ROLLUP_LEVELS - 1; l >= 1; l--)
+    {
+        ROLLUP_LEVEL *lv   = &s->level[l];
+        int64_t       open = floor_div(t, level_seconds[l]);
+
+        advance_level(s, l, open);
+
+        // buckets that fell out of the window need no work
+        if (lv->closed < open - 1 - level_length[l]) lv->closed = open - 1 - level_length[l];
+
+        while (lv->closed < open - 1)
+        {
+            ROLLUP_POINT p;
+            int64_t      b = lv->closed + 1;
+
+            bucket_value(s, l, b, &p);          // still open: the sum of its children
+            clear_bucket(lv, slot(l, b));
+            store_add(lv, slot(l, b), &p);
+            lv->closed = b;
+        }
+    }
+}
+
+static void series_add(ROLLUP_SERIES *s, int64_t t, const ROLLUP_POINT *p)
+{
+    int64_t minute = floor_div(t, level_seconds[0]);
+
+    if (!s->started)
+    {
+        for (int l = 0; l < ROLLUP_LEVELS; l++)
+        {
+            s->level[l].head   = floor_div(t, level_seconds[l]);
+            s->level[l].closed = s->level[l].head - 1;
+        }
+        s->started = 1;
+    }
+    else if (minute > s->level[0].head)
+    {
+        compact(s, minute);                     // before the minutes it reads are recycled
+        advance_level(s, 0, minute);
+    }
+
+    // the minute bucket, and every coarse bucket that is already closed
+    for (int l = 0; l < ROLLUP_LEVELS; l++)
+    {
+        ROLLUP_LEVEL *lv = &s->level[l];
+        int64_t       b  = floor_div(t, level_seconds[l]);
+
+        if (l > 0 && b > lv->closed) break;
+        if (in_window(lv, l, b)) store_add(lv, slot(l, b), p);
+    }
+}
+
+
+/*************************************** table ***************************************/
+
+static ROLLUP_SERIES **find_series(const ROLLUP_DB *db, uint64_t device)
+{
+    uint32_t i = (uint32_t)mix64(device) & db->mask;
+
+    while (db->series[i] && db->series[i]->device != device) i = (i + 1) & db->mask;
+    return &db->series[i];
+}
+
+static int grow(ROLLUP_DB *db)
+{
+    ROLLUP_DB       bigger = *db;
+    ROLLUP_SERIES **old = db->series;
+
+    bigger.mask   = db->mask * 2 + 1;
+    bigger.series = calloc((size_t)bigger.mask + 1, sizeof(ROLLUP_SERIES *));
+    if (!bigger.series) return -1;
+
+    for (uint32_t i = 0; i <= db->mask; i++)
+    {
+        if (old[i]) *find_series(&bigger, old[i]->device) = old[i];
+    }
+    free(old);
+    *db = bigger;
+    return 0;
+}
+
+static ROLLUP_SERIES *get_series(ROLLUP_DB *db, uint64_t device)
+{
+    ROLLUP_SERIES **p;
+
+    if ((db->count + 1) * 2 > db->mask + 1 && grow(db) != 0) return NULL;
+
+    p = find_series(db, device);
+    if (!*p)
+    {
+        if (!(*p = series_new(device))) return NULL;
+        db->count++;
+    }
+    return *p;
+}
+
+
+int rollup_init(ROLLUP_DB *db)
+{
+    memset(db, 0, sizeof(ROLLUP_DB));
+
+    db->mask   = 1023;
+    db->series = calloc((size_t)db->mask + 1, sizeof(ROLLUP_SERIES *));
+    db->fleet  = series_new(0);
+    if (!db->series || !db->fleet)
+    {
+        rollup_free(db);
+        return -1;
+    }
+    return 0;
+}
+
+void rollup_free(ROLLUP_DB *db)
+{
+    for (uint32_t i = 0; db->series && i <= db->mask; i++) series_free(db->series[i]);
+    free(db->series);
+    series_free(db->fleet);
+    memset(db, 0, sizeof(ROLLUP_DB));
+}
+
+/*
+ * rollup_add - Accounts one decoded fix of a device (device != 0), and the
+ * fleet total. Distance is the great circle from the previous positioned
+ * fix of the device, when not more than ROLLUP_MAX_GAP_MS older.
+ * @return  0, 1 if older than every window, -1 without time or memory.
+ *
+ */
+int rollup_add(ROLLUP_DB *db, uint64_t device, const FIXRECORD *rec)
+{
+    ROLLUP_SERIES *s;
+    ROLLUP_POINT   p;
+    int64_t        t;
+    int            positioned = (rec->present & GPS_HAS_POSITION) == GPS_HAS_POSITION && rec->fix;
+
+    if (device == 0 || rec->utc_ms == 0 || !(s = get_series(db, device))) return -1;
+
+    t = floor_div(rec->utc_ms, 1000);
+    if (s->started && t / level_seconds[ROLLUP_DAY] <= s->level[ROLLUP_DAY].head - ROLLUP_DAYS)
+    {
+        db->late++;
+        return 1;
+    }
+
+    memset(&p, 0, sizeof(p));
+    p.epochs    = 1;
+    p.fixed     = (uint32_t)positioned;
+    p.sat_sum   = positioned && (rec->present & GPS_HAS_NUMSAT) ? rec->numsat : 0;
+    p.max_speed = (rec->present & GPS_HAS_SPEED) ? rec->speed : 0;
+
+    if (positioned)
+    {
+        if (s->last_ms && rec->utc_ms > s->last_ms && rec->utc_ms - s->last_ms <= ROLLUP_MAX_GAP_MS)
+        {
+            double phi1 = s->last.latitude * RAD_PER_UNIT;
+            double phi2 = rec->latitude * RAD_PER_UNIT;
+            double s1   = sin((phi2 - phi1) / 2);
+            double s2   = sin((double)(rec->longitude - s->last.longitude) * RAD_PER_UNIT / 2);
+            double h    = s1 * s1 + cos(phi1) * cos(phi2) * s2 * s2;
+
+            p.distance_dm = (uint64_t)(20 * EARTH_RADIUS * asin(sqrt(h < 1 ? h : 1)) + 0.5);
+        }
+        if (rec->utc_ms > s->last_ms)
+        {
+            s->last_ms            = rec->utc_ms;
+            s->last.latitude      = rec->latitude;
+            s->last.longitude     = rec->longitude;
+        }
+    }
+
+    series_add(s, t, &p);
+    series_add(db->fleet, t, &p);
+    return 0;
+}
+
+/*
+ * rollup_query - Buckets of one level covering [from, to) (s since 1970),
+ * oldest first, empty buckets included. device 0 is the fleet total.
+ * @return  number of points written.
+ *
+ */
+uint32_t rollup_query(const ROLLUP_DB *db, uint64_t device, int level, int64_t from, int64_t to,
+                      ROLLUP_POINT *point, uint32_t max_points)
+{
+    const ROLLUP_SERIES *s;
+    uint32_t             n = 0;
+
+    if (level < 0 || level >= ROLLUP_LEVELS || to <= from) return 0;
+
+    s = device ? *find_series(db, device) : db->fleet;
+
+    for (int64_t b = floor_div(from, level_seconds[level]); b * level_seconds[level] < to && n < max_points; b++)
+    {
+        if (s) bucket_value(s, level, b, &point[n]);
+        else
+        {
+            memset(&point[n], 0, sizeof(ROLLUP_POINT));
+            point[n].start = b * level_seconds[level];
+        }
+        n++;
+    }
+    return n;
+}
+
+
+/*************************************** persistence ***************************************/
+
+typedef struct
+{
+    uint32_t    magic;
+    uint32_t    length[ROLLUP_LEVELS];              // buckets per level of the writer
+    uint32_t    count;                              // device series (the fleet follows them)
+    uint32_t    reserved;
+} ROLLUP_FILE_HEADER;
+
+typedef struct
+{
+    uint64_t    device;
+    int64_t     last_ms;
+    LOCATION    last;
+    uint32_t    started;
+    int64_t     head[ROLLUP_LEVELS];
+    int64_t     closed[ROLLUP_LEVELS];
+} ROLLUP_FILE_SERIES;
+
+static int write_series(FILE *fp, const ROLLUP_SERIES *s)
+{
+    ROLLUP_FILE_SERIES h;
+
+    memset(&h, 0, sizeof(h));
+    h.device  = s->device;
+    h.last_ms = s->last_ms;
+    h.last    = s->last;
+    h.started = s->started;
+    for (int l = 0; l < ROLLUP_LEVELS; l++)
+    {
+        h.head[l]   = s->level[l].head;
+        h.closed[l] = s->level[l].closed;
+    }
+    return (fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(s->columns, columns_size(s->device), 1, fp) == 1) ? 0 : -1;
+}
+
+static ROLLUP_SERIES *read_series(FILE *fp)
+{
+    ROLLUP_FILE_SERIES h;
+    ROLLUP_SERIES     *s;
+
+    if (fread(&h, sizeof(h), 1, fp) != 1 || !(s = series_new(h.device))) return NULL;
+    if (fread(s->columns, columns_size(h.device), 1, fp) != 1)
+    {
+        series_free(s);
+        return NULL;
+    }
+    s->last_ms = h.last_ms;
+    s->last    = h.last;
+    s->started = (uint8_t)h.started;
+    for (int l = 0; l < ROLLUP_LEVELS; l++)
+    {
+        s->level[l].head   = h.head[l];
+        s->level[l].closed = h.closed[l];
+    }
+    return s;
+}
+
+/*
+ * rollup_save - Writes every series, columns as they are in memory.
+ * @return  0, -1 on an I/O error.
+ *
+ */
+int rollup_save(const ROLLUP_DB *db, const char *path)
+{
+    ROLLUP_FILE_HEADER h = { ROLLUP_FILE_MAGIC, { ROLLUP_MINUTES, ROLLUP_HOURS, ROLLUP_DAYS }, db->count, 0 };
+    FILE              *fp = fopen(path, "wb");
+    int                rc = 0;
+
+    if (!fp) return -1;
+
+    if (fwrite(&h, sizeof(h), 1, fp) != 1) rc = -1;
+    for (uint32_t i = 0; rc == 0 && i <= db->mask; i++)
+    {
+        if (db->series[i]) rc = write_series(fp, db->series[i]);
+    }
+    if (rc == 0) rc = write_series(fp, db->fleet);
+
+    if (fclose(fp) != 0) rc = -1;
+    return rc;
+}
+
+/*
+ * rollup_load - Replaces db (initialised) with a saved one of the same build.
+ * @return  0, -1 on an I/O error or a different layout.
+ *
+ */
+int rollup_load(ROLLUP_DB *db, const char *path)
+{
+    ROLLUP_FILE_HEADER h;
+    ROLLUP_DB          loaded;
+    FILE              *fp = fopen(path, "rb");
+    int                rc = -1;
+
+    if (!fp) return -1;
+    if (fread(&h, sizeof(h), 1, fp) != 1 || h.magic != ROLLUP_FILE_MAGIC || h.length[0] != ROLLUP_MINUTES ||
+        h.length[1] != ROLLUP_HOURS || h.length[2] != ROLLUP_DAYS || rollup_init(&loaded) != 0)
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    uint32_t i;
+    for (i = 0; i < h.count; i++)
+    {
+        ROLLUP_SERIES *s = read_series(fp);
+
+        if (!s) break;
+        if ((loaded.count + 1) * 2 > loaded.mask + 1 && grow(&loaded) != 0)
+        {
+            series_free(s);
+            break;
+        }
+        *find_series(&loaded, s->device) = s;
+        loaded.count++;
+    }
+
+    ROLLUP_SERIES *fleet = (i == h.count) ? read_series(fp) : NULL;
+    if (fleet)
+    {
+        series_free(loaded.fleet);
+        loaded.fleet = fleet;
+        rollup_free(db);
+        *db = loaded;
+        rc = 0;
+    }
+    else
+    {
+        rollup_free(&loaded);
+    }
+
+    fclose(fp);
+    return rc;
+}
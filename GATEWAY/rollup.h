@@ -0,0 +1,89 @@
+/*
+ * rollup.h
+ *
+ * Pre-aggregated per-device statistics for dashboards: fix availability,
+ * satellites, max speed and distance in minute, hour and day buckets.
+ * Every level is a ring of time buckets stored column by column; a fix
+ * updates its minute bucket, and when an hour (day) is over its minutes
+ * (hours) are compacted into one coarse bucket. The minute ring is short,
+ * the coarse rings go back weeks and months in a few kB per device.
+ * Device columns are 32 bit (saturating, far beyond one receiver's rate);
+ * the fleet total sums every device, its columns are 64 bit.
+ * Not thread safe: one decode thread updates, queries take the same lock.
+ */
+
+#ifndef INC_ROLLUP_H_
+#define INC_ROLLUP_H_
+
+#include <stdint.h>
+#include "fix_record.h"
+
+#define ROLLUP_MINUTE           0
+#define ROLLUP_HOUR             1
+#define ROLLUP_DAY              2
+#define ROLLUP_LEVELS           3
+
+#define ROLLUP_MINUTES          180                 // buckets kept per level
+#define ROLLUP_HOURS            336
+#define ROLLUP_DAYS             400
+
+#define ROLLUP_MAX_GAP_MS       600000              // longer gaps add no distance
+#define ROLLUP_FILE_MAGIC       0x32505552u         // "RUP2"
+
+// ROLLUP_POINT: one bucket, means are sums / counts so buckets merge exactly
+typedef struct
+{
+    int64_t     start;                              // s since 1970
+    uint64_t    epochs;                             // fixes received
+    uint64_t    fixed;                              // of which with a valid position fix
+    uint64_t    sat_sum;                            // satellites summed over the fixed epochs
+    uint64_t    distance_dm;                        // travelled, decimetres
+    uint16_t    max_speed;                          // knots * 100
+} ROLLUP_POINT;
+
+// ROLLUP_LEVEL: ring of buckets, bucket b lives in column index b % length
+typedef struct
+{
+    int64_t     head;                               // newest bucket (time / seconds)
+    int64_t     closed;                             // buckets up to here are final
+    uint8_t     wide;                               // sum columns are uint64_t, else uint32_t
+    void        *epochs;
+    void        *fixed;
+    void        *sat_sum;
+    void        *distance_dm;
+    uint16_t    *max_speed;
+} ROLLUP_LEVEL;
+
+typedef struct
+{
+    uint64_t        device;                         // 0 = fleet total
+    ROLLUP_LEVEL    level[ROLLUP_LEVELS];
+    int64_t         last_ms;                        // last positioned fix, for the distance
+    LOCATION        last;
+    uint8_t         started;
+    void            *columns;                       // one block for every column
+} ROLLUP_SERIES;
+
+typedef struct
+{
+    ROLLUP_SERIES   **series;                       // open addressing by device id
+    uint32_t        mask;
+    uint32_t        count;
+    ROLLUP_SERIES   *fleet;
+
+    uint64_t        late;                           // fixes older than every window
+} ROLLUP_DB;
+
+
+// Public function declarations
+int      rollup_init(ROLLUP_DB *db);
+void     rollup_free(ROLLUP_DB *db);
+
+int      rollup_add(ROLLUP_DB *db, uint64_t device, const FIXRECORD *rec);
+uint32_t rollup_query(const ROLLUP_DB *db, uint64_t device, int level, int64_t from, int64_t to,
+                      ROLLUP_POINT *point, uint32_t max_points);
+
+int      rollup_save(const ROLLUP_DB *db, const char *path);
+int      rollup_load(ROLLUP_DB *db, const char *path);
+
+#endif /* INC_ROLLUP_H_ */
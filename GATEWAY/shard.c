@@ -0,0 +1,992 @@
+/*
+ * shard.c - Consistent hash sharding of receiver streams.
+ *
+ * Router side: non-blocking sockets, one output and one input buffer per
+ * shard, driven by shard_router_poll (feed polls by itself when a shard
+ * falls SHARD_HIGH_WATER behind, so a slow shard throttles the router
+ * instead of growing memory). Handoff of a stream:
+ *
+ *   router -> old   SHARD_MSG_RELEASE       stream bytes are held from now on
+ *   old -> router   SHARD_MSG_CHECKPOINT    after its last SHARD_MSG_FIX of the stream
+ *   router -> new   SHARD_MSG_ADOPT, then the held bytes as SHARD_MSG_DATA
+ *
+ * Messages on one socket keep their order, so every fix the old shard
+ * produced reaches the router before the checkpoint does. A shard whose
+ * connection closes is gone: streams it was releasing restart on their new
+ * owner from the held bytes (its unsent fixes and partial line are lost),
+ * and a checkpoint for it is not waited for.
+ *
+ * Shard side: a blocking loop over one router connection with a table of
+ * per-stream checkpoints, see shard_worker_serve. Every line a stream
+ * completes is counted in its STREAM_COST, and a sample of the feed calls
+ * is timed whole, so a cost report is one walk over the table.
+ */
+
+#include "shard.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define READ_CHUNK          65536
+#define DATA_MAX            (1u << 20)          // payload of one SHARD_MSG_DATA
+#define WORKER_BUCKETS      4096
+
+
+static uint64_t mix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+static int buf_put(SHARD_BUF *b, const void *data, size_t len)
+{
+    if (b->head && b->head == b->len) b->head = b->len = 0;
+
+    if (b->len + len > b->cap)
+    {
+        // drop the consumed front before growing
+        if (b->head)
+        {
+            memmove(b->data, b->data + b->head, b->len - b->head);
+            b->len -= b->head;
+            b->head = 0;
+        }
+        if (b->len + len > b->cap)
+        {
+            size_t   cap = b->cap ? b->cap : 4096;
+            uint8_t *p;
+
+            while (cap < b->len + len) cap *= 2;
+            if (!(p = realloc(b->data, cap))) return -1;
+            b->data = p;
+            b->cap  = cap;
+        }
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+static size_t buf_pending(const SHARD_BUF *b)
+{
+    return b->len - b->head;
+}
+
+static void buf_free(SHARD_BUF *b)
+{
+    free(b->data);
+    memset(b, 0, sizeof(SHARD_BUF));
+}
+
+static int put_msg(SHARD_BUF *b, uint32_t type, uint64_t device, const void *payload, size_t len)
+{
+    SHARD_MSG m = { type, (uint32_t)len, device };
+
+    if (buf_put(b, &m, sizeof(m)) != 0) return -1;
+    return len ? buf_put(b, payload, len) : 0;
+}
+
+
+/*************************************** ring ***************************************/
+
+static int point_cmp(const void *a, const void *b)
+{
+    uint64_t x = ((const SHARD_POINT *)a)->hash, y = ((const SHARD_POINT *)b)->hash;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * shard_ring_build - vnodes points per shard on a 64 bit ring.
+ * A device belongs to the first point at or after its hash, so adding or
+ * removing a shard only moves the devices of that shard's arcs.
+ * @return  0, -1 if out of memory.
+ *
+ */
+int shard_ring_build(SHARD_RING *ring, const uint32_t *shard, uint32_t count, uint32_t vnodes)
+{
+    memset(ring, 0, sizeof(SHARD_RING));
+    if (count == 0) return 0;
+    if (vnodes == 0) vnodes = SHARD_VNODES;
+
+    ring->point = malloc((size_t)count * vnodes * sizeof(SHARD_POINT));
+    if (!ring->point) return -1;
+
+    for (uint32_t s = 0; s < count; s++)
+    {
+        for (uint32_t v = 0; v < vnodes; v++)
+        {
+            ring->point[ring->count].hash  = mix64(((uint64_t)shard[s] << 32) | v);
+            ring->point[ring->count].shard = shard[s];
+            ring->count++;
+        }
+    }
+    qsort(ring->point, ring->count, sizeof(SHARD_POINT), point_cmp);
+    return 0;
+}
+
+/*
+ * shard_ring_lookup - Owner of a device.
+ * @return  shard id, 0xFFFFFFFF if the ring is empty.
+ *
+ */
+uint32_t shard_ring_lookup(const SHARD_RING *ring, uint64_t device)
+{
+    uint64_t h = mix64(device);
+    uint32_t lo = 0, hi = ring->count;
+
+    if (ring->count == 0) return 0xFFFFFFFFu;
+
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+
+        if (ring->point[mid].hash < h) lo = mid + 1;
+        else hi = mid;
+    }
+    return ring->point[lo == ring->count ? 0 : lo].shard;
+}
+
+void shard_ring_free(SHARD_RING *ring)
+{
+    free(ring->point);
+    memset(ring, 0, sizeof(SHARD_RING));
+}
+
+
+/*************************************** router ***************************************/
+
+static SHARD_CONN *find_conn(SHARD_ROUTER *r, uint32_t shard)
+{
+    for (uint32_t i = 0; i < r->conn_count; i++)
+    {
+        if (r->conn[i].id == shard) return &r->conn[i];
+    }
+    return NULL;
+}
+
+static int grow_streams(SHARD_ROUTER *r)
+{
+    uint32_t      cap = (r->stream_mask + 1) * 2;
+    SHARD_STREAM *old = r->stream, *tab = calloc(cap, sizeof(SHARD_STREAM));
+
+    if (!tab) return -1;
+
+    for (uint32_t i = 0; i <= r->stream_mask; i++)
+    {
+        if (!old[i].device) continue;
+
+        uint32_t j = (uint32_t)mix64(old[i].device) & (cap - 1);
+        while (tab[j].device) j = (j + 1) & (cap - 1);
+        tab[j] = old[i];
+    }
+    free(old);
+    r->stream      = tab;
+    r->stream_mask = cap - 1;
+    return 0;
+}
+
+static SHARD_STREAM *find_stream(SHARD_ROUTER *r, uint64_t device, int create)
+{
+    uint32_t i;
+
+    if (create && (r->stream_count + 1) * 2 > r->stream_mask + 1 && grow_streams(r) != 0) return NULL;
+
+    i = (uint32_t)mix64(device) & r->stream_mask;
+    while (r->stream[i].device && r->stream[i].device != device) i = (i + 1) & r->stream_mask;
+
+    if (r->stream[i].device) return &r->stream[i];
+    if (!create) return NULL;
+
+    r->stream[i].device = device;
+    r->stream[i].owner  = shard_ring_lookup(&r->ring, device);
+    r->stream_count++;
+    return &r->stream[i];
+}
+
+static int conn_alive(const SHARD_CONN *c)
+{
+    return c && !c->closed;
+}
+
+/*
+ * finish_handoff - Hands a moving stream to its target: the checkpoint
+ * (NULL: the target starts the stream fresh) and the held bytes. Without a
+ * live target the held bytes are dropped, like bytes fed to a dead shard.
+ *
+ */
+static void finish_handoff(SHARD_ROUTER *r, SHARD_STREAM *s, const uint8_t *payload, uint32_t len)
+{
+    SHARD_CONN *c = find_conn(r, s->target);
+
+    if (conn_alive(c))
+    {
+        if (payload) put_msg(&c->out, SHARD_MSG_ADOPT, s->device, payload, len);
+        for (size_t off = s->held.head; off < s->held.len; off += DATA_MAX)
+        {
+            size_t n = s->held.len - off < DATA_MAX ? s->held.len - off : DATA_MAX;
+            put_msg(&c->out, SHARD_MSG_DATA, s->device, s->held.data + off, n);
+        }
+    }
+    buf_free(&s->held);
+
+    s->owner  = s->target;
+    s->moving = 0;
+    r->moving--;
+}
+
+/* checkpoint of a released stream: forward it and the held bytes to the new owner */
+static void complete_handoff(SHARD_ROUTER *r, uint64_t device, const uint8_t *payload, uint32_t len)
+{
+    SHARD_STREAM *s = find_stream(r, device, 0);
+
+    if (s && s->moving) finish_handoff(r, s, payload, len);
+}
+
+/* the shard closed or broke its connection: no checkpoint or cost report will come */
+static void conn_lost(SHARD_ROUTER *r, SHARD_CONN *c)
+{
+    if (c->closed) return;
+
+    c->closed = 1;
+    buf_free(&c->out);
+
+    for (uint32_t i = 0; i <= r->stream_mask; i++)
+    {
+        SHARD_STREAM *s = &r->stream[i];
+
+        if (s->device && s->moving && s->owner == c->id) finish_handoff(r, s, NULL, 0);
+    }
+    if (c->cost_pending && r->cost_wait) r->cost_wait--;
+    c->cost_pending = 0;
+}
+
+static void handle_input(SHARD_ROUTER *r, SHARD_CONN *c)
+{
+    SHARD_MSG m;
+
+    while (c->in.len - c->in.head >= sizeof(SHARD_MSG))
+    {
+        memcpy(&m, c->in.data + c->in.head, sizeof(m));
+        if (c->in.len - c->in.head < sizeof(m) + m.len) break;
+
+        const uint8_t *payload = c->in.data + c->in.head + sizeof(m);
+
+        if (m.type == SHARD_MSG_FIX && m.len == sizeof(FIXRECORD))
+        {
+            FIXRECORD rec;
+
+            memcpy(&rec, payload, sizeof(rec));
+            if (r->deliver) r->deliver(m.device, &rec, r->ctx);
+        }
+        else if (m.type == SHARD_MSG_CHECKPOINT && m.len == sizeof(SHARD_CHECKPOINT))
+        {
+            complete_handoff(r, m.device, payload, m.len);
+        }
+        else if (m.type == SHARD_MSG_COST && m.device == r->cost_query && c->cost_pending)
+        {
+            for (uint32_t off = 0; off + sizeof(STREAM_COST_ENTRY) <= m.len; off += sizeof(STREAM_COST_ENTRY))
+            {
+                STREAM_COST_ENTRY e;
+
+                memcpy(&e, payload + off, sizeof(e));
+                e.shard = c->id;
+                r->cost_count = stream_cost_rank(r->cost_top, r->cost_count, r->cost_n, &e);
+            }
+            c->cost_pending = 0;
+            r->cost_wait--;
+        }
+        c->in.head += sizeof(m) + m.len;
+    }
+
+    if (c->in.head == c->in.len) c->in.head = c->in.len = 0;
+}
+
+/* reads what is available, 0 or -1 on a broken connection */
+static int conn_read(SHARD_ROUTER *r, SHARD_CONN *c)
+{
+    uint8_t chunk[READ_CHUNK];
+
+    for (;;)
+    {
+        ssize_t n = recv(c->fd, chunk, sizeof(chunk), 0);
+
+        if (n > 0)
+        {
+            if (buf_put(&c->in, chunk, (size_t)n) != 0) return -1;
+            handle_input(r, c);
+            continue;
+        }
+        if (n == 0)
+        {
+            conn_lost(r, c);
+            return 0;
+        }
+        if (errno == EINTR) continue;
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+}
+
+static int conn_write(SHARD_CONN *c)
+{
+    while (buf_pending(&c->out))
+    {
+        ssize_t n = send(c->fd, c->out.data + c->out.head, buf_pending(&c->out), MSG_NOSIGNAL);
+
+        if (n > 0)
+        {
+            c->out.head += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        return (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ? 0 : -1;
+    }
+    c->out.head = c->out.len = 0;
+    return 0;
+}
+
+
+int shard_router_init(SHARD_ROUTER *r, shard_deliver deliver, void *ctx)
+{
+    memset(r, 0, sizeof(SHARD_ROUTER));
+
+    r->stream = calloc(1024, sizeof(SHARD_STREAM));
+    if (!r->stream) return -1;
+
+    r->stream_mask = 1023;
+    r->deliver     = deliver;
+    r->ctx         = ctx;
+    return 0;
+}
+
+/*
+ * shard_router_attach - Adds a connected shard, it gets streams once it is
+ * part of the ring (shard_router_set_ring).
+ * @return  0, -1 if the id is taken or the table is full.
+ *
+ */
+int shard_router_attach(SHARD_ROUTER *r, uint32_t shard, int fd)
+{
+    if (r->conn_count == SHARD_MAX || find_conn(r, shard)) return -1;
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) return -1;
+
+    SHARD_CONN *c = &r->conn[r->conn_count++];
+    memset(c, 0, sizeof(SHARD_CONN));
+    c->id = shard;
+    c->fd = fd;
+    return 0;
+}
+
+/*
+ * shard_router_set_ring - Makes the given shards the ring and starts a
+ * handoff for every stream whose owner changes. Completes through
+ * shard_router_poll; a stream may move again before its handoff is done.
+ * @return  number of handoffs started, -1 if a shard is not attached.
+ *
+ */
+int shard_router_set_ring(SHARD_ROUTER *r, const uint32_t *shard, uint32_t count)
+{
+    SHARD_RING ring;
+    int        started = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!find_conn(r, shard[i])) return -1;
+    }
+    if (shard_ring_build(&ring, shard, count, SHARD_VNODES) != 0) return -1;
+
+    shard_ring_free(&r->ring);
+    r->ring = ring;
+
+    for (uint32_t i = 0; i <= r->stream_mask; i++)
+    {
+        SHARD_STREAM *s = &r->stream[i];
+        uint32_t      owner;
+
+        if (!s->device) continue;
+
+        owner = shard_ring_lookup(&r->ring, s->device);
+        if (s->moving)
+        {
+            s->target = owner;                  // the checkpoint goes to the latest owner
+            continue;
+        }
+        if (owner == s->owner) continue;
+
+        SHARD_CONN *c = find_conn(r, s->owner);
+        if (!conn_alive(c) || put_msg(&c->out, SHARD_MSG_RELEASE, s->device, NULL, 0) != 0)
+        {
+            s->owner = owner;                   // old shard is gone: restart the stream there
+            continue;
+        }
+        s->target = owner;
+        s->moving = 1;
+        r->moving++;
+        r->handoffs++;
+        started++;
+    }
+    return started;
+}
+
+/*
+ * shard_router_feed - Routes receiver bytes of a device to its shard.
+ * @return  0, -1 without shards or when the shard is gone (the bytes are
+ *          dropped until a new ring moves the stream).
+ *
+ */
+int shard_router_feed(SHARD_ROUTER *r, uint64_t device, const void *data, size_t len)
+{
+    SHARD_STREAM *s;
+    SHARD_CONN   *c;
+
+    if (device == 0 || r->ring.count == 0 || !(s = find_stream(r, device, 1))) return -1;
+
+    if (s->moving) return buf_put(&s->held, data, len);
+    if (!conn_alive(c = find_conn(r, s->owner))) return -1;
+
+    for (size_t off = 0; off < len; off += DATA_MAX)
+    {
+        size_t n = len - off < DATA_MAX ? len - off : DATA_MAX;
+
+        if (put_msg(&c->out, SHARD_MSG_DATA, device, (const uint8_t *)data + off, n) != 0) return -1;
+    }
+
+    // back pressure: let the shard catch up (its fixes are read meanwhile)
+    while (buf_pending(&c->out) > SHARD_HIGH_WATER)
+    {
+        if (c->closed || shard_router_poll(r, 100) < 0) return -1;
+    }
+    return 0;
+}
+
+/*
+ * shard_router_poll - Moves queued bytes, delivers fixes, completes handoffs.
+ * @return  handoffs still in flight, -1 on a broken connection.
+ *
+ */
+int shard_router_poll(SHARD_ROUTER *r, int timeout_ms)
+{
+    struct pollfd pfd[SHARD_MAX];
+    int           rc = 0;
+
+    for (uint32_t i = 0; i < r->conn_count; i++)
+    {
+        pfd[i].fd      = r->conn[i].closed ? -1 : r->conn[i].fd;
+        pfd[i].events  = (short)(POLLIN | (buf_pending(&r->conn[i].out) ? POLLOUT : 0));
+        pfd[i].revents = 0;
+    }
+
+    if (poll(pfd, r->conn_count, timeout_ms) < 0) return errno == EINTR ? (int)r->moving : -1;
+
+    for (uint32_t i = 0; i < r->conn_count; i++)
+    {
+        SHARD_CONN *c = &r->conn[i];
+
+        int         broken = 0;
+
+        if (pfd[i].revents & POLLOUT) broken |= conn_write(c);
+        if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) broken |= conn_read(r, c);
+        if (broken < 0) conn_lost(r, c);
+        rc |= broken;
+    }
+    return rc < 0 ? -1 : (int)r->moving;
+}
+
+/*
+ * shard_router_costs - Asks every shard for its most expensive streams and
+ * merges the answers into top (n entries, most expensive first). A shard
+ * reports at most STREAM_COST_TOP_MAX streams; shards that do not answer
+ * within timeout_ms are left out. Streams in a handoff are in no report.
+ * @return  entries in top, -1 on a broken connection.
+ *
+ */
+int shard_router_costs(SHARD_ROUTER *r, STREAM_COST_ENTRY *top, uint32_t n, int timeout_ms)
+{
+    uint32_t        want = n < STREAM_COST_TOP_MAX ? n : STREAM_COST_TOP_MAX;
+    struct timespec start, now;
+    int             rc = 0;
+
+    r->cost_top   = top;
+    r->cost_n     = n;
+    r->cost_count = 0;
+    r->cost_wait  = 0;
+    r->cost_query++;
+
+    for (uint32_t i = 0; i < r->conn_count; i++)
+    {
+        SHARD_CONN *c = &r->conn[i];
+
+        c->cost_pending = 0;
+        if (!c->closed && put_msg(&c->out, SHARD_MSG_COST_QUERY, r->cost_query, &want, sizeof(want)) == 0)
+        {
+            c->cost_pending = 1;
+            r->cost_wait++;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (r->cost_wait)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        long elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed >= timeout_ms) break;
+        if (shard_router_poll(r, (int)(timeout_ms - elapsed)) < 0)
+        {
+            rc = -1;
+            break;
+        }
+    }
+
+    r->cost_top  = NULL;
+    r->cost_wait = 0;
+    return rc < 0 ? -1 : (int)r->cost_count;
+}
+
+/* flushes, half closes and reads the shard until it closes too */
+static int drain_conn(SHARD_ROUTER *r, SHARD_CONN *c)
+{
+    while (buf_pending(&c->out) && !c->closed)
+    {
+        if (shard_router_poll(r, 1000) < 0) return -1;
+    }
+    shutdown(c->fd, SHUT_WR);
+    while (!c->closed)
+    {
+        if (shard_router_poll(r, 1000) < 0) return -1;
+    }
+    return 0;
+}
+
+/*
+ * shard_router_detach - Removes a shard that owns no stream any more (left
+ * the ring and its handoffs completed). Its last fixes are delivered first.
+ * @return  0, -1 if unknown or still in use.
+ *
+ */
+int shard_router_detach(SHARD_ROUTER *r, uint32_t shard)
+{
+    SHARD_CONN *c = find_conn(r, shard);
+    int         rc;
+
+    if (!c) return -1;
+    for (uint32_t i = 0; i <= r->stream_mask; i++)
+    {
+        const SHARD_STREAM *s = &r->stream[i];
+
+        if (s->device && (s->owner == shard || (s->moving && s->target == shard))) return -1;
+    }
+
+    rc = drain_conn(r, c);
+    close(c->fd);
+    buf_free(&c->out);
+    buf_free(&c->in);
+    *c = r->conn[--r->conn_count];
+    return rc;
+}
+
+/*
+ * shard_router_close - Lets every shard finish, delivers the remaining
+ * fixes and frees the router. Handoffs in flight are completed first.
+ * @return  0, -1 if a connection broke.
+ *
+ */
+int shard_router_close(SHARD_ROUTER *r)
+{
+    int rc = 0;
+
+    while (r->moving && rc >= 0) rc = shard_router_poll(r, 1000);
+
+    for (uint32_t i = 0; i < r->conn_count; i++)
+    {
+        if (drain_conn(r, &r->conn[i]) != 0) rc = -1;
+    }
+    for (uint32_t i = 0; i < r->conn_count; i++)
+    {
+        close(r->conn[i].fd);
+        buf_free(&r->conn[i].out);
+        buf_free(&r->conn[i].in);
+    }
+    for (uint32_t i = 0; i <= r->stream_mask; i++) buf_free(&r->stream[i].held);
+
+    free(r->stream);
+    shard_ring_free(&r->ring);
+    memset(r, 0, sizeof(SHARD_ROUTER));
+    return rc < 0 ? -1 : 0;
+}
+
+
+/*************************************** shard ***************************************/
+
+static int hexval(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+/* '$' ... '*' hh with a matching checksum */
+static int line_valid(const char *line, size_t len)
+{
+    uint8_t sum = 0;
+    size_t  i;
+
+    for (i = 1; i < len && line[i] != '*'; i++) sum ^= (uint8_t)line[i];
+    if (i + 3 > len) return 0;
+    return hexval(line[i + 1]) >= 0 && hexval(line[i + 2]) >= 0 &&
+           sum == (uint8_t)(hexval(line[i + 1]) * 16 + hexval(line[i + 2]));
+}
+
+/*
+ * decode_line - Decodes the completed line of a stream.
+ * @return  1 GGA / RMC decoded, 0 other valid sentence, -1 invalid line.
+ *
+ */
+static int decode_line(SHARD_CHECKPOINT *s, shard_emit emit, void *ctx)
+{
+    char      line[NMEA_SENTENCE_MAX + 1];
+    FIXRECORD rec;
+
+    if (s->partial_len < 7 || !line_valid(s->partial, s->partial_len)) return -1;
+    if (s->partial[0] != '$') return 0;
+
+    memcpy(line, s->partial, s->partial_len);
+    line[s->partial_len] = '\0';
+
+    if (memcmp(line + 3, "RMC,", 4) == 0)
+    {
+        decodeRMCIncremental(line, &s->gps.rmcstruct, &s->rmc);
+        return 1;
+    }
+    else if (memcmp(line + 3, "GGA,", 4) == 0)
+    {
+        decodeGGAIncremental(line, &s->gps.ggastruct, &s->gga);
+        fix_record_from_gps(&rec, &s->gps);
+        s->fixes++;
+        if (emit) emit(s, &rec, ctx);
+        return 1;
+    }
+    return 0;
+}
+
+static void end_line(SHARD_CHECKPOINT *s, shard_emit emit, void *ctx)
+{
+    int kind;
+
+    if (s->overflow)
+    {
+        s->cost.invalid++;
+        return;
+    }
+
+    kind = decode_line(s, emit, ctx);
+    if (kind < 0)
+    {
+        s->cost.invalid++;
+        return;
+    }
+    s->cost.sentences++;
+    if (kind > 0) s->cost.decoded++;
+}
+
+/*
+ * shard_stream_init - Fresh stream state, nothing decoded yet.
+ *
+ */
+void shard_stream_init(SHARD_CHECKPOINT *s, uint64_t device)
+{
+    memset(s, 0, sizeof(SHARD_CHECKPOINT));
+    s->device = device;
+    initGPS(&s->gps);
+    initHistory(&s->gga);
+    initHistory(&s->rmc);
+    stream_cost_init(&s->cost, device);
+}
+
+/*
+ * shard_stream_feed - Decodes stream bytes, cut anywhere; one fix per valid
+ * GGA (with the date, speed and course of the last RMC). A line that does
+ * not fit NMEA_SENTENCE_MAX, or is cut by a new '$', is dropped. Bytes,
+ * lines and (sampled) time of the whole call, garbage included, are added
+ * to the stream's cost.
+ *
+ */
+void shard_stream_feed(SHARD_CHECKPOINT *s, const char *data, size_t len, shard_emit emit, void *ctx)
+{
+    uint64_t start = stream_cost_begin(&s->cost);
+
+    s->bytes      += len;
+    s->cost.bytes += len;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = data[i];
+
+        if (c == '\r' || c == '\n')
+        {
+            if (s->partial_len) end_line(s, emit, ctx);
+            s->partial_len = 0;
+            s->overflow    = 0;
+        }
+        else if (c == '$' || c == '!')
+        {
+            if (s->partial_len) s->cost.invalid++;
+            s->partial[0]  = c;
+            s->partial_len = 1;
+            s->overflow    = 0;
+        }
+        else if (s->partial_len == 0)
+        {
+            s->cost.garbage++;
+        }
+        else if (s->partial_len < NMEA_SENTENCE_MAX)
+        {
+            s->partial[s->partial_len++] = c;
+        }
+        else
+        {
+            s->overflow = 1;
+        }
+    }
+    stream_cost_end(&s->cost, start);
+}
+
+typedef struct WORKER_STREAM
+{
+    SHARD_CHECKPOINT        cp;
+    struct WORKER_STREAM    *next;
+} WORKER_STREAM;
+
+static WORKER_STREAM **worker_slot(WORKER_STREAM **bucket, uint64_t device)
+{
+    WORKER_STREAM **p = &bucket[mix64(device) % WORKER_BUCKETS];
+
+    while (*p && (*p)->cp.device != device) p = &(*p)->next;
+    return p;
+}
+
+static void emit_fix(const SHARD_CHECKPOINT *s, const FIXRECORD *rec, void *ctx)
+{
+    put_msg((SHARD_BUF *)ctx, SHARD_MSG_FIX, s->device, rec, sizeof(FIXRECORD));
+}
+
+/* answers SHARD_MSG_COST_QUERY with the top n streams of this shard */
+static int report_costs(WORKER_STREAM **bucket, SHARD_BUF *out, uint64_t query, const uint8_t *payload, uint32_t len)
+{
+    STREAM_COST_ENTRY top[STREAM_COST_TOP_MAX], e;
+    uint32_t          n = 0, count = 0;
+
+    if (len == sizeof(n)) memcpy(&n, payload, sizeof(n));
+    if (n > STREAM_COST_TOP_MAX) n = STREAM_COST_TOP_MAX;
+
+    memset(&e, 0, sizeof(e));
+    for (uint32_t i = 0; i < WORKER_BUCKETS; i++)
+    {
+        for (const WORKER_STREAM *ws = bucket[i]; ws; ws = ws->next)
+        {
+            e.device = ws->cp.device;
+            e.cost   = ws->cp.cost;
+            count    = stream_cost_rank(top, count, n, &e);
+        }
+    }
+    return put_msg(out, SHARD_MSG_COST, query, top, count * sizeof(STREAM_COST_ENTRY));
+}
+
+static int send_all(int fd, SHARD_BUF *b)
+{
+    while (buf_pending(b))
+    {
+        ssize_t n = send(fd, b->data + b->head, buf_pending(b), MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        b->head += (size_t)n;
+    }
+    b->head = b->len = 0;
+    return 0;
+}
+
+/*
+ * shard_worker_serve - Shard main loop on a router connection: decodes
+ * SHARD_MSG_DATA into SHARD_MSG_FIX, answers SHARD_MSG_RELEASE with the
+ * checkpoint (the stream is forgotten) and resumes streams from
+ * SHARD_MSG_ADOPT.
+ * @return  0 when the router closed the connection, -1 on an error.
+ *          The caller closes fd.
+ *
+ */
+int shard_worker_serve(int fd)
+{
+    WORKER_STREAM **bucket = calloc(WORKER_BUCKETS, sizeof(WORKER_STREAM *));
+    SHARD_BUF     in, out;
+    uint8_t       chunk[READ_CHUNK];
+    int           rc = 0;
+
+    memset(&in, 0, sizeof(in));
+    memset(&out, 0, sizeof(out));
+    if (!bucket) return -1;
+
+    for (;;)
+    {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0)
+        {
+            rc = n < 0 ? -1 : 0;
+            break;
+        }
+        if (buf_put(&in, chunk, (size_t)n) != 0)
+        {
+            rc = -1;
+            break;
+        }
+
+        SHARD_MSG m;
+        while (in.len - in.head >= sizeof(m))
+        {
+            memcpy(&m, in.data + in.head, sizeof(m));
+            if (in.len - in.head < sizeof(m) + m.len) break;
+
+            const uint8_t  *payload = in.data + in.head + sizeof(m);
+            WORKER_STREAM **slot = worker_slot(bucket, m.device);
+            WORKER_STREAM  *ws = *slot;
+
+            if (!ws && (m.type == SHARD_MSG_DATA || m.type == SHARD_MSG_ADOPT))
+            {
+                if (!(ws = malloc(sizeof(WORKER_STREAM))))
+                {
+                    rc = -1;
+                    goto done;
+                }
+                shard_stream_init(&ws->cp, m.device);
+                ws->next = NULL;
+                *slot = ws;
+            }
+
+            switch (m.type)
+            {
+                case SHARD_MSG_DATA:
+                    shard_stream_feed(&ws->cp, (const char *)payload, m.len, emit_fix, &out);
+                    break;
+
+                case SHARD_MSG_ADOPT:
+                    if (m.len == sizeof(SHARD_CHECKPOINT)) memcpy(&ws->cp, payload, sizeof(SHARD_CHECKPOINT));
+                    ws->cp.device = m.device;
+                    break;
+
+                case SHARD_MSG_RELEASE:
+                    if (ws)
+                    {
+                        put_msg(&out, SHARD_MSG_CHECKPOINT, m.device, &ws->cp, sizeof(SHARD_CHECKPOINT));
+                        *slot = ws->next;
+                        free(ws);
+                    }
+                    else
+                    {
+                        SHARD_CHECKPOINT fresh;
+
+                        shard_stream_init(&fresh, m.device);
+                        put_msg(&out, SHARD_MSG_CHECKPOINT, m.device, &fresh, sizeof(fresh));
+                    }
+                    break;
+
+                case SHARD_MSG_COST_QUERY:
+                    if (report_costs(bucket, &out, m.device, payload, m.len) != 0)
+                    {
+                        rc = -1;
+                        goto done;
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+            in.head += sizeof(m) + m.len;
+        }
+        if (in.head == in.len) in.head = in.len = 0;
+
+        if (send_all(fd, &out) != 0)
+        {
+            rc = -1;
+            break;
+        }
+    }
+
+done:
+    for (uint32_t i = 0; i < WORKER_BUCKETS; i++)
+    {
+        while (bucket[i])
+        {
+            WORKER_STREAM *next = bucket[i]->next;
+            free(bucket[i]);
+            bucket[i] = next;
+        }
+    }
+    free(bucket);
+    buf_free(&in);
+    buf_free(&out);
+    return rc;
+}
+
+
+/*************************************** sockets ***************************************/
+
+static int unix_address(struct sockaddr_un *addr, const char *path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) return -1;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+/*
+ * shard_listen - Listening Unix socket for a shard process (path replaced).
+ * @return  fd, -1 on error.
+ *
+ */
+int shard_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    int                fd;
+
+    if (unix_address(&addr, path) != 0 || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * shard_connect - Router side connection to a shard's socket.
+ * @return  fd, -1 on error.
+ *
+ */
+int shard_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    int                fd;
+
+    if (unix_address(&addr, path) != 0 || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,149 @@
+/*
+ * shard.h
+ *
+ * Sharding of receiver streams over parser processes. A router owns the
+ * device connections and forwards each stream to the shard chosen by a
+ * consistent hash ring; the shards decode and send FIXRECORDs back, which
+ * the router merges into one output. When the ring changes only the
+ * streams whose owner changed move: the old shard returns the stream's
+ * checkpoint (partial line + decoder state), the new shard resumes from
+ * it, and bytes arriving meanwhile are held by the router, so no sentence
+ * is lost or decoded twice and fixes of a device stay in order.
+ *
+ * Router and shards talk over stream sockets (Unix sockets locally) with
+ * SHARD_MSG framed messages; checkpoints are raw structs, so all processes
+ * must run the same build. Each stream's decode cost (STREAM_COST) lives
+ * in its checkpoint, and shard_router_costs collects the most expensive
+ * streams from all shards.
+ */
+
+#ifndef INC_SHARD_H_
+#define INC_SHARD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "fix_record.h"
+#include "stream_cost.h"
+
+#define SHARD_MAX               64                  // shard connections per router
+#define SHARD_VNODES            128                 // ring points per shard
+#define SHARD_HIGH_WATER        (1u << 20)          // queued bytes per shard before feed waits
+
+enum
+{
+    SHARD_MSG_DATA = 1,                             // router -> shard: receiver bytes
+    SHARD_MSG_RELEASE,                              // router -> shard: return the stream's checkpoint
+    SHARD_MSG_ADOPT,                                // router -> shard: SHARD_CHECKPOINT to resume from
+    SHARD_MSG_CHECKPOINT,                           // shard -> router: reply to SHARD_MSG_RELEASE
+    SHARD_MSG_FIX,                                  // shard -> router: FIXRECORD
+    SHARD_MSG_COST_QUERY,                           // router -> shard: uint32_t n, device = query number
+    SHARD_MSG_COST                                  // shard -> router: its top n STREAM_COST_ENTRYs
+};
+
+typedef struct
+{
+    uint32_t    type;
+    uint32_t    len;                                // payload bytes after the header
+    uint64_t    device;
+} SHARD_MSG;
+
+// SHARD_CHECKPOINT: everything a shard knows about one stream
+typedef struct
+{
+    uint64_t        device;
+    uint64_t        bytes;                          // stream bytes consumed
+    uint64_t        fixes;                          // fixes emitted
+    GPSSTRUCT       gps;                            // last decoded epoch
+    NMEA_HISTORY    gga, rmc;                       // incremental decoder state
+    uint8_t         partial_len;                    // unterminated line so far
+    uint8_t         overflow;                       // line too long, skipping to its end
+    char            partial[NMEA_SENTENCE_MAX];
+    STREAM_COST     cost;
+} SHARD_CHECKPOINT;
+
+typedef struct
+{
+    uint64_t    hash;
+    uint32_t    shard;
+} SHARD_POINT;
+
+typedef struct
+{
+    SHARD_POINT *point;                             // sorted by hash
+    uint32_t    count;
+} SHARD_RING;
+
+typedef struct
+{
+    uint8_t     *data;
+    size_t      len, cap;
+    size_t      head;                               // consumed bytes (out buffers)
+} SHARD_BUF;
+
+typedef struct
+{
+    uint32_t    id;
+    int         fd;
+    uint8_t     closed;                             // shard closed its side or the connection broke
+    uint8_t     cost_pending;                       // shard_router_costs waits for its answer
+    SHARD_BUF   out, in;
+} SHARD_CONN;
+
+typedef struct
+{
+    uint64_t    device;                             // 0 = free slot
+    uint32_t    owner;                              // shard id
+    uint32_t    target;                             // shard id the stream moves to
+    uint8_t     moving;
+    SHARD_BUF   held;                               // bytes received while moving
+} SHARD_STREAM;
+
+typedef void (*shard_deliver)(uint64_t device, const FIXRECORD *rec, void *ctx);
+typedef void (*shard_emit)(const SHARD_CHECKPOINT *s, const FIXRECORD *rec, void *ctx);
+
+typedef struct
+{
+    SHARD_RING      ring;
+    SHARD_CONN      conn[SHARD_MAX];
+    uint32_t        conn_count;
+
+    SHARD_STREAM    *stream;                        // open addressing by device id
+    uint32_t        stream_mask;
+    uint32_t        stream_count;
+    uint32_t        moving;                         // handoffs in flight
+
+    shard_deliver   deliver;
+    void            *ctx;
+
+    uint64_t        handoffs;
+
+    /* shard_router_costs in progress */
+    STREAM_COST_ENTRY   *cost_top;
+    uint32_t        cost_n, cost_count;
+    uint32_t        cost_wait;                      // shards that have not answered
+    uint64_t        cost_query;                     // number of the current query
+} SHARD_ROUTER;
+
+
+// Public function declarations
+int      shard_ring_build(SHARD_RING *ring, const uint32_t *shard, uint32_t count, uint32_t vnodes);
+uint32_t shard_ring_lookup(const SHARD_RING *ring, uint64_t device);
+void     shard_ring_free(SHARD_RING *ring);
+
+int      shard_router_init(SHARD_ROUTER *r, shard_deliver deliver, void *ctx);
+int      shard_router_attach(SHARD_ROUTER *r, uint32_t shard, int fd);
+int      shard_router_detach(SHARD_ROUTER *r, uint32_t shard);
+int      shard_router_set_ring(SHARD_ROUTER *r, const uint32_t *shard, uint32_t count);
+int      shard_router_feed(SHARD_ROUTER *r, uint64_t device, const void *data, size_t len);
+int      shard_router_poll(SHARD_ROUTER *r, int timeout_ms);
+int      shard_router_costs(SHARD_ROUTER *r, STREAM_COST_ENTRY *top, uint32_t n, int timeout_ms);
+int      shard_router_close(SHARD_ROUTER *r);
+
+void     shard_stream_init(SHARD_CHECKPOINT *s, uint64_t device);
+void     shard_stream_feed(SHARD_CHECKPOINT *s, const char *data, size_t len, shard_emit emit, void *ctx);
+int      shard_worker_serve(int fd);
+
+int      shard_listen(const char *path);
+int      shard_connect(const char *path);
+
+#endif /* INC_SHARD_H_ */
@@ -0,0 +1,101 @@
+/*
+ * stream_cost.c - Sampled per-stream CPU cost.
+ * The gap to the next sample is drawn uniformly from 1 .. 2 * PERIOD - 1
+ * and a sample is weighted by the gap that led to it, so the sum of the
+ * weighted samples estimates the time of all calls without bias. The clock
+ * is the time stamp counter where there is one (rdtsc / cntvct), else a
+ * monotonic nanosecond clock: ticks compare streams with each other, they
+ * are not converted to seconds.
+ */
+
+#include "stream_cost.h"
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+/*
+ * stream_cost_clock - Current time stamp counter.
+ * @return  ticks.
+ *
+ */
+uint64_t stream_cost_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static uint32_t next_gap(STREAM_COST *c)
+{
+    uint32_t x = c->rng;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    c->rng = x;
+    return 1 + x % (2 * STREAM_COST_PERIOD - 1);
+}
+
+/*
+ * stream_cost_init - Zero counters, first sample at a random call.
+ *
+ */
+void stream_cost_init(STREAM_COST *c, uint64_t seed)
+{
+    memset(c, 0, sizeof(STREAM_COST));
+    c->rng = (uint32_t)(seed ^ (seed >> 32)) | 1;       // xorshift state must not be 0
+    c->weight    = next_gap(c);
+    c->countdown = c->weight;
+}
+
+/*
+ * stream_cost_sample - Adds a timed call (from stream_cost_end) and draws
+ * the next sampling point.
+ *
+ */
+void stream_cost_sample(STREAM_COST *c, uint64_t ticks)
+{
+    c->ticks += ticks * c->weight;
+    c->samples++;
+    c->weight    = next_gap(c);
+    c->countdown = c->weight;
+}
+
+/*
+ * stream_cost_rank - Inserts e into top, count entries sorted by
+ * stream_cost_total (most expensive first) and at most n long.
+ * @return  the new count.
+ *
+ */
+uint32_t stream_cost_rank(STREAM_COST_ENTRY *top, uint32_t count, uint32_t n, const STREAM_COST_ENTRY *e)
+{
+    uint32_t i     = count;
+    uint64_t total = stream_cost_total(&e->cost);
+
+    if (n == 0 || (count == n && total <= stream_cost_total(&top[n - 1].cost))) return count;
+
+    if (count < n) count++;
+    else i = n - 1;                                     // the last one falls out
+
+    while (i > 0 && stream_cost_total(&top[i - 1].cost) < total)
+    {
+        top[i] = top[i - 1];
+        i--;
+    }
+    top[i] = *e;
+    return count;
+}
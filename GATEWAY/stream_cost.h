@@ -0,0 +1,82 @@
+/*
+ * stream_cost.h
+ *
+ * Per-stream cost accounting for the decode pipeline: bytes and sentences
+ * are counted exactly, CPU time is sampled. About one feed call in
+ * STREAM_COST_PERIOD is timed whole with the time stamp counter (the byte
+ * scan, garbage and overlong lines as well as the decoding), at random
+ * intervals so periodic sentence patterns (GGA, RMC, 3 x GSV, ...) can not
+ * alias with the sampling, and each sample is weighted by the calls it
+ * stands for. Streams are ranked on stream_cost_total: the estimated time
+ * plus STREAM_COST_BYTE_TICKS per byte for receiving and forwarding it,
+ * which the feed does not see. The top-N streams are reported through the
+ * shard router, see shard_router_costs.
+ */
+
+#ifndef INC_STREAM_COST_H_
+#define INC_STREAM_COST_H_
+
+#include <stdint.h>
+
+#define STREAM_COST_PERIOD      16                  // feed calls per sample on average
+#define STREAM_COST_BYTE_TICKS  2                   // per byte, outside the timed feed
+#define STREAM_COST_TOP_MAX     256                 // largest top-N a shard reports
+
+// STREAM_COST: counters of one stream, travels with its checkpoint
+typedef struct
+{
+    uint64_t    bytes;
+    uint64_t    sentences;                          // complete lines with a valid checksum
+    uint64_t    decoded;                            // of which GGA / RMC
+    uint64_t    invalid;                            // lines with a bad checksum, overlong or cut
+    uint64_t    garbage;                            // bytes outside any sentence
+    uint64_t    ticks;                              // estimated feed time, time stamp counter ticks
+    uint32_t    samples;
+    uint32_t    countdown;                          // feed calls until the next sample
+    uint32_t    weight;                             // calls the next sample stands for
+    uint32_t    rng;
+} STREAM_COST;
+
+// STREAM_COST_ENTRY: one line of a top-N report
+typedef struct
+{
+    uint64_t    device;
+    uint32_t    shard;
+    uint32_t    reserved;
+    STREAM_COST cost;
+} STREAM_COST_ENTRY;
+
+
+// Public function declarations
+uint64_t stream_cost_clock(void);
+void     stream_cost_init(STREAM_COST *c, uint64_t seed);
+void     stream_cost_sample(STREAM_COST *c, uint64_t ticks);
+uint32_t stream_cost_rank(STREAM_COST_ENTRY *top, uint32_t count, uint32_t n, const STREAM_COST_ENTRY *e);
+
+/*
+ * stream_cost_begin / stream_cost_end - Bracket one feed call; only the
+ * sampled calls read the clock.
+ *
+ */
+static inline uint64_t stream_cost_begin(STREAM_COST *c)
+{
+    return --c->countdown == 0 ? stream_cost_clock() : 0;
+}
+
+static inline void stream_cost_end(STREAM_COST *c, uint64_t start)
+{
+    if (start) stream_cost_sample(c, stream_cost_clock() - start);
+}
+
+/*
+ * stream_cost_total - What streams are ranked on: the estimated feed time
+ * plus the per-byte share outside it.
+ * @return  ticks.
+ *
+ */
+static inline uint64_t stream_cost_total(const STREAM_COST *c)
+{
+    return c->ticks + c->bytes * STREAM_COST_BYTE_TICKS;
+}
+
+#endif /* INC_STREAM_COST_H_ */
@@ -0,0 +1,538 @@
+/*
+ * ais_test.c - NMEA/gps_ais decoding, reassembly and rejection.
+ *
+ *   ais_test [messages]
+ *
+ * Besides the published sample sentences, messages are built bit by bit
+ * after ITU-R M.1371 with random field values, armoured and wrapped into
+ * sentences here, so every field of the result is known. Checked:
+ *   - the published type 1, 5, 18 and 19 samples: every field as their
+ *     published decode
+ *   - random type 18 and 19 messages (extreme coordinates, the "not
+ *     available" values, names of every 6 bit character, 0..5 fill bits):
+ *     every field
+ *   - a type 19 cut into two fragments at every character, into three
+ *     at random places, a 5 fragment message of the longest length, two
+ *     messages with their fragments interleaved: the same message as sent
+ *     in one sentence; one character longer is refused
+ *   - fragments out of order or one missing in the middle: the rest of
+ *     the message refused; a message started again taken from its new
+ *     first fragment; all slots busy: the oldest gives way
+ *   - a slot waiting for its next fragment: completed after
+ *     AIS_SLOT_MAX_AGE - 1 other sentences, given up after
+ *     AIS_SLOT_MAX_AGE, its last fragment then refused
+ *   - every character of a sentence changed, and the checksum itself:
+ *     refused and counted as bad checksum
+ *   - fill bits out of 0..5 or not a digit, fill bits leaving a message
+ *     too short for its type, a character outside the armour (where four
+ *     are taken at a time and in the last ones): refused and counted as
+ *     bad payload
+ */
+
+#include "gps_ais.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SENTENCE_MAX    100
+
+typedef struct
+{
+    uint8_t     d[AIS_MAX_BITS / 8 + 8];
+    unsigned    n;
+} BITS;
+
+static const char sixbit_text[65] = "@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_ !\"#$%&'()*+,-./0123456789:;<=>?";
+
+static const char *type1_sample = "!AIVDM,1,1,,B,177KQJ5000G?tO`K>RA1wUbN0TKH,0*5C";
+static const char *type5_sample[2] =
+{
+    "!AIVDM,2,1,1,A,55?MbV02;H;s<HtKR20EHE:0@T4@Dn2222222216L961O5Gf0NSQEp6ClRp8,0*1C",
+    "!AIVDM,2,2,1,A,88888888880,2*25",
+};
+static const char *type18_sample = "!AIVDM,1,1,,A,B52K>;h00Fc>jpUlNV@ikwpUoP06,0*4C";
+static const char *type19_sample = "!AIVDM,1,1,,B,C5N3SRgPEnJGEBT>NhWAwwo862PaLELTBJ:V00000000S0D:R220,0*0B";
+
+
+static uint32_t rand32(void)
+{
+    return (uint32_t)rand() << 16 ^ (uint32_t)rand();
+}
+
+static void put(BITS *b, uint32_t v, unsigned len)
+{
+    while (len-- > 0)
+    {
+        if (v >> len & 1) b->d[b->n / 8] |= (uint8_t)(0x80 >> (b->n % 8));
+        b->n++;
+    }
+}
+
+static void put_text(BITS *b, const char *text, unsigned chars)
+{
+    for (unsigned i = 0; i < chars; i++)
+    {
+        const char *c = i < strlen(text) ? strchr(sixbit_text, text[i]) : NULL;
+
+        put(b, c ? (uint32_t)(c - sixbit_text) : 0, 6);
+    }
+}
+
+/* the payload characters of b; returns the fill bits */
+static int armour(const BITS *b, char *out)
+{
+    unsigned chars = (b->n + 5) / 6;
+
+    for (unsigned i = 0; i < chars; i++)
+    {
+        unsigned v = 0;
+
+        for (unsigned k = 0; k < 6; k++)
+        {
+            unsigned at = 6 * i + k;
+
+            v = v << 1 | (at < b->n ? (unsigned)(b->d[at / 8] >> (7 - at % 8) & 1) : 0);
+        }
+        out[i] = (char)(v < 40 ? v + 48 : v + 56);
+    }
+    out[chars] = '\0';
+    return (int)(chars * 6 - b->n);
+}
+
+/* one sentence of len payload characters, its checksum computed */
+static void make_sentence(char *out, int total, int number, const char *seq_id, char channel, const char *payload, int len,
+                          const char *fill)
+{
+    unsigned char sum = 0;
+    int           n = snprintf(out, SENTENCE_MAX, "!AIVDM,%d,%d,%s,%c,%.*s,%s", total, number, seq_id, channel, len, payload, fill);
+
+    for (int i = 1; i < n; i++) sum ^= (unsigned char)out[i];
+    snprintf(out + n, (size_t)(SENTENCE_MAX - n), "*%02X", sum);
+}
+
+static void single(char *out, const char *payload, int fill)
+{
+    char f[4];
+
+    snprintf(f, sizeof(f), "%d", fill);
+    make_sentence(out, 1, 1, "", 'B', payload, (int)strlen(payload), f);
+}
+
+/* 1/10000 minute -> degrees * GPS_COORD_SCALE, to nearest */
+static int32_t coordinate(int32_t v)
+{
+    double   x = v / 600000.0 * GPS_COORD_SCALE;
+
+    return (int32_t)(x < 0 ? x - 0.5 : x + 0.5);
+}
+
+/* a random coordinate in 1/10000 minute: anywhere in range, an end of it, or "not available" */
+static int32_t random_coordinate(int32_t range, int32_t none)
+{
+    switch (rand() % 6)
+    {
+        case 0:  return -range;
+        case 1:  return range;
+        case 2:  return none;
+        default: return (int32_t)(rand32() % (2u * (uint32_t)range + 1)) - range;
+    }
+}
+
+/* a random name of 0..20 characters, some ending in spaces */
+static void random_name(char *name, char *want)
+{
+    int len = rand() % 21;
+
+    for (int i = 0; i < len; i++) name[i] = sixbit_text[1 + rand() % 63];
+    if (len > 0 && rand() % 4 == 0) name[len - 1] = ' ';
+    name[len] = '\0';
+
+    strcpy(want, name);
+    for (len = (int)strlen(want); len > 0 && want[len - 1] == ' '; len--) want[len - 1] = '\0';
+}
+
+/*
+ * random_position - A type 18 or 19 message: its bits into b, what
+ * decodeAIS should give into want.
+ *
+ */
+static void random_position(uint8_t type, BITS *b, AIS_MESSAGE *want)
+{
+    AIS_POSITION *p = &want->position;
+    int32_t      lon = random_coordinate(180 * 600000, 181 * 600000), lat = random_coordinate(90 * 600000, 91 * 600000);
+    char         name[21];
+
+    memset(b, 0, sizeof(*b));
+    memset(want, 0, sizeof(*want));
+    want->type    = type;
+    want->mmsi    = rand32() % 1000000000u;
+    want->channel = 'B';
+    want->has     = AIS_HAS_POSITION;
+    p->speed      = rand() % 4 == 0 ? AIS_NO_SPEED : (uint16_t)(rand() % 1023);
+    p->accuracy   = (uint8_t)(rand() % 2);
+    p->longitude  = coordinate(lon);
+    p->latitude   = coordinate(lat);
+    p->course     = rand() % 4 == 0 ? AIS_NO_COURSE : (uint16_t)(rand() % 3600);
+    p->heading    = rand() % 4 == 0 ? AIS_NO_HEADING : (uint16_t)(rand() % 360);
+    p->second     = (uint8_t)(rand() % 64);
+    p->status     = 15;
+    p->turn       = -128;
+
+    put(b, type, 6);
+    put(b, (uint32_t)(rand() % 4), 2);                  // repeat indicator
+    put(b, want->mmsi, 30);
+    put(b, (uint32_t)(rand() % 256), 8);                // reserved
+    put(b, p->speed, 10);
+    put(b, p->accuracy, 1);
+    put(b, (uint32_t)lon, 28);
+    put(b, (uint32_t)lat, 27);
+    put(b, p->course, 12);
+    put(b, p->heading, 9);
+    put(b, p->second, 6);
+    if (type == 18)
+    {
+        put(b, rand32(), 2 + 7 + 20);                   // regional, flags, radio status
+    }
+    else
+    {
+        AIS_STATIC *s = &want->statics;
+
+        random_name(name, s->name);
+        s->ship_type    = (uint8_t)(rand() % 256);
+        s->to_bow       = (uint16_t)(rand() % 512);
+        s->to_stern     = (uint16_t)(rand() % 512);
+        s->to_port      = (uint8_t)(rand() % 64);
+        s->to_starboard = (uint8_t)(rand() % 64);
+        s->epfd         = (uint8_t)(rand() % 16);
+        want->has      |= AIS_HAS_STATIC;
+
+        put(b, (uint32_t)(rand() % 16), 4);             // regional
+        put_text(b, name, 20);
+        put(b, s->ship_type, 8);
+        put(b, s->to_bow, 9);
+        put(b, s->to_stern, 9);
+        put(b, s->to_port, 6);
+        put(b, s->to_starboard, 6);
+        put(b, s->epfd, 4);
+        put(b, rand32(), 1 + 1 + 1 + 4);                // raim, dte, assigned, spare
+    }
+    put(b, rand32(), (unsigned)(rand() % 6));           // spare bits some stations add
+}
+
+/* feeds sentences, returns the last decodeAIS result */
+static int feed(AIS_DECODER *ais, char (*s)[SENTENCE_MAX], int n, AIS_MESSAGE *msg)
+{
+    int rc = -1;
+
+    for (int i = 0; i < n; i++) rc = decodeAIS(ais, s[i], msg);
+    return rc;
+}
+
+/* payload cut at the given character positions into fragments of seq_id */
+static int fragments(char (*s)[SENTENCE_MAX], const char *payload, int fill, const int *cut, int cuts, const char *seq_id,
+                     char channel)
+{
+    int  total = cuts + 1, len = (int)strlen(payload);
+    char f[4];
+
+    for (int i = 0; i < total; i++)
+    {
+        int from = i ? cut[i - 1] : 0, to = i < cuts ? cut[i] : len;
+
+        snprintf(f, sizeof(f), "%d", i < cuts ? 0 : fill);
+        make_sentence(s[i], total, i + 1, seq_id, channel, payload + from, to - from, f);
+    }
+    return total;
+}
+
+/* a class B position as published: no heading, accuracy low */
+static void set_position(AIS_POSITION *p, int32_t latitude, int32_t longitude, uint16_t speed, uint16_t course, uint8_t second)
+{
+    p->latitude  = latitude;
+    p->longitude = longitude;
+    p->speed     = speed;
+    p->course    = course;
+    p->heading   = AIS_NO_HEADING;
+    p->turn      = -128;
+    p->status    = 15;
+    p->second    = second;
+    p->accuracy  = 0;
+}
+
+/* the text fields as strings: what follows the end of the text is not part of it */
+static void clear_text(AIS_MESSAGE *m)
+{
+    AIS_STATIC *s = &m->statics;
+    size_t     n;
+
+    n = strlen(s->callsign);
+    memset(s->callsign + n, 0, sizeof(s->callsign) - n);
+    n = strlen(s->name);
+    memset(s->name + n, 0, sizeof(s->name) - n);
+    n = strlen(s->destination);
+    memset(s->destination + n, 0, sizeof(s->destination) - n);
+}
+
+static int same(const AIS_MESSAGE *a, const AIS_MESSAGE *b)
+{
+    AIS_MESSAGE x = *a, y = *b;
+
+    clear_text(&x);
+    clear_text(&y);
+    return memcmp(&x, &y, sizeof(AIS_MESSAGE)) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    static AIS_DECODER ais;
+    AIS_MESSAGE        m, want, m2, want2;
+    BITS               b;
+    char               s[8][SENTENCE_MAX], payload[AIS_MAX_BITS / 6 + 8], payload2[AIS_MAX_BITS / 6 + 8];
+    int                messages = argc > 1 ? atoi(argv[1]) : 20000, ok = 1, fill, fill2;
+
+    if (messages < 1) return 2;
+    srand(1);
+
+    // 1: the published samples
+    int samples = 1;
+
+    initAIS(&ais);
+    samples &= decodeAIS(&ais, type1_sample, &m) == 1 && m.type == 1 && m.mmsi == 477553000 && m.position.status == 5 &&
+               m.position.speed == 0 && m.position.latitude == 47582833 && m.position.longitude == -122345833 &&
+               m.position.course == 510 && m.position.heading == 181 && m.position.second == 15 && m.channel == 'B';
+    samples &= decodeAIS(&ais, type5_sample[0], &m) == 0 && decodeAIS(&ais, type5_sample[1], &m) == 1 && m.type == 5 &&
+               m.mmsi == 351759000 && m.statics.imo == 9134270 && strcmp(m.statics.callsign, "3FOF8") == 0 &&
+               strcmp(m.statics.name, "EVER DIADEM") == 0 && strcmp(m.statics.destination, "NEW YORK") == 0 &&
+               m.statics.ship_type == 70 && m.statics.to_bow == 225 && m.statics.to_stern == 70 && m.statics.to_port == 1 &&
+               m.statics.to_starboard == 31 && m.statics.epfd == 1 && m.statics.eta_month == 5 && m.statics.eta_day == 15 &&
+               m.statics.eta_hour == 14 && m.statics.eta_minute == 0 && m.statics.draught == 122;
+
+    memset(&want, 0, sizeof(want));
+    want.type    = 18;
+    want.mmsi    = 338087471;
+    want.has     = AIS_HAS_POSITION;
+    want.channel = 'A';
+    set_position(&want.position, 40684540, -74072132, 1, 796, 49);
+    samples &= decodeAIS(&ais, type18_sample, &m) == 1 && same(&m, &want);
+
+    memset(&want, 0, sizeof(want));
+    want.type     = 19;
+    want.mmsi     = 367059850;
+    want.has      = AIS_HAS_POSITION | AIS_HAS_STATIC;
+    want.channel  = 'B';
+    set_position(&want.position, 29543695, -88810392, 87, 3359, 46);
+    strcpy(want.statics.name, "CAPT.J.RIMES");
+    want.statics.ship_type    = 70;
+    want.statics.to_bow       = 5;
+    want.statics.to_stern     = 21;
+    want.statics.to_port      = 4;
+    want.statics.to_starboard = 4;
+    want.statics.epfd         = 1;
+    samples &= decodeAIS(&ais, type19_sample, &m) == 1 && same(&m, &want);
+    samples &= ais.messages == 4 && ais.bad_checksum == 0 && ais.bad_payload == 0 && ais.lost_fragments == 0;
+
+    printf("published samples, types 1 5 18 19   %s\n", samples ? "ok" : "FAILED");
+    ok &= samples;
+
+    // 2: random type 18 / 19 messages, every field
+    int differ = 0;
+
+    initAIS(&ais);
+    for (int i = 0; i < messages; i++)
+    {
+        random_position(i % 2 ? 19 : 18, &b, &want);
+        single(s[0], payload, armour(&b, payload));
+        differ += decodeAIS(&ais, s[0], &m) != 1 || !same(&m, &want);
+    }
+    int fields = differ == 0 && ais.messages == (uint32_t)messages;
+
+    printf("type 18 / 19, every field             %s  (%d messages, %d differ)\n", fields ? "ok" : "FAILED", messages, differ);
+    ok &= fields;
+
+    // 3: reassembled from fragments
+    int frag_ok = 1, tries = 0;
+
+    initAIS(&ais);
+    random_position(19, &b, &want);
+    fill = armour(&b, payload);
+    for (int cut = 1; cut < (int)strlen(payload); cut++, tries++)
+    {
+        fragments(s, payload, fill, &cut, 1, "3", 'B');
+        frag_ok &= decodeAIS(&ais, s[0], &m) == 0 && decodeAIS(&ais, s[1], &m) == 1 && same(&m, &want);
+    }
+    for (int i = 0; i < 2000; i++, tries++)
+    {
+        int cut[2], len;
+
+        random_position(19, &b, &want);
+        want.channel = 'A';
+        fill         = armour(&b, payload);
+        len          = (int)strlen(payload);
+        cut[0]       = 1 + rand() % (len - 2);
+        cut[1]       = cut[0] + 1 + rand() % (len - cut[0] - 1);
+        frag_ok &= feed(&ais, s, fragments(s, payload, fill, cut, 2, "7", 'A'), &m) == 1 && same(&m, &want);
+    }
+
+    // the longest message (an unsupported type 8), in 5 fragments; one character more is too long
+    int cut5[4] = { 40, 80, 120, 160 }, unsupported = (int)ais.unsupported;
+
+    memset(&b, 0, sizeof(b));
+    put(&b, 8, 6);
+    while (b.n < AIS_MAX_BITS) put(&b, rand32(), b.n + 16 <= AIS_MAX_BITS ? 16 : AIS_MAX_BITS - b.n);
+    fill = armour(&b, payload);
+    frag_ok &= feed(&ais, s, fragments(s, payload, fill, cut5, 4, "1", 'A'), &m) == 0 && ais.unsupported == (uint32_t)unsupported + 1;
+    strcat(payload, "0");
+
+    uint32_t bad0 = ais.bad_payload;
+
+    frag_ok &= feed(&ais, s, fragments(s, payload, fill, cut5, 4, "1", 'A'), &m) == -1 && ais.bad_payload == bad0 + 1;
+
+    // two messages, their fragments interleaved, on the same and on different channels
+    for (int i = 0; i < 200; i++, tries += 2)
+    {
+        char t[8][SENTENCE_MAX];
+        int  c1 = 10 + rand() % 30, c2 = 10 + rand() % 30;
+
+        random_position(19, &b, &want);
+        fill = armour(&b, payload);
+        random_position(19, &b, &want2);
+        fill2 = armour(&b, payload2);
+        want.channel  = 'A';
+        want2.channel = i % 2 ? 'A' : 'B';
+        fragments(s, payload, fill, &c1, 1, "4", 'A');
+        fragments(t, payload2, fill2, &c2, 1, i % 2 ? "5" : "4", want2.channel);
+        frag_ok &= decodeAIS(&ais, s[0], &m) == 0 && decodeAIS(&ais, t[0], &m2) == 0 && decodeAIS(&ais, s[1], &m) == 1 &&
+                   decodeAIS(&ais, t[1], &m2) == 1 && same(&m, &want) && same(&m2, &want2);
+    }
+    frag_ok &= ais.lost_fragments == 0;
+    printf("reassembled from fragments            %s  (%d messages, in 2, 3, 5 fragments and interleaved)\n",
+           frag_ok ? "ok" : "FAILED", tries);
+    ok &= frag_ok;
+
+    // 4: out of order, started again, all slots busy
+    int      order = 1, c = 20;
+    uint32_t lost0;
+
+    initAIS(&ais);
+    random_position(19, &b, &want);
+    fill = armour(&b, payload);
+    fragments(s, payload, fill, &c, 1, "2", 'B');
+    order &= decodeAIS(&ais, s[1], &m) == -1 && ais.lost_fragments == 1;                      // 2 before 1
+    order &= decodeAIS(&ais, s[0], &m) == 0 && decodeAIS(&ais, s[0], &m) == 0 && ais.lost_fragments == 2 &&
+             decodeAIS(&ais, s[1], &m) == 1 && same(&m, &want);                               // 1 again, then 2
+
+    char busy[AIS_SLOTS + 1][2][SENTENCE_MAX];
+
+    for (int i = 0; i <= AIS_SLOTS; i++)
+    {
+        char seq_id[2] = { (char)('0' + i), '\0' };
+
+        fragments(busy[i], payload, fill, &c, 1, seq_id, 'B');
+        order &= decodeAIS(&ais, busy[i][0], &m) == 0;
+    }
+    lost0  = ais.lost_fragments;
+    order &= decodeAIS(&ais, busy[0][1], &m) == -1;                                           // the oldest gave way
+    for (int i = 1; i <= AIS_SLOTS; i++) order &= decodeAIS(&ais, busy[i][1], &m) == 1 && same(&m, &want);
+    order &= lost0 == 3;
+
+    // a fragment missing in the middle: the rest of the message is refused
+    int cut3[2] = { 15, 30 };
+
+    lost0  = ais.lost_fragments;
+    fragments(s, payload, fill, cut3, 2, "6", 'B');
+    order &= decodeAIS(&ais, s[0], &m) == 0 && decodeAIS(&ais, s[2], &m) == -1 && decodeAIS(&ais, s[1], &m) == -1 &&
+             decodeAIS(&ais, s[2], &m) == -1 && ais.lost_fragments == lost0 + 3;
+    printf("out of order, restarted, slots busy   %s  (%u fragments lost)\n", order ? "ok" : "FAILED", ais.lost_fragments);
+    ok &= order;
+
+    // 5: a slot waiting too long for its next fragment
+    int stale = 1;
+
+    fragments(s, payload, fill, &c, 1, "2", 'B');
+
+    random_position(18, &b, &want2);
+    single(s[2], payload2, armour(&b, payload2));
+    for (int others = AIS_SLOT_MAX_AGE - 1; others <= AIS_SLOT_MAX_AGE; others++)
+    {
+        initAIS(&ais);
+        decodeAIS(&ais, s[0], &m);
+        for (int i = 0; i < others; i++) stale &= decodeAIS(&ais, s[2], &m2) == 1;
+
+        int rc = decodeAIS(&ais, s[1], &m);
+
+        if (others < AIS_SLOT_MAX_AGE) stale &= rc == 1 && same(&m, &want) && ais.lost_fragments == 0;
+        else stale &= rc == -1 && ais.lost_fragments == 2;                                    // given up, then its fragment refused
+    }
+    printf("stale slot given up                   %s  (after %d other sentences)\n", stale ? "ok" : "FAILED",
+           AIS_SLOT_MAX_AGE);
+    ok &= stale;
+
+    // 6: bad checksums: every character changed but the field separators, then the checksum itself
+    int      checked = 0, accepted = 0;
+    uint32_t messages0;
+
+    initAIS(&ais);
+    for (int i = 0; i < 4; i++)
+    {
+        const char *base = i == 0 ? type1_sample : i == 1 ? type18_sample : i == 2 ? type19_sample : type5_sample[1];
+        size_t      star = (size_t)(strchr(base, '*') - base);
+
+        for (size_t at = 1; at < strlen(base); at++)
+        {
+            if (base[at] == ',' || base[at] == '*' || (at < star && at <= 5)) continue;     // the "AIVDM" not AIS any more
+            strcpy(s[0], base);
+            s[0][at] = at > star ? (s[0][at] == '0' ? '1' : '0') : (s[0][at] == '5' ? '6' : '5');
+            accepted += decodeAIS(&ais, s[0], &m) != -1;
+            checked++;
+        }
+    }
+    strcpy(s[0], type18_sample);
+    *strchr(s[0], '*') = '\0';
+    accepted += decodeAIS(&ais, s[0], &m) != -1;                                              // no checksum at all
+    checked++;
+    messages0 = ais.messages;
+
+    int checksum = accepted == 0 && ais.bad_checksum == (uint32_t)checked && messages0 == 0 && ais.bad_payload == 0;
+
+    printf("bad checksum refused                  %s  (%d sentences, %d taken, %u counted)\n", checksum ? "ok" : "FAILED",
+           checked, accepted, ais.bad_checksum);
+    ok &= checksum;
+
+    // 7: bad fill bits, too short, bad armour
+    static const char *bad_fill[] = { "6", "7", "9", "x", "12", "-1" };
+    int                refused = 0, payload_ok = 1;
+
+    initAIS(&ais);
+    random_position(18, &b, &want);
+    b.n = 168 + 12;                                                                           // 6..9 fill bits would leave enough
+    armour(&b, payload);
+    for (size_t i = 0; i < sizeof(bad_fill) / sizeof(bad_fill[0]); i++)
+    {
+        make_sentence(s[0], 1, 1, "", 'B', payload, (int)strlen(payload), bad_fill[i]);
+        refused += decodeAIS(&ais, s[0], &m) == -1;
+    }
+    strcpy(payload2, payload);
+    payload2[3] = 'X';                                                                        // between 'W' and '`'
+    single(s[0], payload2, 0);
+    strcpy(payload2, payload);
+    payload2[29] = 'x';                                                                       // after 'w', past the last 4
+    single(s[1], payload2, 0);
+    refused += feed(&ais, s, 1, &m) == -1;
+    refused += feed(&ais, s + 1, 1, &m) == -1;
+
+    b.n = 168;                                                                                // no spare bits
+    armour(&b, payload);
+    for (int f = 0; f <= 5; f++)
+    {
+        single(s[0], payload, f);
+        payload_ok &= decodeAIS(&ais, s[0], &m) == (f == 0 ? 1 : -1);                         // 168 - f bits: too short
+        refused += f > 0;
+    }
+    payload_ok &= refused == 6 + 2 + 5 && ais.bad_payload == (uint32_t)refused && ais.messages == 1 && ais.bad_checksum == 0;
+    printf("bad fill bits and payload refused     %s  (%d refused, %u counted)\n", payload_ok ? "ok" : "FAILED", refused,
+           ais.bad_payload);
+    ok &= payload_ok;
+
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
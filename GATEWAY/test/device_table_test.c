@@ -0,0 +1,203 @@
+/*
+ * device_table_test.c - Seqlock consistency of the device table under concurrent writers.
+ *
+ *   device_table_test [seconds]
+ *
+ * Two writer threads update the same 64 devices with records whose every
+ * field is derived from the fix time, so a record mixing two updates is
+ * detected. Both write every device, so they also contend for the same
+ * slot locks, and their counters interleave, so some updates are older
+ * than the stored record. Four readers look up random devices and scan the
+ * table meanwhile. Checked:
+ *   - no reader ever sees a torn record
+ *   - a reader never sees a device go back in time
+ *   - after the writers stop, every device holds its newest record
+ *   - devices added while readers run are all found, up to the table
+ *     limit, and the next one is refused
+ */
+
+#include "device_table.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define DEVICES     64
+#define WRITERS     2
+#define READERS     4
+#define BASE_MS     1700000000000LL
+
+static DEVICE_TABLE     table;
+static _Atomic int      stop;
+
+typedef struct
+{
+    int             index;
+    unsigned long   updates, older, reads, scans, torn, backwards;
+    int64_t         seen[DEVICES + 1];             // reader: newest time seen, writer: last time written
+} WORKER;
+
+
+static void make_record(FIXRECORD *r, uint64_t id, uint32_t n)
+{
+    r->utc_ms      = BASE_MS + n;
+    r->latitude    = (int32_t)(n * 31u + (uint32_t)id);
+    r->longitude   = -r->latitude;
+    r->altitude_mm = (int32_t)(n ^ (uint32_t)id);
+    r->speed       = (uint16_t)n;
+    r->course      = (uint16_t)(n >> 16);
+    r->hdop        = (uint16_t)id;
+    r->present     = (uint16_t)(n * 7u);
+    r->numsat      = (uint8_t)n;
+    r->fix         = 1;
+    r->reserved    = (uint16_t)~n;
+}
+
+static int consistent(const FIXRECORD *r, uint64_t id)
+{
+    FIXRECORD expect;
+
+    if (r->utc_ms < BASE_MS) return 0;
+    make_record(&expect, id, (uint32_t)(r->utc_ms - BASE_MS));
+    return memcmp(r, &expect, sizeof(FIXRECORD)) == 0;
+}
+
+static void *writer(void *arg)
+{
+    WORKER   *w = arg;
+    uint32_t n  = (uint32_t)w->index;
+
+    while (!atomic_load(&stop))
+    {
+        for (uint64_t id = 1; id <= DEVICES; id++)
+        {
+            FIXRECORD r;
+            uint32_t  k = n + (uint32_t)(id % 3) * WRITERS;       // writers drift past each other
+
+            make_record(&r, id, k);
+            int rc = devtab_update(&table, id, &r);
+            if (rc == 0) w->updates++;
+            if (rc == 1) w->older++;
+        }
+        n += WRITERS;
+    }
+    for (uint64_t id = 1; id <= DEVICES; id++) w->seen[id] = BASE_MS + n - WRITERS + (int64_t)(id % 3) * WRITERS;
+    return NULL;
+}
+
+static void visit(uint64_t id, const FIXRECORD *rec, void *ctx)
+{
+    WORKER *w = ctx;
+
+    if (id > DEVICES) return;
+    if (!consistent(rec, id)) w->torn++;
+}
+
+static void *reader(void *arg)
+{
+    WORKER       *w = arg;
+    unsigned int seed = (unsigned int)w->index;
+
+    while (!atomic_load(&stop))
+    {
+        uint64_t  id = 1 + (uint64_t)(rand_r(&seed) % DEVICES);
+        FIXRECORD r;
+
+        if (devtab_lookup(&table, id, &r) == 0)
+        {
+            w->reads++;
+            if (!consistent(&r, id)) w->torn++;
+            else if (r.utc_ms < w->seen[id]) w->backwards++;
+            else w->seen[id] = r.utc_ms;
+        }
+        if (w->reads % 4096 == 0)
+        {
+            devtab_scan(&table, visit, w);
+            w->scans++;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    double      seconds = argc > 1 ? atof(argv[1]) : 2.0;
+    pthread_t   wt[WRITERS], rt[READERS];
+    WORKER      ww[WRITERS], rw[READERS];
+    unsigned long updates = 0, older = 0, reads = 0, scans = 0, torn = 0, backwards = 0;
+    int         ok = 1, newest_ok = 1;
+    struct timespec pause = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+
+    if (devtab_init(&table, 1000) != 0) return 2;
+
+    memset(ww, 0, sizeof(ww));
+    memset(rw, 0, sizeof(rw));
+    for (int i = 0; i < WRITERS; i++)
+    {
+        ww[i].index = i;
+        pthread_create(&wt[i], NULL, writer, &ww[i]);
+    }
+    for (int i = 0; i < READERS; i++)
+    {
+        rw[i].index = i + 1;
+        pthread_create(&rt[i], NULL, reader, &rw[i]);
+    }
+
+    nanosleep(&pause, NULL);
+    atomic_store(&stop, 1);
+    for (int i = 0; i < WRITERS; i++)
+    {
+        pthread_join(wt[i], NULL);
+        updates += ww[i].updates;
+        older   += ww[i].older;
+    }
+    for (int i = 0; i < READERS; i++)
+    {
+        pthread_join(rt[i], NULL);
+        reads     += rw[i].reads;
+        scans     += rw[i].scans;
+        torn      += rw[i].torn;
+        backwards += rw[i].backwards;
+    }
+
+    for (uint64_t id = 1; id <= DEVICES; id++)
+    {
+        FIXRECORD r;
+        int64_t   newest = ww[0].seen[id] > ww[1].seen[id] ? ww[0].seen[id] : ww[1].seen[id];
+
+        if (devtab_lookup(&table, id, &r) != 0 || r.utc_ms != newest || !consistent(&r, id)) newest_ok = 0;
+    }
+
+    int rw_ok = torn == 0 && backwards == 0 && reads > 0 && updates > 0 && older > 0;
+    printf("%d writers, %d readers, same devices    %s  (%lu updates, %lu older dropped, %lu reads, %lu scans, "
+           "%lu torn, %lu backwards)\n", WRITERS, READERS, rw_ok ? "ok" : "FAILED", updates, older, reads, scans, torn, backwards);
+    printf("newest record kept                    %s\n", newest_ok ? "ok" : "FAILED");
+    ok &= rw_ok && newest_ok;
+
+    /* fill the table while readers keep looking up the first devices */
+    atomic_store(&stop, 0);
+    for (int i = 0; i < READERS; i++) pthread_create(&rt[i], NULL, reader, &rw[i]);
+
+    uint64_t  id = DEVICES + 1;
+    FIXRECORD r;
+    int       rc;
+
+    make_record(&r, 0, 1);
+    while ((rc = devtab_update(&table, id, &r)) == 0) id++;
+
+    atomic_store(&stop, 1);
+    for (int i = 0; i < READERS; i++) pthread_join(rt[i], NULL);
+
+    int found = 1;
+    for (uint64_t k = 1; k < id; k++) found &= devtab_lookup(&table, k, &r) == 0;
+    int fill_ok = rc == -1 && devtab_count(&table) == table.limit && id - 1 == table.limit && found &&
+                  devtab_lookup(&table, id, &r) == -1;
+    for (int i = 0; i < READERS; i++) fill_ok &= rw[i].torn == 0 && rw[i].backwards == 0;
+    printf("filled to the limit under readers     %s  (%u devices)\n", fill_ok ? "ok" : "FAILED", devtab_count(&table));
+    ok &= fill_ok;
+
+    devtab_free(&table);
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
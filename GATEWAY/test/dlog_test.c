@@ -0,0 +1,242 @@
+/*
+ * dlog_test.c - NMEA/gps_dlog through dlog_decode and back.
+ *
+ *   dlog_test [events]
+ *
+ * Events are recorded with gps_dlog, flushed through a sink that takes a
+ * random number of bytes per call, with other UART output (NMEA text, a
+ * stray sync byte) between the flushes, and decoded in random pieces.
+ * Checked:
+ *   - every message of gps_dlog_msgs.h, with arguments of every varint
+ *     length (1 to 5 bytes): the same events in the same order, same
+ *     sequence numbers and arguments, the same text; every foreign byte
+ *     skipped, none missing
+ *   - the ring overflowing while nobody flushes: the events kept come in
+ *     order, each DLOG_LOST event counts the gap just before it, together
+ *     they count what dlogLost gives, and the decoder sees exactly that
+ *     many missing
+ *   - the capture cut at every byte of its last frame: all but that frame
+ *     decoded, the cut frame's bytes counted as skipped
+ */
+
+#include "dlog_decode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CAPTURE_MAX (1 << 20)
+#define EXPECT_MAX  20000
+
+#define DLOG_NARGS(id, nargs, fmt) nargs,
+static const uint8_t nargs[DLOG_COUNT] = { DLOG_MESSAGES(DLOG_NARGS) };
+#undef DLOG_NARGS
+
+/* 1..5 byte varints, their edges */
+static const uint32_t edge[] =
+{
+    0, 1, 0x7F, 0x80, 0x3FFF, 0x4000, 0x1FFFFF, 0x200000, 0xFFFFFFF, 0x10000000, 0x7FFFFFFF, 0xFFFFFFFF,
+};
+#define EDGES       (int)(sizeof(edge) / sizeof(edge[0]))
+
+static const char   foreign[] = "$GPTXT,01,01,02,ANTSTATUS=OK*3B\r\n\xA5 boot\r\n";
+
+static unsigned char capture[CAPTURE_MAX];
+static size_t        capture_len;
+static unsigned long foreign_bytes;
+
+static DLOG_EVENT    expect[EXPECT_MAX];
+static int           expected;
+static uint8_t       seq;                       // gps_dlog's sequence, followed
+
+static DLOG_EVENT    got[EXPECT_MAX];
+static int           decoded;
+static unsigned      gap[EXPECT_MAX];            // missing just before got[i]
+static unsigned long last_missing;
+
+
+/* a UART with little room: takes 1..len bytes */
+static int sink(const unsigned char *data, int len)
+{
+    int n = 1 + rand() % len;
+
+    memcpy(capture + capture_len, data, (size_t)n);
+    capture_len += (size_t)n;
+    return n;
+}
+
+static void flush_all(void)
+{
+    while (dlogPending()) dlogFlush(sink);
+}
+
+static void record(uint8_t id, uint32_t a, uint32_t b, uint32_t c)
+{
+    DLOG_EVENT *e = &expect[expected++];
+
+    dlogRecord((dlog_id)id, a, b, c);
+    memset(e, 0, sizeof(*e));
+    e->id     = id;
+    e->seq    = seq++;
+    e->arg[0] = nargs[id] > 0 ? a : 0;
+    e->arg[1] = nargs[id] > 1 ? b : 0;
+    e->arg[2] = nargs[id] > 2 ? c : 0;
+}
+
+static void add_foreign(void)
+{
+    memcpy(capture + capture_len, foreign, sizeof(foreign) - 1);
+    capture_len   += sizeof(foreign) - 1;
+    foreign_bytes += sizeof(foreign) - 1;
+}
+
+static void take(void *ctx, const DLOG_EVENT *ev, unsigned missing)
+{
+    (void)ctx;
+    if (decoded < EXPECT_MAX)
+    {
+        gap[decoded]   = missing;
+        got[decoded++] = *ev;
+    }
+    last_missing += missing;
+}
+
+/* decodes capture[0, len) in random pieces */
+static void decode_capture(DLOG_DECODER *d, size_t len)
+{
+    dlog_decoder_init(d, take, NULL);
+    decoded      = 0;
+    last_missing = 0;
+    for (size_t at = 0; at < len;)
+    {
+        size_t n = 1 + (size_t)rand() % 700;
+
+        if (n > len - at) n = len - at;
+        dlog_decode(d, capture + at, n);
+        at += n;
+    }
+    dlog_decode_end(d);
+}
+
+/* decoded events [0, n) against expect[from, from + n): how many differ */
+static int compare(int from, int n)
+{
+    int differ = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        char a[256], b[256];
+
+        dlog_format(a, sizeof(a), &got[i]);
+        dlog_format(b, sizeof(b), &expect[from + i]);
+        if (memcmp(&got[i], &expect[from + i], sizeof(DLOG_EVENT)) != 0 || strcmp(a, b) != 0) differ++;
+    }
+    return differ;
+}
+
+int main(int argc, char **argv)
+{
+    static DLOG_DECODER d;
+    int                 events = argc > 1 ? atoi(argv[1]) : 5000, ok = 1;
+    char                text[256];
+
+    if (events < DLOG_COUNT * EDGES || events > EXPECT_MAX - 200) return 2;
+    srand(11);
+
+    // 1: every message, every varint length, flushed in pieces between other output
+    for (int i = 0; i < events; i++)
+    {
+        uint8_t id = (uint8_t)(i % DLOG_COUNT);
+
+        if (dlogPending() > DLOG_RING_SIZE - DLOG_FRAME_MAX) flush_all();
+        if (i < DLOG_COUNT * EDGES) record(id, edge[i / DLOG_COUNT], edge[(i / DLOG_COUNT + 3) % EDGES], edge[EDGES - 1 - i / DLOG_COUNT]);
+        else record(id, (uint32_t)rand() << 1 ^ (uint32_t)rand(), (uint32_t)rand() % 1000, (uint32_t)rand() % 2);
+        if (rand() % 5 == 0)
+        {
+            flush_all();
+            if (rand() % 3 == 0) add_foreign();
+        }
+    }
+    flush_all();
+    decode_capture(&d, capture_len);
+
+    int differ = compare(0, decoded);
+    int round  = decoded == expected && differ == 0 && d.missing == 0 && d.skipped == foreign_bytes && dlogLost() == 0;
+
+    printf("every message and varint length      %s  (%d events, %d decoded, %d differ, %lu missing, %lu of %lu foreign bytes "
+           "skipped)\n", round ? "ok" : "FAILED", expected, decoded, differ, d.missing, d.skipped, foreign_bytes);
+    ok &= round;
+
+    DLOG_EVENT power = { DLOG_POWER_MODE, 0, { 2, 3, 0 } };
+
+    dlog_format(text, sizeof(text), &power);
+    int formatted = strcmp(text, "power: mode 2 -> 3") == 0 && strcmp(dlog_name(DLOG_POWER_MODE), "DLOG_POWER_MODE") == 0;
+
+    printf("text of an event                     %s  (%s: \"%s\")\n", formatted ? "ok" : "FAILED", dlog_name(DLOG_POWER_MODE), text);
+    ok &= formatted;
+
+    // 2: nobody flushes while 60 events come, then one more
+    int      first = expected;
+    uint32_t lost0 = dlogLost();
+
+    capture_len = 0;
+    for (int i = 0; i < 60; i++) record(DLOG_GGA, 0xFFFFFFFF, (uint32_t)i, 1);
+    flush_all();
+    record(DLOG_RMC, 12, 0x3C0, 1);
+    flush_all();
+    decode_capture(&d, capture_len);
+
+    // a DLOG_LOST frame takes a sequence number too, each one reports the gap just before it
+    uint32_t lost = dlogLost() - lost0, reported = 0;
+    int      kept = 0, frames = 0, next = 0;
+    int      overflow = lost > 0 && decoded > 0 && got[decoded - 1].id == DLOG_RMC && got[decoded - 1].arg[0] == 12;
+
+    for (int i = 0; i < decoded - 1; i++)
+    {
+        if (got[i].id == DLOG_LOST)
+        {
+            overflow &= got[i].arg[0] == gap[i];
+            reported += got[i].arg[0];
+            frames++;
+            continue;
+        }
+        // the k-th GGA, in order, its sequence number moved on by the DLOG_LOST frames before it
+        int k = (int)got[i].arg[1];
+
+        overflow &= gap[i] == 0 && got[i].id == DLOG_GGA && k >= next && k < 60 &&
+                    memcmp(got[i].arg, expect[first + k].arg, sizeof(got[i].arg)) == 0 &&
+                    got[i].seq == (uint8_t)(expect[first].seq + k + frames);
+        next = k + 1;
+        kept++;
+    }
+    overflow &= reported == lost && d.missing == lost && kept + (int)lost == 60;
+    seq = (uint8_t)(got[decoded - 1].seq + 1);              // the DLOG_LOST frames moved gps_dlog's sequence on
+    printf("ring overflow, DLOG_LOST             %s  (%d of 60 events kept, %u lost, DLOG_LOST frames say %u, %lu missing)\n",
+           overflow ? "ok" : "FAILED", kept, lost, reported, d.missing);
+    ok &= overflow;
+
+    // 3: a capture cut short: every byte of the last frame
+    int cut_ok = 1, frame = 0;
+
+    capture_len = 0;
+    for (int i = 0; i < 10; i++) record(DLOG_POWER_MODE, (uint32_t)i, (uint32_t)i + 1, 0);
+    flush_all();
+
+    size_t before = capture_len;
+
+    record(DLOG_GGA, 0x10000000, 0x3FF, 1);
+    flush_all();
+    frame = (int)(capture_len - before);
+    for (int cut = 1; cut < frame; cut++)
+    {
+        decode_capture(&d, before + (size_t)cut);
+        cut_ok &= decoded == 10 && compare(expected - 11, 10) == 0 && d.skipped == (unsigned long)cut && d.missing == 0;
+    }
+    decode_capture(&d, capture_len);
+    cut_ok &= decoded == 11 && compare(expected - 11, 11) == 0 && d.skipped == 0;
+    printf("truncated tail                       %s  (cut at each of the last frame's %d bytes)\n", cut_ok ? "ok" : "FAILED",
+           frame);
+    ok &= cut_ok;
+
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
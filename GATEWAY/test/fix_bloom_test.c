@@ -0,0 +1,267 @@
+/*
+ * fix_bloom_test.c - Block index queries against a brute-force scan.
+ *
+ *   fix_bloom_test [queries]
+ *
+ * A fix log is written in four sessions (fixlog_open ... fixlog_close), so
+ * each reopen leaves a partial block in the middle of the log. 60 devices
+ * random walk over a degree square, a few fixes without a position or a
+ * time. Checked:
+ *   - the index covers every block but the partial last one
+ *   - random regions, with and without a time range, opened on the
+ *     reopened log: the matches are exactly those of a scan over every
+ *     record, and blocks are skipped
+ *   - after one more session the old index still answers exactly (the new
+ *     blocks are read unindexed)
+ *   - the index is refused for another log and for the log cut short
+ */
+
+#include "fix_bloom.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEVICES     60
+#define SESSIONS    4
+#define LAT0        48000000                    // degrees * GPS_COORD_SCALE
+#define LON0        11000000
+#define SPAN        1000000                     // 1 degree
+#define T0_MS       1700000000000LL
+
+static const char   *log_path   = "/tmp/fix_bloom_test.log";
+static const char   *other_path = "/tmp/fix_bloom_test.other";
+static const char   *index_path = "/tmp/fix_bloom_test.fbi";
+
+static int32_t      lat[DEVICES], lon[DEVICES];
+static int64_t      now_ms = T0_MS;
+
+typedef struct
+{
+    long        matches;
+    uint64_t    sum;                            // order independent hash of the matches
+} RESULT;
+
+
+static uint64_t mix(uint64_t x)
+{
+    x = (x ^ (x >> 33)) * 0xFF51AFD7ED558CCDull;
+    x = (x ^ (x >> 33)) * 0xC4CEB9FE1A85EC53ull;
+    return x ^ (x >> 33);
+}
+
+static uint64_t record_hash(const FIXLOG_RECORD *rec)
+{
+    return mix(rec->device ^ mix((uint64_t)rec->fix.utc_ms ^ mix(((uint64_t)(uint32_t)rec->fix.latitude << 32) |
+                                                                   (uint32_t)rec->fix.longitude)));
+}
+
+/* one session of the log: records fixes, the writer keeping up */
+static int write_session(const char *path, int records, unsigned seed)
+{
+    FIXLOG          log;
+    FIXLOG_CONFIG   cfg;
+    FIXLOG_PRODUCER *p;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.path = path;
+    if (fixlog_open(&log, &cfg) != 0 || !(p = fixlog_producer(&log))) return -1;
+
+    srand(seed);
+    for (int i = 0; i < records; i++)
+    {
+        int       d = rand() % DEVICES;
+        FIXRECORD f;
+
+        lat[d] += rand() % 4001 - 2000;
+        lon[d] += rand() % 4001 - 2000;
+        if (lat[d] < LAT0) lat[d] = LAT0;
+        if (lat[d] > LAT0 + SPAN) lat[d] = LAT0 + SPAN;
+        if (lon[d] < LON0) lon[d] = LON0;
+        if (lon[d] > LON0 + SPAN) lon[d] = LON0 + SPAN;
+        now_ms += 100;
+
+        memset(&f, 0, sizeof(f));
+        f.utc_ms    = rand() % 50 ? now_ms : 0;
+        f.latitude  = lat[d];
+        f.longitude = lon[d];
+        f.fix       = 1;
+        f.present   = (uint16_t)((rand() % 50 ? GPS_HAS_POSITION | GPS_HAS_FIX : 0) | (f.utc_ms ? GPS_HAS_TIME : 0));
+
+        while (fixlog_append(p, (uint64_t)d + 1, &f) != 0)
+        {
+            struct timespec wait = { 0, 1000000 };
+
+            nanosleep(&wait, NULL);
+        }
+    }
+    return fixlog_close(&log);
+}
+
+static int add_match(const FIXLOG_RECORD *rec, void *ctx)
+{
+    RESULT *r = ctx;
+
+    r->matches++;
+    r->sum += record_hash(rec);
+    return 0;
+}
+
+/* every record of the log against the query, as fixbloom_query defines a match */
+static RESULT scan(const char *path, const FIXBLOOM_QUERY *q, uint64_t *blocks, uint64_t *partial_inside)
+{
+    RESULT  r = { 0, 0 };
+    FILE    *in = fopen(path, "rb");
+    uint8_t block[FIXLOG_BLOCK];
+    int     timed = q->to_ms > q->from_ms;
+    int     last_count = -1;
+
+    *blocks = *partial_inside = 0;
+    while (in && fread(block, FIXLOG_BLOCK, 1, in) == 1)
+    {
+        const FIXLOG_RECORD *rec;
+        int                  count = fixlog_block_records(block, &rec);
+
+        if (last_count >= 0 && (size_t)last_count < FIXLOG_PER_BLOCK) (*partial_inside)++;
+        last_count = count;
+        (*blocks)++;
+        for (int i = 0; i < count; i++)
+        {
+            const FIXRECORD *f = &rec[i].fix;
+
+            if ((f->present & GPS_HAS_POSITION) != GPS_HAS_POSITION) continue;
+            if (f->latitude < q->min.latitude || f->latitude > q->max.latitude) continue;
+            if (f->longitude < q->min.longitude || f->longitude > q->max.longitude) continue;
+            if (timed && (!f->utc_ms || f->utc_ms < q->from_ms || f->utc_ms >= q->to_ms)) continue;
+            add_match(&rec[i], &r);
+        }
+    }
+    if (in) fclose(in);
+    return r;
+}
+
+static void random_query(FIXBLOOM_QUERY *q, int64_t end_ms)
+{
+    int32_t size = 2000 + rand() % (rand() % 4 ? 20000 : 300000);
+
+    memset(q, 0, sizeof(*q));
+    q->min.latitude  = LAT0 - 10000 + rand() % (SPAN + 20000);
+    q->min.longitude = LON0 - 10000 + rand() % (SPAN + 20000);
+    q->max.latitude  = q->min.latitude + size;
+    q->max.longitude = q->min.longitude + size * (1 + rand() % 3);
+    if (rand() % 2)
+    {
+        q->from_ms = T0_MS + rand() % (end_ms - T0_MS);
+        q->to_ms   = q->from_ms + 1000 + rand() % 600000;
+    }
+}
+
+/* queries through the index against the scan: how many differ */
+static int compare(FIXBLOOM *b, const char *path, int queries, long *matched, uint64_t *read, uint64_t *blocks)
+{
+    int differ = 0;
+
+    *matched = 0;
+    *read    = *blocks = 0;
+    for (int i = 0; i < queries; i++)
+    {
+        FIXBLOOM_QUERY q;
+        FIXBLOOM_STATS st;
+        RESULT         got = { 0, 0 }, want;
+        uint64_t       n, partial;
+
+        random_query(&q, now_ms);
+        want = scan(path, &q, &n, &partial);
+        if (fixbloom_query(b, &q, add_match, &got, &st) != got.matches || got.matches != want.matches || got.sum != want.sum ||
+            st.blocks != n)
+        {
+            differ++;
+        }
+        *matched += want.matches;
+        *read    += st.read;
+        *blocks  += st.blocks;
+    }
+    return differ;
+}
+
+static int refused(const char *path)
+{
+    FIXBLOOM b;
+
+    if (fixbloom_open(&b, path, index_path) == 0)
+    {
+        fixbloom_close(&b);
+        return 0;
+    }
+    return errno == ESTALE;
+}
+
+int main(int argc, char **argv)
+{
+    int      queries = argc > 1 ? atoi(argv[1]) : 300, ok = 1, differ;
+    FIXBLOOM b;
+    FIXBLOOM_QUERY all;
+    uint64_t blocks, partial, read, total;
+    long     matched;
+
+    remove(log_path);
+    remove(other_path);
+    for (int d = 0; d < DEVICES; d++)
+    {
+        lat[d] = LAT0 + (int32_t)((unsigned)d * 7919u % SPAN);
+        lon[d] = LON0 + (int32_t)((unsigned)d * 104729u % SPAN);
+    }
+    for (int s = 0; s < SESSIONS; s++)
+    {
+        if (write_session(log_path, 20000 + 1234 * s, (unsigned)s + 1) != 0) return 2;
+    }
+
+    memset(&all, 0, sizeof(all));
+    scan(log_path, &all, &blocks, &partial);
+    if (fixbloom_build(log_path, index_path, NULL) != 0 || fixbloom_open(&b, log_path, index_path) != 0)
+    {
+        perror("fixbloom");
+        return 2;
+    }
+    int covered = b.hdr.blocks == blocks - 1 && partial == SESSIONS - 1;
+    printf("index covers all but the last block  %s  (%llu of %llu blocks, %llu partial ones inside)\n",
+           covered ? "ok" : "FAILED", (unsigned long long)b.hdr.blocks, (unsigned long long)blocks,
+           (unsigned long long)partial);
+    ok &= covered;
+
+    srand(7);
+    differ = compare(&b, log_path, queries, &matched, &read, &total);
+    int same = differ == 0 && matched > 0 && read < total / 4;
+    printf("queries against a full scan          %s  (%d queries, %d differ, %ld matches, %.1f%% of blocks read)\n",
+           same ? "ok" : "FAILED", queries, differ, matched, 100.0 * (double)read / (double)(total ? total : 1));
+    ok &= same;
+    fixbloom_close(&b);
+
+    // the log grows by one more session: the old index still holds
+    if (write_session(log_path, 5000, 99) != 0) return 2;
+    int reopened = fixbloom_open(&b, log_path, index_path) == 0;
+    if (reopened)
+    {
+        differ   = compare(&b, log_path, queries / 3, &matched, &read, &total);
+        reopened = differ == 0 && matched > 0;
+        fixbloom_close(&b);
+    }
+    printf("grown log, old index                 %s  (%d differ, %ld matches)\n", reopened ? "ok" : "FAILED", differ, matched);
+    ok &= reopened;
+
+    // another log, and this one cut short
+    if (write_session(other_path, 30000, 5) != 0) return 2;
+    int other = refused(other_path);
+    int cut   = truncate(log_path, (off_t)FIXLOG_BLOCK * 3) == 0 && refused(log_path);
+    printf("index of another log refused         %s  (other log %s, cut short %s)\n", other && cut ? "ok" : "FAILED",
+           other ? "refused" : "ACCEPTED", cut ? "refused" : "ACCEPTED");
+    ok &= other && cut;
+
+    remove(log_path);
+    remove(other_path);
+    remove(index_path);
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
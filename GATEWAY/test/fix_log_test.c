@@ -0,0 +1,276 @@
+/*
+ * fix_log_test.c - fix_log drops and durability.
+ *
+ *   fix_log_test
+ *
+ * Each record carries its producer as the device and the producer's own
+ * count as utc_ms, so the file tells which records are there and in what
+ * order. Checked:
+ *   - a full ring: the writer commits every 300 ms, a producer appends a
+ *     burst of four rings' worth. The appends refused are exactly the
+ *     stats' dropped count, and after closing the file holds every
+ *     accepted record once, in order, and nothing else
+ *   - a crash: a child process logs from two producers (fsync every
+ *     20 ms) and reports fixlog_stats to the parent, which kills it with
+ *     SIGKILL. No report has more records durable than written, or fewer
+ *     than the one before; every record the last report counted written
+ *     (so every one durable) is in the file by commit order, each
+ *     producer's records in order; the durability lag stayed within the
+ *     fsync interval plus two commits (and some scheduling slack)
+ *   - reopened after the crash: the log appends behind the old records,
+ *     which are all still there
+ */
+
+#include "fix_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define PRODUCERS   2
+#define FSYNC_MS    20
+#define COMMIT_MS   2
+#define LAG_SLACK   50
+
+typedef struct
+{
+    uint64_t    durable, written;
+    uint32_t    lag_ms;
+} REPORT;
+
+typedef struct
+{
+    FIXLOG_PRODUCER *p;
+    uint64_t        device;
+    uint64_t        sent;
+} PRODUCER;
+
+typedef struct
+{
+    uint64_t    records;                        // in the file
+    uint64_t    below;                          // with first_seq + index < the limit given
+    uint64_t    next[PRODUCERS + 1];            // per device: highest utc_ms + 1
+    int         disorder;                       // a device's records out of order, or an unknown device
+    int         gaps;                           // a device's records not contiguous
+    int         bad_blocks;
+} CONTENT;
+
+static const char *log_path = "/tmp/fix_log_test.log";
+
+
+static void sleep_ms(long ms)
+{
+    struct timespec t = { ms / 1000, ms % 1000 * 1000000L };
+
+    while (nanosleep(&t, &t) != 0);
+}
+
+static void make_fix(FIXRECORD *f, uint64_t n)
+{
+    memset(f, 0, sizeof(*f));
+    f->utc_ms    = (int64_t)n;
+    f->latitude  = 48000000 + (int32_t)(n % 1000);
+    f->longitude = 11000000;
+    f->present   = GPS_HAS_POSITION | GPS_HAS_TIME;
+}
+
+/* reads the whole log; seq_limit: count the records of commit order below it */
+static CONTENT read_log(uint64_t seq_limit)
+{
+    CONTENT c;
+    FILE    *in = fopen(log_path, "rb");
+    uint8_t block[FIXLOG_BLOCK];
+
+    memset(&c, 0, sizeof(c));
+    while (in && fread(block, FIXLOG_BLOCK, 1, in) == 1)
+    {
+        const FIXLOG_RECORD       *rec;
+        const FIXLOG_BLOCK_HEADER *h = (const FIXLOG_BLOCK_HEADER *)block;
+        int                        n = fixlog_block_records(block, &rec);
+
+        if (n < 0)
+        {
+            c.bad_blocks++;
+            continue;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            uint64_t d = rec[i].device, v = (uint64_t)rec[i].fix.utc_ms;
+
+            c.records++;
+            if (h->first_seq + (uint64_t)i < seq_limit) c.below++;
+            if (d == 0 || d > PRODUCERS || v < c.next[d])
+            {
+                c.disorder++;
+                continue;
+            }
+            if (v != c.next[d]) c.gaps++;
+            c.next[d] = v + 1;
+        }
+    }
+    if (in) fclose(in);
+    return c;
+}
+
+static void *produce(void *arg)
+{
+    PRODUCER *pr = arg;
+
+    for (;;)
+    {
+        FIXRECORD f;
+
+        make_fix(&f, pr->sent);
+        if (fixlog_append(pr->p, pr->device, &f) == 0) pr->sent++;
+        else sleep_ms(1);
+        if (pr->sent % 64 == 0) sleep_ms(1);
+    }
+    return NULL;
+}
+
+/* the crashing child: logs from two threads and reports the stats until killed */
+static void child(int out)
+{
+    FIXLOG        log;
+    FIXLOG_CONFIG cfg;
+    PRODUCER      pr[PRODUCERS];
+    pthread_t     tid;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.path      = log_path;
+    cfg.commit_ms = COMMIT_MS;
+    cfg.fsync_ms  = FSYNC_MS;
+    if (fixlog_open(&log, &cfg) != 0) _exit(2);
+    for (int i = 0; i < PRODUCERS; i++)
+    {
+        pr[i].p      = fixlog_producer(&log);
+        pr[i].device = (uint64_t)i + 1;
+        pr[i].sent   = 0;
+        if (!pr[i].p || pthread_create(&tid, NULL, produce, &pr[i]) != 0) _exit(2);
+    }
+    for (;;)
+    {
+        FIXLOG_STATS st;
+        REPORT       r;
+
+        fixlog_stats(&log, &st);
+        r.durable = st.durable;
+        r.written = st.written;
+        r.lag_ms  = st.lag_ms;
+        if (write(out, &r, sizeof(r)) != sizeof(r)) _exit(2);
+        sleep_ms(1);
+    }
+}
+
+int main(void)
+{
+    FIXLOG        log;
+    FIXLOG_CONFIG cfg;
+    FIXLOG_STATS  st;
+    CONTENT       c;
+    int           ok = 1;
+
+    // 1: a burst into a ring the writer does not get to
+    remove(log_path);
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.path         = log_path;
+    cfg.commit_ms    = 300;
+    cfg.ring_records = 1024;
+
+    FIXLOG_PRODUCER *p;
+    uint64_t         accepted = 0, refused = 0;
+
+    if (fixlog_open(&log, &cfg) != 0 || !(p = fixlog_producer(&log))) return 2;
+    for (uint64_t i = 0; i < 4 * 1024; i++)
+    {
+        FIXRECORD f;
+
+        make_fix(&f, accepted);
+        if (fixlog_append(p, 1, &f) == 0) accepted++;
+        else refused++;
+    }
+    fixlog_stats(&log, &st);
+    uint64_t dropped = st.dropped;
+
+    if (fixlog_close(&log) != 0) return 2;
+    c = read_log(0);
+
+    int full = refused > 0 && dropped == refused && accepted + refused == 4 * 1024 && c.records == accepted &&
+               c.next[1] == accepted && c.disorder == 0 && c.gaps == 0 && c.bad_blocks == 0;
+    printf("full ring, drops counted             %s  (%llu accepted, %llu refused, %llu counted dropped, %llu in the file)\n",
+           full ? "ok" : "FAILED", (unsigned long long)accepted, (unsigned long long)refused, (unsigned long long)dropped,
+           (unsigned long long)c.records);
+    ok &= full;
+
+    // 2: killed while logging
+    int   pipefd[2];
+    pid_t pid;
+
+    remove(log_path);
+    if (pipe(pipefd) != 0 || (pid = fork()) < 0) return 2;
+    if (pid == 0)
+    {
+        close(pipefd[0]);
+        child(pipefd[1]);
+    }
+    close(pipefd[1]);
+
+    REPORT          r, last = { 0, 0, 0 };
+    uint32_t        max_lag = 0;
+    int             reports = 0, ahead = 0;
+    struct timespec t0, now;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do
+    {
+        if (read(pipefd[0], &r, sizeof(r)) != sizeof(r)) break;
+        ahead  += r.durable > r.written || r.durable < last.durable || r.written < last.written;
+        last    = r;
+        max_lag = r.lag_ms > max_lag ? r.lag_ms : max_lag;
+        reports++;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec - t0.tv_sec) * 1000 + (now.tv_nsec - t0.tv_nsec) / 1000000 < 500);
+    kill(pid, SIGKILL);                         // right after a report, so the file has moved on little since
+    waitpid(pid, NULL, 0);
+    close(pipefd[0]);
+
+    c = read_log(last.written);
+
+    int durable = last.durable > 0 && ahead == 0 && c.below == last.written && c.disorder == 0 && c.gaps == 0 &&
+                  c.bad_blocks == 0 && max_lag <= FSYNC_MS + 2 * COMMIT_MS + LAG_SLACK;
+    printf("killed, durable records in the file  %s  (%llu reported durable, %llu written, all in the file, %llu in all; "
+           "max lag %u ms, %d of %d reports ahead of the writes)\n", durable ? "ok" : "FAILED",
+           (unsigned long long)last.durable, (unsigned long long)last.written, (unsigned long long)c.records, max_lag,
+           ahead, reports);
+    ok &= durable;
+
+    // 3: reopened, the log goes on behind the old records
+    CONTENT before = c;
+    uint64_t more = 0;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.path = log_path;
+    if (fixlog_open(&log, &cfg) != 0 || !(p = fixlog_producer(&log))) return 2;
+    for (; more < 5000; more++)
+    {
+        FIXRECORD f;
+
+        make_fix(&f, before.next[1] + more);
+        while (fixlog_append(p, 1, &f) != 0) sleep_ms(1);
+    }
+    if (fixlog_close(&log) != 0) return 2;
+    c = read_log(0);
+
+    int reopened = c.records == before.records + more && c.next[1] == before.next[1] + more && c.next[2] == before.next[2] &&
+                   c.disorder == 0 && c.gaps == 0 && c.bad_blocks == 0;
+    printf("reopened, appended behind            %s  (%llu records before, %llu after)\n", reopened ? "ok" : "FAILED",
+           (unsigned long long)before.records, (unsigned long long)c.records);
+    ok &= reopened;
+
+    remove(log_path);
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,367 @@
+/*
+ * geo_index_test.c - geo_index queries against a brute-force scan.
+ *
+ *   geo_index_test [queries]
+ *
+ * 50000 devices: half in a few cities, the rest spread over the globe,
+ * along the antimeridian (both signs, and exactly +-180) and around the
+ * poles (up to exactly +-90). They move, some far enough to change cell,
+ * and some are removed, so the cell lists and the dense entries are
+ * exercised before the queries. Checked, against a scan over every live
+ * device:
+ *   - radius: the same devices, centres in the cities, on the
+ *     antimeridian and at the poles
+ *   - box: the same devices, boxes crossing the antimeridian and
+ *     reaching the poles included
+ *   - k nearest: the same distances in the same order, with and
+ *     without a radius limit
+ * and the throughput of updates and of city queries, against the scan.
+ */
+
+#include "geo_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define DEVICES     50000
+#define CITIES      8
+#define K_MAX       50
+
+#define EARTH_RADIUS        6371008.8
+#define RAD_PER_UNIT        (M_PI / 180.0 / GPS_COORD_SCALE)
+#define D                   GPS_COORD_SCALE
+
+static const int32_t city[CITIES][2] =
+{
+    { 48137000, 11575000 }, { 51507000, -127000 }, { 40712000, -74006000 }, { -33868000, 151209000 },
+    { 35676000, 139650000 }, { -23550000, -46633000 }, { 64146000, -21942000 }, { -36848000, 174763000 },
+};
+
+static LOCATION  pos[DEVICES];
+static int       live[DEVICES];
+static GEO_HIT   hit[DEVICES];
+static GEO_INDEX g;
+
+typedef struct
+{
+    uint64_t    id;
+    double      dist;
+} NEAR;
+
+
+static int32_t span(int32_t lo, int32_t hi)
+{
+    return lo + (int32_t)(((uint32_t)rand() << 16 ^ (uint32_t)rand()) % (uint32_t)(hi - lo + 1));
+}
+
+/* same great-circle distance as the index */
+static double distance(const LOCATION *a, const LOCATION *b)
+{
+    double phi1 = a->latitude * RAD_PER_UNIT;
+    double phi2 = b->latitude * RAD_PER_UNIT;
+    double s1   = sin((phi2 - phi1) / 2);
+    double s2   = sin((double)(b->longitude - a->longitude) * RAD_PER_UNIT / 2);
+    double h    = s1 * s1 + cos(phi1) * cos(phi2) * s2 * s2;
+
+    return 2 * EARTH_RADIUS * asin(sqrt(h < 1 ? h : 1));
+}
+
+/* a location of the mix: city, antimeridian, pole or anywhere */
+static void place(LOCATION *loc)
+{
+    int kind = rand() % 20;
+
+    memset(loc, 0, sizeof(*loc));
+    if (kind < 10)
+    {
+        const int32_t *c = city[rand() % CITIES];
+
+        loc->latitude  = c[0] + span(-200000, 200000);
+        loc->longitude = c[1] + span(-200000, 200000);
+    }
+    else if (kind < 13)
+    {
+        loc->latitude  = span(-70 * D, 70 * D);
+        loc->longitude = rand() % 10 ? span(179 * D, 180 * D) * (rand() % 2 ? 1 : -1) : (rand() % 2 ? 180 * D : -180 * D);
+    }
+    else if (kind < 16)
+    {
+        loc->latitude  = (rand() % 10 ? span(89 * D, 90 * D) : 90 * D) * (rand() % 2 ? 1 : -1);
+        loc->longitude = span(-180 * D, 180 * D);
+    }
+    else
+    {
+        loc->latitude  = span(-90 * D, 90 * D);
+        loc->longitude = span(-180 * D, 180 * D);
+    }
+}
+
+/* a query centre: a city, the antimeridian or a pole */
+static void centre(LOCATION *loc)
+{
+    place(loc);
+    if (rand() % 4 == 0) loc->latitude = rand() % 2 ? 90 * D : -90 * D;
+}
+
+static int in_box(const LOCATION *p, const LOCATION *min, const LOCATION *max)
+{
+    if (p->latitude < min->latitude || p->latitude > max->latitude) return 0;
+    if (min->longitude <= max->longitude) return p->longitude >= min->longitude && p->longitude <= max->longitude;
+    return p->longitude >= min->longitude || p->longitude <= max->longitude;
+}
+
+static int id_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static int near_cmp(const void *a, const void *b)
+{
+    double x = ((const NEAR *)a)->dist, y = ((const NEAR *)b)->dist;
+
+    return (x > y) - (x < y);
+}
+
+/* the hits' ids against the brute-force ids, both sorted */
+static int same_ids(uint32_t n, uint64_t *want, uint32_t m)
+{
+    static uint64_t got[DEVICES];
+
+    if (n != m) return 0;
+    for (uint32_t i = 0; i < n; i++) got[i] = hit[i].id;
+    qsort(got, n, sizeof(uint64_t), id_cmp);
+    qsort(want, m, sizeof(uint64_t), id_cmp);
+    return memcmp(got, want, n * sizeof(uint64_t)) == 0;
+}
+
+static uint32_t scan_radius(const LOCATION *c, float radius, uint64_t *out)
+{
+    uint32_t m = 0;
+
+    for (uint32_t i = 0; i < DEVICES; i++)
+    {
+        if (live[i] && distance(c, &pos[i]) <= radius) out[m++] = i;
+    }
+    return m;
+}
+
+static uint32_t scan_nearest(const LOCATION *c, uint32_t k, float max_radius, NEAR *out)
+{
+    static NEAR all[DEVICES];
+    uint32_t    m = 0;
+
+    for (uint32_t i = 0; i < DEVICES; i++)
+    {
+        if (!live[i]) continue;
+        all[m].id   = i;
+        all[m].dist = distance(c, &pos[i]);
+        if (max_radius <= 0 || all[m].dist <= max_radius) m++;
+    }
+    qsort(all, m, sizeof(NEAR), near_cmp);
+    if (m > k) m = k;
+    memcpy(out, all, m * sizeof(NEAR));
+    return m;
+}
+
+static double elapsed_s(const struct timespec *since)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - since->tv_sec) + (double)(now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    static uint64_t want[DEVICES];
+    static NEAR     best[K_MAX];
+    int             queries = argc > 1 ? atoi(argv[1]) : 300, ok = 1, differ;
+    long            found;
+
+    if (queries < 1 || geo_init(&g, DEVICES, 0) != 0) return 2;
+    srand(3);
+
+    // in, moved (a tenth of them to somewhere else entirely), a twentieth removed
+    int rejected = 0;
+
+    for (uint32_t i = 0; i < DEVICES; i++)
+    {
+        place(&pos[i]);
+        rejected += geo_update(&g, i, &pos[i]) != 0;
+        live[i] = 1;
+    }
+    for (uint32_t i = 0; i < DEVICES; i++)
+    {
+        if (rand() % 10 == 0) place(&pos[i]);
+        else
+        {
+            pos[i].latitude  = pos[i].latitude > 89990000 || pos[i].latitude < -89990000 ? pos[i].latitude
+                                                                                          : pos[i].latitude + span(-5000, 5000);
+            pos[i].longitude = pos[i].longitude > 179990000 || pos[i].longitude < -179990000 ? pos[i].longitude
+                                                                                              : pos[i].longitude + span(-5000, 5000);
+        }
+        rejected += geo_update(&g, i, &pos[i]) != 0;
+    }
+    for (uint32_t i = 0; i < DEVICES; i++)
+    {
+        if (rand() % 20 == 0)
+        {
+            rejected += geo_remove(&g, i) != 0;
+            live[i] = 0;
+        }
+    }
+    int filled = rejected == 0 && geo_remove(&g, DEVICES) == -1;
+
+    printf("updates and removals                 %s  (%u devices, %llu cell changes, %d rejected)\n", filled ? "ok" : "FAILED",
+           g.count, (unsigned long long)g.moves, rejected);
+    ok &= filled;
+
+    // radius
+    differ = 0;
+    found  = 0;
+    for (int q = 0; q < queries; q++)
+    {
+        LOCATION c;
+        float    radius = (float)(rand() % 4 ? span(100, 50000) : span(50000, 1500000));
+
+        centre(&c);
+        uint32_t m = scan_radius(&c, radius, want);
+
+        differ += !same_ids(geo_radius(&g, &c, radius, hit, DEVICES), want, m);
+        found  += m;
+    }
+    printf("radius against a scan                %s  (%d queries, %d differ, %ld devices found)\n", differ ? "FAILED" : "ok",
+           queries, differ, found);
+    ok &= differ == 0;
+
+    // box, a third of them across the antimeridian, a third reaching a pole
+    differ = 0;
+    found  = 0;
+    for (int q = 0; q < queries; q++)
+    {
+        LOCATION min = { 0 }, max = { 0 };
+        int32_t  h = span(1000, 3 * D), w = span(1000, 5 * D);
+        uint32_t m = 0;
+
+        switch (q % 3)
+        {
+            case 0:
+                min.latitude  = span(-70 * D, 70 * D);
+                min.longitude = span(180 * D - w, 180 * D);
+                max.longitude = min.longitude + w - 360 * D;
+                break;
+            case 1:
+                min.latitude  = rand() % 2 ? 90 * D - h : -90 * D;
+                min.longitude = span(-180 * D, 180 * D - w);
+                max.longitude = min.longitude + w;
+                break;
+            default:
+                min.latitude  = city[q % CITIES][0] - h / 2;
+                min.longitude = city[q % CITIES][1] - w / 2;
+                max.longitude = min.longitude + w;
+                break;
+        }
+        max.latitude = min.latitude + h;
+        for (uint32_t i = 0; i < DEVICES; i++)
+        {
+            if (live[i] && in_box(&pos[i], &min, &max)) want[m++] = i;
+        }
+        differ += !same_ids(geo_box(&g, &min, &max, hit, DEVICES), want, m);
+        found  += m;
+    }
+    printf("box against a scan                   %s  (%d queries, %d differ, %ld devices found)\n", differ ? "FAILED" : "ok",
+           queries, differ, found);
+    ok &= differ == 0;
+
+    // k nearest, the same distances in the same order
+    differ = 0;
+    found  = 0;
+    for (int q = 0; q < queries; q++)
+    {
+        LOCATION c;
+        uint32_t k          = 1 + (uint32_t)rand() % K_MAX;
+        float    max_radius = rand() % 2 ? 0 : (float)span(200, 20000);
+
+        centre(&c);
+        uint32_t m = scan_nearest(&c, k, max_radius, best);
+        uint32_t n = geo_nearest(&g, &c, k, max_radius, hit);
+        int      same = n == m;
+
+        for (uint32_t i = 0; same && i < n; i++) same = hit[i].dist == (float)best[i].dist;
+        differ += !same;
+        found  += n;
+    }
+    printf("k nearest against a scan             %s  (%d queries, %d differ, %ld devices found)\n", differ ? "FAILED" : "ok",
+           queries, differ, found);
+    ok &= differ == 0;
+
+    // throughput: updates, then city radius (1 km) and 10 nearest queries, against the scan
+    struct timespec t0;
+    uint64_t        ids[1000];
+    LOCATION        batch[1000];
+    double          update_s, radius_s, nearest_s, scan_s;
+    int             rounds = 200;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            ids[i]   = (uint64_t)(rand() % DEVICES);
+            batch[i] = pos[ids[i]];
+            batch[i].latitude += span(-3000, 3000) * (batch[i].latitude > -89 * D && batch[i].latitude < 89 * D);
+            pos[ids[i]] = batch[i];
+            live[ids[i]] = 1;
+        }
+        geo_update_batch(&g, ids, batch, 1000);
+    }
+    update_s = elapsed_s(&t0);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int q = 0; q < 20000; q++)
+    {
+        LOCATION c = { 0 };
+
+        c.latitude  = city[q % CITIES][0] + span(-100000, 100000);
+        c.longitude = city[q % CITIES][1] + span(-100000, 100000);
+        found += geo_radius(&g, &c, 1000, hit, DEVICES);
+    }
+    radius_s = elapsed_s(&t0);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int q = 0; q < 20000; q++)
+    {
+        LOCATION c = { 0 };
+
+        c.latitude  = city[q % CITIES][0] + span(-100000, 100000);
+        c.longitude = city[q % CITIES][1] + span(-100000, 100000);
+        found += geo_nearest(&g, &c, 10, 0, hit);
+    }
+    nearest_s = elapsed_s(&t0);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int q = 0; q < 200; q++)
+    {
+        LOCATION c = { 0 };
+
+        c.latitude  = city[q % CITIES][0] + span(-100000, 100000);
+        c.longitude = city[q % CITIES][1] + span(-100000, 100000);
+        found += scan_radius(&c, 1000, want);
+    }
+    scan_s = elapsed_s(&t0) / 200 * 20000;
+
+    int fast = radius_s < scan_s && nearest_s < scan_s;
+
+    printf("throughput                           %s  (%.1f M updates/s; city radius %.0f k/s, 10 nearest %.0f k/s, "
+           "scan %.1f k/s)\n", fast ? "ok" : "FAILED", rounds * 1000 / update_s / 1e6, 20000 / radius_s / 1e3,
+           20000 / nearest_s / 1e3, 20000 / scan_s / 1e3);
+    ok &= fast;
+
+    geo_free(&g);
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
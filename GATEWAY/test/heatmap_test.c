@@ -0,0 +1,318 @@
+/*
+ * heatmap_test.c - heat_aggregate on known inputs.
+ *
+ *   heatmap_test [threads]
+ *
+ * Checked:
+ *   - a small NMEA log with GGA fixes in the middle of known cells of a
+ *     600 x 600 cell grid (3 x 3 tiles): every cell holds exactly the
+ *     fixes sent to it, one outside the grid and one with too few
+ *     satellites are counted as such, a bad checksum is not read
+ *   - its raw tiles at zoom levels 0, 1 and 2: tiles.txt gives each
+ *     level's cell and tile counts, the tile of a cell and its place in
+ *     the tile (rows north first) hold the sum of the finer cells, tiles
+ *     without fixes have no file
+ *   - a large NMEA log and a track file, several HEAT_CHUNK units each:
+ *     the grid and the counters with several workers are those of one
+ *     worker
+ */
+
+#include "heatmap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CELL        1000
+#define SIDE        600                         // cells
+#define LAT0        48000000
+#define LON0        11000000
+#define LEVELS      3
+
+typedef struct
+{
+    int         row, col, count;
+} SPOT;
+
+static const char *small_path = "/tmp/heatmap_test.nmea";
+static const char *large_path = "/tmp/heatmap_test.large.nmea";
+static const char *track_path = "/tmp/heatmap_test.trk";
+static const char *tile_dir   = "/tmp/heatmap_test.tiles";
+
+/* the small log: fixes per cell, across tile borders and at the far corner */
+static const SPOT spot[] =
+{
+    { 0, 0, 3 }, { 0, 1, 1 }, { 1, 1, 2 }, { 255, 255, 1 }, { 256, 0, 2 }, { 300, 300, 4 }, { 301, 301, 1 },
+    { 599, 599, 1 }, { 520, 100, 5 },
+};
+#define SPOTS       (int)(sizeof(spot) / sizeof(spot[0]))
+
+
+static void sentence(FILE *fp, const char *body, int bad)
+{
+    unsigned char sum = 0;
+
+    for (const char *p = body; *p; p++) sum ^= (unsigned char)*p;
+    fprintf(fp, "$%s*%02X\r\n", body, sum ^ (bad ? 0x55 : 0));
+}
+
+/* GGA (and a RMC before it) at degrees * GPS_COORD_SCALE */
+static void fix(FILE *fp, int t, int32_t lat, int32_t lon, int sats, int bad)
+{
+    char body[160];
+    char hms[16];
+
+    snprintf(hms, sizeof(hms), "%02d%02d%02d.00", t / 3600 % 24, t / 60 % 60, t % 60);
+    snprintf(body, sizeof(body), "GPRMC,%s,A,%02d%02d.%04d,N,%03d%02d.%04d,E,%d.%d,90.0,180326,,", hms, lat / 1000000,
+             lat % 1000000 * 60 / 1000000, lat % 1000000 * 60 % 1000000 / 100, lon / 1000000, lon % 1000000 * 60 / 1000000,
+             lon % 1000000 * 60 % 1000000 / 100, t % 30, t % 10);
+    sentence(fp, body, 0);
+    snprintf(body, sizeof(body), "GPGGA,%s,%02d%02d.%04d,N,%03d%02d.%04d,E,1,%02d,0.9,500.0,M,46.9,M,,", hms, lat / 1000000,
+             lat % 1000000 * 60 / 1000000, lat % 1000000 * 60 % 1000000 / 100, lon / 1000000, lon % 1000000 * 60 / 1000000,
+             lon % 1000000 * 60 % 1000000 / 100, sats);
+    sentence(fp, body, bad);
+}
+
+static int grid_init(HEAT_GRID *g)
+{
+    LOCATION min = { 0 }, max = { 0 };
+
+    min.latitude  = LAT0;
+    min.longitude = LON0;
+    max.latitude  = LAT0 + SIDE * CELL;
+    max.longitude = LON0 + SIDE * CELL;
+    return heat_grid_init(g, &min, &max, CELL);
+}
+
+static uint32_t cell_count(const HEAT_GRID *g, int row, int col)
+{
+    const uint32_t *t = g->tile[(size_t)(row / HEAT_TILE) * g->tiles_x + (size_t)(col / HEAT_TILE)];
+
+    return t ? t[(row % HEAT_TILE) * HEAT_TILE + col % HEAT_TILE] : 0;
+}
+
+/* fixes the spots put into a cell of a level */
+static uint32_t expected(int level, int row, int col)
+{
+    uint32_t n = 0;
+
+    for (int i = 0; i < SPOTS; i++)
+    {
+        if (spot[i].row >> level == row && spot[i].col >> level == col) n += (uint32_t)spot[i].count;
+    }
+    return n;
+}
+
+/* a level's cell from its raw tile file, -1 without the file */
+static long tile_count(int level, int tiles_y, int row, int col)
+{
+    char     path[256];
+    uint8_t  b[4];
+    FILE     *fp;
+    long     v = -1;
+
+    snprintf(path, sizeof(path), "%s/%d/%d_%d.u32", tile_dir, level, col / HEAT_TILE, tiles_y - 1 - row / HEAT_TILE);
+    if (!(fp = fopen(path, "rb"))) return -1;
+    if (fseek(fp, ((long)(HEAT_TILE - 1 - row % HEAT_TILE) * HEAT_TILE + col % HEAT_TILE) * 4, SEEK_SET) == 0 &&
+        fread(b, 1, 4, fp) == 4)
+    {
+        v = (long)((uint32_t)b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24);
+    }
+    fclose(fp);
+    return v;
+}
+
+/* every level's tiles against the spots; 0 on a mismatch */
+static int check_tiles(char *detail, size_t size)
+{
+    char  path[256];
+    FILE  *fp;
+    int   ok = 1, files = 0;
+
+    snprintf(path, sizeof(path), "%s/tiles.txt", tile_dir);
+    if (!(fp = fopen(path, "r"))) return 0;
+    for (int l = 0; l < LEVELS; l++)
+    {
+        long     cell, lat, lon, tiles_x, tiles_y, max, level;
+        int      side = (SIDE + (1 << l) - 1) >> l, want_tiles = (side + HEAT_TILE - 1) / HEAT_TILE;
+        uint32_t want_max = 0;
+
+        for (int i = 0; i < SPOTS; i++)
+        {
+            uint32_t n = expected(l, spot[i].row >> l, spot[i].col >> l);
+
+            want_max = n > want_max ? n : want_max;
+        }
+
+        if (fscanf(fp, "%ld %ld %ld %ld %ld %ld %ld", &level, &cell, &lat, &lon, &tiles_x, &tiles_y, &max) != 7 ||
+            level != l || cell != (long)CELL << l || lat != LAT0 || lon != LON0 || tiles_x != want_tiles ||
+            tiles_y != want_tiles || max != (long)want_max)
+        {
+            ok = 0;
+            break;
+        }
+
+        // the spots' cells, and their tiles' neighbours that got nothing
+        for (int i = 0; i < SPOTS; i++)
+        {
+            int row = spot[i].row >> l, col = spot[i].col >> l;
+
+            ok &= tile_count(l, want_tiles, row, col) == (long)expected(l, row, col);
+            ok &= tile_count(l, want_tiles, row ^ 1, col) == (long)expected(l, row ^ 1, col);
+        }
+
+        // tiles with a file: exactly those holding a spot
+        for (int ty = 0; ty < want_tiles; ty++)
+        {
+            for (int tx = 0; tx < want_tiles; tx++)
+            {
+                int held = 0;
+
+                for (int i = 0; i < SPOTS; i++) held |= (spot[i].row >> l) / HEAT_TILE == ty && (spot[i].col >> l) / HEAT_TILE == tx;
+                snprintf(path, sizeof(path), "%s/%d/%d_%d.u32", tile_dir, l, tx, want_tiles - 1 - ty);
+                ok &= (access(path, F_OK) == 0) == held;
+                files += held;
+            }
+        }
+    }
+    fclose(fp);
+    snprintf(detail, size, "%d levels, %d tile files", LEVELS, files);
+    return ok;
+}
+
+/* a random walk over the grid, a bit beyond it: size bytes of NMEA and a track file */
+static int write_large(size_t size)
+{
+    FILE         *nmea = fopen(large_path, "wb"), *trk = fopen(track_path, "wb");
+    TRACK_HEADER h = { TRACK_MAGIC, sizeof(FIXRECORD), 0 };
+    int32_t      lat = LAT0 + SIDE * CELL / 2, lon = LON0 + SIDE * CELL / 2;
+
+    if (!nmea || !trk || fwrite(&h, sizeof(h), 1, trk) != 1) return -1;
+    srand(5);
+    for (int t = 0; ftell(nmea) < (long)size; t++)
+    {
+        FIXRECORD rec;
+
+        lat += rand() % 4001 - 2000;
+        lon += rand() % 4001 - 2000;
+        if (lat < LAT0 - 10000 || lat > LAT0 + SIDE * CELL + 10000) lat = LAT0 + SIDE * CELL / 2;
+        if (lon < LON0 - 10000 || lon > LON0 + SIDE * CELL + 10000) lon = LON0 + SIDE * CELL / 2;
+        fix(nmea, t, lat, lon, 3 + rand() % 10, rand() % 200 == 0);
+
+        memset(&rec, 0, sizeof(rec));
+        rec.utc_ms    = 1700000000000LL + t * 1000LL;
+        rec.latitude  = lon - LON0 + LAT0;                  // another walk: the same one mirrored
+        rec.longitude = lat - LAT0 + LON0;
+        rec.numsat    = (uint8_t)(3 + rand() % 10);
+        rec.fix       = 1;
+        rec.present   = GPS_HAS_POSITION | GPS_HAS_TIME | GPS_HAS_FIX | GPS_HAS_NUMSAT;
+        if (fwrite(&rec, sizeof(rec), 1, trk) != 1) return -1;
+        rec.latitude += 150000;
+        rec.numsat    = (uint8_t)(rec.numsat + 1);
+        if (fwrite(&rec, sizeof(rec), 1, trk) != 1) return -1;
+    }
+    return fclose(nmea) == 0 && fclose(trk) == 0 ? 0 : -1;
+}
+
+static double elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - since->tv_sec) * 1e3 + (double)(now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    int         threads = argc > 1 ? atoi(argv[1]) : 4, ok = 1;
+    HEAT_GRID   g, one, many;
+    HEAT_FILTER filter;
+    FILE        *fp;
+    char        detail[160];
+    uint32_t    want = 0;
+
+    // the small log
+    if (!(fp = fopen(small_path, "wb"))) return 2;
+    for (int i = 0, t = 0; i < SPOTS; i++)
+    {
+        for (int n = 0; n < spot[i].count; n++, t++)
+        {
+            fix(fp, t, LAT0 + spot[i].row * CELL + CELL / 2, LON0 + spot[i].col * CELL + CELL / 2, 8, 0);
+        }
+        want += (uint32_t)spot[i].count;
+    }
+    fix(fp, 100, LAT0 + SIDE * CELL + CELL / 2, LON0 + CELL / 2, 8, 0);     // north of the grid
+    fix(fp, 101, LAT0 + CELL / 2, LON0 + CELL / 2, 4, 0);                   // too few satellites
+    fix(fp, 102, LAT0 + CELL / 2, LON0 + CELL / 2, 8, 1);                   // bad checksum
+    fprintf(fp, "$GPGGA,000103.00,4800.0300,N,01100.");                    // cut off
+    if (fclose(fp) != 0) return 2;
+
+    memset(&filter, 0, sizeof(filter));
+    filter.min_sats = 5;
+    if (grid_init(&g) != 0 || heat_aggregate(&small_path, 1, 1, &filter, &g) != 0) return 2;
+
+    int      exact = g.binned == want && g.outside == 1 && g.filtered == 1;
+    uint64_t total = 0;
+
+    for (int i = 0; i < SPOTS; i++) exact &= cell_count(&g, spot[i].row, spot[i].col) == (uint32_t)spot[i].count;
+    for (size_t i = 0; i < (size_t)g.tiles_x * g.tiles_y; i++)
+    {
+        for (uint32_t c = 0; g.tile[i] && c < HEAT_TILE * HEAT_TILE; c++) total += g.tile[i][c];
+    }
+    exact &= total == want;
+    printf("small log, cell counts               %s  (%llu binned of %u, %llu outside, %llu filtered, %llu in all cells)\n",
+           exact ? "ok" : "FAILED", (unsigned long long)g.binned, want, (unsigned long long)g.outside,
+           (unsigned long long)g.filtered, (unsigned long long)total);
+    ok &= exact;
+
+    // its tiles
+    char cmd[300];
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", tile_dir);
+    if (system(cmd) != 0) return 2;
+    int tiles = heat_write_tiles(&g, tile_dir, LEVELS, 1) == 0 && check_tiles(detail, sizeof(detail));
+
+    printf("tiles and zoom levels                %s  (%s)\n", tiles ? "ok" : "FAILED", detail);
+    ok &= tiles;
+    heat_grid_free(&g);
+    system(cmd);
+    remove(small_path);
+
+    // several workers against one
+    const char      *paths[2] = { large_path, track_path };
+    struct timespec t0;
+    double          one_ms, many_ms;
+
+    if (write_large(3 * HEAT_CHUNK) != 0 || grid_init(&one) != 0 || grid_init(&many) != 0) return 2;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (heat_aggregate(paths, 2, 1, &filter, &one) != 0) return 2;
+    one_ms = elapsed_ms(&t0);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (heat_aggregate(paths, 2, threads, &filter, &many) != 0) return 2;
+    many_ms = elapsed_ms(&t0);
+
+    int      same = one.binned == many.binned && one.outside == many.outside && one.filtered == many.filtered &&
+                    one.binned > 0 && one.outside > 0 && one.filtered > 0;
+    uint32_t cells = 0;
+
+    for (int row = 0; row < SIDE; row++)
+    {
+        for (int col = 0; col < SIDE; col++)
+        {
+            same  &= cell_count(&one, row, col) == cell_count(&many, row, col);
+            cells += cell_count(&one, row, col) != 0;
+        }
+    }
+    printf("%d workers against one                %s  (%llu binned, %llu outside, %llu filtered, %u cells; %.0f / %.0f ms)\n",
+           threads, same ? "ok" : "FAILED", (unsigned long long)many.binned, (unsigned long long)many.outside,
+           (unsigned long long)many.filtered, cells, one_ms, many_ms);
+    ok &= same;
+
+    heat_grid_free(&one);
+    heat_grid_free(&many);
+    remove(large_path);
+    remove(track_path);
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,219 @@
+/*
+ * map_match_test.c - Map matching on a synthetic block grid.
+ *
+ *   map_match_test [fixes]
+ *
+ * A 20 x 20 grid of 100 m blocks (two-way streets) is built from file
+ * records, saved and loaded back. A vehicle drives a random route over it
+ * at 10 m/s, and each second reports a fix with 12 m Gaussian noise on
+ * each axis (HDOP 1). Checked:
+ *   - the loaded graph equals the built one
+ *   - the smoothed (lagged) match is on the street actually driven (or,
+ *     near a junction, on one of its streets) for at least 95% of the
+ *     fixes, and the chain never breaks
+ *   - the mean error against the true position drops well below the raw
+ *     fix error (the cross-track part is removed)
+ * The time per fix is printed, not checked.
+ */
+
+#include "map_match.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define BLOCKS      20
+#define SIDE        (BLOCKS + 1)                // nodes per row
+#define BLOCK_M     100.0
+#define SPEED       10.0                        // m per fix
+#define NOISE       12.0                        // m, each axis
+#define LAT0        48100000                    // µdeg
+#define LON0        11500000
+
+#define M_LAT       0.111195                    // m per µdeg of latitude
+#define M_LON       (M_LAT * cos(LAT0 * 1e-6 * M_PI / 180))
+
+static MM_FILE_NODE node[SIDE * SIDE];
+static MM_FILE_EDGE edge[2 * BLOCKS * SIDE];
+static uint32_t     edge_count;
+
+
+static double gauss(void)
+{
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static void make_grid(void)
+{
+    for (int r = 0; r < SIDE; r++)
+    {
+        for (int c = 0; c < SIDE; c++)
+        {
+            node[r * SIDE + c].latitude  = LAT0 + (int32_t)lround(r * BLOCK_M / M_LAT);
+            node[r * SIDE + c].longitude = LON0 + (int32_t)lround(c * BLOCK_M / M_LON);
+            if (c < BLOCKS) edge[edge_count++] = (MM_FILE_EDGE){ (uint32_t)(r * SIDE + c), (uint32_t)(r * SIDE + c + 1), 0 };
+            if (r < BLOCKS) edge[edge_count++] = (MM_FILE_EDGE){ (uint32_t)(r * SIDE + c), (uint32_t)((r + 1) * SIDE + c), 0 };
+        }
+    }
+}
+
+static int same_graph(const MM_GRAPH *a, const MM_GRAPH *b)
+{
+    if (a->node_count != b->node_count || a->edge_count != b->edge_count) return 0;
+    for (uint32_t i = 0; i < a->node_count; i++)
+    {
+        if (a->x[i] != b->x[i] || a->y[i] != b->y[i]) return 0;
+    }
+    for (uint32_t i = 0; i < a->edge_count; i++)
+    {
+        if (a->edge[i].from != b->edge[i].from || a->edge[i].to != b->edge[i].to ||
+            a->edge[i].flags != b->edge[i].flags || a->edge[i].length != b->edge[i].length) return 0;
+    }
+    return 1;
+}
+
+/* the next node of the route: any neighbour but the one we came from */
+static int next_node(int at, int from)
+{
+    int r = at / SIDE, c = at % SIDE, n;
+
+    do
+    {
+        switch (rand() % 4)
+        {
+            case 0:  n = c < BLOCKS ? at + 1 : -1;    break;
+            case 1:  n = c > 0 ? at - 1 : -1;         break;
+            case 2:  n = r < BLOCKS ? at + SIDE : -1; break;
+            default: n = r > 0 ? at - SIDE : -1;      break;
+        }
+    } while (n < 0 || n == from);
+    return n;
+}
+
+static double error_m(const LOCATION *l, double x, double y)
+{
+    double dx = (l->longitude - LON0) * M_LON - x;
+    double dy = (l->latitude - LAT0) * M_LAT - y;
+
+    return sqrt(dx * dx + dy * dy);
+}
+
+int main(int argc, char **argv)
+{
+    int         fixes = argc > 1 ? atoi(argv[1]) : 5000;
+    MM_GRAPH    built, loaded;
+    MM_MATCHER  *m = malloc(sizeof(MM_MATCHER));
+    MM_DEVICE   dev;
+    int         ok = 1;
+    const char  *path = "/tmp/map_match_test.rgr";
+
+    // truth of the last MM_WINDOW fixes: position and street
+    double      tx[MM_WINDOW], ty[MM_WINDOW];
+    int         ta[MM_WINDOW], tb[MM_WINDOW];
+
+    if (!m || fixes < MM_WINDOW) return 2;
+    srand(1);
+    make_grid();
+
+    if (mm_graph_build(&built, node, SIDE * SIDE, edge, edge_count) != 0 ||
+        mm_graph_save(path, node, SIDE * SIDE, edge, edge_count) != 0 || mm_graph_load(&loaded, path) != 0)
+    {
+        printf("graph build / save / load FAILED\n");
+        return 1;
+    }
+    remove(path);
+
+    int same = same_graph(&built, &loaded);
+    printf("saved and loaded graph               %s  (%u nodes, %u edges)\n",
+           same ? "ok" : "FAILED", loaded.node_count, loaded.edge_count);
+    ok &= same;
+
+    mm_init(m, &loaded);
+    mm_device_init(&dev);
+
+    int     from = SIDE * (SIDE / 2) + SIDE / 2, to = next_node(from, -1);
+    double  along = 0, raw_err = 0, now_err = 0, lag_err = 0;
+    int     lag_n = 0, lag_on_street = 0;
+    clock_t t0 = clock();
+
+    for (int i = 0; i < fixes; i++)
+    {
+        GPSSTRUCT fix;
+        MM_MATCH  now, lagged;
+
+        along += SPEED;
+        while (along >= BLOCK_M)
+        {
+            along -= BLOCK_M;
+            int n = next_node(to, from);
+            from  = to;
+            to    = n;
+        }
+
+        double x = (from % SIDE + (to % SIDE - from % SIDE) * along / BLOCK_M) * BLOCK_M;
+        double y = (from / SIDE + (to / SIDE - from / SIDE) * along / BLOCK_M) * BLOCK_M;
+        double fx = x + NOISE * gauss(), fy = y + NOISE * gauss();
+        int    k = i % MM_WINDOW;
+
+        tx[k] = x;  ty[k] = y;  ta[k] = from;  tb[k] = to;
+
+        memset(&fix, 0, sizeof(fix));
+        fix.ggastruct.location.latitude  = LAT0 + (int32_t)lround(fy / M_LAT);
+        fix.ggastruct.location.longitude = LON0 + (int32_t)lround(fx / M_LON);
+        fix.ggastruct.is_fix_valid       = 1;
+        fix.ggastruct.hdop               = 100;
+        fix.ggastruct.present            = GPS_HAS_POSITION | GPS_HAS_FIX | GPS_HAS_HDOP;
+
+        raw_err += sqrt((fx - x) * (fx - x) + (fy - y) * (fy - y));
+        if (mm_update(m, &dev, &fix, &now, &lagged) != 0) continue;
+        now_err += error_m(&now.location, x, y);
+
+        if (!lagged.valid) continue;
+
+        // the lagged match is for the fix MM_WINDOW - 1 epochs ago
+        int            j = (i + 1) % MM_WINDOW;
+        const MM_EDGE *e = &loaded.edge[lagged.edge];
+
+        lag_err += error_m(&lagged.location, tx[j], ty[j]);
+        lag_n++;
+        if (((int)e->from == ta[j] && (int)e->to == tb[j]) || ((int)e->from == tb[j] && (int)e->to == ta[j]))
+        {
+            lag_on_street++;
+        }
+        else
+        {
+            // within two sigma of a junction any street of it is right
+            double dx = tx[j] - (ta[j] % SIDE) * BLOCK_M, dy = ty[j] - (ta[j] / SIDE) * BLOCK_M;
+            int    near_from = sqrt(dx * dx + dy * dy) < 2 * NOISE;
+            int    near_to   = BLOCK_M - sqrt(dx * dx + dy * dy) < 2 * NOISE;
+
+            if ((near_from && ((int)e->from == ta[j] || (int)e->to == ta[j])) ||
+                (near_to && ((int)e->from == tb[j] || (int)e->to == tb[j]))) lag_on_street++;
+        }
+    }
+    double us = (double)(clock() - t0) * 1e6 / CLOCKS_PER_SEC / fixes;
+
+    raw_err /= fixes;
+    now_err /= fixes;
+    lag_err /= lag_n ? lag_n : 1;
+
+    int street_ok = lag_n == fixes - (MM_WINDOW - 1) && lag_on_street >= lag_n * 95 / 100 && dev.breaks == 0;
+    printf("lagged match on the driven street    %s  (%d of %d, %u breaks)\n",
+           street_ok ? "ok" : "FAILED", lag_on_street, lag_n, dev.breaks);
+    ok &= street_ok;
+
+    int error_ok = lag_err < raw_err * 0.8 && now_err < raw_err;
+    printf("mean error                           %s  (fix %.1f m, matched now %.1f m, lagged %.1f m, %.1f us per fix)\n",
+           error_ok ? "ok" : "FAILED", raw_err, now_err, lag_err, us);
+    ok &= error_ok;
+
+    mm_graph_free(&built);
+    mm_graph_free(&loaded);
+    free(m);
+
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
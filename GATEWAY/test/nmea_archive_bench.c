@@ -0,0 +1,167 @@
+/*
+ * nmea_archive_bench.c - NMZ against gzip and xz on a receiver log.
+ *
+ *   nmea_archive_bench [seconds]
+ *
+ * The log is what SIM/gnss_sim puts out at 1 Hz with its default sentences
+ * (RMC, VTG, GGA, GSA, three GSV pages) over a drive with a new speed and
+ * course every minute, some stops and an outage every hour; 20000 s make
+ * about 9 MB. It goes through nmeaz_compress_file in the default block
+ * size and back through nmeaz_decompress_file, and through gzip -9 and
+ * xz -9 for comparison. Checked:
+ *   - the log comes back byte for byte
+ *   - NMZ is smaller than gzip -9, and than xz -9 where xz is installed
+ * The sizes, ratios and NMZ speeds are reported.
+ */
+
+#include "nmea_archive.h"
+#include "gnss_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define STEP_MS     10
+
+static const char   *log_path  = "/tmp/nmea_archive_bench.nmea";
+static const char   *nmz_path  = "/tmp/nmea_archive_bench.nmz";
+static const char   *back_path = "/tmp/nmea_archive_bench.back";
+static const char   *gz_path   = "/tmp/nmea_archive_bench.gz";
+static const char   *xz_path   = "/tmp/nmea_archive_bench.xz";
+
+static FILE         *log_file;
+
+
+static double seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static long file_size(const char *path)
+{
+    struct stat st;
+
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+static int log_write(void *ctx, const uint8_t *data, int len)
+{
+    (void)ctx;
+    return (int)fwrite(data, 1, (size_t)len, log_file);
+}
+
+/* the receiver's output over a drive of the given length */
+static int make_log(long secs)
+{
+    static GNSS_SIM sim;
+    GNSS_SIM_CONFIG cfg;
+    uint32_t        now = 0;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.start     = GNSS_SIM_HOT;
+    cfg.latitude  = 48.1;
+    cfg.longitude = 11.5;
+    cfg.altitude  = 520.0;
+    cfg.knots     = 20.0;
+    cfg.course    = 90.0;
+    cfg.seed      = 1;
+    cfg.write     = log_write;
+
+    if (!(log_file = fopen(log_path, "wb")) || gnss_sim_init(&sim, &cfg, now) != 0) return -1;
+    srand(1);
+    for (long s = 0; s < secs; s++)
+    {
+        if (s % 60 == 0) gnss_sim_motion(&sim, rand() % 10 == 0 ? 0.0 : 5.0 + rand() % 60, rand() % 360, now);
+        if (s % 3600 == 1800) gnss_sim_outage(&sim, 30000, now);
+        for (int k = 0; k < 1000 / STEP_MS; k++)
+        {
+            now += STEP_MS;
+            gnss_sim_poll(&sim, now);
+        }
+    }
+    return fclose(log_file);
+}
+
+static int same_files(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+    char  ba[65536], bb[65536];
+    int   same = fa && fb;
+
+    while (same)
+    {
+        size_t na = fread(ba, 1, sizeof(ba), fa), nb = fread(bb, 1, sizeof(bb), fb);
+
+        same = na == nb && memcmp(ba, bb, na) == 0;
+        if (na == 0) break;
+    }
+    if (fa) fclose(fa);
+    if (fb) fclose(fb);
+    return same;
+}
+
+int main(int argc, char **argv)
+{
+    long   secs = argc > 1 ? atol(argv[1]) : 20000;
+    char   cmd[300];
+    double t, pack_s, unpack_s;
+    int    ok = 1;
+
+    if (secs < 60 || make_log(secs) != 0) return 2;
+
+    FILE *in = fopen(log_path, "rb"), *out = fopen(nmz_path, "wb");
+
+    t = seconds();
+    if (!in || !out || nmeaz_compress_file(in, out, 0) != 0) return 2;
+    fclose(in);
+    fclose(out);
+    pack_s = seconds() - t;
+
+    in  = fopen(nmz_path, "rb");
+    out = fopen(back_path, "wb");
+    t   = seconds();
+    if (!in || !out) return 2;
+
+    int unpacked = nmeaz_decompress_file(in, out, 1) == 0;
+
+    fclose(in);
+    fclose(out);
+    unpack_s = seconds() - t;
+
+    // the same log through gzip and, if there, xz
+    snprintf(cmd, sizeof(cmd), "gzip -9 -c %s > %s", log_path, gz_path);
+    if (system(cmd) != 0) return 2;
+    snprintf(cmd, sizeof(cmd), "xz -9 -c %s > %s 2> /dev/null", log_path, xz_path);
+
+    int  have_xz = system(cmd) == 0;
+    long raw = file_size(log_path), nmz = file_size(nmz_path), gz = file_size(gz_path), xz = have_xz ? file_size(xz_path) : -1;
+
+    int exact = unpacked && same_files(log_path, back_path);
+
+    printf("round trip                           %s  (%ld bytes, %d s of output)\n", exact ? "ok" : "FAILED", raw, (int)secs);
+    ok &= exact;
+
+    int smaller = nmz > 0 && nmz < gz && (!have_xz || nmz < xz);
+
+    printf("%-36s %s  (NMZ %ld, gzip -9 %ld", have_xz ? "smaller than gzip -9 and xz -9" : "smaller than gzip -9",
+           smaller ? "ok" : "FAILED", nmz, gz);
+    if (have_xz) printf(", xz -9 %ld", xz);
+    printf(" bytes)\n");
+    ok &= smaller;
+
+    printf("%.2f MB: NMZ %.1f:1, gzip -9 %.1f:1", raw / 1e6, (double)raw / nmz, (double)raw / gz);
+    if (have_xz) printf(", xz -9 %.1f:1", (double)raw / xz);
+    printf("; NMZ packs %.0f MB/s, unpacks %.0f MB/s\n", raw / 1e6 / pack_s, raw / 1e6 / unpack_s);
+
+    remove(log_path);
+    remove(nmz_path);
+    remove(back_path);
+    remove(gz_path);
+    remove(xz_path);
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+/*
+ * nmea_archive_test.c - Round trips of sentences up to the longest the codec takes.
+ *
+ *   nmea_archive_test
+ *
+ * Sentences of every length from a short one up to NMEAZ_LINE_MAX (CRLF
+ * and LF endings, numeric and literal fields, repeated so every field
+ * coding is used) go through nmeaz_compress_block / nmeaz_decompress_block.
+ * The block must come back byte for byte and must really be coded, not
+ * stored. Lines just over the limit travel as literals.
+ */
+
+#include "nmea_archive.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RAW_MAX     (1 << 20)
+
+static char     *raw, *back;
+static uint8_t  *packed;
+static size_t   raw_len;
+
+
+/* appends one sentence of exactly len bytes (checksum and ending included) */
+static void sentence(int len, int lf, unsigned seq)
+{
+    int     body = len - (lf ? 5 : 6);          // '$' body '*' HH [CR] LF
+    int     pad  = body - 28;                   // what the fixed width fields leave
+    char    s[NMEAZ_LINE_MAX + 8];
+    int     n;
+    uint8_t sum = 0;
+
+    n = sprintf(s, "$GPTST,%06u,%04u.%03u,", seq, 1000 + seq % 7, seq * 37 % 1000);
+    for (int i = 0; i < pad; i++) s[n++] = (char)('A' + (i + (int)seq / 4) % 26);
+    n += sprintf(s + n, ",%05u", seq * 3 % 100000);
+
+    for (int i = 1; i < n; i++) sum ^= (uint8_t)s[i];
+    n += sprintf(s + n, lf ? "*%02X\n" : "*%02X\r\n", sum);
+
+    if (n != len) abort();
+    memcpy(raw + raw_len, s, (size_t)n);
+    raw_len += (size_t)n;
+}
+
+static int round_trip(const char *what)
+{
+    NMEAZ_HEADER hdr;
+    long         packed_len = nmeaz_compress_block(raw, raw_len, packed, nmeaz_bound(raw_len));
+    long         back_len   = packed_len > 0 ? nmeaz_decompress_block(packed, (size_t)packed_len, back, RAW_MAX) : -1;
+
+    memcpy(&hdr, packed, sizeof(hdr));
+    int ok = back_len == (long)raw_len && memcmp(raw, back, raw_len) == 0 && hdr.magic == NMEAZ_MAGIC;
+
+    printf("%-36s %s  (%zu bytes -> %ld)\n", what, ok ? "ok" : "FAILED", raw_len, packed_len);
+    return ok;
+}
+
+int main(void)
+{
+    unsigned seq = 0;
+    int      ok  = 1;
+    char     what[64];
+
+    raw    = malloc(RAW_MAX);
+    back   = malloc(RAW_MAX);
+    packed = malloc(nmeaz_bound(RAW_MAX));
+    if (!raw || !back || !packed) return 2;
+
+    // every length, four times each so the fields repeat and change
+    raw_len = 0;
+    for (int len = 34; len <= NMEAZ_LINE_MAX; len++)
+    {
+        for (int k = 0; k < 4; k++) sentence(len, k == 3, seq++);
+    }
+    ok &= round_trip("lengths 34 .. NMEAZ_LINE_MAX");
+
+    for (int lf = 0; lf <= 1; lf++)
+    {
+        raw_len = 0;
+        for (int k = 0; k < 200; k++) sentence(NMEAZ_LINE_MAX, lf, seq++);
+        snprintf(what, sizeof(what), "%d byte lines, %s", NMEAZ_LINE_MAX, lf ? "LF" : "CRLF");
+        ok &= round_trip(what);
+    }
+
+    // one byte over: kept as literal lines, still exact
+    raw_len = 0;
+    for (int k = 0; k < 200; k++) sentence(k % 2 ? NMEAZ_LINE_MAX + 1 : NMEAZ_LINE_MAX, 0, seq++);
+    snprintf(what, sizeof(what), "%d and %d byte lines", NMEAZ_LINE_MAX, NMEAZ_LINE_MAX + 1);
+    ok &= round_trip(what);
+
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+/*
+ * nmea_scan_bench.c - Structural scan against a byte-at-a-time reference.
+ *
+ *   nmea_scan_bench [MB]
+ *
+ * Builds a synthetic log (GGA / RMC / GSV with bad checksums, missing
+ * checksums, truncated sentences and binary noise, 29 MB by default) and
+ * checks that
+ *   - nmea_scan sets exactly the mask bits a per-byte classification does
+ *   - nmea_index finds exactly the sentences of a byte-at-a-time state
+ *     machine, also when fed in pieces through `consumed`
+ *   - threads that all scan first pick the same classifier
+ * then reports the throughput of stage 1, of the whole index and of the
+ * reference loop (best of five runs). Timings are printed, not checked.
+ */
+
+#include "nmea_scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define THREADS     8
+#define RUNS        5
+
+static char         *log_buf;
+static size_t       log_len;
+static NMEA_SPAN    *spans, *expect;
+static size_t       max_spans;
+
+
+static double seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void make_log(size_t size)
+{
+    static const char *fmt[] =
+    {
+        "GPGGA,%06d.00,4807.%04d,N,01131.%04d,E,1,08,0.9,545.4,M,46.9,M,,",
+        "GPRMC,%06d.00,A,4807.%04d,N,01131.%04d,E,0.13,309.62,120598,,",
+        "GPGSV,3,1,11,%02d,%02d,%03d,42,04,77,048,45,09,05,113,",
+    };
+    size_t n = 0;
+
+    log_buf = malloc(size + 512);
+    if (!log_buf) return;
+    srand(1);
+
+    for (int i = 0; n < size; i++)
+    {
+        char    body[200];
+        int     len = snprintf(body, sizeof(body), fmt[i % 3], i % 1000000, rand() % 10000, rand() % 10000);
+        uint8_t sum = 0;
+        int     kind = rand() % 100;
+
+        for (int k = 0; k < len; k++) sum ^= (uint8_t)body[k];
+        if (kind == 0) sum ^= 0x5A;                                 // bad checksum
+        if (kind == 1) body[len / 2] = (char)0x81;                  // invalid byte
+
+        if (kind == 2) n += (size_t)sprintf(log_buf + n, "$%.*s", len / 2, body);               // truncated by the next '$'
+        if (kind == 3) n += (size_t)sprintf(log_buf + n, "!%s\r\n", body);                     // no checksum
+        else           n += (size_t)sprintf(log_buf + n, "$%s*%02X\r\n", body, sum);
+        if (kind == 4)
+        {
+            for (int k = rand() % 40; k > 0; k--) log_buf[n++] = (char)rand();                // binary noise
+        }
+    }
+    log_len = n;
+}
+
+static int is_hex(char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f');
+}
+
+static int hex(char c)
+{
+    return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+/* the byte-at-a-time state machine nmea_index replaces */
+static size_t reference(const char *buf, size_t len, NMEA_SPAN *out)
+{
+    size_t   n = 0;
+    int      in = 0;
+    uint32_t start = 0, star = 0, commas = 0, bad = 0;
+    uint8_t  sum = 0, star_sum = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        uint8_t c = (uint8_t)buf[i];
+
+        if (c == '$' || c == '!')
+        {
+            in = 1; start = (uint32_t)i; star = 0; commas = bad = 0; sum = 0;
+            continue;
+        }
+        if (!in) continue;
+
+        if (c == '\r' || c == '\n')
+        {
+            NMEA_SPAN *s = &out[n++];
+
+            s->start      = start;
+            s->end        = (uint32_t)i;
+            s->star       = star ? star : (uint32_t)i;
+            s->num_fields = (uint8_t)(commas + 1 > 255 ? 255 : commas + 1);
+            s->flags      = bad ? NMEA_SPAN_BAD_CHARS : 0;
+            if (!star || i - star < 3 || !is_hex(buf[star + 1]) || !is_hex(buf[star + 2]))
+                s->flags |= NMEA_SPAN_NO_CHECKSUM;
+            else if (star_sum == (uint8_t)(hex(buf[star + 1]) * 16 + hex(buf[star + 2])))
+                s->flags |= NMEA_SPAN_CHECKSUM_OK;
+            in = 0;
+            continue;
+        }
+        if (c < 0x20 || c >= 0x7F) bad++;
+        if (c == '*' && !star)
+        {
+            star     = (uint32_t)i;
+            star_sum = sum;
+        }
+        if (c == ',' && !star) commas++;
+        sum ^= c;
+    }
+    return n;
+}
+
+static int spans_match(size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (spans[i].start != expect[i].start || spans[i].star != expect[i].star || spans[i].end != expect[i].end ||
+            spans[i].num_fields != expect[i].num_fields || spans[i].flags != expect[i].flags) return 0;
+    }
+    return 1;
+}
+
+static int masks_match(void)
+{
+    size_t          blocks = (log_len + NMEA_SCAN_BLOCK - 1) / NMEA_SCAN_BLOCK;
+    NMEA_SCAN_MASKS *m     = malloc(blocks * sizeof(NMEA_SCAN_MASKS));
+    int             ok     = m != NULL;
+
+    if (ok) nmea_scan(log_buf, log_len, m);
+    for (size_t i = 0; ok && i < blocks * NMEA_SCAN_BLOCK; i++)
+    {
+        uint8_t  c   = i < log_len ? (uint8_t)log_buf[i] : 0;
+        int      in  = i < log_len;
+        uint64_t bit = 1ULL << (i % NMEA_SCAN_BLOCK);
+        const NMEA_SCAN_MASKS *b = &m[i / NMEA_SCAN_BLOCK];
+
+        ok = !!(b->start & bit)   == (in && (c == '$' || c == '!')) &&
+             !!(b->comma & bit)   == (in && c == ',') &&
+             !!(b->star & bit)    == (in && c == '*') &&
+             !!(b->eol & bit)     == (in && (c == '\r' || c == '\n')) &&
+             !!(b->invalid & bit) == (in && ((c < 0x20 && c != '\r' && c != '\n') || c >= 0x7F));
+    }
+    free(m);
+    return ok;
+}
+
+/* index the log in pieces of random size, carrying over what was not consumed */
+static size_t index_in_pieces(void)
+{
+    size_t n = 0, pos = 0;
+
+    while (pos < log_len)
+    {
+        size_t piece = 1 + (size_t)rand() % 100000, done, got;
+
+        if (piece > log_len - pos) piece = log_len - pos;
+        got = nmea_index(log_buf + pos, piece, spans + n, max_spans - n, &done);
+        for (size_t i = n; i < n + got; i++)
+        {
+            spans[i].start += (uint32_t)pos;
+            spans[i].star  += (uint32_t)pos;
+            spans[i].end   += (uint32_t)pos;
+        }
+        n += got;
+        if (pos + piece == log_len) break;
+        pos += done;
+    }
+    return n;
+}
+
+static void *first_scan(void *arg)
+{
+    NMEA_SCAN_MASKS m[4];
+
+    nmea_scan(log_buf, sizeof(m) / sizeof(m[0]) * NMEA_SCAN_BLOCK, m);
+    *(int *)arg = nmea_scan_impl();
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *impl_name[] = { "scalar", "SSE2", "AVX2" };
+    size_t      mb = argc > 1 ? (size_t)atoi(argv[1]) : 29;
+    pthread_t   tid[THREADS];
+    int         impl[THREADS], ok = 1, same = 1;
+    size_t      n_ref, n, done;
+    NMEA_SCAN_MASKS *m;
+    double      t, best[3] = { 1e9, 1e9, 1e9 };
+
+    if (mb < 1) return 2;
+    make_log(mb << 20);
+    if (!log_buf) return 2;
+
+    for (int i = 0; i < THREADS; i++) pthread_create(&tid[i], NULL, first_scan, &impl[i]);
+    for (int i = 0; i < THREADS; i++)
+    {
+        pthread_join(tid[i], NULL);
+        same &= impl[i] == impl[0];
+    }
+    printf("classifier picked by %d threads     %s  (%s)\n", THREADS, same ? "ok" : "FAILED", impl_name[impl[0]]);
+    ok &= same;
+
+    max_spans = log_len / 8;
+    spans     = malloc(max_spans * sizeof(NMEA_SPAN));
+    expect    = malloc(max_spans * sizeof(NMEA_SPAN));
+    m         = malloc((log_len / NMEA_SCAN_BLOCK + 1) * sizeof(NMEA_SCAN_MASKS));
+    if (!spans || !expect || !m) return 2;
+
+    int masks_ok = masks_match();
+    printf("stage 1 masks                        %s\n", masks_ok ? "ok" : "FAILED");
+    ok &= masks_ok;
+
+    n_ref = reference(log_buf, log_len, expect);
+    n     = nmea_index(log_buf, log_len, spans, max_spans, &done);
+    int index_ok = n == n_ref && spans_match(n);
+    printf("nmea_index, whole log                %s  (%zu sentences)\n", index_ok ? "ok" : "FAILED", n);
+    ok &= index_ok;
+
+    n = index_in_pieces();
+    index_ok = n == n_ref && spans_match(n);
+    printf("nmea_index, in pieces                %s\n", index_ok ? "ok" : "FAILED");
+    ok &= index_ok;
+
+    for (int r = 0; r < RUNS; r++)
+    {
+        t = seconds();
+        nmea_scan(log_buf, log_len, m);
+        if (seconds() - t < best[0]) best[0] = seconds() - t;
+
+        t = seconds();
+        nmea_index(log_buf, log_len, spans, max_spans, &done);
+        if (seconds() - t < best[1]) best[1] = seconds() - t;
+
+        t = seconds();
+        reference(log_buf, log_len, expect);
+        if (seconds() - t < best[2]) best[2] = seconds() - t;
+    }
+
+    double gb = (double)log_len / 1e9;
+    printf("%zu MB, %s: stage 1 %.2f GB/s, nmea_index %.2f GB/s, byte loop %.2f GB/s (%.1fx)\n",
+           mb, impl_name[impl[0]], gb / best[0], gb / best[1], gb / best[2], best[2] / best[1]);
+
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,355 @@
+/*
+ * ntrip_test.c - NTRIP client against a caster stand-in on localhost.
+ *
+ *   ntrip_test
+ *
+ * The stand-in caster (a thread) checks the request and the Basic
+ * authorization, answers as a v1 (ICY) or v2 (HTTP/1.1 chunked) caster and
+ * streams RTCM3 frames in random pieces, with garbage and a corrupted frame
+ * in between, while it records the GGA reports the client sends. Checked:
+ *   - every valid frame reaches the receiver once, in order, the corrupted
+ *     one never; the stream never outruns headroom_pct of the UART
+ *   - the position report is repeated every gga_interval_ms and follows
+ *     ntrip_set_gga
+ *   - a refused login ends the connection
+ *   - without a connection (ntrip_init / ntrip_feed / ntrip_service) the
+ *     defaults apply and the pacing budget is exact
+ */
+
+#include "ntrip.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define FRAMES          120
+#define BURST_FRAMES    10
+#define BURST_MS        100
+#define BAUD            460800
+#define GGA_A           "$GPGGA,120000.00,4807.0380,N,01131.0000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n"
+#define GGA_B           "$GPGGA,120005.00,4807.0990,N,01131.2000,E,1,08,0.9,545.4,M,46.9,M,,*4F\r\n"
+
+typedef struct
+{
+    int         listen_fd;
+    int         version;
+    const char  *auth;                  // expected "Authorization: Basic ..." value
+    int         linger_ms;              // keep the connection open after the frames
+
+    int         refused;
+    int         gga_a, gga_b;           // reports received
+    uint32_t    first_gga_ms, last_gga_ms;
+} CASTER;
+
+static uint8_t  frames[FRAMES][RTCM_MAX_FRAME];
+static int      frame_len[FRAMES];
+
+static uint8_t  received[FRAMES * RTCM_MAX_FRAME];
+static int      received_len;
+static uint32_t first_write_ms, last_write_ms;
+
+
+static uint32_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+static int make_frame(uint8_t *f, uint16_t type, int payload)
+{
+    f[0] = RTCM_PREAMBLE;
+    f[1] = (uint8_t)(payload >> 8);
+    f[2] = (uint8_t)payload;
+    f[3] = (uint8_t)(type >> 4);
+    f[4] = (uint8_t)(type << 4);
+    for (int i = 2; i < payload; i++) f[3 + i] = (uint8_t)rand();
+
+    uint32_t crc = rtcm_crc24q(f, 3 + payload);
+    f[3 + payload]     = (uint8_t)(crc >> 16);
+    f[3 + payload + 1] = (uint8_t)(crc >> 8);
+    f[3 + payload + 2] = (uint8_t)crc;
+    return 3 + payload + 3;
+}
+
+static int writer(void *ctx, const uint8_t *data, int len)
+{
+    (void)ctx;
+    if (received_len == 0) first_write_ms = now_ms();
+    last_write_ms = now_ms();
+    memcpy(received + received_len, data, (size_t)len);
+    received_len += len;
+    return len;
+}
+
+/* sends in pieces of random size, chunk encoded for v2 */
+static int caster_send(CASTER *k, int fd, const uint8_t *data, int len)
+{
+    while (len > 0)
+    {
+        int  n = 1 + rand() % 200;
+        char size[16];
+
+        if (n > len) n = len;
+        if (k->version == 2)
+        {
+            int s = snprintf(size, sizeof(size), "%x\r\n", n);
+            if (send(fd, size, (size_t)s, MSG_NOSIGNAL) != s) return -1;
+        }
+        if (send(fd, data, (size_t)n, MSG_NOSIGNAL) != n) return -1;
+        if (k->version == 2 && send(fd, "\r\n", 2, MSG_NOSIGNAL) != 2) return -1;
+        data += n;
+        len  -= n;
+    }
+    return 0;
+}
+
+/* reads what the client sent in the meantime: GGA reports */
+static void caster_read(CASTER *k, int fd, char *line, int *line_len, int wait_ms)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    char          buf[512];
+
+    while (poll(&pfd, 1, wait_ms) > 0)
+    {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+
+        if (n <= 0) return;
+        for (ssize_t i = 0; i < n; i++)
+        {
+            if (*line_len < 255) line[(*line_len)++] = buf[i];
+            if (buf[i] != '\n') continue;
+
+            line[*line_len] = '\0';
+            if (strcmp(line, GGA_A) == 0) k->gga_a++;
+            if (strcmp(line, GGA_B) == 0) k->gga_b++;
+            if (k->gga_a + k->gga_b == 1) k->first_gga_ms = now_ms();
+            k->last_gga_ms = now_ms();
+            *line_len = 0;
+        }
+        wait_ms = 0;
+    }
+}
+
+static void *caster_main(void *arg)
+{
+    CASTER  *k = arg;
+    char    request[2048] = "", line[256];
+    int     len = 0, line_len = 0;
+    int     fd = accept(k->listen_fd, NULL, NULL);
+
+    if (fd < 0) return NULL;
+
+    while (len < (int)sizeof(request) - 1 && !strstr(request, "\r\n\r\n"))
+    {
+        ssize_t n = recv(fd, request + len, sizeof(request) - 1 - (size_t)len, 0);
+        if (n <= 0) break;
+        len += (int)n;
+        request[len] = '\0';
+    }
+
+    if (strncmp(request, "GET /TEST ", 10) != 0 || !strstr(request, k->auth))
+    {
+        const char *no = k->version == 2 ? "HTTP/1.1 401 Unauthorized\r\n\r\n" : "ERROR - Bad Password\r\n";
+        send(fd, no, strlen(no), MSG_NOSIGNAL);
+        k->refused = 1;
+        close(fd);
+        return NULL;
+    }
+
+    const char *ok = k->version == 2 ? "HTTP/1.1 200 OK\r\nNtrip-Version: Ntrip/2.0\r\n"
+                                       "Content-Type: gnss/data\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                     : "ICY 200 OK\r\n";
+    send(fd, ok, strlen(ok), MSG_NOSIGNAL);
+
+    for (int i = 0; i < FRAMES; i++)
+    {
+        static const uint8_t garbage[] = { 0x00, 0xD3, 0xFF, 0x12, '$', 'G', 0xD3, 0x00 };
+        uint8_t              bad[RTCM_MAX_FRAME];
+
+        if (i == FRAMES / 2)
+        {
+            memcpy(bad, frames[i], (size_t)frame_len[i]);
+            bad[10] ^= 0x40;                            // a corrupted copy before the real one
+            caster_send(k, fd, bad, frame_len[i]);
+        }
+        if (i % 7 == 3) caster_send(k, fd, garbage, sizeof(garbage));
+        if (caster_send(k, fd, frames[i], frame_len[i]) != 0) break;
+
+        if (i % BURST_FRAMES == BURST_FRAMES - 1) caster_read(k, fd, line, &line_len, BURST_MS);
+    }
+
+    for (uint32_t end = now_ms() + (uint32_t)k->linger_ms; (int32_t)(end - now_ms()) > 0;)
+    {
+        caster_read(k, fd, line, &line_len, 10);
+    }
+    close(fd);
+    return NULL;
+}
+
+static int start_caster(CASTER *k, pthread_t *tid)
+{
+    struct sockaddr_in addr;
+    socklen_t          len = sizeof(addr);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    k->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (k->listen_fd < 0 || bind(k->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(k->listen_fd, 1) != 0 || getsockname(k->listen_fd, (struct sockaddr *)&addr, &len) != 0)
+    {
+        return -1;
+    }
+    if (pthread_create(tid, NULL, caster_main, k) != 0) return -1;
+    return ntohs(addr.sin_port);
+}
+
+static int stream_test(int version, const char *password, int *failed)
+{
+    CASTER       k;
+    NTRIP_CONFIG cfg;
+    NTRIP_CLIENT c;
+    pthread_t    tid;
+    int          port, ok, expect_len = 0, rc = 0;
+    uint32_t     start, switched = 0;
+
+    memset(&k, 0, sizeof(k));
+    k.version   = version;
+    k.auth      = "Authorization: Basic cm92ZXI6c2VjcmV0\r\n";      // rover:secret
+    k.linger_ms = 600;
+    if ((port = start_caster(&k, &tid)) < 0) return -1;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.host            = "127.0.0.1";
+    cfg.port            = (uint16_t)port;
+    cfg.mountpoint      = "TEST";
+    cfg.user            = "rover";
+    cfg.password        = password;
+    cfg.version         = version;
+    cfg.gga             = GGA_A;
+    cfg.gga_interval_ms = 100;
+    cfg.baud            = BAUD;
+    cfg.write           = writer;
+
+    received_len = 0;
+    if (ntrip_connect(&c, &cfg) != 0)
+    {
+        pthread_join(tid, NULL);
+        close(k.listen_fd);
+        return -1;
+    }
+
+    start = now_ms();
+    while (rc >= 0 && now_ms() - start < 5000)
+    {
+        rc = ntrip_poll(&c, 50);
+        if (!switched && received_len > 0 && now_ms() - start > 300)
+        {
+            ntrip_set_gga(&c, GGA_B);
+            switched = now_ms();
+        }
+    }
+    ntrip_close(&c);
+    pthread_join(tid, NULL);
+    close(k.listen_fd);
+
+    if (password && strcmp(password, "secret") != 0)
+    {
+        ok = k.refused && received_len == 0 && rc < 0;
+        printf("v%d refused login                  %s\n", version, ok ? "ok" : "FAILED");
+        *failed += !ok;
+        return 0;
+    }
+
+    for (int i = 0; i < FRAMES; i++) expect_len += frame_len[i];
+
+    // a token bucket of headroom_pct of baud / 10 per second with RTCM_MAX_FRAME of burst
+    uint32_t rate    = BAUD / 10 * NTRIP_DEFAULT_HEADROOM / 100;
+    uint32_t elapsed = last_write_ms - first_write_ms + 1;
+    int      paced   = (uint64_t)received_len <= (uint64_t)rate * elapsed / 1000 + rate / 10 + RTCM_MAX_FRAME;
+
+    ok = received_len == expect_len && paced && c.stats.frames == FRAMES && c.stats.crc_errors >= 1 &&
+         c.stats.stale == 0 && c.stats.overflow == 0 && c.stats.superseded == 0;
+    for (int i = 0, at = 0; ok && i < FRAMES; at += frame_len[i++])
+    {
+        if (memcmp(received + at, frames[i], (size_t)frame_len[i]) != 0) ok = 0;
+    }
+    printf("v%d stream                         %s  (%d frames, %d bytes in %u ms, %u crc errors, %u resync bytes)\n",
+           version, ok ? "ok" : "FAILED", c.stats.frames, received_len, elapsed, c.stats.crc_errors, c.stats.resyncs);
+    *failed += !ok;
+
+    // one report when streaming starts, then every 100 ms until the caster closes
+    uint32_t span = k.last_gga_ms - k.first_gga_ms;
+    ok = k.gga_a >= 1 && k.gga_b >= 3 && k.gga_a + k.gga_b >= (int)(span / 100) &&
+         k.gga_a + k.gga_b <= (int)(span / 100) + 2 && (uint32_t)(k.gga_a + k.gga_b) == c.stats.gga_sent;
+    printf("v%d periodic GGA                   %s  (%d + %d reports over %u ms)\n",
+           version, ok ? "ok" : "FAILED", k.gga_a, k.gga_b, span);
+    *failed += !ok;
+    return 0;
+}
+
+/* no socket: explicit clock, defaults from ntrip_init */
+static int offline_test(void)
+{
+    NTRIP_CONFIG cfg;
+    NTRIP_CLIENT c;
+    uint32_t     rate = 9600 / 10 * NTRIP_DEFAULT_HEADROOM / 100;
+    int          ok = 1, delivered = 0;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.baud  = 9600;
+    cfg.write = writer;
+    received_len = 0;
+
+    ntrip_init(&c, &cfg, 1000);
+    ok &= c.cfg.headroom_pct == NTRIP_DEFAULT_HEADROOM && c.cfg.max_age_ms == NTRIP_DEFAULT_MAX_AGE;
+
+    ntrip_feed(&c, (const uint8_t *)"ICY 200 OK\r\n", 12, 1000);
+    for (int i = 0; i < 20; i++) ntrip_feed(&c, frames[i], frame_len[i], 1000);
+
+    for (uint32_t t = 1000; t <= 11000; t += 10)
+    {
+        ntrip_service(&c, t);
+        // never ahead of the budget: one frame of burst, then rate bytes per second
+        if ((uint32_t)received_len > RTCM_MAX_FRAME + rate * (t - 1000) / 1000) ok = 0;
+    }
+    for (int i = 0, at = 0; i < 20 && at < received_len; at += frame_len[i++])
+    {
+        if (memcmp(received + at, frames[i], (size_t)frame_len[i]) == 0) delivered++;
+    }
+
+    ok &= received_len > 0 && delivered + (int)c.stats.stale == 20 && c.stats.stale > 0;
+    printf("offline pacing at 9600 baud       %s  (%d bytes, %d frames sent, %u stale)\n",
+           ok ? "ok" : "FAILED", received_len, delivered, c.stats.stale);
+    return ok;
+}
+
+int main(void)
+{
+    int failed = 0;
+
+    srand(1);
+    for (int i = 0; i < FRAMES; i++) frame_len[i] = make_frame(frames[i], (uint16_t)(1001 + i), 20 + rand() % 200);
+
+    for (int version = 1; version <= 2; version++)
+    {
+        if (stream_test(version, "secret", &failed) != 0 || stream_test(version, "wrong", &failed) != 0)
+        {
+            perror("caster");
+            return 1;
+        }
+    }
+    failed += !offline_test();
+
+    printf("%s\n", failed ? "FAILED" : "all passed");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,246 @@
+/*
+ * project_test.c - NMEA/gps_project against a Krueger series reference.
+ *
+ *   project_test [points]
+ *
+ * The reference is the 6th order Krueger series (Karney 2011) in libm
+ * double precision, good to a few nm over a zone. Random points, each
+ * set projected with locationToUTMZone and taken back with utmToLocation
+ * from the reference's easting / northing. Checked:
+ *   - within 3 deg of the central meridian, north and south of the
+ *     equator: forward error below 0.1 mm, the hemisphere and false
+ *     northing right, inverse within the microdegree rounding
+ *   - across a zone edge, 3 to 3.5 deg out, projected into the zone next
+ *     door: forward error below 0.3 mm, inverse as above
+ *   - locationToUTMBatch gives the scalar results
+ *   - the local grid: gridProject / gridUnproject within 5 mm of the
+ *     reference over GRID_RADIUS, north and south
+ */
+
+#include "gps_project.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define WGS84_A     6378137.0
+#define WGS84_F     (1 / 298.257223563)
+#define K0          0.9996
+#define DEG         (M_PI / 180 / GPS_COORD_SCALE)
+
+typedef struct
+{
+    double      fwd_mm;                         // max distance to the reference
+    int32_t     inv_udeg;                       // max latitude / longitude difference taken back
+    int         wrong;                          // zone / hemisphere / return value
+} ERRORS;
+
+static double alpha[7];
+
+
+static void krueger_init(void)
+{
+    double n = WGS84_F / (2 - WGS84_F), n2 = n * n, n3 = n2 * n, n4 = n3 * n, n5 = n4 * n, n6 = n5 * n;
+
+    alpha[1] = n / 2 - 2 * n2 / 3 + 5 * n3 / 16 + 41 * n4 / 180 - 127 * n5 / 288 + 7891 * n6 / 37800;
+    alpha[2] = 13 * n2 / 48 - 3 * n3 / 5 + 557 * n4 / 1440 + 281 * n5 / 630 - 1983433 * n6 / 1935360;
+    alpha[3] = 61 * n3 / 240 - 103 * n4 / 140 + 15061 * n5 / 26880 + 167603 * n6 / 181440;
+    alpha[4] = 49561 * n4 / 161280 - 179 * n5 / 168 + 6601661 * n6 / 7257600;
+    alpha[5] = 34729 * n5 / 80640 - 3418889 * n6 / 1995840;
+    alpha[6] = 212378941 * n6 / 319334400;
+}
+
+/* reference forward projection into zone */
+static void krueger(const LOCATION *loc, int zone, double *east, double *north)
+{
+    double n   = WGS84_F / (2 - WGS84_F);
+    double e   = sqrt(WGS84_F * (2 - WGS84_F));
+    double A   = WGS84_A / (1 + n) * (1 + n * n / 4 + pow(n, 4) / 64 + pow(n, 6) / 256);
+    double phi = loc->latitude * DEG;
+    double lam = loc->longitude * DEG - (zone * 6 - 183) * M_PI / 180;
+
+    if (lam >  M_PI) lam -= 2 * M_PI;
+    if (lam < -M_PI) lam += 2 * M_PI;
+
+    double t   = sinh(atanh(sin(phi)) - e * atanh(e * sin(phi)));
+    double xi0 = atan2(t, cos(lam));
+    double et0 = atanh(sin(lam) / sqrt(1 + t * t));
+    double xi  = xi0, eta = et0;
+
+    for (int j = 1; j <= 6; j++)
+    {
+        xi  += alpha[j] * sin(2 * j * xi0) * cosh(2 * j * et0);
+        eta += alpha[j] * cos(2 * j * xi0) * sinh(2 * j * et0);
+    }
+    *east  = UTM_FALSE_EASTING + K0 * A * eta;
+    *north = K0 * A * xi + (loc->latitude < 0 ? UTM_FALSE_NORTHING : 0);
+}
+
+static double urand(double lo, double hi)
+{
+    return lo + (hi - lo) * rand() / RAND_MAX;
+}
+
+/* a random point 'from' to 'to' degrees off zone's central meridian (either side), latitudes lat_lo..lat_hi */
+static void random_point(LOCATION *loc, int zone, double from, double to, double lat_lo, double lat_hi)
+{
+    double off = urand(from, to) * (rand() % 2 ? 1 : -1);
+    double lon = zone * 6 - 183 + off;
+
+    if (lon >   180) lon -= 360;
+    if (lon <= -180) lon += 360;
+    memset(loc, 0, sizeof(*loc));
+    loc->latitude  = (int32_t)lround(urand(lat_lo, lat_hi) * GPS_COORD_SCALE);
+    loc->longitude = (int32_t)lround(lon * GPS_COORD_SCALE);
+}
+
+static void check(const LOCATION *loc, int zone, ERRORS *err)
+{
+    UTMCOORD got, ref;
+    LOCATION back;
+    char     hemisphere = loc->latitude < 0 ? 'S' : 'N';
+
+    krueger(loc, zone, &ref.easting, &ref.northing);
+    ref.zone       = (uint8_t)zone;
+    ref.hemisphere = hemisphere;
+    if (locationToUTMZone(loc, (uint8_t)zone, &got) != 0 || got.zone != zone || got.hemisphere != hemisphere ||
+        utmToLocation(&ref, &back) != 0)
+    {
+        err->wrong++;
+        return;
+    }
+
+    double  d    = hypot(got.easting - ref.easting, got.northing - ref.northing) * 1000;
+    int32_t dlat = abs(back.latitude - loc->latitude);
+    int32_t dlon = abs(back.longitude - loc->longitude);
+
+    if (dlon > 180 * GPS_COORD_SCALE) dlon = 360 * GPS_COORD_SCALE - dlon;
+    if (d > err->fwd_mm) err->fwd_mm = d;
+    if (dlat > err->inv_udeg) err->inv_udeg = dlat;
+    if (dlon > err->inv_udeg) err->inv_udeg = dlon;
+}
+
+/* points random_point(...) in random zones */
+static ERRORS run(int points, double from, double to, double lat_lo, double lat_hi)
+{
+    ERRORS err = { 0, 0, 0 };
+
+    for (int i = 0; i < points; i++)
+    {
+        LOCATION loc;
+        int      zone = 1 + rand() % 60;
+
+        random_point(&loc, zone, from, to, lat_lo, lat_hi);
+        check(&loc, zone, &err);
+    }
+    return err;
+}
+
+/* grid round trips around random origins, max error against the reference in mm */
+static double grid_error(int origins, double lat_lo, double lat_hi, int *wrong)
+{
+    double worst = 0;
+
+    for (int o = 0; o < origins; o++)
+    {
+        LOCATION   origin, loc, back;
+        GRIDORIGIN g;
+        GRIDPOINT  pt;
+        int        zone = 1 + rand() % 60;
+
+        random_point(&origin, zone, 0, 2.5, lat_lo, lat_hi);
+        zone = utmZone(origin.latitude, origin.longitude);
+        if (initGrid(&g, &origin) != 0)
+        {
+            (*wrong)++;
+            continue;
+        }
+        for (int i = 0; i < 100; i++)
+        {
+            double e, n, r = urand(0, GRID_RADIUS), a = urand(0, 2 * M_PI);
+
+            loc            = origin;
+            loc.latitude  += (int32_t)lround(r * sin(a));
+            loc.longitude += (int32_t)lround(r * cos(a));
+            if (gridProject(&g, &loc, &pt) != 0 || gridUnproject(&g, &pt, &back) != 0)
+            {
+                (*wrong)++;
+                continue;
+            }
+            krueger(&loc, zone, &e, &n);
+
+            double d = hypot(g.origin_utm.easting + pt.east_mm / 1000.0 - e, g.origin_utm.northing + pt.north_mm / 1000.0 - n);
+
+            if (d * 1000 > worst) worst = d * 1000;
+            if (abs(back.latitude - loc.latitude) > 1 || abs(back.longitude - loc.longitude) > 1) (*wrong)++;
+        }
+    }
+    return worst;
+}
+
+static int report(const char *name, const ERRORS *err, double bound_mm)
+{
+    int ok = err->fwd_mm < bound_mm && err->inv_udeg <= 1 && err->wrong == 0;
+
+    printf("%-34s %s  (forward %.4f mm, bound %.1f mm; inverse %d udeg; %d wrong)\n", name, ok ? "ok" : "FAILED", err->fwd_mm,
+           bound_mm, err->inv_udeg, err->wrong);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int    points = argc > 1 ? atoi(argv[1]) : 20000, ok = 1;
+    ERRORS err;
+
+    if (points < 1) return 2;
+    krueger_init();
+    srand(1);
+
+    err = run(points, 0, 3.0, 0, 84);
+    ok &= report("north, within 3 deg of the CM", &err, 0.1);
+    err = run(points, 0, 3.0, -80, 0);
+    ok &= report("south, within 3 deg of the CM", &err, 0.1);
+    err = run(points / 4, 3.0, 3.5, -80, 84);
+    ok &= report("zone edge, 3 to 3.5 deg out", &err, 0.3);
+
+    // a point on the edge itself, projected into both zones (Munich's longitude: 12 deg E, 32 | 33)
+    LOCATION edge = { 0 };
+
+    memset(&err, 0, sizeof(err));
+    edge.latitude  = 48 * GPS_COORD_SCALE;
+    edge.longitude = 12 * GPS_COORD_SCALE;
+    check(&edge, 32, &err);
+    check(&edge, 33, &err);
+    ok &= report("on the 32 | 33 edge, both zones", &err, 0.1);
+
+    // batch against scalar, own zones
+    static LOCATION loc[4099];
+    static UTMCOORD batch[4099];
+    int             differ = 0;
+
+    for (int i = 0; i < 4099; i++) random_point(&loc[i], 1 + rand() % 60, 0, 3.0, -80, 84);
+    locationToUTMBatch(loc, batch, 4099, 0);
+    for (int i = 0; i < 4099; i++)
+    {
+        UTMCOORD s;
+
+        if (locationToUTM(&loc[i], &s) != 0 || s.zone != batch[i].zone || s.hemisphere != batch[i].hemisphere ||
+            fabs(s.easting - batch[i].easting) > 1e-9 || fabs(s.northing - batch[i].northing) > 1e-9)
+        {
+            differ++;
+        }
+    }
+    printf("%-34s %s  (4099 points, %d differ)\n", "batch against scalar", differ ? "FAILED" : "ok", differ);
+    ok &= differ == 0;
+
+    int    wrong = 0;
+    double north = grid_error(100, 0, 80, &wrong), south = grid_error(100, -80, 0, &wrong);
+    int    grid  = north < 5 && south < 5 && wrong == 0;
+
+    printf("%-34s %s  (north %.2f mm, south %.2f mm, bound 5 mm; %d round trips off)\n", "local grid over GRID_RADIUS",
+           grid ? "ok" : "FAILED", north, south, wrong);
+    ok &= grid;
+
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
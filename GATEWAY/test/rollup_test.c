@@ -0,0 +1,237 @@
+/*
+ * rollup_test.c - Rollup buckets against brute-force sums.
+ *
+ *   rollup_test
+ *
+ * 100 devices report every 20 s for two days, 33 km apart each time, so
+ * the fleet distance of an hour and of a day does not fit 32 bits (one
+ * device's day still does). 3% of the fixes arrive 5 min to 4 h late:
+ * into open minutes, into closed hours and before the minute window.
+ * Every bucket still in its window is compared, for every device and the
+ * fleet, at every level, with sums taken directly over the fixes sent;
+ * then again after rollup_save / rollup_load.
+ */
+
+#include "rollup.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define DEVICES     100
+#define STEP        20                          // s between fixes of a device
+#define DAYS        2
+#define T0          (20000LL * 86400 + 1800)    // half past midnight
+#define LATE_MAX    (4 * 3600)
+#define PENDING_MAX 8192
+
+#define EARTH_RADIUS        6371008.8
+#define RAD_PER_UNIT        (M_PI / 180.0 / GPS_COORD_SCALE)
+
+typedef struct
+{
+    int64_t     due;                            // s
+    uint64_t    device;
+    FIXRECORD   rec;
+} PENDING;
+
+static const int64_t  level_seconds[ROLLUP_LEVELS] = { 60, 3600, 86400 };
+static const uint32_t level_length[ROLLUP_LEVELS]  = { ROLLUP_MINUTES, ROLLUP_HOURS, ROLLUP_DAYS };
+
+static ROLLUP_POINT *expect[DEVICES + 1][ROLLUP_LEVELS];    // [0] is the fleet, index bucket - base
+static int64_t      base[ROLLUP_LEVELS], buckets[ROLLUP_LEVELS];
+static int64_t      last_ms[DEVICES + 1];
+static LOCATION     last[DEVICES + 1];
+
+static PENDING      pending[PENDING_MAX];
+static int          pending_count;
+static unsigned     late, late_closed_hour, late_before_minutes;
+
+
+/* what rollup_add adds for one fix, from the device's previous fix */
+static void reference(uint64_t device, const FIXRECORD *rec)
+{
+    ROLLUP_POINT p;
+    int          d = (int)device;
+    int64_t      t = rec->utc_ms / 1000;
+
+    memset(&p, 0, sizeof(p));
+    p.epochs    = 1;
+    p.fixed     = rec->fix;
+    p.sat_sum   = rec->fix ? rec->numsat : 0;
+    p.max_speed = rec->speed;
+    if (rec->fix)
+    {
+        if (last_ms[d] && rec->utc_ms > last_ms[d] && rec->utc_ms - last_ms[d] <= ROLLUP_MAX_GAP_MS)
+        {
+            double phi1 = last[d].latitude * RAD_PER_UNIT;
+            double phi2 = rec->latitude * RAD_PER_UNIT;
+            double s1   = sin((phi2 - phi1) / 2);
+            double s2   = sin((double)(rec->longitude - last[d].longitude) * RAD_PER_UNIT / 2);
+            double h    = s1 * s1 + cos(phi1) * cos(phi2) * s2 * s2;
+
+            p.distance_dm = (uint64_t)(20 * EARTH_RADIUS * asin(sqrt(h < 1 ? h : 1)) + 0.5);
+        }
+        if (rec->utc_ms > last_ms[d])
+        {
+            last_ms[d]          = rec->utc_ms;
+            last[d].latitude    = rec->latitude;
+            last[d].longitude   = rec->longitude;
+        }
+    }
+
+    for (int l = 0; l < ROLLUP_LEVELS; l++)
+    {
+        for (int k = 0; k < 2; k++)                             // the device and the fleet
+        {
+            ROLLUP_POINT *e = &expect[k ? 0 : d][l][t / level_seconds[l] - base[l]];
+
+            e->epochs      += p.epochs;
+            e->fixed       += p.fixed;
+            e->sat_sum     += p.sat_sum;
+            e->distance_dm += p.distance_dm;
+            if (p.max_speed > e->max_speed) e->max_speed = p.max_speed;
+        }
+    }
+}
+
+static int add(ROLLUP_DB *db, uint64_t device, const FIXRECORD *rec)
+{
+    reference(device, rec);
+    return rollup_add(db, device, rec);
+}
+
+static void make_fix(FIXRECORD *rec, int d, int64_t t)
+{
+    int k = (int)((t - T0) / STEP);
+
+    memset(rec, 0, sizeof(*rec));
+    rec->utc_ms    = t * 1000 + d;
+    rec->latitude  = 40000000 + (k % 2) * 300000;               // 33 km up and down
+    rec->longitude = 11000000 + d * 10000;
+    rec->speed     = (uint16_t)(rand() % 60000);
+    rec->numsat    = (uint8_t)(4 + rand() % 17);
+    rec->fix       = rand() % 10 != 0;
+    rec->present   = GPS_HAS_TIME | GPS_HAS_SPEED | GPS_HAS_NUMSAT | (rec->fix ? GPS_HAS_POSITION | GPS_HAS_FIX : 0);
+}
+
+/* every bucket in the window of the final head, against the sums */
+static int compare(const ROLLUP_DB *db, int64_t now, unsigned *buckets_checked)
+{
+    static ROLLUP_POINT got[ROLLUP_DAYS];
+
+    for (int s = 0; s <= DEVICES; s++)
+    {
+        for (int l = 0; l < ROLLUP_LEVELS; l++)
+        {
+            int64_t  head = now / level_seconds[l], first = head - level_length[l] + 1;
+            uint32_t n    = rollup_query(db, (uint64_t)s, l, first * level_seconds[l], (head + 1) * level_seconds[l],
+                                         got, ROLLUP_DAYS);
+
+            if (n != level_length[l]) return 0;
+            for (uint32_t i = 0; i < n; i++)
+            {
+                int64_t             b = first + i;
+                static ROLLUP_POINT none;
+                const ROLLUP_POINT *e = b >= base[l] && b < base[l] + buckets[l] ? &expect[s][l][b - base[l]] : &none;
+
+                if (got[i].start != b * level_seconds[l] || got[i].epochs != e->epochs || got[i].fixed != e->fixed ||
+                    got[i].sat_sum != e->sat_sum || got[i].distance_dm != e->distance_dm || got[i].max_speed != e->max_speed)
+                {
+                    printf("  %s %d, level %d, bucket %lld: epochs %llu/%llu sat %llu/%llu distance %llu/%llu\n",
+                           s ? "device" : "fleet", s, l, (long long)b, (unsigned long long)got[i].epochs,
+                           (unsigned long long)e->epochs, (unsigned long long)got[i].sat_sum,
+                           (unsigned long long)e->sat_sum, (unsigned long long)got[i].distance_dm,
+                           (unsigned long long)e->distance_dm);
+                    return 0;
+                }
+                (*buckets_checked)++;
+            }
+        }
+    }
+    return 1;
+}
+
+int main(void)
+{
+    ROLLUP_DB   db, loaded;
+    int64_t     end = T0 + DAYS * 86400, now = T0;
+    int         ok = 1, rc = 0;
+    unsigned    checked = 0;
+    const char  *path = "/tmp/rollup_test.rup";
+
+    srand(1);
+    for (int l = 0; l < ROLLUP_LEVELS; l++)
+    {
+        base[l]    = T0 / level_seconds[l];
+        buckets[l] = (end + LATE_MAX) / level_seconds[l] - base[l] + 1;
+        for (int s = 0; s <= DEVICES; s++)
+        {
+            if (!(expect[s][l] = calloc((size_t)buckets[l], sizeof(ROLLUP_POINT)))) return 2;
+        }
+    }
+    if (rollup_init(&db) != 0) return 2;
+
+    for (now = T0; now < end; now += STEP)
+    {
+        for (int d = 1; d <= DEVICES; d++)
+        {
+            FIXRECORD rec;
+
+            make_fix(&rec, d, now);
+            if (rand() % 100 < 3 && pending_count < PENDING_MAX)
+            {
+                pending[pending_count++] = (PENDING){ now + 300 + rand() % (LATE_MAX - 300), (uint64_t)d, rec };
+                continue;
+            }
+            rc |= add(&db, (uint64_t)d, &rec);
+        }
+
+        // the late ones that are due, in any order
+        for (int i = 0; i < pending_count; i++)
+        {
+            if (pending[i].due > now) continue;
+
+            int64_t t = pending[i].rec.utc_ms / 1000;
+
+            late++;
+            if (t / 3600 <= db.fleet->level[ROLLUP_HOUR].closed) late_closed_hour++;
+            if (t / 60 <= db.fleet->level[ROLLUP_MINUTE].head - ROLLUP_MINUTES) late_before_minutes++;
+            rc |= add(&db, pending[i].device, &pending[i].rec);
+            pending[i--] = pending[--pending_count];
+        }
+    }
+    now -= STEP;
+
+    uint64_t fleet_day = 0, fleet_hour = 0;
+    for (int64_t b = 0; b < buckets[ROLLUP_DAY]; b++)
+    {
+        if (expect[0][ROLLUP_DAY][b].distance_dm > fleet_day) fleet_day = expect[0][ROLLUP_DAY][b].distance_dm;
+    }
+    for (int64_t b = 0; b < buckets[ROLLUP_HOUR]; b++)
+    {
+        if (expect[0][ROLLUP_HOUR][b].distance_dm > fleet_hour) fleet_hour = expect[0][ROLLUP_HOUR][b].distance_dm;
+    }
+
+    int same = rc == 0 && late_closed_hour > 0 && late_before_minutes > 0 && fleet_hour > UINT32_MAX && compare(&db, now, &checked);
+    printf("buckets against brute-force sums     %s  (%u buckets, %u late fixes: %u into closed hours, %u before the "
+           "minute window; fleet max %.1f Gdm per hour, %.1f per day)\n", same ? "ok" : "FAILED", checked, late,
+           late_closed_hour, late_before_minutes, fleet_hour / 1e9, fleet_day / 1e9);
+    ok &= same;
+
+    checked = 0;
+    int reloaded = rollup_save(&db, path) == 0 && rollup_init(&loaded) == 0 && rollup_load(&loaded, path) == 0 &&
+                   compare(&loaded, now, &checked);
+    printf("saved and loaded                     %s  (%u buckets)\n", reloaded ? "ok" : "FAILED", checked);
+    ok &= reloaded;
+    remove(path);
+
+    rollup_free(&loaded);
+    rollup_free(&db);
+    for (int l = 0; l < ROLLUP_LEVELS; l++)
+    {
+        for (int s = 0; s <= DEVICES; s++) free(expect[s][l]);
+    }
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,283 @@
+/*
+ * shard_test.c - Router and shard processes over Unix sockets.
+ *
+ *   shard_test
+ *
+ * Forks SHARDS shard processes (shard_listen / shard_worker_serve) and
+ * routes 200 receivers to them, each sending RMC + GGA once per epoch in
+ * pieces cut at random points, so lines are split across handoffs.
+ *   1. the ring grows by one shard, then loses one (released and
+ *      detached) while data flows: every fix arrives exactly once, in order
+ *   2. a shard is killed (SIGKILL) and the ring changes before the router
+ *      has noticed: the streams it was releasing restart on their new
+ *      owner, no handoff stays in flight, a cost query does not wait for
+ *      the dead shard, and shard_router_close returns. Fixes stay in
+ *      order without duplicates and every device reaches the last epoch.
+ *   3. a stream of garbage and one of overlong lines, 1 MiB each, have
+ *      their feed time sampled and rank above a stream of valid sentences
+ * A hang is caught by alarm().
+ */
+
+#include "shard.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define SHARDS      4
+#define DEVICES     200
+#define EPOCHS      150
+#define KILL_EPOCH  100
+#define DEVICE0     1000
+#define NOISE_BYTES (1 << 20)
+#define PIECE       512
+
+static pid_t        pid[SHARDS + 1];
+static char         path[SHARDS + 1][64];
+
+static int64_t      last_ms[DEVICES];
+static int          fixes[DEVICES];
+static int          disorder, strangers;
+
+static char         stream[DEVICES][EPOCHS][200];       // the epoch's RMC + GGA
+static size_t       stream_len[DEVICES][EPOCHS];
+static size_t       sent[DEVICES][EPOCHS];
+
+
+static void deliver(uint64_t device, const FIXRECORD *rec, void *ctx)
+{
+    (void)ctx;
+    if (device < DEVICE0 || device >= DEVICE0 + DEVICES || rec->latitude != 48000000 + (int32_t)(device - DEVICE0) * 50 * 100 / 60)
+    {
+        strangers++;
+        return;
+    }
+    int d = (int)(device - DEVICE0);
+
+    if (rec->utc_ms <= last_ms[d]) disorder++;
+    last_ms[d] = rec->utc_ms;
+    fixes[d]++;
+}
+
+static size_t sentence(char *out, const char *body)
+{
+    uint8_t sum = 0;
+
+    for (const char *p = body; *p; p++) sum ^= (uint8_t)*p;
+    return (size_t)sprintf(out, "$%s*%02X\r\n", body, sum);
+}
+
+static void make_streams(void)
+{
+    for (int d = 0; d < DEVICES; d++)
+    {
+        for (int e = 0; e < EPOCHS; e++)
+        {
+            char body[160];
+            int  t = 36000 + e;
+            char hms[16];
+
+            snprintf(hms, sizeof(hms), "%02d%02d%02d.00", t / 3600, t / 60 % 60, t % 60);
+            snprintf(body, sizeof(body), "GPRMC,%s,A,4800.%04d,N,01100.0000,E,0.5,90.0,180326,,", hms, d * 50);
+            stream_len[d][e] = sentence(stream[d][e], body);
+            snprintf(body, sizeof(body), "GPGGA,%s,4800.%04d,N,01100.0000,E,1,08,0.9,500.0,M,46.9,M,,", hms, d * 50);
+            stream_len[d][e] += sentence(stream[d][e] + stream_len[d][e], body);
+        }
+    }
+}
+
+static int start_shard(int id)
+{
+    snprintf(path[id], sizeof(path[id]), "/tmp/shard_test.%d.%d", (int)getpid(), id);
+
+    int lfd = shard_listen(path[id]);
+    if (lfd < 0) return -1;
+
+    if ((pid[id] = fork()) == 0)
+    {
+        int fd = accept(lfd, NULL, NULL);
+
+        close(lfd);
+        _exit(fd >= 0 && shard_worker_serve(fd) == 0 ? 0 : 1);
+    }
+    close(lfd);
+    return pid[id] > 0 ? 0 : -1;
+}
+
+static int attach(SHARD_ROUTER *r, int id)
+{
+    int fd = shard_connect(path[id]);
+
+    unlink(path[id]);
+    return fd >= 0 ? shard_router_attach(r, (uint32_t)id, fd) : -1;
+}
+
+/* one epoch of every device, each in two pieces cut at random points */
+static int feed_epoch(SHARD_ROUTER *r, int e, int *refused)
+{
+    for (int piece = 0; piece < 2; piece++)
+    {
+        for (int d = 0; d < DEVICES; d++)
+        {
+            size_t end = piece ? stream_len[d][e] : (size_t)rand() % stream_len[d][e];
+            size_t n   = end - sent[d][e];
+
+            if (shard_router_feed(r, DEVICE0 + (uint64_t)d, stream[d][e] + sent[d][e], n) != 0) (*refused)++;
+            sent[d][e] = end;
+        }
+        if (shard_router_poll(r, 0) < 0) return -1;
+    }
+    return 0;
+}
+
+static double elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - since->tv_sec) * 1e3 + (double)(now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+/* a stream's bytes through shard_stream_feed in PIECE byte calls */
+static void feed_pieces(SHARD_CHECKPOINT *s, const char *data, size_t len)
+{
+    for (size_t at = 0; at < len; at += PIECE) shard_stream_feed(s, data + at, len - at < PIECE ? len - at : PIECE, NULL, NULL);
+}
+
+static int total_fixes(void)
+{
+    int n = 0;
+
+    for (int d = 0; d < DEVICES; d++) n += fixes[d];
+    return n;
+}
+
+int main(void)
+{
+    static const uint32_t ring_a[] = { 1, 2, 3 }, ring_b[] = { 1, 2, 3, 4 }, ring_c[] = { 2, 3, 4 }, ring_d[] = { 3, 4 };
+    SHARD_ROUTER      r;
+    STREAM_COST_ENTRY top[8];
+    struct timespec   t0;
+    int               ok = 1, refused = 0, handoffs, all_once = 1, detached;
+
+    alarm(20);
+    signal(SIGPIPE, SIG_IGN);
+    srand(1);
+    make_streams();
+
+    for (int id = 1; id <= SHARDS; id++)
+    {
+        if (start_shard(id) != 0)
+        {
+            perror("shard");
+            return 2;
+        }
+    }
+    if (shard_router_init(&r, deliver, NULL) != 0) return 2;
+    for (int id = 1; id <= 3; id++)
+    {
+        if (attach(&r, id) != 0) return 2;
+    }
+    shard_router_set_ring(&r, ring_a, 3);
+
+    /* 1: planned handoffs */
+    for (int e = 0; e < KILL_EPOCH; e++)
+    {
+        if (e == 30)
+        {
+            if (attach(&r, 4) != 0) return 2;
+            handoffs = shard_router_set_ring(&r, ring_b, 4);
+            printf("shard 4 joins: %d streams move\n", handoffs);
+        }
+        if (e == 60)
+        {
+            handoffs = shard_router_set_ring(&r, ring_c, 3);
+            printf("shard 1 leaves: %d streams move\n", handoffs);
+        }
+        if (feed_epoch(&r, e, &refused) != 0) break;
+    }
+    while (r.moving && shard_router_poll(&r, 100) >= 0) {}
+    detached = shard_router_detach(&r, 1) == 0;
+
+    // every fix so far: the last epoch's GGA ends its stream, so all come out
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (total_fixes() < DEVICES * KILL_EPOCH && elapsed_ms(&t0) < 5000) shard_router_poll(&r, 100);
+    for (int d = 0; d < DEVICES; d++) all_once &= fixes[d] == KILL_EPOCH;
+
+    int planned_ok = all_once && detached && refused == 0 && disorder == 0 && strangers == 0;
+    printf("planned handoffs, every fix once    %s  (%llu handoffs, shard 1 %s)\n", planned_ok ? "ok" : "FAILED",
+           (unsigned long long)r.handoffs, detached ? "detached" : "NOT detached");
+    ok &= planned_ok;
+
+    /* 2: shard 2 dies, the ring changes before the router has noticed */
+    int before[DEVICES];
+    memcpy(before, fixes, sizeof(before));
+
+    kill(pid[2], SIGKILL);
+    waitpid(pid[2], NULL, 0);
+    handoffs = shard_router_set_ring(&r, ring_d, 2);
+
+    for (int e = KILL_EPOCH; e < EPOCHS; e++) feed_epoch(&r, e, &refused);
+
+    int polls = 0;
+    while (r.moving && polls++ < 50) shard_router_poll(&r, 100);
+    int settled = r.moving == 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int    costs = shard_router_costs(&r, top, 8, 5000);
+    double cost_ms = elapsed_ms(&t0);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    shard_router_close(&r);
+    double close_ms = elapsed_ms(&t0);
+
+    int reached = 1, lost = 0;
+    for (int d = 0; d < DEVICES; d++)
+    {
+        reached &= last_ms[d] % 86400000 == (int64_t)(36000 + EPOCHS - 1) * 1000;
+        lost    += EPOCHS - KILL_EPOCH - (fixes[d] - before[d]);
+    }
+
+    int kill_ok = settled && reached && disorder == 0 && strangers == 0 && costs > 0 && cost_ms < 1000;
+    printf("shard killed before the ring change %s  (%d streams released to it, %d fixes lost, cost query %.0f ms, "
+           "close %.0f ms)\n", kill_ok ? "ok" : "FAILED", handoffs, lost, cost_ms, close_ms);
+    ok &= kill_ok;
+
+    for (int id = 1; id <= SHARDS; id++) waitpid(pid[id], NULL, 0);
+
+    /* 3: bytes the decoder never sees still cost */
+    static SHARD_CHECKPOINT sc[3];
+    static char             noise[NOISE_BYTES];
+    STREAM_COST_ENTRY       e, rank[3];
+    uint32_t                ranked = 0;
+
+    shard_stream_init(&sc[0], 1);
+    for (int ep = 0; ep < EPOCHS; ep++) feed_pieces(&sc[0], stream[0][ep], stream_len[0][ep]);
+    shard_stream_init(&sc[1], 2);
+    memset(noise, 'x', sizeof(noise));
+    feed_pieces(&sc[1], noise, sizeof(noise));
+    shard_stream_init(&sc[2], 3);
+    for (size_t at = 0; at < sizeof(noise); at += 1000) memcpy(noise + at, "$GPGGA,", 7);
+    feed_pieces(&sc[2], noise, sizeof(noise));
+
+    memset(&e, 0, sizeof(e));
+    for (int i = 0; i < 3; i++)
+    {
+        e.device = sc[i].device;
+        e.cost   = sc[i].cost;
+        ranked   = stream_cost_rank(rank, ranked, 3, &e);
+    }
+    int noise_ok = ranked == 3 && rank[2].device == 1 && sc[0].cost.decoded > 0 && sc[1].cost.garbage == NOISE_BYTES &&
+                   sc[2].cost.invalid > 0 && sc[1].cost.ticks > 0 && sc[2].cost.ticks > 0;
+    printf("garbage and overlong lines cost     %s  (decoded %llu, garbage %llu, overlong %llu kticks)\n",
+           noise_ok ? "ok" : "FAILED", (unsigned long long)stream_cost_total(&sc[0].cost) / 1000,
+           (unsigned long long)stream_cost_total(&sc[1].cost) / 1000, (unsigned long long)stream_cost_total(&sc[2].cost) / 1000);
+    ok &= noise_ok;
+
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
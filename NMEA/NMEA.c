@@ -1,18 +1,19 @@
 /*
  * NMEA.c - Implementation of NMEA sentence parsing for GPS data.
- * Provides functions for parsing GGA sentences and converting
+ * Provides functions for parsing GGA and RMC sentences and converting
  * them into structured data.
  */
 
 #include "NMEA.h"
+#include "gps_dlog.h"
 #include <stdlib.h>
 #include <string.h>
-#include <stdio.h>
 //#include <stdint.h>
 //#include <ctype.h>      // for check symbols,  isdigit
 
 // Macros for various precisions
 #define FIXED_PRECISION_2   100       // For precision up to 2 decimal places
+#define FIXED_PRECISION_3   1000      // For precision up to 3 decimal places
 #define FIXED_PRECISION_4   10000     // For precision up to 4 decimal places
 #define FIXED_PRECISION_6   1000000   // For precision up to 6 decimal places
 
@@ -52,11 +53,12 @@ int32_t nmea_atof_fixed(const char *str, int scale)
         str++;                                          
     }
 
+    int     scale_factor = scale;                                   // Scale factor for fractional part
+
     // Handle fractional part if decimal point is found
     if (*str == '.')
     {
         str++;                                                      // Skip the decimal point
-        int     scale_factor = scale;                               // Scale factor for fractional part
         // Process digits after decimal, adjusting scale
         while (*str >= '0' && *str <= '9' && scale_factor > 1)      // reduce scale and move to next character
         {
@@ -66,29 +68,100 @@ int32_t nmea_atof_fixed(const char *str, int scale)
         }
     }
 
-    // Apply remaining scale if no fractional digits
-    while (scale > 1)
+    // Apply remaining scale for the missing fractional digits
+    while (scale_factor > 1)
     {
         result *= 10;                                   
-        scale /= 10;                             
+        scale_factor /= 10;                             
     }
 
     return result * sign;                               
 }
 
 
+/**
+ * Splits an NMEA sentence into its comma separated fields.
+ * Unlike strtok, empty fields are kept (",," gives a field of length 0), so the
+ * field number always matches the position in the sentence. The sentence is
+ * not modified; the leading '$' (or '!') is skipped and parsing stops at the
+ * checksum delimiter '*', CR, LF or the end of the string.
+ * @param sentence   The NMEA sentence.
+ * @param fields     Output array, fields[0] is the address field (e.g. "GPGGA").
+ * @param max_fields Size of the fields array.
+ * @return           Number of fields found.
+ */
+int nmea_tokenize(const char *sentence, NMEA_FIELD *fields, int max_fields)
+{
+    const char *ptr = sentence;
+    int         n   = 0;
+
+    if (!ptr || !fields) return 0;
+    if (*ptr == '$' || *ptr == '!') ptr++;
+
+    while (n < max_fields)
+    {
+        const char *start = ptr;
+
+        while (*ptr && *ptr != ',' && *ptr != '*' && *ptr != '\r' && *ptr != '\n') ptr++;
+
+        fields[n].ptr = start;
+        fields[n].len = (uint8_t)(ptr - start);
+        n++;
+
+        if (*ptr != ',') break;
+        ptr++;
+    }
+
+    return n;
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+/**
+ * Checks the "*hh" checksum of a sentence: the XOR of every character
+ * between the leading '$' (or '!') and the '*'.
+ * @param sentence   The NMEA sentence.
+ * @return           1 if it matches, 0 if it does not or is missing.
+ */
+int nmea_checksum_ok(const char *sentence)
+{
+    const char *ptr = sentence;
+    uint8_t     sum = 0;
+
+    if (!ptr) return 0;
+    if (*ptr == '$' || *ptr == '!') ptr++;
+
+    while (*ptr && *ptr != '*' && *ptr != '\r' && *ptr != '\n') sum ^= (uint8_t)*ptr++;
+    if (*ptr != '*') return 0;
+
+    int hi = hex_digit(ptr[1]);
+    int lo = hex_digit(hi >= 0 ? ptr[2] : '\0');
+
+    return hi >= 0 && lo >= 0 && (uint8_t)(hi * 16 + lo) == sum;
+}
+
+
 /*
  * parse_coordinate - Parses a coordinate from the NMEA format.
+ * (d)ddmm.mmmm -> degrees * GPS_COORD_SCALE
  *
  */
 static int32_t parse_coordinate(const char *str, char direction, int scale) 
 {
-    int32_t degrees         = nmea_atof_fixed(str, scale);     // convert string to fixed point
-    int32_t int_degrees     = degrees / 100;
-    int32_t minutes         = degrees - (int_degrees * 100);
-    int32_t decimal_degrees = int_degrees + (int32_t)(minutes / 60.0); //---> <d1:loss data>
-
     if (!str || *str == '\0') return 0;
+
+    int32_t raw             = nmea_atof_fixed(str, scale);             // (d)ddmm.mmmm * scale
+    int32_t int_degrees     = raw / (100 * scale);
+    int32_t minutes         = raw - (int_degrees * 100 * scale);       // mm.mmmm * scale
+    int32_t decimal_degrees = int_degrees * GPS_COORD_SCALE +
+                              (int32_t)(((int64_t)minutes * GPS_COORD_SCALE) / (60 * scale));
+
     /* Apply direction correction (negative for South or West) */
     if (direction == 'S' || direction == 'W')
         decimal_degrees = -decimal_degrees;
@@ -97,150 +170,307 @@ static int32_t parse_coordinate(const char *str, char direction, int scale)
 }
 
 /*
- * decodeGGA - Decodes the GGA sentence into a GGASTRUCT.
- * 
+ * diffFields - Compares a sentence with the previous one of its type.
+ * Returns a bit per field (bit n = field n) that differs from the previous
+ * sentence, and keeps a copy of the new sentence in hist for the next call.
+ *
  */
-int decodeGGA(char *GGAbuffer, GGASTRUCT *gga) 
+static uint32_t diffFields(NMEA_HISTORY *hist, const NMEA_FIELD *field, int num_fields)
 {
-    /* Validate input */
-    if (!GGAbuffer || !gga) 
+    uint32_t dirty = 0;
+    int      body  = 0;
+
+    for (int i = 0; i < num_fields; i++)
     {
-        return -1; /* Invalid input */
+        if (!hist->valid || i >= hist->num_fields || hist->len[i] != field[i].len ||
+            memcmp(hist->sentence + hist->off[i], field[i].ptr, field[i].len) != 0)
+        {
+            dirty |= 1u << i;
+        }
+        body += field[i].len + 1;
+    }
+
+    // the previous values are only known for the fields it had
+    if (hist->valid && hist->num_fields > num_fields) dirty |= ~0u << num_fields;
+
+    if (dirty == 0)
+    {
+        hist->reused += (uint32_t)num_fields;
+        return 0;
     }
 
-    int  field_num = 0;
-    char *ptr      = GGAbuffer;
-    char *start    = ptr;
-    char *token    = strtok(GGAbuffer, ",");
+    // remember this sentence, joined by ',' as it was received
+    if (body > NMEA_SENTENCE_MAX)
+    {
+        hist->valid = 0;                    // too long to keep, next one is decoded in full
+        return ~0u;
+    }
+    for (int i = 0, off = 0; i < num_fields; i++)
+    {
+        memcpy(hist->sentence + off, field[i].ptr, field[i].len);
+        hist->off[i] = (uint8_t)off;
+        hist->len[i] = field[i].len;
+        off         += field[i].len + 1;
+        if (dirty & (1u << i)) hist->converted++;
+        else                   hist->reused++;
+    }
+    hist->num_fields = (uint8_t)num_fields;
+    hist->valid      = 1;
 
-    printf("Parsing GGA sentence: %s\n", start);
+    return dirty;
+}
+
+#define FIELD_BIT(n)    (1u << (n))
+
+/*
+ * decodeGGAFields - Converts the GGA fields whose bit is set in dirty.
+ * The other non-empty fields keep their value in gga and only mark it present.
+ *
+ */
+static void decodeGGAFields(const NMEA_FIELD *field, int num_fields, uint32_t dirty, GGASTRUCT *gga)
+{
+    gga->present = 0;
 
     /* Parse each comma-separated field */
     // Iterate through the GGA sentence
-    while (token != NULL) 
+    for (int field_num = 1; field_num < num_fields; field_num++)
     {
+        const char *token = field[field_num].ptr;
+        uint8_t     len   = field[field_num].len;
+
+        if (len == 0) continue;     // empty field: not reported, keep the old value
+
         switch (field_num) 
         {
-            case 1: /* UTC Time (HHMMSS) */
-                if (field_num == 6) // checking if the field size is 6 symbols
+            case 1: /* UTC Time (HHMMSS.ss) */
+                if (len >= 6) // checking if the field size is at least 6 symbols
                 {
-                    uint8_t hour = (uint8_t)((token[0] - '0') * 10 + (token[1] - '0'));
-                    uint8_t min  = (uint8_t)((token[2] - '0') * 10 + (token[3] - '0'));
-                    uint8_t sec  = (uint8_t)((token[4] - '0') * 10 + (token[5] - '0'));
+                    if (dirty & FIELD_BIT(1))
+                    {
+                        uint8_t hour = (uint8_t)((token[0] - '0') * 10 + (token[1] - '0'));
+                        uint8_t min  = (uint8_t)((token[2] - '0') * 10 + (token[3] - '0'));
+                        uint8_t sec  = (uint8_t)((token[4] - '0') * 10 + (token[5] - '0'));
+                        uint8_t csec = 0;
+
+                        // optional fractional seconds, kept with 1/100 s resolution
+                        if (len >= 8 && token[6] == '.' && token[7] >= '0' && token[7] <= '9')
+                        {
+                            csec = (uint8_t)((token[7] - '0') * 10);
+                            if (len >= 9 && token[8] >= '0' && token[8] <= '9') csec = (uint8_t)(csec + (token[8] - '0'));
+                        }
 
-                    // settings value format HHMMSS
-                    gga->time.time = (uint32_t)(hour << 16) | (uint32_t)(min << 8) | (uint32_t)sec;
+                        // settings value format HHMMSS (+ hundredths in the top byte)
+                        gga->time.time = ((uint32_t)csec << 24) | ((uint32_t)hour << 16) | ((uint32_t)min << 8) | (uint32_t)sec;
+                    }
+                    gga->present |= GPS_HAS_TIME;
                 }
                 break;
             case 2: /* Latitude */
+                // the N/S indicator follows the value, look ahead for it
+                if (dirty & (FIELD_BIT(2) | FIELD_BIT(3)))
                 {
-                    if (token && token[0] != '\0')
-                    {
-                        // convert the latitude with 4 size floating
-                        gga->location.latitude = parse_coordinate(token, gga->location.NS, FIXED_PRECISION_4);
-                    }
-                    break;
-                }
-            case 3: /* N/S Indicator */
-                {
-                    // Get the latitude indicator
-                    gga->location.NS = token[0];
-                    break;
+                    char ns = (num_fields > 3 && field[3].len) ? field[3].ptr[0] : 'N';
+
+                    // convert the latitude with 4 size floating
+                    gga->location.latitude = parse_coordinate(token, ns, FIXED_PRECISION_4);
+                    gga->location.NS       = ns;
                 }
+                gga->present |= GPS_HAS_LATITUDE;
+                break;
             case 4: /* Longitude */
+                // the E/W indicator follows the value, look ahead for it
+                if (dirty & (FIELD_BIT(4) | FIELD_BIT(5)))
                 {
-                    if (token && token[0] != '\0')
-                    {
-                        // Use parse_coordinate to convert longitude
-                        gga->location.longitude = parse_coordinate(token, gga->location.EW, FIXED_PRECISION_4);
-                    }
-                    break;
-                }
-            case 5: /* E/W Indicator */
-                {
-                    // Record the longitude direction indicator
-                    gga->location.EW = token[0];
-                    break;
+                    char ew = (num_fields > 5 && field[5].len) ? field[5].ptr[0] : 'E';
+
+                    // Use parse_coordinate to convert longitude
+                    gga->location.longitude = parse_coordinate(token, ew, FIXED_PRECISION_4);
+                    gga->location.EW        = ew;
                 }
+                gga->present |= GPS_HAS_LONGITUDE;
+                break;
             case 6: /* Fix Validity */
+                if (dirty & FIELD_BIT(6))
                 {
-                    gga->is_fix_valid = nmea_atof_fixed(token,FIXED_PRECISION_2) ? 1 : 0;
-                    break;
+                    gga->is_fix_valid = nmea_atof_fixed(token, 1) ? 1 : 0;
                 }
+                gga->present |= GPS_HAS_FIX;
+                break;
             case 7: /* Number of Satellites */
+                if (dirty & FIELD_BIT(7))
                 {
-                    int32_t numsat_val = nmea_atof_fixed(token,FIXED_PRECISION_2);
+                    int32_t numsat_val = nmea_atof_fixed(token, 1);
                     gga->numsat = (numsat_val > 127) ? 127 : (uint8_t)numsat_val;
-                    break;
                 }
-            case 9: /* Altitude */
+                gga->present |= GPS_HAS_NUMSAT;
+                break;
+            case 8: /* HDOP */
+                if (dirty & FIELD_BIT(8))
                 {
-                    gga->altitude.altitude = nmea_atof_fixed(token, FIXED_PRECISION_4);
-                    break;
+                    int32_t hdop_val = nmea_atof_fixed(token, FIXED_PRECISION_2);
+                    gga->hdop = (hdop_val > 0xFFFF) ? 0xFFFF : (uint16_t)hdop_val;
                 }
-            case 10: /* Altitude Unit */
+                gga->present |= GPS_HAS_HDOP;
+                break;
+            case 9: /* Altitude */
+                if (dirty & (FIELD_BIT(9) | FIELD_BIT(10)))
                 {
-                    gga->altitude.unit = token[0];
-                    break;
+                    gga->altitude.altitude = nmea_atof_fixed(token, FIXED_PRECISION_3);   // metres -> mm
+                    gga->altitude.unit     = (num_fields > 10 && field[10].len) ? field[10].ptr[0] : 'M';
                 }
+                gga->present |= GPS_HAS_ALTITUDE;
+                break;
         }
-        token = strtok(NULL, ",");
-        field_num++;
     }
-
-    return 0;
 }
 
 /*
- * decodeRMC - Decodes the RMC sentence into an RMCSTRUCT.
+ * decodeRMCFields - Converts the RMC fields whose bit is set in dirty.
+ * The other non-empty fields keep their value in rmc and only mark it present.
  *
  */
-int decodeRMC(char *RMCbuffer, RMCSTRUCT *rmc) 
+static void decodeRMCFields(const NMEA_FIELD *field, int num_fields, uint32_t dirty, RMCSTRUCT *rmc)
 {
-    /* Validate input */
-    if (!RMCbuffer || !rmc) 
-    {
-        return -1; /* Invalid input */
-    }
-
-    char *token = strtok(RMCbuffer, ",");
-    int field_num = 0;
+    rmc->present = 0;
 
     /* Parse each comma-separated field */
-    while (token != NULL) 
+    for (int field_num = 1; field_num < num_fields; field_num++)
     {
+        const char *token = field[field_num].ptr;
+        uint8_t     len   = field[field_num].len;
+
+        if (len == 0) continue;     // empty field: not reported, keep the old value
+
         switch (field_num) 
         {
-            case 1: /* UTC Time (HHMMSS) */
-                {
-                    rmc->date.day = (uint8_t)((token[0] - '0') * 10 + (token[1] - '0'));
-                    rmc->date.month = (uint8_t)((token[2] - '0') * 10 + (token[3] - '0'));
-                    /* Adjust for 21st century */
-                    rmc->date.year = (uint16_t)(2000 + (token[4] - '0') * 10 + (token[5] - '0'));
-                    break;
-                }
             case 2: /* Validity ('A' = valid, 'V' = invalid) */
+                if (dirty & FIELD_BIT(2))
                 {
                     rmc->is_data_valid = (token[0] == 'A') ? 1 : 0;
-                    break;
                 }
-            case 3: /* Speed over ground in knots */
+                rmc->present |= GPS_HAS_STATUS;
+                break;
+            case 7: /* Speed over ground in knots */
+                if (dirty & FIELD_BIT(7))
                 {
-                    rmc->speed_knots = nmea_atof_fixed(token,FIXED_PRECISION_2 );
-                    break;
+                    rmc->speed_knots = nmea_atof_fixed(token, FIXED_PRECISION_3);
                 }
-            case 4: /* Course over ground */
+                rmc->present |= GPS_HAS_SPEED;
+                break;
+            case 8: /* Course over ground */
+                if (dirty & FIELD_BIT(8))
+                {
+                    rmc->course = nmea_atof_fixed(token, FIXED_PRECISION_2);
+                }
+                rmc->present |= GPS_HAS_COURSE;
+                break;
+            case 9: /* Date (DDMMYY) */
+                if (len >= 6)
                 {
-                    rmc->course = nmea_atof_fixed(token,FIXED_PRECISION_4 );
-                    break;
+                    if (dirty & FIELD_BIT(9))
+                    {
+                        rmc->date.day = (uint8_t)((token[0] - '0') * 10 + (token[1] - '0'));
+                        rmc->date.month = (uint8_t)((token[2] - '0') * 10 + (token[3] - '0'));
+                        /* Adjust for 21st century */
+                        rmc->date.year = (uint16_t)(2000 + (token[4] - '0') * 10 + (token[5] - '0'));
+                    }
+                    rmc->present |= GPS_HAS_DATE;
                 }
+                break;
         }
-        token = strtok(NULL, ",");
-        field_num++;
     }
+}
+
+/*
+ * decodeGGA - Decodes the GGA sentence into a GGASTRUCT.
+ * Only the fields present in the sentence are written, gga->present
+ * tells which ones (GPS_HAS_* bits).
+ * 
+ */
+int decodeGGA(char *GGAbuffer, GGASTRUCT *gga) 
+{
+    /* Validate input */
+    if (!GGAbuffer || !gga) 
+    {
+        return -1; /* Invalid input */
+    }
+
+    NMEA_FIELD field[NMEA_MAX_FIELDS];
+    int        num_fields = nmea_tokenize(GGAbuffer, field, NMEA_MAX_FIELDS);
+
+    decodeGGAFields(field, num_fields, ~0u, gga);
+    DLOG3(DLOG_GGA, num_fields, gga->present, gga->is_fix_valid);
+
+    return 0;
+}
+
+/*
+ * decodeRMC - Decodes the RMC sentence into an RMCSTRUCT.
+ * Only the fields present in the sentence are written, rmc->present
+ * tells which ones (GPS_HAS_* bits).
+ *
+ */
+int decodeRMC(char *RMCbuffer, RMCSTRUCT *rmc) 
+{
+    /* Validate input */
+    if (!RMCbuffer || !rmc) 
+    {
+        return -1; /* Invalid input */
+    }
+
+    NMEA_FIELD field[NMEA_MAX_FIELDS];
+    int        num_fields = nmea_tokenize(RMCbuffer, field, NMEA_MAX_FIELDS);
+
+    decodeRMCFields(field, num_fields, ~0u, rmc);
+    DLOG3(DLOG_RMC, num_fields, rmc->present, rmc->is_data_valid);
+
     return 0; 
 }
 
+/*
+ * decodeGGAIncremental - decodeGGA that only converts the fields that changed.
+ * gga must still hold the result of the previous call made with the same hist
+ * (initHistory() before the first one); unchanged fields keep that value.
+ *
+ */
+int decodeGGAIncremental(char *GGAbuffer, GGASTRUCT *gga, NMEA_HISTORY *hist)
+{
+    if (!GGAbuffer || !gga || !hist) return -1;
+
+    NMEA_FIELD field[NMEA_MAX_FIELDS];
+    int        num_fields = nmea_tokenize(GGAbuffer, field, NMEA_MAX_FIELDS);
+
+    decodeGGAFields(field, num_fields, diffFields(hist, field, num_fields), gga);
+
+    return 0;
+}
+
+/*
+ * decodeRMCIncremental - decodeRMC that only converts the fields that changed.
+ * Same contract as decodeGGAIncremental.
+ *
+ */
+int decodeRMCIncremental(char *RMCbuffer, RMCSTRUCT *rmc, NMEA_HISTORY *hist)
+{
+    if (!RMCbuffer || !rmc || !hist) return -1;
+
+    NMEA_FIELD field[NMEA_MAX_FIELDS];
+    int        num_fields = nmea_tokenize(RMCbuffer, field, NMEA_MAX_FIELDS);
+
+    decodeRMCFields(field, num_fields, diffFields(hist, field, num_fields), rmc);
+
+    return 0;
+}
+
+/*
+ * initHistory - Forgets the previous sentence, the next decode converts every field.
+ *
+ */
+void initHistory(NMEA_HISTORY *hist)
+{
+    memset(hist, 0, sizeof(NMEA_HISTORY));
+}
+
 /*
  * initGPS - Initializes a GPSSTRUCT to default values.
  *
@@ -250,6 +480,42 @@ void initGPS(GPSSTRUCT *gps)
     memset(gps, 0, sizeof(GPSSTRUCT)); /* Set all fields to 0 */
 }
 
+/*
+ * mergeGPS - Merges a partial update into dst.
+ * Only the fields whose GPS_HAS_* bit is set in src are copied, so several
+ * partial sentences of one epoch can be combined without re-parsing.
+ *
+ */
+void mergeGPS(GPSSTRUCT *dst, const GPSSTRUCT *src)
+{
+    uint16_t gga = src->ggastruct.present;
+    uint16_t rmc = src->rmcstruct.present;
+
+    if (gga & GPS_HAS_TIME)      dst->ggastruct.time = src->ggastruct.time;
+    if (gga & GPS_HAS_LATITUDE)
+    {
+        dst->ggastruct.location.latitude = src->ggastruct.location.latitude;
+        dst->ggastruct.location.NS       = src->ggastruct.location.NS;
+    }
+    if (gga & GPS_HAS_LONGITUDE)
+    {
+        dst->ggastruct.location.longitude = src->ggastruct.location.longitude;
+        dst->ggastruct.location.EW        = src->ggastruct.location.EW;
+    }
+    if (gga & GPS_HAS_FIX)       dst->ggastruct.is_fix_valid = src->ggastruct.is_fix_valid;
+    if (gga & GPS_HAS_NUMSAT)    dst->ggastruct.numsat       = src->ggastruct.numsat;
+    if (gga & GPS_HAS_ALTITUDE)  dst->ggastruct.altitude     = src->ggastruct.altitude;
+    if (gga & GPS_HAS_HDOP)      dst->ggastruct.hdop         = src->ggastruct.hdop;
+
+    if (rmc & GPS_HAS_STATUS)    dst->rmcstruct.is_data_valid = src->rmcstruct.is_data_valid;
+    if (rmc & GPS_HAS_SPEED)     dst->rmcstruct.speed_knots   = src->rmcstruct.speed_knots;
+    if (rmc & GPS_HAS_COURSE)    dst->rmcstruct.course        = src->rmcstruct.course;
+    if (rmc & GPS_HAS_DATE)      dst->rmcstruct.date          = src->rmcstruct.date;
+
+    dst->ggastruct.present |= gga;
+    dst->rmcstruct.present |= rmc;
+}
+
 /*
  * populateGPSData - Populates a GPSSTRUCT with data from GGA and RMC sentences.
  *
@@ -12,6 +12,48 @@
 #define DECODE_HOUR(t)   (((t) >> 16) & 0xFF)
 #define DECODE_MIN(t)    (((t) >> 8) & 0xFF)
 #define DECODE_SEC(t)    ((t) & 0xFF)
+#define DECODE_CSEC(t)   (((t) >> 24) & 0xFF)     // hundredths of a second (0..99)
+
+// Fixed-point scale of LOCATION latitude/longitude (degrees * GPS_COORD_SCALE)
+#define GPS_COORD_SCALE  1000000
+
+// Presence bits: which fields a decoded sentence actually reported
+// (GGASTRUCT.present / RMCSTRUCT.present share one bit space, OR them for an epoch)
+#define GPS_HAS_TIME        (1u << 0)
+#define GPS_HAS_LATITUDE    (1u << 1)       // latitude + N/S
+#define GPS_HAS_LONGITUDE   (1u << 2)       // longitude + E/W
+#define GPS_HAS_FIX         (1u << 3)
+#define GPS_HAS_NUMSAT      (1u << 4)
+#define GPS_HAS_ALTITUDE    (1u << 5)       // altitude + unit
+#define GPS_HAS_STATUS      (1u << 6)       // RMC A/V
+#define GPS_HAS_SPEED       (1u << 7)
+#define GPS_HAS_COURSE      (1u << 8)
+#define GPS_HAS_DATE        (1u << 9)
+#define GPS_HAS_HDOP        (1u << 10)
+
+#define GPS_HAS_POSITION    (GPS_HAS_LATITUDE | GPS_HAS_LONGITUDE)
+
+#define NMEA_MAX_FIELDS     24              // enough for every standard sentence
+#define NMEA_SENTENCE_MAX   96              // 82 by the standard, some receivers go longer
+
+// NMEA_FIELD: one field of a sentence, points into the sentence (not NUL terminated)
+typedef struct
+{
+    const char  *ptr;
+    uint8_t     len;
+} NMEA_FIELD;
+
+// NMEA_HISTORY: previous sentence of one type, for the incremental decoders
+typedef struct
+{
+    char        sentence[NMEA_SENTENCE_MAX];    // fields joined by ',' (no '$', no checksum)
+    uint8_t     off[NMEA_MAX_FIELDS];
+    uint8_t     len[NMEA_MAX_FIELDS];
+    uint8_t     num_fields;
+    uint8_t     valid;
+    uint32_t    converted;                      // fields converted / reused so far
+    uint32_t    reused;
+} NMEA_HISTORY;
 
 // LOCATION structure with fixed-point representation
 typedef struct
@@ -27,6 +69,7 @@ typedef struct
 typedef struct
 {
     uint32_t time;          // HHMMSS format in uint32_t (example, 123456 for 12:34:56)
+                            // packed as (csec << 24) | (hour << 16) | (min << 8) | sec
 } TIME;
 
 // ALTITUDE structure
@@ -60,6 +103,8 @@ typedef struct
     ALTITUDE    altitude;       // 5 байт
     int8_t      is_fix_valid;   // 1 байт     Boolean
     uint8_t     numsat;         // 1 байт     Number of satellites
+    uint16_t    present;        // 2 байта    GPS_HAS_* bits of the fields above
+    uint16_t    hdop;           // 2 байта    Horizontal dilution of precision * 100
 } GGASTRUCT;
 
 
@@ -69,6 +114,7 @@ typedef struct {
     int32_t speed_knots;        // Speed in knots * 1000
     int32_t course;             // Course in degrees * 100
     uint8_t is_data_valid;      // Boolean
+    uint16_t present;           // GPS_HAS_* bits of the fields above
 } RMCSTRUCT;
 
 // GPSSTRUCT for combining GGA and RMC data
@@ -79,9 +125,15 @@ typedef struct {
 
 // Public function declarations
 int32_t nmea_atof_fixed(const char *str, int scale);
+int nmea_tokenize(const char *sentence, NMEA_FIELD *fields, int max_fields);
+int nmea_checksum_ok(const char *sentence);
 int decodeGGA(char *GGAbuffer, GGASTRUCT *gga);
 int decodeRMC(char *RMCbuffer, RMCSTRUCT *rmc);
+int decodeGGAIncremental(char *GGAbuffer, GGASTRUCT *gga, NMEA_HISTORY *hist);
+int decodeRMCIncremental(char *RMCbuffer, RMCSTRUCT *rmc, NMEA_HISTORY *hist);
+void initHistory(NMEA_HISTORY *hist);
 void initGPS(GPSSTRUCT *gps);
+void mergeGPS(GPSSTRUCT *dst, const GPSSTRUCT *src);
 
 int populateGPSData(char *ggaSentence, char *rmcSentence, GPSSTRUCT *gps);
 
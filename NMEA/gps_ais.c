@@ -0,0 +1,394 @@
+/*
+ * gps_ais.c - AIS (!AIVDM / !AIVDO) decoding.
+ * Sentences go through the same nmea_tokenize / checksum path as GGA and
+ * RMC. The payload is de-armoured with a 128 entry table straight into
+ * packed bits, four characters (24 bits, three whole bytes) at a time
+ * while the output is byte aligned; multi-sentence messages are collected
+ * in AIS_SLOTS fixed slots, fragments in order. Fields are then read with
+ * shifts from the packed bits into AIS_MESSAGE.
+ */
+
+#include "gps_ais.h"
+#include <stddef.h>
+#include <string.h>
+
+#define ARMOUR_BAD      0xFF
+#define AIS_NO_SEQ_ID   10          // messages without a sequential message id
+
+/* 6 bit value of each payload character ('0'..'W', '`'..'w') */
+static const uint8_t armour[128] =
+{
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F,
+    0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x28, 0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+    0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0x3E, 0x3F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+/* characters of the 6 bit text fields ('@' ends the text) */
+static const char sixbit_text[65] = "@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_ !\"#$%&'()*+,-./0123456789:;<=>?";
+
+
+static uint8_t sixbit(char c)
+{
+    unsigned char u = (unsigned char)c;
+
+    return u < 128 ? armour[u] : ARMOUR_BAD;
+}
+
+/*
+ * append_payload - De-armours payload characters onto the bits of a slot.
+ * @return  0 on success, -1 on an invalid character or an overlong message.
+ *
+ */
+static int append_payload(AIS_SLOT *s, const char *p, int len)
+{
+    uint32_t acc  = s->acc;
+    uint8_t  nacc = s->acc_bits;
+    uint8_t  *out = &s->data[s->bits / 8];
+    int      i = 0;
+
+    if (s->bits + nacc + 6u * (unsigned)len > AIS_MAX_BITS) return -1;
+
+    // byte aligned: 4 characters make 3 whole bytes
+    if (nacc == 0)
+    {
+        for (; i + 4 <= len; i += 4)
+        {
+            uint8_t a = sixbit(p[i]), b = sixbit(p[i + 1]), c = sixbit(p[i + 2]), d = sixbit(p[i + 3]);
+
+            if ((a | b | c | d) & 0x80) return -1;      // ARMOUR_BAD is the only value with bit 7
+
+            uint32_t w = ((uint32_t)a << 18) | ((uint32_t)b << 12) | ((uint32_t)c << 6) | d;
+
+            out[0] = (uint8_t)(w >> 16);
+            out[1] = (uint8_t)(w >> 8);
+            out[2] = (uint8_t)w;
+            out += 3;
+        }
+    }
+    for (; i < len; i++)
+    {
+        uint8_t v = sixbit(p[i]);
+
+        if (v == ARMOUR_BAD) return -1;
+        acc   = (acc << 6) | v;
+        nacc += 6;
+        if (nacc >= 8)
+        {
+            nacc -= 8;
+            *out++ = (uint8_t)(acc >> nacc);
+        }
+        acc &= (1u << nacc) - 1;
+    }
+
+    s->bits     = (uint16_t)((out - s->data) * 8);
+    s->acc      = acc;
+    s->acc_bits = nacc;
+    return 0;
+}
+
+/*
+ * finish_payload - Flushes the last bits of a slot and drops the fill bits.
+ * @return  number of message bits.
+ *
+ */
+static unsigned finish_payload(AIS_SLOT *s, unsigned fill)
+{
+    unsigned bits  = s->bits + s->acc_bits;
+    uint8_t  *tail = &s->data[s->bits / 8];
+
+    memset(tail, 0, sizeof(s->data) - (size_t)(s->bits / 8));
+    if (s->acc_bits) *tail = (uint8_t)(s->acc << (8 - s->acc_bits));
+
+    return bits > fill ? bits - fill : 0;
+}
+
+/* len (1..32) bits from bit position start, most significant bit first */
+static uint32_t get_bits(const uint8_t *d, unsigned start, unsigned len)
+{
+    unsigned last = start + len - 1;
+    uint64_t v = 0;
+
+    for (unsigned i = start / 8; i <= last / 8; i++) v = (v << 8) | d[i];
+    v >>= 7 - (last & 7);
+    return (uint32_t)(v & ((1ull << len) - 1));
+}
+
+static int32_t get_signed(const uint8_t *d, unsigned start, unsigned len)
+{
+    uint32_t v = get_bits(d, start, len);
+    uint32_t sign = 1u << (len - 1);
+
+    return (int32_t)(v ^ sign) - (int32_t)sign;
+}
+
+/* chars 6 bit characters into out (chars + 1 bytes), '@' padding and trailing spaces removed */
+static void get_text(const uint8_t *d, unsigned start, unsigned chars, char *out)
+{
+    unsigned n = 0;
+
+    for (; n < chars; n++)
+    {
+        char c = sixbit_text[get_bits(d, start + 6 * n, 6)];
+
+        if (c == '@') break;
+        out[n] = c;
+    }
+    while (n > 0 && out[n - 1] == ' ') n--;
+    out[n] = '\0';
+}
+
+/* 1/10000 minute -> degrees * GPS_COORD_SCALE */
+static int32_t ais_coordinate(int32_t v)
+{
+    int64_t x = (int64_t)v * 5;
+
+    return (int32_t)((x + (x >= 0 ? 1 : -1)) / 3);
+}
+
+static void decode_position(const uint8_t *d, AIS_MESSAGE *m, unsigned speed_at)
+{
+    AIS_POSITION *p = &m->position;
+    unsigned      at = speed_at;
+
+    p->speed     = (uint16_t)get_bits(d, at, 10);
+    p->accuracy  = (uint8_t)get_bits(d, at + 10, 1);
+    p->longitude = ais_coordinate(get_signed(d, at + 11, 28));
+    p->latitude  = ais_coordinate(get_signed(d, at + 39, 27));
+    p->course    = (uint16_t)get_bits(d, at + 66, 12);
+    p->heading   = (uint16_t)get_bits(d, at + 78, 9);
+    p->second    = (uint8_t)get_bits(d, at + 87, 6);
+    m->has      |= AIS_HAS_POSITION;
+}
+
+static void decode_dimensions(const uint8_t *d, AIS_STATIC *s, unsigned at)
+{
+    s->to_bow       = (uint16_t)get_bits(d, at, 9);
+    s->to_stern     = (uint16_t)get_bits(d, at + 9, 9);
+    s->to_port      = (uint8_t)get_bits(d, at + 18, 6);
+    s->to_starboard = (uint8_t)get_bits(d, at + 24, 6);
+    s->epfd         = (uint8_t)get_bits(d, at + 30, 4);
+}
+
+/*
+ * decode_message - Extracts the fields of one complete message.
+ * @return  1 decoded, 0 unsupported type, -1 too short for its type.
+ *
+ */
+static int decode_message(const uint8_t *d, unsigned bits, AIS_MESSAGE *m)
+{
+    if (bits < 38) return -1;
+
+    m->type = (uint8_t)get_bits(d, 0, 6);
+    m->mmsi = get_bits(d, 8, 30);
+
+    switch (m->type)
+    {
+        case 1:
+        case 2:
+        case 3:
+            if (bits < 168) return -1;
+            m->position.status = (uint8_t)get_bits(d, 38, 4);
+            m->position.turn   = (int8_t)get_signed(d, 42, 8);
+            decode_position(d, m, 50);
+            return 1;
+
+        case 18:
+            if (bits < 168) return -1;
+            m->position.status = 15;
+            m->position.turn   = -128;
+            decode_position(d, m, 46);
+            return 1;
+
+        case 19:
+            if (bits < 312) return -1;
+            m->position.status = 15;
+            m->position.turn   = -128;
+            decode_position(d, m, 46);
+            get_text(d, 143, 20, m->statics.name);
+            m->statics.ship_type = (uint8_t)get_bits(d, 263, 8);
+            decode_dimensions(d, &m->statics, 271);
+            m->has |= AIS_HAS_STATIC;
+            return 1;
+
+        case 5:
+            if (bits < 420) return -1;          // some stations leave out the last 2 spare bits
+            m->statics.imo = get_bits(d, 40, 30);
+            get_text(d, 70, 7, m->statics.callsign);
+            get_text(d, 112, 20, m->statics.name);
+            m->statics.ship_type  = (uint8_t)get_bits(d, 232, 8);
+            decode_dimensions(d, &m->statics, 240);
+            m->statics.eta_month  = (uint8_t)get_bits(d, 274, 4);
+            m->statics.eta_day    = (uint8_t)get_bits(d, 278, 5);
+            m->statics.eta_hour   = (uint8_t)get_bits(d, 283, 5);
+            m->statics.eta_minute = (uint8_t)get_bits(d, 288, 6);
+            m->statics.draught    = (uint8_t)get_bits(d, 294, 8);
+            get_text(d, 302, 20, m->statics.destination);
+            m->has |= AIS_HAS_STATIC;
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+/* a one digit field, -1 if empty or not a digit */
+static int digit_field(const NMEA_FIELD *f)
+{
+    return (f->len == 1 && f->ptr[0] >= '0' && f->ptr[0] <= '9') ? f->ptr[0] - '0' : -1;
+}
+
+/*
+ * find_slot - Slot for a fragment: the message it continues, or for a
+ * first fragment a free (else the oldest) slot.
+ * @return  the slot, NULL if the fragment continues nothing.
+ *
+ */
+static AIS_SLOT *find_slot(AIS_DECODER *ais, int number, uint8_t seq_id, char channel)
+{
+    AIS_SLOT *match = NULL, *victim = NULL;
+
+    for (int i = 0; i < AIS_SLOTS; i++)
+    {
+        AIS_SLOT *s = &ais->slot[i];
+
+        if (s->total && s->seq_id == seq_id && s->channel == channel) match = s;
+        else if (!victim || (victim->total && (!s->total || s->age > victim->age))) victim = s;
+    }
+
+    if (number != 1)
+    {
+        if (match && match->next == number) return match;
+        if (match) match->total = 0;            // a fragment went missing
+        return NULL;
+    }
+    if (match)
+    {
+        ais->lost_fragments++;                  // restarted before it was complete
+        return match;
+    }
+    if (victim->total) ais->lost_fragments++;   // all slots busy: the oldest gives way
+    return victim;
+}
+
+/*
+ * initAIS - Empties the reassembly slots and clears the statistics.
+ *
+ */
+void initAIS(AIS_DECODER *ais)
+{
+    memset(ais, 0, sizeof(AIS_DECODER));
+}
+
+/*
+ * decodeAIS - Feeds one !AIVDM / !AIVDO sentence to the decoder.
+ * A message sent in several sentences is returned with its last one.
+ * @return  1 when msg holds a decoded message, 0 when the sentence was
+ *          taken but completes nothing (more fragments to come, or a
+ *          message type not decoded here), -1 if it was rejected (not
+ *          AIS, bad checksum, bad payload, fragment out of order).
+ *
+ */
+int decodeAIS(AIS_DECODER *ais, const char *sentence, AIS_MESSAGE *msg)
+{
+    NMEA_FIELD field[NMEA_MAX_FIELDS];
+    AIS_SLOT   single, *slot;
+    int        num_fields, total, number, fill, rc;
+    uint8_t    seq_id;
+    char       channel;
+
+    if (!ais || !sentence || !msg) return -1;
+
+    num_fields = nmea_tokenize(sentence, field, NMEA_MAX_FIELDS);
+    if (num_fields < 7 || field[0].len != 5 || memcmp(field[0].ptr + 2, "VD", 2) != 0 ||
+        (field[0].ptr[4] != 'M' && field[0].ptr[4] != 'O'))
+    {
+        return -1;
+    }
+    if (!nmea_checksum_ok(sentence))
+    {
+        ais->bad_checksum++;
+        return -1;
+    }
+
+    total   = digit_field(&field[1]);
+    number  = digit_field(&field[2]);
+    seq_id  = field[3].len ? (uint8_t)digit_field(&field[3]) : AIS_NO_SEQ_ID;
+    channel = field[4].len ? field[4].ptr[0] : 0;
+    fill    = field[6].len ? digit_field(&field[6]) : 0;
+    if (total < 1 || number < 1 || number > total || fill < 0 || fill > 5 || seq_id > AIS_NO_SEQ_ID)
+    {
+        ais->bad_payload++;
+        return -1;
+    }
+
+    // slots that waited too long for their next fragment are given up
+    for (int i = 0; i < AIS_SLOTS; i++)
+    {
+        if (ais->slot[i].total && ++ais->slot[i].age > AIS_SLOT_MAX_AGE)
+        {
+            ais->slot[i].total = 0;
+            ais->lost_fragments++;
+        }
+    }
+
+    if (total == 1)
+    {
+        slot = &single;
+        memset(slot, 0, offsetof(AIS_SLOT, data));
+    }
+    else
+    {
+        slot = find_slot(ais, number, seq_id, channel);
+        if (!slot)
+        {
+            ais->lost_fragments++;
+            return -1;
+        }
+        if (number == 1)
+        {
+            memset(slot, 0, offsetof(AIS_SLOT, data));
+            slot->total   = (uint8_t)total;
+            slot->seq_id  = seq_id;
+            slot->channel = channel;
+            slot->own     = field[0].ptr[4] == 'O';
+        }
+    }
+
+    if (append_payload(slot, field[5].ptr, field[5].len) != 0)
+    {
+        slot->total = 0;
+        ais->bad_payload++;
+        return -1;
+    }
+    if (number < total)
+    {
+        slot->next = (uint8_t)(number + 1);
+        slot->age  = 0;
+        return 0;
+    }
+
+    memset(msg, 0, sizeof(AIS_MESSAGE));
+    msg->channel = channel;
+    msg->own     = field[0].ptr[4] == 'O';
+
+    rc = decode_message(slot->data, finish_payload(slot, (unsigned)fill), msg);
+    slot->total = 0;
+
+    if (rc < 0)
+    {
+        ais->bad_payload++;
+        return -1;
+    }
+    if (rc == 0)
+    {
+        ais->unsupported++;
+        return 0;
+    }
+    ais->messages++;
+    return 1;
+}
@@ -0,0 +1,99 @@
+/*
+ * gps_ais.h
+ *
+ * Header file for AIS (!AIVDM / !AIVDO) decoding
+ */
+
+#ifndef INC_GPS_AIS_H_
+#define INC_GPS_AIS_H_
+
+#include <stdint.h>
+#include "NMEA.h"
+
+#define AIS_SLOTS               4           // multi-fragment messages assembled at the same time
+#define AIS_MAX_BITS            1008        // longest AIS message (5 slots)
+#define AIS_SLOT_MAX_AGE        8           // sentences a slot waits for its next fragment
+
+// AIS_MESSAGE.has
+#define AIS_HAS_POSITION        (1u << 0)
+#define AIS_HAS_STATIC          (1u << 1)
+
+// "not available" values, as sent
+#define AIS_NO_SPEED            1023
+#define AIS_NO_COURSE           3600
+#define AIS_NO_HEADING          511
+#define AIS_NO_LATITUDE         (91 * GPS_COORD_SCALE)
+#define AIS_NO_LONGITUDE        (181 * GPS_COORD_SCALE)
+
+// AIS_POSITION: position reports (types 1, 2, 3, 18, 19)
+typedef struct
+{
+    int32_t     latitude;           // degrees * GPS_COORD_SCALE, AIS_NO_LATITUDE if unknown
+    int32_t     longitude;          // degrees * GPS_COORD_SCALE, AIS_NO_LONGITUDE if unknown
+    uint16_t    speed;              // knots * 10
+    uint16_t    course;             // degrees * 10
+    uint16_t    heading;            // degrees
+    int8_t      turn;               // rate of turn as sent, -128 = not available (types 1-3)
+    uint8_t     status;             // navigation status, 15 = not defined (types 1-3)
+    uint8_t     second;             // UTC second of the report, 60.. = not available
+    uint8_t     accuracy;           // 1: better than 10 m
+} AIS_POSITION;
+
+// AIS_STATIC: static and voyage data (type 5, partly type 19)
+typedef struct
+{
+    uint32_t    imo;
+    char        callsign[8];
+    char        name[21];
+    char        destination[21];
+    uint8_t     ship_type;
+    uint8_t     epfd;               // position fix device type
+    uint16_t    to_bow, to_stern;   // metres from the reference point
+    uint8_t     to_port, to_starboard;
+    uint8_t     eta_month, eta_day, eta_hour, eta_minute;
+    uint8_t     draught;            // metres * 10
+} AIS_STATIC;
+
+typedef struct
+{
+    uint32_t        mmsi;
+    uint8_t         type;
+    uint8_t         has;            // AIS_HAS_* bits
+    uint8_t         own;            // !xxVDO: our own vessel
+    char            channel;        // 'A' / 'B', 0 if not given
+    AIS_POSITION    position;
+    AIS_STATIC      statics;
+} AIS_MESSAGE;
+
+// AIS_SLOT: one message being reassembled from its fragments
+typedef struct
+{
+    uint8_t     total;              // fragments, 0 = free
+    uint8_t     next;               // fragment number expected next
+    uint8_t     seq_id;
+    char        channel;
+    uint8_t     own;
+    uint8_t     age;
+    uint8_t     acc_bits;           // bits waiting in acc
+    uint32_t    acc;
+    uint16_t    bits;               // bits stored in data
+    uint8_t     data[AIS_MAX_BITS / 8 + 4];
+} AIS_SLOT;
+
+typedef struct
+{
+    AIS_SLOT    slot[AIS_SLOTS];
+
+    /* statistics */
+    uint32_t    messages;           // decoded
+    uint32_t    bad_checksum;
+    uint32_t    bad_payload;        // invalid armour or too short for its type
+    uint32_t    lost_fragments;     // out of order or never completed
+    uint32_t    unsupported;        // other message types
+} AIS_DECODER;
+
+// Public function declarations
+void initAIS(AIS_DECODER *ais);
+int decodeAIS(AIS_DECODER *ais, const char *sentence, AIS_MESSAGE *msg);
+
+#endif /* INC_GPS_AIS_H_ */
@@ -0,0 +1,135 @@
+/*
+ * gps_dlog.c - Deferred binary logging.
+ * Recording an event costs a table lookup, a few shifts per argument and
+ * a copy of 4..19 bytes; nothing is formatted and nothing waits for the
+ * UART. A full ring drops the event and the next one that fits is
+ * preceded by a DLOG_LOST event with the number dropped.
+ */
+
+#include "gps_dlog.h"
+
+#define DLOG_NARGS(id, nargs, fmt) nargs,
+static const uint8_t dlog_nargs[DLOG_COUNT] = { DLOG_MESSAGES(DLOG_NARGS) };
+#undef DLOG_NARGS
+
+static unsigned char dlog_ring[DLOG_RING_SIZE];
+static uint32_t      dlog_head;             // free running, masked on access
+static uint32_t      dlog_tail;
+static uint8_t       dlog_seq;
+static uint32_t      dlog_lost;             // since power up
+static uint32_t      dlog_unreported;       // not announced by a DLOG_LOST event yet
+
+
+static int put_varint(unsigned char *p, uint32_t v)
+{
+    int n = 0;
+
+    while (v >= 0x80)
+    {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+/*
+ * put_frame - Encodes one event and copies it into the ring.
+ * @return  0 on success, -1 if it did not fit (the event is counted as lost).
+ *
+ */
+static int put_frame(dlog_id id, uint32_t a, uint32_t b, uint32_t c)
+{
+    unsigned char frame[DLOG_FRAME_MAX];
+    uint32_t      args[3] = { a, b, c };
+    uint8_t       sum = 0;
+    int           len = 0;
+
+    frame[len++] = DLOG_SYNC;
+    frame[len++] = (unsigned char)id;
+    frame[len++] = dlog_seq++;
+    for (int i = 0; i < dlog_nargs[id]; i++)
+    {
+        len += put_varint(frame + len, args[i]);
+    }
+    for (int i = 0; i < len; i++) sum = (uint8_t)(sum + frame[i]);
+    frame[len++] = sum;
+
+    if (DLOG_RING_SIZE - (dlog_head - dlog_tail) < (uint32_t)len)
+    {
+        dlog_lost++;
+        dlog_unreported++;
+        return -1;
+    }
+    for (int i = 0; i < len; i++)
+    {
+        dlog_ring[(dlog_head + (uint32_t)i) & (DLOG_RING_SIZE - 1)] = frame[i];
+    }
+    dlog_head += (uint32_t)len;
+    return 0;
+}
+
+/*
+ * dlogRecord - Logs one event, use the DLOG0..DLOG3 macros.
+ * Arguments beyond the count given in gps_dlog_msgs.h are ignored.
+ *
+ */
+void dlogRecord(dlog_id id, uint32_t a, uint32_t b, uint32_t c)
+{
+    if ((unsigned)id >= DLOG_COUNT) return;
+
+    if (dlog_unreported)
+    {
+        uint32_t n = dlog_unreported;
+
+        if (put_frame(DLOG_LOST, n, 0, 0) < 0) return;
+        dlog_unreported = 0;
+    }
+    put_frame(id, a, b, c);
+}
+
+/*
+ * dlogFlush - Hands the recorded bytes to the tx path.
+ * sink queues up to len bytes without blocking and returns how many it
+ * took (Uart_write_span fits); the rest stays for the next flush.
+ * @return  number of bytes handed over.
+ *
+ */
+int dlogFlush(int (*sink)(const unsigned char *data, int len))
+{
+    int total = 0;
+
+    while (dlog_head != dlog_tail)
+    {
+        uint32_t at   = dlog_tail & (DLOG_RING_SIZE - 1);
+        uint32_t span = dlog_head - dlog_tail;
+        int      n;
+
+        if (span > DLOG_RING_SIZE - at) span = DLOG_RING_SIZE - at;
+        n = sink(&dlog_ring[at], (int)span);
+        if (n <= 0) break;
+
+        dlog_tail += (uint32_t)n;
+        total     += n;
+        if ((uint32_t)n < span) break;
+    }
+    return total;
+}
+
+/*
+ * dlogPending - Bytes waiting for dlogFlush().
+ *
+ */
+uint32_t dlogPending(void)
+{
+    return dlog_head - dlog_tail;
+}
+
+/*
+ * dlogLost - Events dropped because the ring was full, since power up.
+ *
+ */
+uint32_t dlogLost(void)
+{
+    return dlog_lost;
+}
@@ -0,0 +1,44 @@
+/*
+ * gps_dlog.h
+ *
+ * Deferred binary logging. An event is a message id from gps_dlog_msgs.h
+ * plus up to three raw 32 bit arguments, stored as a few bytes in a small
+ * ring instead of being formatted on the device. dlogFlush() hands the
+ * bytes to the tx path (e.g. Uart_write_span) whenever it has room; the
+ * host tool (GATEWAY/dlog_tool) turns them back into text.
+ *
+ * Frame: DLOG_SYNC, id, seq, arguments (unsigned LEB128), sum of the
+ * preceding frame bytes. seq counts events, so the host sees gaps.
+ * Record and flush from one context only (main loop, not an ISR).
+ */
+
+#ifndef INC_GPS_DLOG_H_
+#define INC_GPS_DLOG_H_
+
+#include <stdint.h>
+#include "gps_dlog_msgs.h"
+
+#define DLOG_RING_SIZE          256         // power of 2
+#define DLOG_SYNC               0xA5
+#define DLOG_FRAME_MAX          (3 + 3 * 5 + 1)
+
+#define DLOG_ID(id, nargs, fmt) id,
+typedef enum
+{
+    DLOG_MESSAGES(DLOG_ID)
+    DLOG_COUNT
+} dlog_id;
+#undef DLOG_ID
+
+#define DLOG0(id)               dlogRecord(id, 0, 0, 0)
+#define DLOG1(id, a)            dlogRecord(id, (uint32_t)(a), 0, 0)
+#define DLOG2(id, a, b)         dlogRecord(id, (uint32_t)(a), (uint32_t)(b), 0)
+#define DLOG3(id, a, b, c)      dlogRecord(id, (uint32_t)(a), (uint32_t)(b), (uint32_t)(c))
+
+// Public function declarations
+void dlogRecord(dlog_id id, uint32_t a, uint32_t b, uint32_t c);
+int dlogFlush(int (*sink)(const unsigned char *data, int len));
+uint32_t dlogPending(void);
+uint32_t dlogLost(void);
+
+#endif /* INC_GPS_DLOG_H_ */
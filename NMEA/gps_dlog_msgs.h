@@ -0,0 +1,21 @@
+/*
+ * gps_dlog_msgs.h
+ *
+ * Message table of the deferred log, shared by the firmware and the host
+ * decoder. The firmware only uses the ids and argument counts; the format
+ * strings are compiled into the host tool alone. Append new messages at
+ * the end (ids are positions) and use only 32 bit conversions (%u %d %X).
+ *
+ * X(id, number of arguments (0..3), host format)
+ */
+
+#ifndef INC_GPS_DLOG_MSGS_H_
+#define INC_GPS_DLOG_MSGS_H_
+
+#define DLOG_MESSAGES(X)                                                        \
+    X(DLOG_LOST,        1, "dlog: %u events lost")                              \
+    X(DLOG_GGA,         3, "GGA: %u fields, present 0x%03X, fix %u")            \
+    X(DLOG_RMC,         3, "RMC: %u fields, present 0x%03X, valid %u")          \
+    X(DLOG_POWER_MODE,  2, "power: mode %u -> %u")
+
+#endif /* INC_GPS_DLOG_MSGS_H_ */
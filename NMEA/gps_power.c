@@ -0,0 +1,309 @@
+/*
+ * gps_power.c - Adaptive receiver duty cycling.
+ * Continuous tracking while the device moves, MTK periodic standby once it
+ * is parked, backup mode after a long stop, with wake-ups scheduled from
+ * the learned time to first fix so a requested fix is ready just in time.
+ * All timing comes from the caller (ms ticks), so the policy runs the
+ * same against the real receiver and against a simulated clock.
+ */
+
+#include "gps_power.h"
+#include "gps_dlog.h"
+#include <stdio.h>
+#include <string.h>
+
+#define LOST_PERIODS        3           // low rate periods without a fix: back to continuous
+#define FIX_FRESH_MS        5000        // a fix older than this does not count as "parked"
+
+
+static int reached(uint32_t now, uint32_t tick)
+{
+    return (int32_t)(now - tick) >= 0;
+}
+
+/*
+ * send_pmtk - Sends "$<body>*<checksum>\r\n" through the command path.
+ *
+ */
+static void send_pmtk(POWER_MANAGER *pm, const char *body)
+{
+    char    sentence[96];
+    uint8_t sum = 0;
+
+    if (!pm->send) return;
+
+    for (const char *p = body; *p; p++) sum ^= (uint8_t)*p;
+    snprintf(sentence, sizeof(sentence), "$%s*%02X\r\n", body, sum);
+    pm->send(sentence);
+}
+
+static uint32_t mode_current(const POWER_MANAGER *pm)
+{
+    switch (pm->mode)
+    {
+        case POWER_LOWRATE:
+            return (uint32_t)(((uint64_t)pm->run_ms * pm->ua_track +
+                               (uint64_t)(pm->lowrate_ms - pm->run_ms) * pm->ua_standby) / pm->lowrate_ms);
+        case POWER_BACKUP:  return pm->ua_backup;
+        case POWER_WAKING:  return pm->ua_acquire;
+        default:            return pm->ua_track;
+    }
+}
+
+/* charges the time since the last call to the current mode */
+static void account(POWER_MANAGER *pm, uint32_t now)
+{
+    uint32_t dt = now - pm->account_tick;
+
+    if ((int32_t)dt <= 0) return;
+
+    pm->charge        += (uint64_t)dt * mode_current(pm);
+    pm->baseline      += (uint64_t)dt * pm->ua_track;
+    pm->time_in[pm->mode] += dt;
+    pm->account_tick   = now;
+}
+
+static void enter(POWER_MANAGER *pm, power_mode mode, uint32_t now)
+{
+    char cmd[64];
+
+    account(pm, now);
+
+    // out of backup, or out of a standby phase of the low rate period: a
+    // command sent to a sleeping receiver only wakes it and is lost
+    if ((pm->mode == POWER_BACKUP || pm->mode == POWER_LOWRATE) && pm->wake) pm->wake();
+
+    switch (mode)
+    {
+        case POWER_CONTINUOUS:
+            send_pmtk(pm, "PMTK225,0");
+            send_pmtk(pm, "PMTK220,1000");
+            break;
+        case POWER_LOWRATE:
+            snprintf(cmd, sizeof(cmd), "PMTK225,2,%lu,%lu,%lu,%lu",
+                     (unsigned long)pm->run_ms, (unsigned long)(pm->lowrate_ms - pm->run_ms),
+                     (unsigned long)pm->run_ms, (unsigned long)(pm->lowrate_ms - pm->run_ms));
+            send_pmtk(pm, cmd);
+            break;
+        case POWER_BACKUP:
+            send_pmtk(pm, "PMTK225,4");
+            break;
+        case POWER_WAKING:
+            send_pmtk(pm, "PMTK225,0");
+            pm->wakes++;
+            break;
+    }
+
+    DLOG2(DLOG_POWER_MODE, pm->mode, mode);
+    pm->mode      = mode;
+    pm->mode_tick = now;
+}
+
+/*
+ * schedule - Picks the wake-up from backup: the next check-in or the
+ * requested fix, minus the time to first fix expected after that long off.
+ *
+ */
+static void schedule(POWER_MANAGER *pm, uint32_t now)
+{
+    uint32_t next = pm->mode_tick + pm->checkin_ms;
+
+    if (pm->deadline && !reached(pm->deadline, next)) next = pm->deadline;
+
+    pm->warm_start = (next - pm->mode_tick) >= pm->hot_off_ms;
+    pm->wake_tick  = next - (pm->warm_start ? pm->warm_ttff_ms : pm->hot_ttff_ms) - POWER_WAKE_MARGIN_MS;
+
+    if (reached(now, pm->wake_tick)) pm->wake_tick = now;
+}
+
+static void learn_ttff(uint32_t *estimate, uint32_t sample)
+{
+    int32_t err = (int32_t)(sample - *estimate);
+
+    *estimate = (uint32_t)((int32_t)*estimate + err / 4);
+}
+
+
+/*
+ * initPower - Starts in continuous mode with the default tuning.
+ *
+ */
+void initPower(POWER_MANAGER *pm, uint32_t now)
+{
+    memset(pm, 0, sizeof(POWER_MANAGER));
+
+    pm->still_knots  = POWER_STILL_KNOTS;
+    pm->move_knots   = POWER_MOVE_KNOTS;
+    pm->park_ms      = POWER_PARK_MS;
+    pm->backup_ms    = POWER_BACKUP_MS;
+    pm->lowrate_ms   = POWER_LOWRATE_MS;
+    pm->run_ms       = POWER_RUN_MS;
+    pm->checkin_ms   = POWER_CHECKIN_MS;
+    pm->hot_off_ms   = POWER_HOT_OFF_MS;
+    pm->hot_ttff_ms  = POWER_HOT_TTFF_MS;
+    pm->warm_ttff_ms = POWER_WARM_TTFF_MS;
+
+    pm->ua_acquire   = POWER_UA_ACQUIRE;
+    pm->ua_track     = POWER_UA_TRACK;
+    pm->ua_standby   = POWER_UA_STANDBY;
+    pm->ua_backup    = POWER_UA_BACKUP;
+
+    pm->mode         = POWER_CONTINUOUS;
+    pm->mode_tick    = now;
+    pm->account_tick = now;
+    pm->last_fix_tick = now;
+}
+
+/*
+ * powerFix - Feeds a decoded epoch (e.g. after populateGPSData).
+ * Speed needs GPS_HAS_SPEED; epochs without a valid position are ignored.
+ *
+ */
+void powerFix(POWER_MANAGER *pm, const GPSSTRUCT *gps, uint32_t now)
+{
+    const GGASTRUCT *gga = &gps->ggastruct;
+    const RMCSTRUCT *rmc = &gps->rmcstruct;
+
+    account(pm, now);
+
+    if ((gga->present & GPS_HAS_POSITION) != GPS_HAS_POSITION || !gga->is_fix_valid) return;
+    if ((rmc->present & GPS_HAS_STATUS) && !rmc->is_data_valid) return;
+
+    // the fix answers a request when it is recent enough for it
+    if (pm->deadline && reached(now, pm->deadline - (pm->mode == POWER_LOWRATE ? pm->lowrate_ms : FIX_FRESH_MS)))
+    {
+        if (pm->mode == POWER_WAKING && !reached(pm->deadline, now)) pm->missed++;
+        pm->deadline = 0;
+    }
+    pm->last_fix_tick = now;
+
+    if (rmc->present & GPS_HAS_SPEED)
+    {
+        if (rmc->speed_knots < pm->still_knots)
+        {
+            if (!pm->still)
+            {
+                pm->still       = 1;
+                pm->still_since = now;
+            }
+        }
+        else if (rmc->speed_knots > pm->move_knots)
+        {
+            pm->still = 0;
+        }
+    }
+
+    switch (pm->mode)
+    {
+        case POWER_LOWRATE:
+            if (!pm->still) enter(pm, POWER_CONTINUOUS, now);
+            break;
+        case POWER_WAKING:
+            learn_ttff(pm->warm_start ? &pm->warm_ttff_ms : &pm->hot_ttff_ms, now - pm->mode_tick);
+            if (!pm->still || pm->motion)
+            {
+                enter(pm, POWER_CONTINUOUS, now);
+            }
+            else
+            {
+                enter(pm, POWER_BACKUP, now);
+                schedule(pm, now);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * powerMotion - Motion hint (accelerometer, ignition...): moving leaves
+ * any saving mode at once, not moving lets the speed rules decide.
+ *
+ */
+void powerMotion(POWER_MANAGER *pm, uint8_t moving, uint32_t now)
+{
+    account(pm, now);
+
+    pm->motion = moving;
+    if (!moving) return;
+
+    pm->still = 0;
+    if (pm->mode != POWER_CONTINUOUS) enter(pm, POWER_CONTINUOUS, now);
+}
+
+/*
+ * powerRequestFix - Asks for a fix by the given tick (e.g. the next report).
+ *
+ */
+void powerRequestFix(POWER_MANAGER *pm, uint32_t deadline)
+{
+    pm->deadline = deadline ? deadline : 1;
+    if (pm->mode == POWER_BACKUP) schedule(pm, pm->account_tick);
+}
+
+/*
+ * powerPoll - Runs the mode transitions, call it periodically.
+ * @return  ms until the next call is needed (the MCU may sleep that long).
+ *
+ */
+uint32_t powerPoll(POWER_MANAGER *pm, uint32_t now)
+{
+    int parked = pm->still && !pm->motion;
+
+    account(pm, now);
+
+    switch (pm->mode)
+    {
+        case POWER_CONTINUOUS:
+            if (parked && !reached(now, pm->last_fix_tick + FIX_FRESH_MS) && reached(now, pm->still_since + pm->park_ms))
+            {
+                enter(pm, POWER_LOWRATE, now);
+            }
+            return 1000;
+
+        case POWER_LOWRATE:
+            if (reached(now, pm->last_fix_tick + LOST_PERIODS * pm->lowrate_ms))
+            {
+                enter(pm, POWER_CONTINUOUS, now);           // no fix any more, stop saving
+            }
+            else if (parked && reached(now, pm->still_since + pm->backup_ms))
+            {
+                enter(pm, POWER_BACKUP, now);
+                schedule(pm, now);
+            }
+            return 1000;
+
+        case POWER_BACKUP:
+            if (reached(now, pm->wake_tick))
+            {
+                enter(pm, POWER_WAKING, now);
+                return 1000;
+            }
+            return pm->wake_tick - now;
+
+        case POWER_WAKING:
+            if (reached(now, pm->mode_tick + POWER_ACQUIRE_MAX_MS))
+            {
+                // no sky: do not drain the battery, try again at the next check-in
+                if (pm->deadline) pm->missed++;
+                pm->deadline = 0;
+                enter(pm, POWER_BACKUP, now);
+                schedule(pm, now);
+                return pm->wake_tick - now;
+            }
+            return 1000;
+    }
+    return 1000;
+}
+
+/*
+ * powerSavedUAh - Estimated charge saved so far against continuous tracking.
+ *
+ */
+uint32_t powerSavedUAh(POWER_MANAGER *pm, uint32_t now)
+{
+    account(pm, now);
+
+    if (pm->charge >= pm->baseline) return 0;
+    return (uint32_t)((pm->baseline - pm->charge) / 3600000u);
+}
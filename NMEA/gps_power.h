@@ -0,0 +1,90 @@
+/*
+ * gps_power.h
+ *
+ * Header file for adaptive receiver duty cycling (MTK PMTK commands)
+ */
+
+#ifndef INC_GPS_POWER_H_
+#define INC_GPS_POWER_H_
+
+#include <stdint.h>
+#include "NMEA.h"
+
+/* default tuning, every value can be changed after initPower() */
+#define POWER_STILL_KNOTS       500         // speed_knots (x1000) below which the device is parked
+#define POWER_MOVE_KNOTS        2000        // speed_knots above which it is moving again
+#define POWER_PARK_MS           60000       // parked this long: low rate
+#define POWER_BACKUP_MS         600000      // parked this long: backup
+#define POWER_LOWRATE_MS        10000       // fix period in low rate mode
+#define POWER_RUN_MS            3000        // receiver on time per low rate period
+#define POWER_CHECKIN_MS        1800000     // fix taken from backup at least this often
+#define POWER_HOT_OFF_MS        7200000     // backup shorter than this: hot start
+#define POWER_HOT_TTFF_MS       2000        // initial time to first fix estimates
+#define POWER_WARM_TTFF_MS      35000
+#define POWER_WAKE_MARGIN_MS    1000        // wake this much before the estimate says
+#define POWER_ACQUIRE_MAX_MS    120000      // give up a scheduled fix after this long
+
+/* receiver currents (MT3339 class), µA */
+#define POWER_UA_ACQUIRE        25000
+#define POWER_UA_TRACK          20000
+#define POWER_UA_STANDBY        200
+#define POWER_UA_BACKUP         7
+
+typedef enum
+{
+    POWER_CONTINUOUS = 0,   // 1 Hz, receiver always on
+    POWER_LOWRATE,          // periodic standby: on for run_ms every lowrate_ms
+    POWER_BACKUP,           // receiver in backup, only the RTC and ephemeris are kept
+    POWER_WAKING            // out of backup for a scheduled fix
+} power_mode;
+
+typedef struct
+{
+    /* command path: a complete sentence with checksum and CR LF, e.g. Uart_sendstring */
+    void     (*send)(const char *sentence);
+    void     (*wake)(void);                 // leaves backup or a low rate standby phase (WAKEUP pin / any byte), may be NULL
+
+    /* tuning */
+    int32_t  still_knots;
+    int32_t  move_knots;
+    uint32_t park_ms;
+    uint32_t backup_ms;
+    uint32_t lowrate_ms;
+    uint32_t run_ms;
+    uint32_t checkin_ms;
+    uint32_t hot_off_ms;
+    uint32_t ua_acquire, ua_track, ua_standby, ua_backup;
+
+    /* state */
+    power_mode mode;
+    uint32_t   mode_tick;                   // when the current mode was entered
+    uint32_t   still_since;                 // first parked fix of the current stop
+    uint8_t    still;
+    uint8_t    motion;                      // last motion hint
+    uint32_t   last_fix_tick;               // last valid fix
+    uint32_t   deadline;                    // a fix is wanted by then (0: none)
+    uint32_t   wake_tick;                   // scheduled wake from backup
+    uint32_t   hot_ttff_ms;                 // learned time to first fix (EMA)
+    uint32_t   warm_ttff_ms;
+    uint8_t    warm_start;                  // the current wake is a warm start
+
+    /* energy, µA x ms */
+    uint32_t   account_tick;
+    uint64_t   charge;                      // spent
+    uint64_t   baseline;                    // a receiver always tracking would have spent
+
+    /* statistics */
+    uint32_t   time_in[POWER_WAKING + 1];   // ms per mode
+    uint32_t   wakes;
+    uint32_t   missed;                      // scheduled fixes not ready by their deadline
+} POWER_MANAGER;
+
+// Public function declarations
+void initPower(POWER_MANAGER *pm, uint32_t now);
+void powerFix(POWER_MANAGER *pm, const GPSSTRUCT *gps, uint32_t now);
+void powerMotion(POWER_MANAGER *pm, uint8_t moving, uint32_t now);
+void powerRequestFix(POWER_MANAGER *pm, uint32_t deadline);
+uint32_t powerPoll(POWER_MANAGER *pm, uint32_t now);
+uint32_t powerSavedUAh(POWER_MANAGER *pm, uint32_t now);
+
+#endif /* INC_GPS_POWER_H_ */
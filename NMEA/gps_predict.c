@@ -0,0 +1,245 @@
+/*
+ * gps_predict.c - Position prediction between GNSS epochs.
+ * Extrapolates the last decoded fix with its speed and course,
+ * in fixed point, so a fast control loop can ask for a position
+ * at any instant in O(1) without locking.
+ */
+
+#include "gps_predict.h"
+#include <string.h>
+
+#define MS_PER_DAY          86400000L
+#define MIN_COS_Q15         328                 // cos(89.4°), clamps longitude rate near the poles
+
+// sin(0°..90°) in Q15, 1° step, linear interpolation in between
+static const int16_t sin_table_q15[91] =
+{
+        0,   572,  1144,  1715,  2286,  2856,  3425,  3993,  4560,  5126,
+     5690,  6252,  6813,  7371,  7927,  8481,  9032,  9580, 10126, 10668,
+    11207, 11743, 12275, 12803, 13328, 13848, 14365, 14876, 15384, 15886,
+    16384, 16877, 17364, 17847, 18324, 18795, 19261, 19720, 20174, 20622,
+    21063, 21498, 21926, 22348, 22763, 23170, 23571, 23965, 24351, 24730,
+    25102, 25466, 25822, 26170, 26510, 26842, 27166, 27482, 27789, 28088,
+    28378, 28660, 28932, 29197, 29452, 29698, 29935, 30163, 30382, 30592,
+    30792, 30983, 31164, 31336, 31499, 31651, 31795, 31928, 32052, 32166,
+    32270, 32365, 32449, 32524, 32588, 32643, 32688, 32723, 32748, 32763,
+    32767
+};
+
+
+/*
+ * sin_q15 - sine of an angle given in degrees * 100, result in Q15.
+ *
+ */
+static int32_t sin_q15(int32_t cdeg)
+{
+    int32_t sign = 1;
+
+    cdeg %= 36000;
+    if (cdeg < 0) cdeg += 36000;
+    if (cdeg >= 18000)
+    {
+        cdeg -= 18000;
+        sign = -1;
+    }
+    if (cdeg > 9000) cdeg = 18000 - cdeg;
+
+    int32_t idx  = cdeg / 100;
+    int32_t frac = cdeg % 100;
+    int32_t val  = sin_table_q15[idx];
+
+    if (frac) val += ((sin_table_q15[idx + 1] - val) * frac) / 100;
+
+    return sign * val;
+}
+
+static int32_t cos_q15(int32_t cdeg)
+{
+    return sin_q15(cdeg + 9000);
+}
+
+
+/*
+ * utc_ms_of_day - Converts a packed TIME value to milliseconds since midnight.
+ *
+ */
+static uint32_t utc_ms_of_day(uint32_t t)
+{
+    return (uint32_t)DECODE_HOUR(t) * 3600000U + (uint32_t)DECODE_MIN(t) * 60000U +
+           (uint32_t)DECODE_SEC(t) * 1000U + (uint32_t)DECODE_CSEC(t) * 10U;
+}
+
+
+/*
+ * initPredictor - Initializes a PREDICTOR with default tuning and no fix.
+ *
+ */
+void initPredictor(PREDICTOR *p)
+{
+    memset(p, 0, sizeof(PREDICTOR));
+
+    p->base_error_mm    = PREDICT_BASE_ERROR_MM;
+    p->speed_error_mm_s = PREDICT_SPEED_ERROR_MM_S;
+    p->accel_mm_s2      = PREDICT_ACCEL_MM_S2;
+    p->max_horizon_ms   = PREDICT_MAX_HORIZON_MS;
+}
+
+
+/*
+ * updatePredictor - Publishes a new fix to the readers.
+ * @param gps         Decoded GGA + RMC data of the epoch.
+ * @param rx_tick_ms  Local tick (e.g. HAL_GetTick()) when the sentence was received.
+ *
+ * The instant the fix was valid is recovered from its UTC timestamp: the smallest
+ * observed (rx tick - UTC) offset is the transport delay free alignment of the two
+ * clocks, so queuing and parsing jitter of this epoch does not shift the prediction.
+ * Must be called from one context only (the decoder).
+ */
+void updatePredictor(PREDICTOR *p, const GPSSTRUCT *gps, uint32_t rx_tick_ms)
+{
+    if (!p || !gps || !gps->ggastruct.is_fix_valid) return;
+    if ((gps->ggastruct.present & GPS_HAS_POSITION) != GPS_HAS_POSITION) return;
+
+    uint32_t ref_tick;
+
+    if (gps->ggastruct.present & GPS_HAS_TIME)
+    {
+        uint32_t utc_ms = utc_ms_of_day(gps->ggastruct.time.time);
+        uint32_t offset = rx_tick_ms - utc_ms;
+
+        if (!p->offset_valid)
+        {
+            p->offset_min   = offset;
+            p->offset_valid = 1;
+        }
+        else
+        {
+            int32_t delta = (int32_t)(offset - p->offset_min);
+
+            // UTC wraps at midnight, the tick does not: move the envelope into the new day
+            if (delta >  MS_PER_DAY / 2)
+            {
+                delta          -= MS_PER_DAY;
+                p->offset_min  += (uint32_t)MS_PER_DAY;
+            }
+            if (delta < -MS_PER_DAY / 2)
+            {
+                delta          += MS_PER_DAY;
+                p->offset_min  -= (uint32_t)MS_PER_DAY;
+            }
+
+            if (delta < 0) p->offset_min += (uint32_t)delta;   // new lower envelope
+            else if (delta > 0) p->offset_min++;               // follow slow clock drift
+        }
+        ref_tick = utc_ms + p->offset_min - p->latency_ms;
+    }
+    else
+    {
+        // no timestamp in this epoch, only the fixed latency can be compensated
+        ref_tick = rx_tick_ms - p->latency_ms;
+    }
+
+    // write the inactive slot, readers keep using the live one
+    PREDICTSLOT *s = &p->slot[(p->seq + 1) & 1];
+
+    s->latitude  = gps->ggastruct.location.latitude;
+    s->longitude = gps->ggastruct.location.longitude;
+    s->ref_tick  = ref_tick;
+
+    s->v_lat      = 0;
+    s->v_lon      = 0;
+    s->speed_mm_s = 0;
+
+    if (gps->rmcstruct.is_data_valid && (gps->rmcstruct.present & GPS_HAS_SPEED) && gps->rmcstruct.speed_knots > 0)
+    {
+        // knots * 1000 -> mm/s (1 knot = 0.514444 m/s)
+        int32_t speed   = (int32_t)(((int64_t)gps->rmcstruct.speed_knots * 514444) / 1000000);
+        int32_t v_north = (int32_t)(((int64_t)speed * sin_q15(9000 - gps->rmcstruct.course)) >> 15);
+        int32_t v_east  = (int32_t)(((int64_t)speed * sin_q15(gps->rmcstruct.course)) >> 15);
+        int32_t cos_lat = cos_q15(s->latitude / (GPS_COORD_SCALE / 100));
+
+        if (cos_lat < MIN_COS_Q15) cos_lat = MIN_COS_Q15;
+
+        // mm/s -> coordinate units per ms in Q24 (1° of latitude = 111320 m)
+        s->v_lat = (int32_t)(((int64_t)v_north * GPS_COORD_SCALE * (1 << 24)) / (111320000LL * 1000));
+        s->v_lon = (int32_t)(((((int64_t)v_east * GPS_COORD_SCALE * (1 << 24)) / (111320000LL * 1000)) * 32768) / cos_lat);
+        s->speed_mm_s = (uint32_t)speed;
+    }
+    s->valid = 1;
+
+    __sync_synchronize();       // slot contents before the sequence
+    p->seq++;
+}
+
+
+/*
+ * predictError - Estimated error growth of an extrapolation.
+ * base error + speed uncertainty * t + worst acceleration * t^2 / 2
+ *
+ */
+uint32_t predictError(const PREDICTOR *p, uint32_t age_ms, uint32_t speed_mm_s)
+{
+    uint64_t err = p->base_error_mm;
+
+    err += ((uint64_t)p->speed_error_mm_s * age_ms) / 1000;
+    err += ((uint64_t)p->accel_mm_s2 * age_ms * age_ms) / 2000000;
+
+    // a heading error of ~1/64 rad grows sideways with the distance travelled
+    err += ((uint64_t)speed_mm_s * age_ms) / 64000;
+
+    return (err > 0xFFFFFFFFu) ? 0xFFFFFFFFu : (uint32_t)err;
+}
+
+
+/*
+ * predictPosition - Extrapolates the last fix to now_tick_ms.
+ * Wait-free from an ISR that preempts the writer; a task preempted by a
+ * publishing ISR simply retries the copy.
+ * @return  0 on success, 1 if the fix is older than max_horizon_ms
+ *          (position is held at the horizon), -1 if there is no fix yet.
+ */
+int predictPosition(const PREDICTOR *p, uint32_t now_tick_ms, PREDICTION *out)
+{
+    PREDICTSLOT s;
+    uint32_t    seq;
+
+    if (!p || !out) return -1;
+
+    do
+    {
+        seq = p->seq;
+        __sync_synchronize();
+        s = p->slot[seq & 1];
+        __sync_synchronize();
+    } while (seq != p->seq);
+
+    if (!s.valid) return -1;
+
+    int     ret = 0;
+    int32_t age = (int32_t)(now_tick_ms - s.ref_tick);
+
+    if (age < 0) age = 0;
+    if ((uint32_t)age > p->max_horizon_ms)
+    {
+        age = (int32_t)p->max_horizon_ms;
+        ret = 1;
+    }
+
+    int64_t lat = s.latitude  + (((int64_t)s.v_lat * age) >> 24);
+    int64_t lon = s.longitude + (((int64_t)s.v_lon * age) >> 24);
+
+    if (lat >  90LL * GPS_COORD_SCALE) lat =  90LL * GPS_COORD_SCALE;
+    if (lat < -90LL * GPS_COORD_SCALE) lat = -90LL * GPS_COORD_SCALE;
+    if (lon >  180LL * GPS_COORD_SCALE) lon -= 360LL * GPS_COORD_SCALE;
+    if (lon < -180LL * GPS_COORD_SCALE) lon += 360LL * GPS_COORD_SCALE;
+
+    out->location.latitude  = (int32_t)lat;
+    out->location.longitude = (int32_t)lon;
+    out->location.NS        = (lat < 0) ? 'S' : 'N';
+    out->location.EW        = (lon < 0) ? 'W' : 'E';
+    out->location.padding   = 0;
+    out->age_ms             = (uint32_t)age;
+    out->error_mm           = predictError(p, (uint32_t)age, s.speed_mm_s);
+
+    return ret;
+}
@@ -0,0 +1,61 @@
+/*
+ * gps_predict.h
+ *
+ * Header file for high-rate position prediction between GNSS epochs
+ */
+
+#ifndef INC_GPS_PREDICT_H_
+#define INC_GPS_PREDICT_H_
+
+#include <stdint.h>
+#include "NMEA.h"
+
+/* default tuning, every value can be changed after initPredictor() */
+#define PREDICT_BASE_ERROR_MM     2500      // error of the fix itself (1 sigma)
+#define PREDICT_SPEED_ERROR_MM_S  100       // speed uncertainty
+#define PREDICT_ACCEL_MM_S2       2000      // assumed worst acceleration (~0.2 g)
+#define PREDICT_MAX_HORIZON_MS    10000     // do not extrapolate further than this
+
+// One published state: everything a query needs, precomputed at the fix
+typedef struct
+{
+    int32_t     latitude;       // degrees * GPS_COORD_SCALE at ref_tick
+    int32_t     longitude;      // degrees * GPS_COORD_SCALE at ref_tick
+    int32_t     v_lat;          // latitude  units per ms, Q24
+    int32_t     v_lon;          // longitude units per ms, Q24
+    uint32_t    ref_tick;       // local tick (ms) at which the fix was valid
+    uint32_t    speed_mm_s;     // ground speed, used for error growth
+    uint8_t     valid;          // 0 until the first valid fix
+} PREDICTSLOT;
+
+// PREDICTOR: single writer (decoder), any number of readers (ISR / tasks)
+typedef struct
+{
+    PREDICTSLOT         slot[2];        // double buffer, slot[seq & 1] is the live one
+    volatile uint32_t   seq;            // incremented after each publish
+
+    uint32_t    latency_ms;             // fixed receiver latency (fix -> first byte)
+    uint32_t    offset_min;             // lower envelope of (rx tick - UTC ms of day)
+    uint8_t     offset_valid;
+
+    uint32_t    base_error_mm;
+    uint32_t    speed_error_mm_s;
+    uint32_t    accel_mm_s2;
+    uint32_t    max_horizon_ms;
+} PREDICTOR;
+
+// PREDICTION returned by predictPosition
+typedef struct
+{
+    LOCATION    location;       // extrapolated position
+    uint32_t    error_mm;       // estimated error bound at the queried instant
+    uint32_t    age_ms;         // time since the fix was valid
+} PREDICTION;
+
+// Public function declarations
+void initPredictor(PREDICTOR *p);
+void updatePredictor(PREDICTOR *p, const GPSSTRUCT *gps, uint32_t rx_tick_ms);
+int  predictPosition(const PREDICTOR *p, uint32_t now_tick_ms, PREDICTION *out);
+uint32_t predictError(const PREDICTOR *p, uint32_t age_ms, uint32_t speed_mm_s);
+
+#endif /* INC_GPS_PREDICT_H_ */
@@ -0,0 +1,454 @@
+/*
+ * gps_project.c - WGS84 <-> UTM conversion and a fixed-point local grid.
+ * The projection uses the Snyder series (USGS PP 1395, eq. 8-9 to 8-25)
+ * with the meridian arc in powers of the third flattening n; it needs
+ * one sine/cosine pair per point, computed with polynomials, so there is
+ * no libm call and the same kernel runs on 4 points at a time with AVX2.
+ * The local grid is a quadratic expansion of the UTM zone around an
+ * origin: after initGrid() a point costs a few integer multiplications.
+ */
+
+#include "gps_project.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GPS_PROJECT_X86
+#endif
+
+// WGS84
+#define WGS84_A         6378137.0
+#define WGS84_E2        0.0066943799901413165          // f (2 - f)
+#define WGS84_EP2       0.0067394967422764341          // e2 / (1 - e2)
+#define WGS84_N         0.0016792203863837047          // f / (2 - f)
+#define UTM_K0          0.9996
+
+#define PI              3.14159265358979323846
+#define UDEG_TO_RAD     (PI / 180.0 / GPS_COORD_SCALE)
+#define RAD_TO_UDEG     (180.0 * GPS_COORD_SCALE / PI)
+
+// rectifying radius and the meridian arc series, n^4 terms (error < 1 µm)
+#define ARC_A           (WGS84_A / (1 + WGS84_N) * (1 + WGS84_N * WGS84_N / 4 + WGS84_N * WGS84_N * WGS84_N * WGS84_N / 64))
+#define ARC_2           (-3.0 * WGS84_N / 2 + 9.0 * WGS84_N * WGS84_N * WGS84_N / 16)
+#define ARC_4           (15.0 * WGS84_N * WGS84_N / 16 - 15.0 * WGS84_N * WGS84_N * WGS84_N * WGS84_N / 32)
+#define ARC_6           (-35.0 * WGS84_N * WGS84_N * WGS84_N / 48)
+#define ARC_8           (315.0 * WGS84_N * WGS84_N * WGS84_N * WGS84_N / 512)
+
+// footpoint latitude (inverse of the arc series)
+#define FOOT_2          (3.0 * WGS84_N / 2 - 27.0 * WGS84_N * WGS84_N * WGS84_N / 32)
+#define FOOT_4          (21.0 * WGS84_N * WGS84_N / 16 - 55.0 * WGS84_N * WGS84_N * WGS84_N * WGS84_N / 32)
+#define FOOT_6          (151.0 * WGS84_N * WGS84_N * WGS84_N / 96)
+#define FOOT_8          (1097.0 * WGS84_N * WGS84_N * WGS84_N * WGS84_N / 512)
+
+#define GRID_STEP       10000                           // µdeg, finite difference step of initGrid
+
+
+/*
+ * UTM_KERNEL - Forward projection of one latitude / longitude offset (radians)
+ * from the central meridian, without false easting / northing.
+ * Arithmetic only, instantiated for double and for a 4 x double vector.
+ *
+ */
+#define UTM_KERNEL(NAME, T, ATTR)                                                                   \
+ATTR static inline void NAME(T phi, T dl, T *east, T *north)                                        \
+{                                                                                                   \
+    /* sin / cos of phi / 2 (|phi / 2| < pi / 4): Taylor to the 17th / 16th power, error < 1e-17 */ \
+    T h  = phi * 0.5;                                                                               \
+    T h2 = h * h;                                                                                   \
+    T sh = h * (1.0 + h2 * (-1.0 / 6 + h2 * (1.0 / 120 + h2 * (-1.0 / 5040 + h2 * (1.0 / 362880 +  \
+               h2 * (-1.0 / 39916800 + h2 * (1.0 / 6227020800.0 + h2 * (-1.0 / 1307674368000.0 +    \
+               h2 * (1.0 / 355687428096000.0)))))))));                                              \
+    T ch = 1.0 + h2 * (-1.0 / 2 + h2 * (1.0 / 24 + h2 * (-1.0 / 720 + h2 * (1.0 / 40320 +           \
+               h2 * (-1.0 / 3628800 + h2 * (1.0 / 479001600 + h2 * (-1.0 / 87178291200.0 +          \
+               h2 * (1.0 / 20922789888000.0))))))));                                                \
+                                                                                                    \
+    T s  = 2.0 * sh * ch;                                                                           \
+    T c  = ch * ch - sh * sh;                                                                       \
+    T s2 = 2.0 * s * c,        c2 = c * c - s * s;                                                  \
+    T s4 = 2.0 * s2 * c2,      c4 = c2 * c2 - s2 * s2;                                              \
+    T s6 = s4 * c2 + c4 * s2,  s8 = 2.0 * s4 * c4;                                                  \
+                                                                                                    \
+    /* N = a / sqrt(1 - e2 sin^2): binomial series, e2 sin^2 < 0.0067 */                            \
+    T x  = WGS84_E2 * s * s;                                                                        \
+    T n  = WGS84_A * (1.0 + x * (1.0 / 2 + x * (3.0 / 8 + x * (5.0 / 16 + x * (35.0 / 128 +         \
+               x * (63.0 / 256 + x * (231.0 / 1024 + x * (429.0 / 2048))))))));                      \
+    T m  = ARC_A * (phi + ARC_2 * s2 + ARC_4 * s4 + ARC_6 * s6 + ARC_8 * s8);                       \
+                                                                                                    \
+    T t  = s / c;                                                                                   \
+    T tt = t * t;                                                                                   \
+    T cc = WGS84_EP2 * c * c;                                                                       \
+    T a  = dl * c;                                                                                  \
+    T a2 = a * a;                                                                                   \
+                                                                                                    \
+    *east  = UTM_K0 * n * (a + a * a2 * ((1.0 - tt + cc) * (1.0 / 6) +                              \
+             a2 * (5.0 - 18.0 * tt + tt * tt + 72.0 * cc - 58.0 * WGS84_EP2) * (1.0 / 120)));       \
+    *north = UTM_K0 * (m + n * t * a2 * (0.5 + a2 * ((5.0 - tt + 9.0 * cc + 4.0 * cc * cc) *        \
+             (1.0 / 24) + a2 * (61.0 - 58.0 * tt + tt * tt + 600.0 * cc - 330.0 * WGS84_EP2) *      \
+             (1.0 / 720))));                                                                        \
+}
+
+UTM_KERNEL(utm_kernel, double, )
+
+#ifdef GPS_PROJECT_X86
+typedef double v4d __attribute__((vector_size(32)));
+
+UTM_KERNEL(utm_kernel_v4, v4d, __attribute__((target("avx2"))))
+#endif
+
+
+/*
+ * sincos_poly - sine and cosine of |x| <= pi / 2 with the kernel's polynomials.
+ *
+ */
+static void sincos_poly(double x, double *s, double *c)
+{
+    double h  = x * 0.5;
+    double h2 = h * h;
+    double sh = h * (1.0 + h2 * (-1.0 / 6 + h2 * (1.0 / 120 + h2 * (-1.0 / 5040 + h2 * (1.0 / 362880 +
+                h2 * (-1.0 / 39916800 + h2 * (1.0 / 6227020800.0 + h2 * (-1.0 / 1307674368000.0 +
+                h2 * (1.0 / 355687428096000.0)))))))));
+    double ch = 1.0 + h2 * (-1.0 / 2 + h2 * (1.0 / 24 + h2 * (-1.0 / 720 + h2 * (1.0 / 40320 +
+                h2 * (-1.0 / 3628800 + h2 * (1.0 / 479001600 + h2 * (-1.0 / 87178291200.0 +
+                h2 * (1.0 / 20922789888000.0))))))));
+
+    *s = 2.0 * sh * ch;
+    *c = ch * ch - sh * sh;
+}
+
+static int32_t round_udeg(double rad)
+{
+    double v = rad * RAD_TO_UDEG;
+
+    return (int32_t)(v >= 0 ? v + 0.5 : v - 0.5);
+}
+
+static double central_meridian(uint8_t zone)
+{
+    return (double)(zone * 6 - 183) * GPS_COORD_SCALE * UDEG_TO_RAD;
+}
+
+
+/*
+ * utmZone - UTM zone of a position (degrees * GPS_COORD_SCALE), with the
+ * Norway and Svalbard exceptions; 0 outside 80°S..84°N.
+ *
+ */
+uint8_t utmZone(int32_t latitude, int32_t longitude)
+{
+    const int32_t D = GPS_COORD_SCALE;
+
+    if (latitude < UTM_MIN_LATITUDE || latitude > UTM_MAX_LATITUDE) return 0;
+
+    int64_t lon = (int64_t)longitude + 180 * D;                 // 0..360°
+    lon %= 360 * (int64_t)D;
+    if (lon < 0) lon += 360 * (int64_t)D;
+
+    uint8_t zone = (uint8_t)(lon / (6 * D) + 1);
+    int32_t l    = (int32_t)(lon - 180 * D);
+
+    if (latitude >= 56 * D && latitude < 64 * D && l >= 3 * D && l < 12 * D) return 32;
+    if (latitude >= 72 * D && l >= 0 && l < 42 * D)
+    {
+        if (l <  9 * D) return 31;
+        if (l < 21 * D) return 33;
+        if (l < 33 * D) return 35;
+        return 37;
+    }
+    return zone;
+}
+
+/*
+ * locationToUTMZone - Projects into a given zone (neighbouring zones are
+ * fine for points just across the border, accuracy drops with distance).
+ *
+ */
+int locationToUTMZone(const LOCATION *loc, uint8_t zone, UTMCOORD *utm)
+{
+    if (!loc || !utm || zone < 1 || zone > 60) return -1;
+
+    double dl = (double)loc->longitude * UDEG_TO_RAD - central_meridian(zone);
+
+    if (dl >  PI) dl -= 2 * PI;
+    if (dl < -PI) dl += 2 * PI;
+
+    utm_kernel((double)loc->latitude * UDEG_TO_RAD, dl, &utm->easting, &utm->northing);
+
+    utm->easting   += UTM_FALSE_EASTING;
+    utm->hemisphere = (loc->latitude < 0) ? 'S' : 'N';
+    if (loc->latitude < 0) utm->northing += UTM_FALSE_NORTHING;
+    utm->zone = zone;
+
+    return 0;
+}
+
+/*
+ * locationToUTM - Projects a position into its own UTM zone.
+ *
+ */
+int locationToUTM(const LOCATION *loc, UTMCOORD *utm)
+{
+    if (!loc || !utm) return -1;
+
+    uint8_t zone = utmZone(loc->latitude, loc->longitude);
+
+    if (zone == 0)
+    {
+        memset(utm, 0, sizeof(UTMCOORD));
+        return -1;
+    }
+    return locationToUTMZone(loc, zone, utm);
+}
+
+/*
+ * utmToLocation - Inverse projection (footpoint latitude series).
+ *
+ */
+int utmToLocation(const UTMCOORD *utm, LOCATION *loc)
+{
+    if (!utm || !loc || utm->zone < 1 || utm->zone > 60) return -1;
+
+    double y  = (utm->hemisphere == 'S') ? utm->northing - UTM_FALSE_NORTHING : utm->northing;
+    double mu = y / (UTM_K0 * ARC_A);
+    double s, c;
+
+    sincos_poly(mu, &s, &c);
+
+    double s2 = 2 * s * c,        c2 = c * c - s * s;
+    double s4 = 2 * s2 * c2,      c4 = c2 * c2 - s2 * s2;
+    double s6 = s4 * c2 + c4 * s2, s8 = 2 * s4 * c4;
+    double phi1 = mu + FOOT_2 * s2 + FOOT_4 * s4 + FOOT_6 * s6 + FOOT_8 * s8;
+
+    sincos_poly(phi1, &s, &c);
+
+    double x  = WGS84_E2 * s * s;
+    double n1 = WGS84_A * (1.0 + x * (1.0 / 2 + x * (3.0 / 8 + x * (5.0 / 16 + x * (35.0 / 128 +
+                x * (63.0 / 256 + x * (231.0 / 1024 + x * (429.0 / 2048))))))));
+    double t1 = s / c;
+    double tt = t1 * t1;
+    double cc = WGS84_EP2 * c * c;
+    double d  = (utm->easting - UTM_FALSE_EASTING) / (n1 * UTM_K0);
+    double d2 = d * d;
+
+    // N1 / R1 = (1 - e2 sin^2) / (1 - e2)
+    double phi = phi1 - t1 * (1.0 - x) / (1.0 - WGS84_E2) * d2 * (0.5 - d2 * ((5.0 + 3.0 * tt + 10.0 * cc -
+                 4.0 * cc * cc - 9.0 * WGS84_EP2) / 24 - d2 * (61.0 + 90.0 * tt + 298.0 * cc + 45.0 * tt * tt -
+                 252.0 * WGS84_EP2 - 3.0 * cc * cc) / 720));
+    double lam = (d - d * d2 * ((1.0 + 2.0 * tt + cc) / 6 - d2 * (5.0 - 2.0 * cc + 28.0 * tt - 3.0 * cc * cc +
+                 8.0 * WGS84_EP2 + 24.0 * tt * tt) / 120)) / c;
+
+    loc->latitude  = round_udeg(phi);
+    loc->longitude = round_udeg(lam + central_meridian(utm->zone));
+    if (loc->longitude >   180 * GPS_COORD_SCALE) loc->longitude -= 360 * GPS_COORD_SCALE;
+    if (loc->longitude <= -180 * GPS_COORD_SCALE) loc->longitude += 360 * GPS_COORD_SCALE;
+    loc->NS        = (loc->latitude < 0) ? 'S' : 'N';
+    loc->EW        = (loc->longitude < 0) ? 'W' : 'E';
+
+    return 0;
+}
+
+
+#ifdef GPS_PROJECT_X86
+/* 4 points per step; returns how many points were done (a multiple of 4) */
+__attribute__((target("avx2")))
+static int batch_avx2(const LOCATION *loc, UTMCOORD *utm, int count, uint8_t zone)
+{
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        double  lat[4], dl[4], e[4], n[4];
+        uint8_t z[4];
+        v4d     ve, vn;
+
+        for (int k = 0; k < 4; k++)
+        {
+            z[k]   = zone ? zone : utmZone(loc[i + k].latitude, loc[i + k].longitude);
+            lat[k] = (double)loc[i + k].latitude * UDEG_TO_RAD;
+            dl[k]  = (double)loc[i + k].longitude * UDEG_TO_RAD - central_meridian(z[k] ? z[k] : 31);
+            if (dl[k] >  PI) dl[k] -= 2 * PI;
+            if (dl[k] < -PI) dl[k] += 2 * PI;
+        }
+
+        v4d vlat, vdl;
+        memcpy(&vlat, lat, sizeof(vlat));
+        memcpy(&vdl, dl, sizeof(vdl));
+        utm_kernel_v4(vlat, vdl, &ve, &vn);
+        memcpy(e, &ve, sizeof(e));
+        memcpy(n, &vn, sizeof(n));
+
+        for (int k = 0; k < 4; k++)
+        {
+            UTMCOORD *u = &utm[i + k];
+
+            u->easting    = e[k] + UTM_FALSE_EASTING;
+            u->northing   = (loc[i + k].latitude < 0) ? n[k] + UTM_FALSE_NORTHING : n[k];
+            u->hemisphere = (loc[i + k].latitude < 0) ? 'S' : 'N';
+            u->zone       = z[k];
+        }
+    }
+    return i;
+}
+#endif
+
+/*
+ * locationToUTMBatch - Projects count positions, each into its own zone
+ * (zone 0) or all into the given zone. Points outside UTM get zone 0.
+ *
+ */
+void locationToUTMBatch(const LOCATION *loc, UTMCOORD *utm, int count, uint8_t zone)
+{
+    int i = 0;
+
+#ifdef GPS_PROJECT_X86
+    static int has_avx2 = -1;
+
+    if (has_avx2 < 0)
+    {
+        __builtin_cpu_init();
+        has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    if (has_avx2) i = batch_avx2(loc, utm, count, zone);
+#endif
+
+    for (; i < count; i++)
+    {
+        uint8_t z = zone ? zone : utmZone(loc[i].latitude, loc[i].longitude);
+
+        locationToUTMZone(&loc[i], z ? z : 31, &utm[i]);
+        utm[i].zone = z;
+    }
+}
+
+
+/*************************************** Local Grid ***************************************/
+
+static int32_t to_fixed(double v, int shift)
+{
+    v *= (double)(1LL << shift);
+    return (int32_t)(v >= 0 ? v + 0.5 : v - 0.5);
+}
+
+/*
+ * initGrid - Builds the quadratic expansion of the origin's UTM zone.
+ * Uses floating point once; gridProject / gridUnproject are integer only.
+ *
+ */
+int initGrid(GRIDORIGIN *g, const LOCATION *origin)
+{
+    UTMCOORD  f[3][3];
+    LOCATION  p;
+    double    h = GRID_STEP;
+
+    if (!g || !origin) return -1;
+
+    memset(g, 0, sizeof(GRIDORIGIN));
+    g->origin = *origin;
+    if (locationToUTM(origin, &g->origin_utm) != 0) return -1;
+
+    // UTM of the 3 x 3 neighbourhood, in the origin's zone
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            p           = *origin;
+            p.latitude  = origin->latitude  + (i - 1) * GRID_STEP;
+            p.longitude = origin->longitude + (j - 1) * GRID_STEP;
+            locationToUTMZone(&p, g->origin_utm.zone, &f[i][j]);
+        }
+    }
+
+    // central differences, metres -> mm
+    g->e_lat = to_fixed((f[2][1].easting  - f[0][1].easting)  * 1000.0 / (2 * h), 16);
+    g->e_lon = to_fixed((f[1][2].easting  - f[1][0].easting)  * 1000.0 / (2 * h), 16);
+    g->n_lat = to_fixed((f[2][1].northing - f[0][1].northing) * 1000.0 / (2 * h), 16);
+    g->n_lon = to_fixed((f[1][2].northing - f[1][0].northing) * 1000.0 / (2 * h), 16);
+
+    // second order terms already carry the 1/2 of the Taylor expansion
+    g->e2[0] = to_fixed((f[2][1].easting - 2 * f[1][1].easting + f[0][1].easting) * 1000.0 / (2 * h * h), 40);
+    g->e2[1] = to_fixed((f[2][2].easting - f[2][0].easting - f[0][2].easting + f[0][0].easting) * 1000.0 / (4 * h * h), 40);
+    g->e2[2] = to_fixed((f[1][2].easting - 2 * f[1][1].easting + f[1][0].easting) * 1000.0 / (2 * h * h), 40);
+    g->n2[0] = to_fixed((f[2][1].northing - 2 * f[1][1].northing + f[0][1].northing) * 1000.0 / (2 * h * h), 40);
+    g->n2[1] = to_fixed((f[2][2].northing - f[2][0].northing - f[0][2].northing + f[0][0].northing) * 1000.0 / (4 * h * h), 40);
+    g->n2[2] = to_fixed((f[1][2].northing - 2 * f[1][1].northing + f[1][0].northing) * 1000.0 / (2 * h * h), 40);
+
+    g->det = ((int64_t)g->e_lat * g->n_lon - (int64_t)g->e_lon * g->n_lat) >> 16;
+
+    return 0;
+}
+
+static void grid_forward(const GRIDORIGIN *g, int32_t dlat, int32_t dlon, int64_t *e, int64_t *n)
+{
+    int64_t aa = (int64_t)dlat * dlat;
+    int64_t ab = (int64_t)dlat * dlon;
+    int64_t bb = (int64_t)dlon * dlon;
+
+    *e = (((int64_t)g->e_lat * dlat + (int64_t)g->e_lon * dlon) >> 16) +
+         ((aa * g->e2[0] + ab * g->e2[1] + bb * g->e2[2]) >> 40);
+    *n = (((int64_t)g->n_lat * dlat + (int64_t)g->n_lon * dlon) >> 16) +
+         ((aa * g->n2[0] + ab * g->n2[1] + bb * g->n2[2]) >> 40);
+}
+
+/*
+ * gridProject - Position -> mm east / north of the grid origin.
+ * @return  0, 1 if the point is further than GRID_RADIUS (computed, but
+ *          less accurate: build a new origin), -1 on error.
+ *
+ */
+int gridProject(const GRIDORIGIN *g, const LOCATION *loc, GRIDPOINT *out)
+{
+    if (!g || !loc || !out || g->det == 0) return -1;
+
+    int32_t dlat = loc->latitude  - g->origin.latitude;
+    int32_t dlon = loc->longitude - g->origin.longitude;
+    int     far  = (dlat > GRID_RADIUS || dlat < -GRID_RADIUS || dlon > GRID_RADIUS || dlon < -GRID_RADIUS);
+    int64_t e, n;
+
+    if (far)
+    {
+        // keep the products inside int64, the answer is only indicative anyway
+        if (dlat >  2 * GRID_RADIUS) dlat =  2 * GRID_RADIUS;
+        if (dlat < -2 * GRID_RADIUS) dlat = -2 * GRID_RADIUS;
+        if (dlon >  2 * GRID_RADIUS) dlon =  2 * GRID_RADIUS;
+        if (dlon < -2 * GRID_RADIUS) dlon = -2 * GRID_RADIUS;
+    }
+
+    grid_forward(g, dlat, dlon, &e, &n);
+    out->east_mm  = (int32_t)e;
+    out->north_mm = (int32_t)n;
+
+    return far;
+}
+
+/*
+ * gridUnproject - mm east / north of the grid origin -> position.
+ * Inverts the linear part, then two Newton steps on the quadratic.
+ *
+ */
+int gridUnproject(const GRIDORIGIN *g, const GRIDPOINT *pt, LOCATION *out)
+{
+    if (!g || !pt || !out || g->det == 0) return -1;
+
+    int32_t dlat = 0, dlon = 0;
+
+    for (int it = 0; it < 3; it++)
+    {
+        int64_t e, n;
+
+        grid_forward(g, dlat, dlon, &e, &n);
+        e = pt->east_mm  - e;
+        n = pt->north_mm - n;
+
+        // [dlat dlon] += J^-1 [e n], J in Q16, det in Q16
+        dlat += (int32_t)(((int64_t)g->n_lon * e - (int64_t)g->e_lon * n) / g->det);
+        dlon += (int32_t)(((int64_t)g->e_lat * n - (int64_t)g->n_lat * e) / g->det);
+
+        if (dlat > 2 * GRID_RADIUS || dlat < -2 * GRID_RADIUS || dlon > 2 * GRID_RADIUS || dlon < -2 * GRID_RADIUS) break;
+    }
+
+    out->latitude  = g->origin.latitude  + dlat;
+    out->longitude = g->origin.longitude + dlon;
+    out->NS        = (out->latitude < 0) ? 'S' : 'N';
+    out->EW        = (out->longitude < 0) ? 'W' : 'E';
+    out->padding   = 0;
+
+    return (dlat > GRID_RADIUS || dlat < -GRID_RADIUS || dlon > GRID_RADIUS || dlon < -GRID_RADIUS) ? 1 : 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * gps_project.h
+ *
+ * Header file for WGS84 -> UTM projection and a fixed-point local grid
+ */
+
+#ifndef INC_GPS_PROJECT_H_
+#define INC_GPS_PROJECT_H_
+
+#include <stdint.h>
+#include "NMEA.h"
+
+#define UTM_MIN_LATITUDE        (-80 * GPS_COORD_SCALE)
+#define UTM_MAX_LATITUDE        (84 * GPS_COORD_SCALE)
+#define UTM_FALSE_EASTING       500000.0            // m
+#define UTM_FALSE_NORTHING      10000000.0          // m, southern hemisphere
+
+#define GRID_RADIUS             50000               // µdeg (~5 km) around the origin, error < 5 mm inside
+
+// UTMCOORD: metres in the zone's grid
+typedef struct
+{
+    double      easting;
+    double      northing;
+    uint8_t     zone;               // 1..60, 0 = outside UTM (polar regions)
+    char        hemisphere;         // 'N' or 'S'
+} UTMCOORD;
+
+// GRIDPOINT: position relative to a GRIDORIGIN, UTM axes, fixed point
+typedef struct
+{
+    int32_t     east_mm;
+    int32_t     north_mm;
+} GRIDPOINT;
+
+// GRIDORIGIN: quadratic expansion of the origin's UTM zone, integer only once built
+typedef struct
+{
+    LOCATION    origin;
+    UTMCOORD    origin_utm;         // add a GRIDPOINT / 1000 to get UTM metres
+    int32_t     e_lat, e_lon;       // d east  / d µdeg, mm Q16
+    int32_t     n_lat, n_lon;       // d north / d µdeg, mm Q16
+    int32_t     e2[3];              // d² east  / (d lat², d lat d lon, d lon²), mm per µdeg² Q40
+    int32_t     n2[3];              // d² north, same
+    int64_t     det;                // e_lat * n_lon - e_lon * n_lat, Q16 (for the inverse)
+} GRIDORIGIN;
+
+// Public function declarations
+uint8_t utmZone(int32_t latitude, int32_t longitude);
+int  locationToUTM(const LOCATION *loc, UTMCOORD *utm);
+int  locationToUTMZone(const LOCATION *loc, uint8_t zone, UTMCOORD *utm);
+int  utmToLocation(const UTMCOORD *utm, LOCATION *loc);
+void locationToUTMBatch(const LOCATION *loc, UTMCOORD *utm, int count, uint8_t zone);
+
+int  initGrid(GRIDORIGIN *g, const LOCATION *origin);
+int  gridProject(const GRIDORIGIN *g, const LOCATION *loc, GRIDPOINT *out);
+int  gridUnproject(const GRIDORIGIN *g, const GRIDPOINT *pt, LOCATION *out);
+
+#endif /* INC_GPS_PROJECT_H_ */
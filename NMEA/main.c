@@ -1,13 +1,40 @@
-/* main.c ---> for tests */
+/* main.c ---> for tests
+ *
+ *   out_NMEA [dlog-file]
+ *
+ * With a file name the deferred log is written there (decode it with
+ * GATEWAY/dlog_tool); without one nothing is written.
+ */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
 #include "NMEA.h"
+#include "gps_predict.h"
+#include "gps_project.h"
+#include "gps_power.h"
+#include "gps_dlog.h"
+#include "gps_ais.h"
 
 
-int main(void)
+static int powerCommands = 0;
+
+static void countCommand(const char *sentence)
+{
+    (void)sentence;
+    powerCommands++;
+}
+
+static FILE *dlogFile;
+
+static int writeLog(const unsigned char *data, int len)
+{
+    return (int)fwrite(data, 1, (size_t)len, dlogFile);
+}
+
+
+int main(int argc, char **argv)
 {
     // Example NMEA sentences
     char ggaSentence[] = "$GPGGA,123456.00,3749.1234,N,12225.5678,W,1,08,1.0,15.6,M,,,*47";
@@ -33,7 +60,9 @@ int main(void)
         printf("  Longitude: %d (East/West: %c)\n", ggaData.location.longitude, ggaData.location.EW);
         printf("  Altitude: %d mm (%c)\n", ggaData.altitude.altitude, ggaData.altitude.unit);
         printf("  Number of satellites: %d\n", ggaData.numsat);
+        printf("  HDOP: %d (x100)\n", ggaData.hdop);
         printf("  Fix valid: %s\n", ggaData.is_fix_valid ? "Yes" : "No");
+        printf("  Present fields: 0x%03X\n", ggaData.present);
     }
     else
     {
@@ -48,6 +77,7 @@ int main(void)
         printf("  Speed: %d knots (x1000)\n", rmcData.speed_knots);
         printf("  Course: %d degrees (x100)\n", rmcData.course);
         printf("  Data valid: %s\n", rmcData.is_data_valid ? "Yes" : "No");
+        printf("  Present fields: 0x%03X\n", rmcData.present);
     }
     else
     {
@@ -76,6 +106,151 @@ int main(void)
     int32_t fixedValue = nmea_atof_fixed(nmeaNumber, 1000000);
     printf("\nConverting string '%s' to fixed-point representation: %d\n", nmeaNumber, fixedValue);
 
+    // Testing decodeGGAIncremental (stationary receiver: only the time changes)
+    char ggaStream[3][80] =
+    {
+        "$GPGGA,123456.00,3749.1234,N,12225.5678,W,1,08,1.0,15.6,M,,,*47",
+        "$GPGGA,123456.10,3749.1234,N,12225.5678,W,1,08,1.0,15.6,M,,,*46",
+        "$GPGGA,123456.20,3749.1235,N,12225.5678,W,1,08,1.0,15.6,M,,,*44",
+    };
+    NMEA_HISTORY ggaHistory;
+    GGASTRUCT    ggaIncremental;
+
+    initHistory(&ggaHistory);
+    memset(&ggaIncremental, 0, sizeof(ggaIncremental));
+    for (int i = 0; i < 3; i++)
+    {
+        decodeGGAIncremental(ggaStream[i], &ggaIncremental, &ggaHistory);
+    }
+    printf("\nIncremental GGA decoding of 3 sentences:\n");
+    printf("  Time: %02d:%02d:%02d.%02d  Latitude: %d\n", DECODE_HOUR(ggaIncremental.time.time),
+           DECODE_MIN(ggaIncremental.time.time), DECODE_SEC(ggaIncremental.time.time),
+           DECODE_CSEC(ggaIncremental.time.time), ggaIncremental.location.latitude);
+    printf("  Fields converted: %u  reused: %u\n", ggaHistory.converted, ggaHistory.reused);
+
+    // Testing predictPosition (synthetic fix: 10 knots due east, received at tick 1000)
+    PREDICTOR  predictor;
+    PREDICTION prediction;
+    GPSSTRUCT  fix;
+
+    initGPS(&fix);
+    fix.ggastruct.location.latitude  = 37818723;     // 37.818723°
+    fix.ggastruct.location.longitude = -122478224;   // -122.478224°
+    fix.ggastruct.is_fix_valid       = 1;
+    fix.rmcstruct.is_data_valid      = 1;
+    fix.rmcstruct.speed_knots        = 10000;        // 10 knots
+    fix.rmcstruct.course             = 9000;         // 90.00°
+    fix.ggastruct.present            = GPS_HAS_POSITION | GPS_HAS_FIX;
+    fix.rmcstruct.present            = GPS_HAS_STATUS | GPS_HAS_SPEED | GPS_HAS_COURSE;
+
+    initPredictor(&predictor);
+    updatePredictor(&predictor, &fix, 1000);
+    if (predictPosition(&predictor, 1500, &prediction) >= 0)
+    {
+        printf("\nPredicted position 500 ms after the fix:\n");
+        printf("  Latitude: %d  Longitude: %d\n", prediction.location.latitude, prediction.location.longitude);
+        printf("  Age: %u ms  Error: %u mm\n", prediction.age_ms, prediction.error_mm);
+    }
+    else
+    {
+        printf("Error predicting position.\n");
+    }
+
+    // Testing locationToUTM / local grid (Golden Gate Bridge, zone 10N)
+    UTMCOORD   utm;
+    GRIDORIGIN grid;
+    GRIDPOINT  gridPoint;
+    LOCATION   back;
+
+    if (locationToUTM(&fix.ggastruct.location, &utm) == 0 && utmToLocation(&utm, &back) == 0)
+    {
+        printf("\nUTM of the predictor fix:\n");
+        printf("  Zone %u%c  E %.3f m  N %.3f m\n", utm.zone, utm.hemisphere, utm.easting, utm.northing);
+        printf("  Back: %d, %d\n", back.latitude, back.longitude);
+    }
+    if (initGrid(&grid, &fix.ggastruct.location) == 0 &&
+        gridProject(&grid, &prediction.location, &gridPoint) == 0)
+    {
+        printf("  Predicted position on the local grid: %d mm E, %d mm N\n", gridPoint.east_mm, gridPoint.north_mm);
+    }
+
+    // Testing the power manager on a virtual clock: 10 min driving, then parked for 3 h,
+    // with a report due 2 h after the stop (the simulated receiver needs 1.5 s for a hot fix)
+    POWER_MANAGER power;
+    GPSSTRUCT     epoch = fix;
+    uint32_t      nextFix = 0;
+
+    initPower(&power, 0);
+    power.send = countCommand;
+    for (uint32_t now = 0; now < 11400000; now += 100)
+    {
+        if (now == 2400000) powerRequestFix(&power, 8400000);
+
+        int receiverOn = (power.mode == POWER_CONTINUOUS || power.mode == POWER_LOWRATE ||
+                          (power.mode == POWER_WAKING && now - power.mode_tick >= 1500));
+        uint32_t period = (power.mode == POWER_LOWRATE) ? power.lowrate_ms : 1000;
+
+        if (receiverOn && now >= nextFix)
+        {
+            epoch.rmcstruct.speed_knots = (now < 600000) ? 20000 : 0;
+            powerFix(&power, &epoch, now);
+            nextFix = now + period;
+        }
+        powerPoll(&power, now);
+    }
+    printf("\nPower manager, 3 h 10 min of virtual time:\n");
+    printf("  Continuous %u s  Low rate %u s  Backup %u s  Waking %u s\n",
+           power.time_in[POWER_CONTINUOUS] / 1000, power.time_in[POWER_LOWRATE] / 1000,
+           power.time_in[POWER_BACKUP] / 1000, power.time_in[POWER_WAKING] / 1000);
+    printf("  Wakes: %u  Missed deadlines: %u  Commands: %d\n", power.wakes, power.missed, powerCommands);
+    printf("  Saved: %u uAh\n", powerSavedUAh(&power, 11400000));
+
+    // Testing decodeAIS: a class A position report and a two sentence static data message
+    const char *aisStream[] =
+    {
+        "!AIVDM,1,1,,B,177KQJ5000G?tO`K>RA1wUbN0TKH,0*5C",
+        "!AIVDM,2,1,1,A,55?MbV02;H;s<HtKR20EHE:0@T4@Dn2222222216L961O5Gf0NSQEp6ClRp8,0*1C",
+        "!AIVDM,2,2,1,A,88888888880,2*25",
+    };
+    AIS_DECODER ais;
+    AIS_MESSAGE aisMessage;
+
+    initAIS(&ais);
+    printf("\nAIS messages:\n");
+    for (int i = 0; i < 3; i++)
+    {
+        if (decodeAIS(&ais, aisStream[i], &aisMessage) != 1) continue;
+
+        printf("  Type %u  MMSI %u\n", aisMessage.type, aisMessage.mmsi);
+        if (aisMessage.has & AIS_HAS_POSITION)
+        {
+            printf("    Latitude: %d  Longitude: %d  Course: %u (x10)\n", aisMessage.position.latitude,
+                   aisMessage.position.longitude, aisMessage.position.course);
+        }
+        if (aisMessage.has & AIS_HAS_STATIC)
+        {
+            printf("    Name: %s  Callsign: %s  Destination: %s\n", aisMessage.statics.name,
+                   aisMessage.statics.callsign, aisMessage.statics.destination);
+        }
+    }
+
+    // The events logged by the decoders and the power manager, only saved when asked for
+    if (argc < 2)
+    {
+        printf("\nDeferred log: %u bytes pending, %u events lost (pass a file name to save them)\n", dlogPending(), dlogLost());
+    }
+    else if ((dlogFile = fopen(argv[1], "wb")) != NULL)
+    {
+        int bytes = dlogFlush(writeLog);
+
+        fclose(dlogFile);
+        printf("\nDeferred log: %d bytes written to %s, %u events lost\n", bytes, argv[1], dlogLost());
+    }
+    else
+    {
+        perror(argv[1]);
+    }
+
     printf("\n==== Tests completed ====\n");
     return 0;
 }
@@ -0,0 +1,197 @@
+/*
+ * bridge_test.c - UART bridge forwarding and filtering on the host shim.
+ *
+ *   bridge_test [sentences]
+ *
+ * A simulated receiver feeds NMEA through Uart_isr in random chunks while
+ * the DMA channel completes transfers at random moments ("interrupt"
+ * context: Bridge_tx_complete). Checked for every mode (no filter, filter
+ * chained from the DMA interrupt, filter deferred to the main loop):
+ *   - the parser still gets the whole stream through the rx ring
+ *   - the forwarded stream is exactly the accepted frames, in order
+ *     (frames longer than BRIDGE_FRAME_MAX are forwarded unfiltered)
+ *   - deferred: the filter never runs in interrupt context
+ * and bytes injected towards the receiver come out of the tx ring intact.
+ */
+
+#include "uart_bridge.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STREAM_MAX  (1 << 20)
+
+extern UART_HandleTypeDef huart1;
+
+uint32_t                host_primask;
+_Thread_local uint32_t  host_ipsr;
+
+static USART_TypeDef    usart, usart2;
+static UART_HandleTypeDef host_port = { &usart2 };
+static UART_BRIDGE      bridge;
+
+static uint8_t          *dma_data;      // transfer in flight
+static uint16_t         dma_len;
+static int              in_isr;
+static unsigned long    filter_calls, filter_isr_calls, dma_errors;
+
+static char             *input, *expect, *parsed, *forwarded;
+static size_t           input_len, expect_len, parsed_len, forwarded_len;
+
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size)
+{
+    if (huart != &host_port || dma_data || size == 0)
+    {
+        dma_errors++;
+        return HAL_BUSY;
+    }
+    dma_data = data;
+    dma_len  = size;
+    return HAL_OK;
+}
+
+/* drop the satellites in view, forward the rest */
+static int no_gsv(const char *frame, int len)
+{
+    filter_calls++;
+    if (in_isr) filter_isr_calls++;
+    return !(len > 6 && memcmp(frame + 3, "GSV", 3) == 0);
+}
+
+static void dma_complete(void)
+{
+    if (!dma_data) return;
+
+    memcpy(forwarded + forwarded_len, dma_data, dma_len);
+    forwarded_len += dma_len;
+    dma_data = NULL;
+
+    in_isr = 1;
+    Bridge_tx_complete(&bridge);
+    in_isr = 0;
+}
+
+static void receive(unsigned char c)
+{
+    usart.SR |= USART_SR_RXNE;
+    usart.DR  = c;
+    Uart_isr(&huart1);
+    usart.SR &= ~(uint32_t)USART_SR_RXNE;
+}
+
+static void make_stream(int sentences, int filtered)
+{
+    static const char *talker[] = { "GPGGA", "GPRMC", "GPGSV", "GPGSA", "GPVTG" };
+
+    input_len = expect_len = 0;
+    for (int i = 0; i < sentences; i++)
+    {
+        char        s[256];
+        const char *t = talker[rand() % 5];
+        int         pad = rand() % 8 == 0 ? 100 + rand() % 60 : rand() % 60;     // some longer than a frame
+        int         len = sprintf(s, "$%s,%d,", t, i);
+
+        memset(s + len, 'a' + i % 26, (size_t)pad);
+        len += pad;
+        len += sprintf(s + len, "*%02X\r\n", i & 0xFF);
+
+        memcpy(input + input_len, s, (size_t)len);
+        input_len += (size_t)len;
+        if (!filtered || len > BRIDGE_FRAME_MAX || strcmp(t, "GPGSV") != 0)
+        {
+            memcpy(expect + expect_len, s, (size_t)len);
+            expect_len += (size_t)len;
+        }
+    }
+}
+
+static int run(const char *what, bridge_filter filter, int deferred, int sentences)
+{
+    size_t fed = 0;
+    int    c, ok;
+
+    make_stream(sentences, filter != NULL);
+    parsed_len = forwarded_len = 0;
+    filter_calls = filter_isr_calls = dma_errors = 0;
+
+    Uart_flush();
+    Bridge_init(&bridge, &host_port, filter);
+    bridge.deferred = (uint8_t)deferred;
+
+    while (fed < input_len || dma_data || bridge.ring.head != bridge.ring.tail)
+    {
+        size_t chunk = 1 + (size_t)(rand() % 64);
+
+        if (chunk > input_len - fed) chunk = input_len - fed;
+        for (size_t i = 0; i < chunk; i++) receive((unsigned char)input[fed++]);
+
+        while ((c = Uart_read()) >= 0) parsed[parsed_len++] = (char)c;
+
+        Bridge_pump(&bridge);
+
+        // the DMA is slower than the line at times, but never so slow that the ring overflows
+        unsigned int pending = (UART_BUFFER_SIZE + bridge.ring.head - bridge.ring.tail) % UART_BUFFER_SIZE;
+        if (rand() % 3 == 0 || pending > UART_BUFFER_SIZE / 2 || fed == input_len) dma_complete();
+    }
+    Bridge_stop(&bridge);
+
+    ok = parsed_len == input_len && memcmp(parsed, input, input_len) == 0 &&
+         forwarded_len == expect_len && memcmp(forwarded, expect, expect_len) == 0 &&
+         bridge.forwarded == expect_len && dma_errors == 0 && (!deferred || filter_isr_calls == 0);
+
+    printf("%-28s %s  (%zu bytes in, %zu forwarded, %u frames filtered, filter %lu calls / %lu in the ISR)\n",
+           what, ok ? "ok" : "FAILED", input_len, forwarded_len, bridge.filtered, filter_calls, filter_isr_calls);
+    return ok;
+}
+
+/* corrections from the host port come out of the tx ring unchanged */
+static int inject(void)
+{
+    unsigned char data[300], out[300];
+    int           queued, sent = 0;
+
+    for (int i = 0; i < (int)sizeof(data); i++) data[i] = (unsigned char)(i * 7);
+
+    Bridge_init(&bridge, &host_port, NULL);
+    queued = Bridge_inject(&bridge, data, (int)sizeof(data));
+
+    while (usart.CR1 & USART_CR1_TXEIE)
+    {
+        usart.SR = USART_SR_TXE;
+        usart.DR = 0x100;
+        Uart_isr(&huart1);
+        if (usart.DR < 0x100 && sent < (int)sizeof(out)) out[sent++] = (unsigned char)usart.DR;
+    }
+    Bridge_stop(&bridge);
+
+    int ok = queued == (int)sizeof(data) && sent == queued && memcmp(out, data, sizeof(data)) == 0 &&
+             bridge.injected == sizeof(data) && bridge.inject_dropped == 0;
+
+    printf("%-28s %s  (%d bytes)\n", "inject towards the receiver", ok ? "ok" : "FAILED", sent);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int sentences = argc > 1 ? atoi(argv[1]) : 4000;
+    int ok = 1;
+
+    input     = malloc(STREAM_MAX);
+    expect    = malloc(STREAM_MAX);
+    parsed    = malloc(STREAM_MAX);
+    forwarded = malloc(STREAM_MAX);
+    if (!input || !expect || !parsed || !forwarded || sentences < 1 || sentences > STREAM_MAX / 256) return 2;
+
+    huart1.Instance = &usart;
+    Ringbuf_init();
+    srand(1);
+
+    ok &= run("no filter", NULL, 0, sentences);
+    ok &= run("filter, chained in the ISR", no_gsv, 0, sentences);
+    ok &= run("filter, deferred", no_gsv, 1, sentences);
+    ok &= inject();
+
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
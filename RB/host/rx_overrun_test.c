@@ -0,0 +1,220 @@
+/*
+ * rx_overrun_test.c - RX_OVERWRITE_OLDEST and RX_DROP_SENTENCE with a reader that falls behind, on the host shim.
+ *
+ *   rx_overrun_test [bursts]
+ *
+ * The ISR never moves the rx tail: it keeps storing, and the reader skips
+ * and counts what was written over. Checked:
+ *   - three rings' worth received without reading: exactly the newest
+ *     UART_BUFFER_SIZE - 1 bytes come out, in order, the rest is counted
+ *   - a timer signal plays the RXNE interrupt: it preempts the reader at
+ *     any instruction, as the real one does, and receives bursts of up to
+ *     a ring and a half of numbered lines. Every byte is either read or
+ *     counted as dropped (none is both), and the whole lines come out in
+ *     order, no repeats
+ *   - RX_DROP_SENTENCE, not reading while a sentence overflows the ring half
+ *     way, once starting with '$' and once with '!' (AIS): the ring is taken
+ *     back to the sentence's start, only the whole sentences before it come
+ *     out, the sentences after it come through intact and exactly the
+ *     overflowing sentence is counted as dropped
+ */
+
+#include "uart_RingBuffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#define LINE_MAX    40
+#define STREAM_MAX  (24 << 20)
+#define BURST_MAX   (UART_BUFFER_SIZE * 3 / 2)
+
+extern UART_HandleTypeDef huart1;
+
+_Thread_local uint32_t  host_ipsr;
+static USART_TypeDef    usart;
+
+static char             *stream;                // what is received, made up front: the "ISR" only copies
+static size_t           stream_len;
+static volatile size_t  sent;
+static volatile int     bursts = 60000;
+static unsigned         seed = 1;
+
+
+/* one received byte, as the RXNE interrupt sees it */
+static void receive(unsigned char c)
+{
+    usart.SR = USART_SR_RXNE;
+    usart.DR = c;
+    Uart_isr(&huart1);
+}
+
+/* the number twice, the second scrambled, so pieces of two lines joined by a gap do not pass */
+static int make_line(char *out, unsigned seq)
+{
+    unsigned char sum = 0;
+    int           len = sprintf(out, "$S,%06u,%06u", seq, seq * 7919u % 1000000u);
+
+    for (int i = 1; i < len; i++) sum ^= (unsigned char)out[i];
+    return len + sprintf(out + len, "*%02X\n", sum);
+}
+
+/* SIGALRM: a burst of received bytes, wherever the reader happens to be */
+static void interrupt(int sig)
+{
+    size_t n = (size_t)rand_r(&seed) % BURST_MAX + 1;
+
+    (void)sig;
+    host_ipsr = 53;                     // USART1 IRQ
+    if (n > stream_len - sent) n = stream_len - sent;
+    for (size_t i = 0; i < n; i++) receive((unsigned char)stream[sent + i]);
+    sent += n;
+    if (--bursts <= 0 || sent == stream_len)
+    {
+        struct itimerval stop = { { 0, 0 }, { 0, 0 } };
+
+        setitimer(ITIMER_REAL, &stop, NULL);
+        bursts = 0;
+    }
+    host_ipsr = 0;
+}
+
+/* reads what is queued, false unless it is exactly want */
+static int read_exactly(const char *want, size_t len)
+{
+    size_t i = 0;
+    int    c;
+
+    while ((c = Uart_read()) >= 0)
+    {
+        if (i >= len || c != (unsigned char)want[i]) return 0;
+        i++;
+    }
+    return i == len;
+}
+
+/* RX_DROP_SENTENCE: the ring filled up to less than a sentence, then one starting with marker */
+static int drop_sentence(char marker, char *detail, size_t size)
+{
+    static char queued[UART_BUFFER_SIZE + LINE_MAX];
+    char        line[LINE_MAX];
+    size_t      n = 0;
+    unsigned    seq = 0;
+    int         len = make_line(line, seq), ok;
+
+    Uart_flush();
+    Ringbuf_overflow(RX_DROP_SENTENCE);
+    uint32_t dropped_before = Uart_rx_dropped(RX_DROP_SENTENCE);
+
+    while (n + (size_t)len <= UART_BUFFER_SIZE - 1)
+    {
+        for (int i = 0; i < len; i++) receive((unsigned char)line[i]);
+        memcpy(queued + n, line, (size_t)len);
+        n  += (size_t)len;
+        len = make_line(line, ++seq);
+    }
+    line[0] = marker;                   // the checksum does not cover the marker
+    for (int i = 0; i < len; i++) receive((unsigned char)line[i]);
+
+    uint32_t dropped = Uart_rx_dropped(RX_DROP_SENTENCE) - dropped_before;
+    int      rolled  = read_exactly(queued, n);
+
+    // afterwards, whole sentences of both kinds get through
+    size_t later = 0;
+
+    for (int k = 0; k < 4; k++)
+    {
+        len = make_line(queued + later, ++seq);
+        queued[later] = k % 2 ? '!' : '$';
+        for (int i = 0; i < len; i++) receive((unsigned char)queued[later + i]);
+        later += (size_t)len;
+    }
+    int intact = read_exactly(queued, later) && Uart_rx_dropped(RX_DROP_SENTENCE) - dropped_before == dropped;
+
+    ok = rolled && intact && dropped == (uint32_t)len;
+    snprintf(detail, size, "%zu bytes of %u sentences kept, %u of a %d byte sentence dropped, later ones %s", n, seq - 4,
+             dropped, len, intact ? "intact" : "DAMAGED");
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    char          line[LINE_MAX + 1], expect[LINE_MAX];
+    int           len = 0, ok = 1, c;
+    unsigned long got = 0, complete = 0, disorder = 0;
+    long          last = -1;
+
+    if (argc > 1) bursts = atoi(argv[1]);
+    if (bursts < 1 || !(stream = malloc(STREAM_MAX + LINE_MAX))) return 2;
+    for (unsigned seq = 0; stream_len < STREAM_MAX; seq++) stream_len += (size_t)make_line(stream + stream_len, seq);
+
+    huart1.Instance = &usart;
+    Ringbuf_init();
+    Ringbuf_overflow(RX_OVERWRITE_OLDEST);
+
+    /* 1: nobody reads while three rings' worth arrive */
+    for (unsigned i = 0; i < 3 * UART_BUFFER_SIZE; i++) receive((unsigned char)(i % 251));
+
+    int      newest = 1;
+    unsigned first  = 3 * UART_BUFFER_SIZE - (UART_BUFFER_SIZE - 1);
+
+    for (unsigned i = first; i < 3 * UART_BUFFER_SIZE; i++) newest &= Uart_read() == (int)(i % 251);
+    newest &= Uart_read() == -1 && Uart_rx_dropped(RX_OVERWRITE_OLDEST) == first;
+    printf("newest bytes kept while not reading      %s  (%u dropped)\n", newest ? "ok" : "FAILED",
+           Uart_rx_dropped(RX_OVERWRITE_OLDEST));
+    ok &= newest;
+
+    /* 2: the "ISR" preempts the reader wherever it is */
+    uint32_t         dropped_before = Uart_rx_dropped(RX_OVERWRITE_OLDEST);
+    struct itimerval every = { { 0, 50 }, { 0, 50 } };
+
+    signal(SIGALRM, interrupt);
+    setitimer(ITIMER_REAL, &every, NULL);
+    for (;;)
+    {
+        int more = bursts > 0;
+
+        while ((c = Uart_read()) >= 0)
+        {
+            got++;
+            if (c == '$') len = 0;
+            if (len < LINE_MAX) line[len++] = (char)c;
+            if (c == '\n')
+            {
+                unsigned seq;
+
+                line[len] = '\0';
+                if (sscanf(line, "$S,%u,", &seq) == 1 && make_line(expect, seq) == len && memcmp(expect, line, (size_t)len) == 0)
+                {
+                    if ((long)seq <= last) disorder++;
+                    last = seq;
+                    complete++;
+                }
+                len = 0;
+            }
+        }
+        if (!more) break;
+    }
+
+    unsigned long dropped = Uart_rx_dropped(RX_OVERWRITE_OLDEST) - dropped_before;
+    int counted = got + dropped == sent && disorder == 0 && dropped > 0 && complete > 0;
+    printf("reader preempted by bursts               %s  (%lu bytes: %lu read, %lu dropped; %lu lines whole, "
+           "%lu out of order)\n", counted ? "ok" : "FAILED", (unsigned long)sent, got, dropped, complete, disorder);
+    ok &= counted;
+
+    /* 3: RX_DROP_SENTENCE, an overflow in the middle of a sentence */
+    char detail[160];
+
+    for (const char *m = "$!"; *m; m++)
+    {
+        int rolled = drop_sentence(*m, detail, sizeof(detail));
+
+        printf("'%c' sentence overflowing taken back      %s  (%s)\n", *m, rolled ? "ok" : "FAILED", detail);
+        ok &= rolled;
+    }
+
+    free(stream);
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
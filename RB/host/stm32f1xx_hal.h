@@ -0,0 +1,84 @@
+/*
+ * stm32f1xx_hal.h (host shim)
+ *
+ * Just enough of the STM32F1 HAL to build the RB sources on a PC: the
+ * USART is three plain registers the test program drives by hand, the
+ * interrupt enable bits are changed atomically because the "ISR" runs on
+ * another thread, and HAL_GetTick counts real milliseconds. DMA transmits
+ * are handed to HAL_UART_Transmit_DMA, which the test program provides;
+ * PRIMASK is a flag the test can look at, IPSR a per thread exception
+ * number the thread playing an interrupt sets.
+ */
+
+#ifndef INC_STM32F1XX_HAL_H_
+#define INC_STM32F1XX_HAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+typedef struct
+{
+    volatile uint32_t SR;
+    volatile uint32_t DR;
+    volatile uint32_t CR1;
+} USART_TypeDef;
+
+typedef struct
+{
+    USART_TypeDef *Instance;
+} UART_HandleTypeDef;
+
+typedef enum
+{
+    HAL_OK = 0,
+    HAL_ERROR,
+    HAL_BUSY,
+    HAL_TIMEOUT
+} HAL_StatusTypeDef;
+
+#define RESET                   0u
+
+#define USART_SR_FE             (1u << 1)
+#define USART_SR_NE             (1u << 2)
+#define USART_SR_ORE            (1u << 3)
+#define USART_SR_RXNE           (1u << 5)
+#define USART_SR_TXE            (1u << 7)
+#define USART_CR1_RXNEIE        (1u << 5)
+#define USART_CR1_TXEIE         (1u << 7)
+
+#define UART_FLAG_FE            USART_SR_FE
+#define UART_FLAG_NE            USART_SR_NE
+#define UART_FLAG_ORE           USART_SR_ORE
+#define UART_IT_RXNE            USART_CR1_RXNEIE
+#define UART_IT_TXE             USART_CR1_TXEIE
+#define UART_IT_ERR             (1u << 0)           // CR3 EIE on the real part
+
+#define READ_REG(reg)                       (reg)
+#define __HAL_UART_GET_FLAG(h, flag)        (((h)->Instance->SR & (flag)) == (flag))
+#define __HAL_UART_CLEAR_FLAG(h, flag)      ((h)->Instance->SR &= ~(uint32_t)(flag))
+#define __HAL_UART_ENABLE_IT(h, it)         __atomic_fetch_or(&(h)->Instance->CR1, (uint32_t)(it), __ATOMIC_SEQ_CST)
+#define __HAL_UART_DISABLE_IT(h, it)        __atomic_fetch_and(&(h)->Instance->CR1, ~(uint32_t)(it), __ATOMIC_SEQ_CST)
+
+extern uint32_t host_primask;
+
+static inline uint32_t __get_PRIMASK(void)          { return host_primask; }
+static inline void     __set_PRIMASK(uint32_t mask) { host_primask = mask; }
+static inline void     __disable_irq(void)          { host_primask = 1; }
+
+extern _Thread_local uint32_t host_ipsr;
+
+static inline uint32_t __get_IPSR(void)             { return host_ipsr; }
+
+/* provided by the test program */
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size);
+
+static inline uint32_t HAL_GetTick(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+#endif /* INC_STM32F1XX_HAL_H_ */
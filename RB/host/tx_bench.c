@@ -0,0 +1,168 @@
+/*
+ * tx_bench.c - Contention benchmark of the multi-writer tx ring on the host shim.
+ *
+ *   tx_bench [writers] [messages per writer]
+ *
+ * Writer threads queue numbered messages with Uart_write_message while
+ * one thread plays the TXE interrupt and drains the ring byte by byte
+ * through Uart_isr. The drained stream is checked line by line: a
+ * message split or mixed with another writer's bytes, a lost or a
+ * repeated message is an error. Last, with the ring full, Uart_sendstring
+ * and Uart_write called as from an ISR must drop instead of waiting, and
+ * called from a task must give up after TIMEOUT_DEF (500 ms) and drop.
+ */
+
+#include "uart_RingBuffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define MAX_WRITERS     64
+#define LINE_MAX        96
+
+extern UART_HandleTypeDef huart1;
+
+_Thread_local uint32_t  host_ipsr;
+static USART_TypeDef    usart;
+static int              writers = 4;
+static unsigned         messages = 200000;
+static _Atomic unsigned long full_waits;
+static _Atomic int      writing;
+
+
+static int make_message(char *msg, int writer, unsigned seq)
+{
+    int len = sprintf(msg, "$W%d,%u,", writer, seq);
+    int pad = (int)(seq % 48);
+
+    memset(msg + len, 'x', (size_t)pad);
+    len += pad;
+    msg[len++] = '\n';
+    return len;
+}
+
+static void *writer_main(void *arg)
+{
+    int  id = (int)(intptr_t)arg;
+    char msg[LINE_MAX];
+
+    for (unsigned seq = 0; seq < messages; seq++)
+    {
+        int len = make_message(msg, id, seq);
+
+        while (Uart_write_message((const unsigned char *)msg, len) == 0)
+        {
+            full_waits++;
+            sched_yield();
+        }
+    }
+    writing--;
+    return NULL;
+}
+
+/* plays the TXE interrupt: one call of Uart_isr per transmitted byte */
+static int isr_byte(void)
+{
+    if (!(__atomic_load_n(&usart.CR1, __ATOMIC_SEQ_CST) & USART_CR1_TXEIE)) return -1;
+
+    usart.SR = USART_SR_TXE;
+    usart.DR = 0x100;                   // not a byte: nothing was sent
+    Uart_isr(&huart1);
+    return usart.DR < 0x100 ? (int)usart.DR : -1;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t        tid[MAX_WRITERS];
+    unsigned         next[MAX_WRITERS] = { 0 };
+    char             line[LINE_MAX + 1], expect[LINE_MAX];
+    int              len = 0;
+    unsigned long    lines = 0, errors = 0, bytes = 0;
+    struct timespec  t0, t1;
+
+    if (argc > 1) writers  = atoi(argv[1]);
+    if (argc > 2) messages = (unsigned)strtoul(argv[2], NULL, 10);
+    if (writers < 1 || writers > MAX_WRITERS) return 2;
+
+    huart1.Instance = &usart;
+    Ringbuf_init();
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    writing = writers;
+    for (int i = 0; i < writers; i++) pthread_create(&tid[i], NULL, writer_main, (void *)(intptr_t)i);
+
+    for (;;)
+    {
+        int c = isr_byte();
+
+        if (c < 0)
+        {
+            if (writing == 0 && isr_byte() < 0) break;     // every message committed and sent
+            sched_yield();
+            continue;
+        }
+        bytes++;
+        if (len < LINE_MAX) line[len++] = (char)c;
+        if (c != '\n') continue;
+
+        int      w;
+        unsigned seq;
+
+        line[len] = '\0';
+        if (sscanf(line, "$W%d,%u,", &w, &seq) != 2 || w < 0 || w >= writers || seq != next[w] ||
+            make_message(expect, w, seq) != len || memcmp(expect, line, (size_t)len) != 0)
+        {
+            if (errors++ < 5) printf("bad line: %.*s", len, line);
+        }
+        else
+        {
+            next[w]++;
+        }
+        lines++;
+        len = 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    for (int i = 0; i < writers; i++)
+    {
+        pthread_join(tid[i], NULL);
+        if (next[i] != messages) errors++;
+    }
+
+    double s = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf("%d writers: %lu messages, %lu bytes in %.2f s (%.0f msg/s)\n", writers, lines, bytes, s, (double)lines / s);
+    printf("contention retries %u, waits on a full ring %lu, errors %lu\n",
+           Uart_tx_contention(), (unsigned long)full_waits, errors);
+
+    // nothing drains the ring now: a writer in an ISR has to give up (alarm catches a hang)
+    alarm(5);
+    while (Uart_write_message((const unsigned char *)line, 16) > 0) {}
+    host_ipsr = 53;                     // USART1 IRQ
+    Uart_sendstring("$ISR,1\n");
+    Uart_write('!');
+    host_ipsr = 0;
+    alarm(0);
+
+    int isr_ok = Uart_tx_dropped() == 8;
+    printf("ISR writes to a full ring: %s (%u bytes dropped)\n", isr_ok ? "ok" : "FAILED", Uart_tx_dropped());
+    if (!isr_ok) errors++;
+
+    // the same from a task: a bounded wait, then the bytes are dropped
+    uint32_t start = HAL_GetTick();
+
+    alarm(5);
+    Uart_sendstring("$TASK,1\n");
+    Uart_write('!');
+    alarm(0);
+
+    uint32_t waited = HAL_GetTick() - start;
+    int      task_ok = Uart_tx_dropped() == 8 + 9 && waited >= 2 * 500 && waited < 2 * 500 + 200;
+    printf("task writes to a full ring: %s (%u bytes dropped after %u ms)\n", task_ok ? "ok" : "FAILED",
+           Uart_tx_dropped() - 8, waited);
+    if (!task_ok) errors++;
+    return errors ? 1 : 0;
+}
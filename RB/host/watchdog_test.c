@@ -0,0 +1,180 @@
+/*
+ * watchdog_test.c - Receiver stream watchdog against faults on the host shim.
+ *
+ *   watchdog_test
+ *
+ * A simulated receiver sends one GGA per epoch through Uart_isr into the
+ * rx ring; the "application" reads lines with Uart_read and reports each
+ * epoch. The clock is virtual (1 ms steps), so the recovery times are
+ * exact. Scenarios:
+ *   - healthy streams at 1, 10 and 20 Hz never trip the watchdog
+ *   - a stuck UART (RXNE interrupt lost, overrun pending) is cleared by
+ *     WDG_REINIT, without reconfiguring or power cycling the receiver
+ *   - a hung receiver is only brought back by WDG_POWERCYCLE
+ *   - a burst of framing errors is handled by WDG_FLUSH
+ */
+
+#include "uart_watchdog.h"
+#include <stdio.h>
+#include <string.h>
+
+#define GGA         "$GPGGA,123456.00,3749.1234,N,12228.6789,W,1,08,0.9,10.0,M,-25.0,M,,*47\r\n"
+#define BOOT_MS     1000                // simulated receiver start up
+
+extern UART_HandleTypeDef huart1;
+
+_Thread_local uint32_t  host_ipsr;
+static USART_TypeDef    usart;
+static uint32_t         now;
+static int              hung;           // receiver sends nothing until power cycled
+static uint32_t         boot_until;     // receiver silent while it boots
+static int              garble;         // next bytes arrive with a framing error
+static uint32_t         power_cycles, configs;
+static int              failures;
+
+static char             line[128];
+static int              line_len;
+
+
+static void power_cycle(void)
+{
+    power_cycles++;
+    hung       = 0;
+    boot_until = now + BOOT_MS;
+}
+
+static void send_config(void)
+{
+    configs++;
+}
+
+/* one received byte: the USART sets RXNE (ORE if the last one was never read) and interrupts if enabled */
+static void receive(unsigned char c)
+{
+    if (usart.SR & USART_SR_RXNE) usart.SR |= USART_SR_ORE;
+    usart.SR |= USART_SR_RXNE;
+    if (garble)
+    {
+        usart.SR |= USART_SR_FE;
+        c ^= 0x20;                                  // wrong baud rate: wrong bits too
+        garble--;
+    }
+    usart.DR = c;
+
+    if (usart.CR1 & (USART_CR1_RXNEIE | UART_IT_ERR))
+    {
+        Uart_isr(&huart1);
+        usart.SR &= ~(uint32_t)(USART_SR_RXNE | USART_SR_ORE | USART_SR_FE | USART_SR_NE);    // SR then DR read
+    }
+}
+
+static void receiver_tick(uint32_t period)
+{
+    if (hung || (int32_t)(now - boot_until) < 0 || now % period != 0) return;
+
+    for (const char *p = GGA; *p; p++) receive((unsigned char)*p);
+}
+
+static void application_tick(UART_WATCHDOG *wd)
+{
+    int c;
+
+    while ((c = Uart_read()) >= 0)
+    {
+        if (c == '$') line_len = 0;                 // resynchronise like a parser would
+        if (line_len < (int)sizeof(line) - 1) line[line_len++] = (char)c;
+        if (c != '\n') continue;
+
+        line[line_len] = '\0';
+        if (strcmp(line, GGA) == 0) Watchdog_epoch(wd, now);
+        else Watchdog_error(wd, 1);
+        line_len = 0;
+    }
+}
+
+/* runs the stream for ms, returns the highest escalation level seen */
+static wdg_level run(UART_WATCHDOG *wd, uint32_t period, uint32_t ms)
+{
+    wdg_level worst = WDG_OK;
+
+    for (uint32_t end = now + ms; now != end; now++)
+    {
+        receiver_tick(period);
+        application_tick(wd);
+
+        wdg_level level = Watchdog_poll(wd, now);
+        if (level > worst) worst = level;
+    }
+    return worst;
+}
+
+static void check(int ok, const char *what, const UART_WATCHDOG *wd)
+{
+    printf("%-44s %s  (recovery %u ms, period %u ms, actions %u/%u/%u/%u)\n", what, ok ? "ok" : "FAILED",
+           wd->last_recovery_ms, wd->period_ms, wd->actions[WDG_FLUSH], wd->actions[WDG_REINIT],
+           wd->actions[WDG_RECONFIG], wd->actions[WDG_POWERCYCLE]);
+    if (!ok) failures++;
+}
+
+static void start(UART_WATCHDOG *wd)
+{
+    usart.SR = usart.CR1 = 0;
+    Ringbuf_init();
+    Uart_flush();
+    line_len = 0;
+    hung = garble = 0;
+    boot_until = now;
+    power_cycles = configs = 0;
+
+    Watchdog_init(wd, now);
+    wd->send_config = send_config;
+    wd->power_cycle = power_cycle;
+}
+
+int main(void)
+{
+    static const uint32_t rates[] = { 1000, 100, 50 };
+    UART_WATCHDOG wd;
+    char          what[64];
+
+    huart1.Instance = &usart;
+    now = 1;
+
+    for (unsigned i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+    {
+        start(&wd);
+        wdg_level worst = run(&wd, rates[i], 20000);
+
+        snprintf(what, sizeof(what), "healthy stream, %u ms epochs", rates[i]);
+        check(worst == WDG_OK && wd.stalls == 0 && wd.bursts == 0 && wd.period_ms == rates[i], what, &wd);
+    }
+
+    /* stuck UART: the receive interrupt is lost, the next byte overruns */
+    start(&wd);
+    run(&wd, 100, 3000);
+    __HAL_UART_DISABLE_IT(&huart1, UART_IT_RXNE | UART_IT_ERR);
+    run(&wd, 100, 3000);
+    // stall seen 150 ms after the last epoch, REINIT 200 ms later, data at the next epoch
+    check(wd.level == WDG_OK && wd.stalls == 1 && wd.actions[WDG_REINIT] == 1 &&
+          wd.actions[WDG_RECONFIG] == 0 && configs == 0 && power_cycles == 0 &&
+          wd.last_recovery_ms <= 2 * wd.period_ms + wd.period_ms, "stuck UART recovered by REINIT", &wd);
+
+    /* receiver firmware hung: nothing but a power cycle helps */
+    start(&wd);
+    run(&wd, 100, 3000);
+    hung = 1;
+    run(&wd, 100, 5000);
+    check(wd.level == WDG_OK && wd.stalls == 1 && configs == 1 && power_cycles == 1 &&
+          wd.last_recovery_ms <= 3 * 2 * wd.period_ms + BOOT_MS + wd.period_ms, "hung receiver recovered by POWERCYCLE", &wd);
+
+    /* framing errors over one sentence, its end of line is lost too */
+    start(&wd);
+    run(&wd, 100, 3000);
+    garble = (int)strlen(GGA);                      // one whole sentence
+    run(&wd, 100, 3000);
+    check(wd.level == WDG_OK && wd.bursts == 1 && wd.stalls == 0 && wd.actions[WDG_REINIT] == 0 &&
+          wd.last_recovery_ms <= wd.period_ms, "error burst recovered by FLUSH", &wd);
+
+    printf("%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
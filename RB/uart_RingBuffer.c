@@ -26,16 +26,46 @@ uint16_t timeout;
 /************************************* NO CHANGES AFTER THIS *************************************/
 
 ring_buffer rx_buffer = { { 0 }, 0, 0};
-ring_buffer tx_buffer = { { 0 }, 0, 0};
+tx_ring     tx_buffer = { { 0 }, 0, 0};
 
 ring_buffer *_rx_buffer;
-ring_buffer *_tx_buffer;
+tx_ring     *_tx_buffer;
+
+ring_buffer *_tee_buffer = NULL;        /* second copy of the received stream (bridge), or NULL */
+
+volatile uint32_t rx_error_count = 0;   /* FE / NE / ORE events seen by the ISR */
+
+volatile rx_overflow rx_policy = RX_DROP_NEW;
+volatile uint32_t rx_dropped[RX_POLICIES];
+int rx_sentence = -1;                   /* where the unfinished sentence's '$' / '!' was stored, -1: none */
+volatile uint32_t rx_written = 0;       /* bytes stored, free running (head = rx_written % size), ISR owned */
+uint32_t rx_read = 0;                   /* bytes read or skipped, free running (tail = rx_read % size), reader owned */
+int rx_skipping = 0;                    /* dropping the rest of a sentence up to the next '$' / '!' */
+
+_Atomic uint32_t tx_contention = 0;     /* reservation / commit retries */
+_Atomic uint32_t tx_dropped = 0;        /* bytes Uart_write / Uart_sendstring gave up on, the ring staying full */
+
+/* tx_ring.state fields, the heads count modulo 4096 */
+#define TX_POS_MASK       0xFFFu
+#define TX_COMMIT_SHIFT   12
+#define TX_WRITER_SHIFT   24
+#define TX_WRITER_ONE     (1u << TX_WRITER_SHIFT)
+
+_Static_assert((UART_BUFFER_SIZE & (UART_BUFFER_SIZE - 1)) == 0 && UART_BUFFER_SIZE <= 2048,
+               "the tx ring needs a power of 2 size of at most 2048");
 
 
 /*************************************** Utility Functions ***************************************/
 static void Ringbuf_reset(ring_buffer *buffer);
 static void store_char(unsigned char c, ring_buffer *buffer);
+static void store_rx(unsigned char c);
+static void rx_sync(void);
 static int check_for(char *str, char *buffinder);
+static int tx_reserve(int min, int max, unsigned int *pos);
+static void tx_copy(unsigned int pos, const unsigned char *data, int len);
+static void tx_commit(void);
+static int in_isr(void);
+static int tx_may_wait(uint32_t start);
 
 
 void Ringbuf_init(void)
@@ -44,12 +74,13 @@ void Ringbuf_init(void)
     _tx_buffer = &tx_buffer;
 
     //<test1: need to check all flags
-    if (__HAL_UART_GET_FLAG(huart, UART_FLAG_FE) ||
-            __HAL_UART_GET_FLAG(huart, UART_FLAG_NE) ||
-            __HAL_UART_GET_FLAG(huart, UART_FLAG_ORE)) {
+    if (__HAL_UART_GET_FLAG(uart, UART_FLAG_FE) ||
+            __HAL_UART_GET_FLAG(uart, UART_FLAG_NE) ||
+            __HAL_UART_GET_FLAG(uart, UART_FLAG_ORE)) {
 
-        __HAL_UART_CLEAR_FLAG(huart, UART_FLAG_FE | UART_FLAG_NE | UART_FLAG_ORE);
+        __HAL_UART_CLEAR_FLAG(uart, UART_FLAG_FE | UART_FLAG_NE | UART_FLAG_ORE);
         Ringbuf_reset(_rx_buffer); 
+        rx_written = rx_read = 0;
 
         if (uart == NULL) return;
     }
@@ -77,6 +108,82 @@ static void store_char(unsigned char c, ring_buffer *buffer)
     }
 }
 
+/* stores a received byte in the rx_buffer, applying the overflow policy when it is full
+ * only the reader moves the tail: RX_OVERWRITE_OLDEST just keeps storing, and the
+ * reader skips what was written over when it next looks (rx_sync)
+ */
+static void store_rx(unsigned char c)
+{
+    ring_buffer *b = _rx_buffer;
+
+    if (c == '$' || c == '!')               // NMEA and AIS (!AIVDM) sentences
+    {
+        rx_skipping = 0;
+        rx_sentence = -1;
+    }
+    else if (rx_skipping)
+    {
+        rx_dropped[RX_DROP_SENTENCE]++;
+        return;
+    }
+
+    unsigned int next = (b->head + 1) % UART_BUFFER_SIZE;
+
+    if (next == b->tail)
+    {
+        switch (rx_policy)
+        {
+            case RX_OVERWRITE_OLDEST:
+                break;                  // stored anyway, the reader skips the oldest
+
+            case RX_DROP_SENTENCE:
+            {
+                // the reader may be between its empty check and its read of the tail byte,
+                // so the sentence is only taken back if it starts after the tail
+                unsigned int queued = (b->head - b->tail + UART_BUFFER_SIZE) % UART_BUFFER_SIZE;
+                unsigned int after  = (unsigned int)(rx_sentence - (int)b->tail + UART_BUFFER_SIZE) % UART_BUFFER_SIZE;
+
+                if (rx_sentence >= 0 && after != 0 && after < queued)
+                {
+                    rx_dropped[RX_DROP_SENTENCE] += queued - after;
+                    rx_written -= queued - after;
+                    b->head = (unsigned int)rx_sentence;
+                }
+                rx_dropped[RX_DROP_SENTENCE]++;
+                rx_sentence = -1;
+                rx_skipping = 1;
+                return;
+            }
+
+            default:
+                rx_dropped[RX_DROP_NEW]++;
+                return;
+        }
+    }
+
+    if (c == '$' || c == '!') rx_sentence = (int)b->head;
+    else if (c == '\n') rx_sentence = -1;      // complete, the parser may take it any time
+
+    b->buffer[b->head] = c;
+    b->head = next;
+    rx_written++;
+}
+
+/* reader side: when the ISR has written over the oldest bytes (RX_OVERWRITE_OLDEST),
+ * skips ahead to the oldest one still there and counts the rest as dropped
+ */
+static void rx_sync(void)
+{
+    uint32_t lead = rx_written - rx_read;
+
+    if (lead > UART_BUFFER_SIZE - 1)
+    {
+        rx_dropped[RX_OVERWRITE_OLDEST] += lead - (UART_BUFFER_SIZE - 1);
+        rx_read += lead - (UART_BUFFER_SIZE - 1);
+        _rx_buffer->tail = rx_read % UART_BUFFER_SIZE;
+    }
+}
+
 static void Ringbuf_reset(ring_buffer *buffer)
 {
     for (int i = 0; i < UART_BUFFER_SIZE; i++)
@@ -87,6 +194,88 @@ static void Ringbuf_reset(ring_buffer *buffer)
     buffer->tail = 0;
 }
 
+/* reserves between min and max bytes of the tx ring in one piece
+ * returns the number of bytes reserved (0 if not even min fit) and their start in pos
+ */
+static int tx_reserve(int min, int max, unsigned int *pos)
+{
+    uint32_t state = atomic_load_explicit(&_tx_buffer->state, memory_order_relaxed);
+
+    for (;;)
+    {
+        unsigned int head = state & TX_POS_MASK;
+        unsigned int used = (head - atomic_load_explicit(&_tx_buffer->tail, memory_order_acquire)) & TX_POS_MASK;
+        int          n    = UART_BUFFER_SIZE - (int)used;
+
+        if (n > max) n = max;
+        if (n < min || n <= 0 || (state >> TX_WRITER_SHIFT) == 0xFF) return 0;
+
+        uint32_t next = ((state & ~TX_POS_MASK) | ((head + (unsigned int)n) & TX_POS_MASK)) + TX_WRITER_ONE;
+
+        if (atomic_compare_exchange_strong_explicit(&_tx_buffer->state, &state, next,
+                                                    memory_order_acquire, memory_order_relaxed))
+        {
+            *pos = head;
+            return n;
+        }
+        atomic_fetch_add_explicit(&tx_contention, 1, memory_order_relaxed);
+    }
+}
+
+/* copies a message into its reservation */
+static void tx_copy(unsigned int pos, const unsigned char *data, int len)
+{
+    unsigned int at    = pos % UART_BUFFER_SIZE;
+    int          first = UART_BUFFER_SIZE - (int)at;
+
+    if (first > len) first = len;
+    memcpy(&_tx_buffer->buffer[at], data, (size_t)first);
+    memcpy(&_tx_buffer->buffer[0], data + first, (size_t)(len - first));
+}
+
+/* ends a write; the last writer out publishes everything reserved so far */
+static void tx_commit(void)
+{
+    uint32_t state = atomic_load_explicit(&_tx_buffer->state, memory_order_relaxed);
+
+    for (;;)
+    {
+        uint32_t next = state - TX_WRITER_ONE;
+
+        if ((next >> TX_WRITER_SHIFT) == 0)
+        {
+            next = (next & ~(TX_POS_MASK << TX_COMMIT_SHIFT)) | ((next & TX_POS_MASK) << TX_COMMIT_SHIFT);
+        }
+        if (atomic_compare_exchange_strong_explicit(&_tx_buffer->state, &state, next,
+                                                    memory_order_release, memory_order_relaxed))
+        {
+            break;
+        }
+        atomic_fetch_add_explicit(&tx_contention, 1, memory_order_relaxed);
+    }
+
+    __HAL_UART_ENABLE_IT(uart, UART_IT_TXE);
+}
+
+/* nonzero in an interrupt handler (IPSR holds the exception number)
+ * waiting for room there never ends if the handler preempted a task
+ * between its reservation and its commit: nothing gets sent meanwhile
+ */
+static int in_isr(void)
+{
+    return __get_IPSR() != 0;
+}
+
+/* nonzero while a writer that found the tx ring full may keep waiting: never in
+ * an ISR, TIMEOUT_DEF ms in a task. A task that preempted another one between its
+ * reservation and its commit would otherwise spin for good: nothing drains behind
+ * the open reservation, and the task holding it does not run again
+ */
+static int tx_may_wait(uint32_t start)
+{
+    return !in_isr() && HAL_GetTick() - start < TIMEOUT_DEF;
+}
+
 /* checks if the entered string is present in the given buffer */
 static int check_for(char *str, char *buffinder)
 {
@@ -123,17 +312,23 @@ repeat:
 
 
 
+/* a byte the ISR wrote over while it was being read is not returned */
 int Uart_read(void)
 {
-    // if the head isn't ahead of the tail, we don't have any characters
-    if (_rx_buffer->head == _rx_buffer->tail)
+    for (;;)
     {
-        return -1;
-    }
-    else
-    {
-        unsigned char c = _rx_buffer->buffer[_rx_buffer->tail];
-        _rx_buffer->tail = (_rx_buffer->tail + 1) % UART_BUFFER_SIZE;
+        rx_sync();
+
+        // if the head isn't ahead of the tail, we don't have any characters
+        if (rx_written == rx_read) return -1;
+
+        unsigned char c = _rx_buffer->buffer[rx_read % UART_BUFFER_SIZE];
+
+        atomic_signal_fence(memory_order_seq_cst);
+        if (rx_written - rx_read > UART_BUFFER_SIZE - 1) continue;     // lapped meanwhile: skip and look again
+
+        rx_read++;
+        _rx_buffer->tail = rx_read % UART_BUFFER_SIZE;
         return c;
     }
 }
@@ -159,42 +354,47 @@ int Uart_read(void)
  * after reaching the end of the buffer (512), the pointers wrap back to the beginning (0).
  *
  */
-/* writes a single character to the uart and increments head */
+/* writes a single character to the uart and increments head
+ * waits up to TIMEOUT_DEF while the buffer is full (not at all in an ISR), then drops the byte
+ */
 void Uart_write(int c)
 {
     if (c < 0 || c > 255) return;
 
-    // calculate the new value of head
-    int i = (unsigned int)(_tx_buffer->head + 1) % UART_BUFFER_SIZE;
+    unsigned char byte = (unsigned char)c;
+    uint32_t      start_time = HAL_GetTick();
 
-    while (i == _tx_buffer->tail);  // wait if the buffer is full
+    while (Uart_write_message(&byte, 1) == 0)   // wait if the buffer is full
+    {
+        if (!tx_may_wait(start_time))
+        {
+            atomic_fetch_add_explicit(&tx_dropped, 1, memory_order_relaxed);
+            return;
+        }
+    }
 
-    // variation 1: timeout mechanism
-    //    uint32_t start_time = HAL_GetTick(); // start time
-    //    while (i == _tx_buffer->tail)
-    //    {
-    //        if ((HAL_GetTick() - start_time) > TIMEOUT_DEF)
-    //        {
-    //            return; // Exit after timeout
-    //        }
-    //    }
-    //
     // variation 2: handle buffer overflow
     //    // if head reaches tail, it indicates a buffer overflow
     //    if (i == _tx_buffer->tail)      // buffer overflow 
     //    {
     //        return;
     //    }
+}
 
-    // store the character in the buffer
-    _tx_buffer->buffer[_tx_buffer->head] = (uint8_t)c;
 
-    // update the head pointer
-    _tx_buffer->head = i;
+/* queues the whole message or nothing, never waits */
+int Uart_write_message(const unsigned char *data, int len)
+{
+    unsigned int pos;
 
+    if (data == NULL || len <= 0) return 0;
+    if (len > UART_BUFFER_SIZE) return -1;
 
-    __HAL_UART_ENABLE_IT(uart, UART_IT_TXE);
+    if (!tx_reserve(len, len, &pos)) return 0;
+    tx_copy(pos, data, len);
+    tx_commit();
 
+    return len;
 }
 
 
@@ -207,11 +407,65 @@ void Uart_write(int c)
 // re:d1>
 
 
-/* sends the string to the uart */
+/* writes up to len bytes to the tx_buffer without waiting
+ * returns the number of bytes actually queued
+ */
+int Uart_write_span(const unsigned char *data, int len)
+{
+    unsigned int pos;
+    int          written;
+
+    if (data == NULL || len <= 0) return 0;
+
+    written = tx_reserve(1, len, &pos);     // what does not fit: the caller decides what to drop
+    if (written)
+    {
+        tx_copy(pos, data, written);
+        tx_commit();
+    }
+
+    return written;
+}
+
+
+/* feeds every received byte into a second ring as well, NULL stops it */
+void Ringbuf_tee(ring_buffer *buffer)
+{
+    if (buffer)
+    {
+        buffer->head = 0;
+        buffer->tail = 0;
+    }
+    _tee_buffer = buffer;
+}
+
+
+/* sends the string to the uart
+ * waits up to TIMEOUT_DEF while the buffer is full (not at all in an ISR), then drops the rest
+ */
 void Uart_sendstring (const char *s)
 {
     if (s == NULL) return;
-    while(*s) Uart_write(*s++);
+
+    int      len = (int)strlen(s);
+    uint32_t start_time = HAL_GetTick();
+
+    // one message per string (per buffer size for longer ones), waiting until it fits
+    while (len > 0)
+    {
+        int n = len < UART_BUFFER_SIZE ? len : UART_BUFFER_SIZE;
+
+        while (Uart_write_message((const unsigned char *)s, n) == 0)
+        {
+            if (!tx_may_wait(start_time))
+            {
+                atomic_fetch_add_explicit(&tx_dropped, (uint32_t)len, memory_order_relaxed);
+                return;
+            }
+        }
+        s   += n;
+        len -= n;
+    }
 
     // <d1:bi
     //if (!IsTxBufferFull())
@@ -257,7 +511,11 @@ void Uart_printbase(long n, uint8_t base)
 /* checks if the new data is available in the incoming buffer */
 int IsDataAvailable(void)
 {
-    return (uint16_t)(UART_BUFFER_SIZE + _rx_buffer->head - _rx_buffer->tail) % UART_BUFFER_SIZE;
+    rx_sync();
+
+    uint32_t queued = rx_written - rx_read;
+
+    return queued < UART_BUFFER_SIZE ? (int)queued : UART_BUFFER_SIZE - 1;
 }
 
 
@@ -359,23 +617,85 @@ repeat2:
 }
 
 
+/* the receive state is the ISR's: RXNE is masked while the reader resets it, a byte
+ * arriving meanwhile waits in DR and is stored once the interrupt is enabled again
+ */
+static uint32_t rx_hold(void)
+{
+    uint32_t enabled = huart1.Instance->CR1 & USART_CR1_RXNEIE;
+
+    __HAL_UART_DISABLE_IT(uart, UART_IT_RXNE);
+    return enabled;
+}
+
+static void rx_release(uint32_t enabled)
+{
+    if (enabled) __HAL_UART_ENABLE_IT(uart, UART_IT_RXNE);
+}
+
+
 void Uart_flush (void)
 {
+    uint32_t rxne = rx_hold();
+
     memset(_rx_buffer->buffer,'\0', UART_BUFFER_SIZE);
     _rx_buffer->head = 0;
     _rx_buffer->tail = 0;
+    rx_written = rx_read = 0;
+    rx_sentence = -1;
+    rx_skipping = 0;
+    rx_release(rxne);
+}
+
+
+uint32_t Uart_errors(void)
+{
+    return rx_error_count;
+}
+
+
+void Ringbuf_overflow(rx_overflow policy)
+{
+    if (policy >= RX_POLICIES) return;
+
+    uint32_t rxne = rx_hold();
+
+    rx_sync();
+    rx_policy   = policy;
+    rx_sentence = -1;
+    rx_skipping = 0;
+    rx_release(rxne);
+}
+
+
+uint32_t Uart_rx_dropped(rx_overflow policy)
+{
+    return policy < RX_POLICIES ? rx_dropped[policy] : 0;
+}
+
+
+uint32_t Uart_tx_contention(void)
+{
+    return atomic_load_explicit(&tx_contention, memory_order_relaxed);
+}
+
+
+uint32_t Uart_tx_dropped(void)
+{
+    return atomic_load_explicit(&tx_dropped, memory_order_relaxed);
 }
 
 
 int Uart_peek()
 {
-    if(_rx_buffer->head == _rx_buffer->tail)
+    rx_sync();
+    if(rx_written == rx_read)
     {
         return -1;
     }
     else
     {
-        return _rx_buffer->buffer[_rx_buffer->tail];
+        return _rx_buffer->buffer[rx_read % UART_BUFFER_SIZE];
     }
 }
 
@@ -395,8 +715,7 @@ int Copy_upto (char *string, char *buffertocopyinto)
 again:
     while (Uart_peek() != string[so_far])
     {
-        buffertocopyinto[indx] = _rx_buffer->buffer[_rx_buffer->tail];
-        _rx_buffer->tail = (unsigned int)(_rx_buffer->tail + 1) % UART_BUFFER_SIZE;
+        buffertocopyinto[indx] = (char)Uart_read();
         indx++;
         while (!IsDataAvailable());
 
@@ -453,21 +772,13 @@ again:
     if (timeout == 0) return 0;
     while (Uart_peek() != string[so_far])  // peek in the rx_buffer to see if we get the string
     {
-        if (_rx_buffer->tail != _rx_buffer->head)
-        {
-            _rx_buffer->tail = (unsigned int)(_rx_buffer->tail + 1) % UART_BUFFER_SIZE;  // increment the tail
-        }
-
-        else
-        {
-            return 0;
-        }
+        if (Uart_read() < 0) return 0;  // increment the tail
     }
     while (Uart_peek() == string [so_far]) // if we got the first letter of the string
     {
         // now we will peek for the other letters too
         so_far++;
-        _rx_buffer->tail = (unsigned int)(_rx_buffer->tail + 1) % UART_BUFFER_SIZE;  // increment the tail
+        Uart_read();  // increment the tail
         if (so_far == len) return 1;
         timeout = TIMEOUT_DEF;
         while ((!IsDataAvailable())&&timeout);
@@ -490,6 +801,17 @@ void Uart_isr (UART_HandleTypeDef *huart)
     uint32_t isrflags   = READ_REG(huart->Instance->SR);
     uint32_t cr1its     = READ_REG(huart->Instance->CR1);
 
+    /* line error: an ORE without RXNE would otherwise keep the interrupt pending forever */
+    if ((isrflags & (USART_SR_ORE | USART_SR_NE | USART_SR_FE)) != RESET)
+    {
+        rx_error_count++;
+        if ((isrflags & USART_SR_RXNE) == RESET)
+        {
+            huart->Instance->DR;                   /* SR then DR read clears the flags */
+            return;
+        }
+    }
+
     /* if DR is not empty and the Rx Int is enabled */
     if (((isrflags & USART_SR_RXNE) != RESET) && ((cr1its & USART_CR1_RXNEIE) != RESET))
     {
@@ -506,25 +828,32 @@ void Uart_isr (UART_HandleTypeDef *huart)
          *********************/
         huart->Instance->SR;                       /* Read status register */
         unsigned char c = huart->Instance->DR;     /* Read data register */
-        store_char (c, _rx_buffer);  // store data in buffer
+        store_rx (c);                // store data in buffer
+        if (_tee_buffer) store_char (c, _tee_buffer);  // the bridge gets its own copy, never blocks the parser
         return;
     }
 
     /*If interrupt is caused due to Transmit Data Register Empty */
     if (((isrflags & USART_SR_TXE) != RESET) && ((cr1its & USART_CR1_TXEIE) != RESET))
     {
-        if(tx_buffer.head == tx_buffer.tail)
+        uint32_t     committed = (atomic_load_explicit(&tx_buffer.state, memory_order_acquire) >> TX_COMMIT_SHIFT) & TX_POS_MASK;
+        unsigned int tail      = atomic_load_explicit(&tx_buffer.tail, memory_order_relaxed);
+
+        if(tail == committed)
         {
             // Buffer empty, so disable interrupts
             __HAL_UART_DISABLE_IT(huart, UART_IT_TXE);
 
+            // a writer of higher priority may have committed in between
+            committed = (atomic_load_explicit(&tx_buffer.state, memory_order_acquire) >> TX_COMMIT_SHIFT) & TX_POS_MASK;
+            if (tail != committed) __HAL_UART_ENABLE_IT(huart, UART_IT_TXE);
         }
 
         else
         {
             // There is more data in the output buffer. Send the next byte
-            unsigned char c = tx_buffer.buffer[tx_buffer.tail];
-            tx_buffer.tail = (tx_buffer.tail + 1) % UART_BUFFER_SIZE;
+            unsigned char c = tx_buffer.buffer[tail % UART_BUFFER_SIZE];
+            atomic_store_explicit(&tx_buffer.tail, (tail + 1) & TX_POS_MASK, memory_order_release);
 
             /******************
              *  @note   PE (Parity error), FE (Framing error), NE (Noise error), ORE (Overrun
@@ -7,8 +7,9 @@
 #define UART_RINGBUFFER_H_
 
 #include "stm32f1xx_hal.h"
+#include <stdatomic.h>
 
-/* change the size of the buffer */
+/* change the size of the buffer (a power of 2, at most 2048 for the tx ring) */
 #define UART_BUFFER_SIZE 512
 
 typedef struct
@@ -18,20 +19,75 @@ typedef struct
   volatile unsigned int tail;
 } ring_buffer;
 
+/* what the receive ring does with a byte that arrives while it is full */
+typedef enum
+{
+  RX_DROP_NEW = 0,        /* keep what is queued, lose the new bytes (default) */
+  RX_OVERWRITE_OLDEST,    /* lose the oldest queued bytes instead (the reader skips them when it next reads) */
+  RX_DROP_SENTENCE,       /* remove the unfinished sentence back to its '$' / '!' and skip its rest */
+  RX_POLICIES
+} rx_overflow;
+
+/* transmit ring for any number of writers (tasks and ISRs)
+ * state packs three free running 12 bit fields into one atomic word:
+ * bits 0-11 reserve head, 12-23 commit head, 24-31 writers in progress.
+ * A writer reserves room for a whole message with one compare-and-swap,
+ * copies it and commits; the last writer to commit moves the commit head
+ * to the reserve head, and the ISR only sends committed bytes, so
+ * messages are never interleaved and nobody takes a lock.
+ */
+typedef struct
+{
+  unsigned char buffer[UART_BUFFER_SIZE];
+  _Atomic uint32_t state;
+  _Atomic uint32_t tail;              /* free running 12 bit, owned by the ISR */
+} tx_ring;
+
 
 /* Initialize the ring buffer */
 void Ringbuf_init(void);
 
 
-/* reads the data in the rx_buffer and increment the tail count in rx_buffer */
+/* reads the data in the rx_buffer and increment the tail count in rx_buffer
+ * Only the reader moves the tail: this, Uart_peek and IsDataAvailable first skip
+ * what RX_OVERWRITE_OLDEST gave up. Not for ISRs
+ */
 int Uart_read(void);
 
 
-/* writes the data to the tx_buffer and increment the head count in tx_buffer */
+/* writes the data to the tx_buffer and increment the head count in tx_buffer
+ * Waits while the buffer is full, at most TIMEOUT_DEF (500 ms): a task it
+ * preempted may hold a reservation that keeps the ring full until that task
+ * runs again. Then the byte is dropped and counted (see Uart_tx_dropped).
+ * Called from an ISR it does not wait at all
+ */
 void Uart_write(int c);
 
 
-/* function to send the string to the uart */
+/* queues a whole message without blocking, it is never interleaved with other writers
+ * Returns len when queued, 0 if there is no room now and -1 if it can never fit
+ * USAGE: if (Uart_write_message(frame, n) == 0) count the drop
+ */
+int Uart_write_message(const unsigned char *data, int len);
+
+
+/* writes up to len bytes to the tx_buffer without blocking
+ * Returns the number of bytes queued (less than len if the buffer is full)
+ */
+int Uart_write_span(const unsigned char *data, int len);
+
+
+/* Copy every received byte into a second ring as well (used by the bridge)
+ * The ring is reset first. Pass NULL to stop copying
+ */
+void Ringbuf_tee(ring_buffer *buffer);
+
+
+/* function to send the string to the uart
+ * Waits while the buffer is full, at most TIMEOUT_DEF (500 ms) for the whole
+ * string, and not at all from an ISR: the part that does not fit by then is
+ * dropped and counted (see Uart_tx_dropped)
+ */
 void Uart_sendstring(const char *s);
 
 
@@ -62,10 +118,43 @@ int Look_for (char *str, char *buffertolookinto);
 void GetDataFromBuffer (char *startString, char *endString, char *buffertocopyfrom, char *buffertocopyinto);
 
 
-/* Resets the entire ring buffer, the new data will start from position 0 */
+/* Resets the entire ring buffer, the new data will start from position 0
+ * (the RXNE interrupt is masked meanwhile, a byte arriving waits in DR)
+ */
 void Uart_flush (void);
 
 
+/* Selects what happens to received bytes while the rx_buffer is full
+ * USAGE: Ringbuf_overflow(RX_DROP_SENTENCE) so the parser only ever sees whole sentences
+ */
+void Ringbuf_overflow(rx_overflow policy);
+
+
+/* Number of received bytes lost to overflow while the given policy was selected
+ * (for RX_DROP_SENTENCE: the removed part and the skipped rest of each sentence,
+ * for RX_OVERWRITE_OLDEST: counted when the reader skips them)
+ */
+uint32_t Uart_rx_dropped(rx_overflow policy);
+
+
+/* Number of times a tx writer had to retry its reservation or commit
+ * because another writer (task or ISR) got in between
+ */
+uint32_t Uart_tx_contention(void);
+
+
+/* Number of bytes Uart_write / Uart_sendstring dropped because the tx_buffer
+ * stayed full: at once in an ISR, after TIMEOUT_DEF in a task
+ */
+uint32_t Uart_tx_dropped(void);
+
+
+/* Number of receive line errors (framing, noise, overrun) since power up
+ * USAGE: if (Uart_errors() != last_errors) something went wrong on the line
+ */
+uint32_t Uart_errors(void);
+
+
 /* Peek for the data in the Rx Bffer without incrementing the tail count
 * Returns the character
 * USAGE: if (Uart_peek () == 'M') do something
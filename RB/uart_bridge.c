@@ -0,0 +1,164 @@
+/*
+ * uart_bridge.c
+ *
+ */
+
+#include "uart_bridge.h"
+#include <string.h>
+
+/* schema of the bridge:
+ *
+ *   receiver --> Uart_isr --+--> rx_buffer ----> parser (Uart_read, Wait_for ...)
+ *                           |
+ *                           +--> bridge ring --> DMA ----> huart (host PC)
+ *
+ *   host PC ---> Bridge_inject -----------------> tx_buffer --> receiver
+ *
+ * the ISR stores each byte twice (one store), everything else is spans:
+ * the DMA reads directly out of the bridge ring, so the CPU never touches
+ * the forwarded bytes again and the parser never waits for the bridge.
+ */
+
+
+/* copies a frame out of the ring (it may wrap) and asks the filter about it */
+static int frame_accepted(UART_BRIDGE *b, unsigned int start, unsigned int len)
+{
+    for (unsigned int i = 0; i < len; i++)
+    {
+        b->frame[i] = (char)b->ring.buffer[(start + i) % UART_BUFFER_SIZE];
+    }
+    return b->filter(b->frame, (int)len);
+}
+
+
+/* returns the length of the next contiguous span to send from the ring tail, 0 if none */
+static unsigned int next_span(UART_BRIDGE *b)
+{
+    ring_buffer *r = &b->ring;
+
+    for (;;)
+    {
+        unsigned int tail    = r->tail;
+        unsigned int pending = (UART_BUFFER_SIZE + r->head - tail) % UART_BUFFER_SIZE;
+        unsigned int len     = pending;
+
+        if (pending == 0) return 0;
+
+        if (b->filter)
+        {
+            if (b->frame_left == 0)
+            {
+                unsigned int n     = b->scanned;
+                int          found = 0;
+
+                // look for the end of the frame, continuing where the last call stopped
+                while (n < pending)
+                {
+                    if (r->buffer[(tail + n++) % UART_BUFFER_SIZE] == '\n')
+                    {
+                        found = 1;
+                        break;
+                    }
+                }
+
+                // incomplete frame: wait, unless the ring filled up without any line end
+                if (!found && pending < UART_BUFFER_SIZE - 1)
+                {
+                    b->scanned = n;
+                    return 0;
+                }
+                b->scanned = 0;
+
+                if (found && n <= BRIDGE_FRAME_MAX && !frame_accepted(b, tail, n))
+                {
+                    r->tail = (tail + n) % UART_BUFFER_SIZE;
+                    b->filtered++;
+                    continue;
+                }
+                b->frame_left = n;
+            }
+            len = b->frame_left;
+        }
+
+        // DMA needs contiguous memory, a wrapped span goes out in two transfers
+        if (len > UART_BUFFER_SIZE - tail) len = UART_BUFFER_SIZE - tail;
+
+        return len;
+    }
+}
+
+
+void Bridge_init(UART_BRIDGE *b, UART_HandleTypeDef *huart, bridge_filter filter)
+{
+    memset(b, 0, sizeof(UART_BRIDGE));
+
+    b->huart  = huart;
+    b->filter = filter;
+
+    Ringbuf_tee(&b->ring);
+}
+
+
+void Bridge_stop(UART_BRIDGE *b)
+{
+    Ringbuf_tee(NULL);
+    b->huart = NULL;
+}
+
+
+void Bridge_pump(UART_BRIDGE *b)
+{
+    /* claim the channel, the completion interrupt may be chaining transfers too */
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (b->busy || b->huart == NULL)
+    {
+        __set_PRIMASK(primask);
+        return;
+    }
+    b->busy = 1;
+    __set_PRIMASK(primask);
+
+    unsigned int len = next_span(b);
+
+    if (len == 0)
+    {
+        b->busy = 0;
+        return;
+    }
+
+    b->inflight = (uint16_t)len;
+    if (HAL_UART_Transmit_DMA(b->huart, &b->ring.buffer[b->ring.tail], (uint16_t)len) != HAL_OK)
+    {
+        b->inflight = 0;
+        b->busy     = 0;
+    }
+}
+
+
+void Bridge_tx_complete(UART_BRIDGE *b)
+{
+    unsigned int sent = b->inflight;
+
+    // only now the bytes may be overwritten by the ISR
+    b->ring.tail = (b->ring.tail + sent) % UART_BUFFER_SIZE;
+    if (b->filter) b->frame_left -= sent;
+
+    b->forwarded += sent;
+    b->inflight   = 0;
+    b->busy       = 0;
+
+    // deferred: the main loop starts the next transfer, the filter never runs in the interrupt
+    if (!b->deferred) Bridge_pump(b);
+}
+
+
+int Bridge_inject(UART_BRIDGE *b, const unsigned char *data, int len)
+{
+    int queued = Uart_write_span(data, len);
+
+    b->injected       += (uint32_t)queued;
+    b->inject_dropped += (uint32_t)(len - queued);
+
+    return queued;
+}
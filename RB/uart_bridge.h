@@ -0,0 +1,67 @@
+/*
+ * uart_bridge.h
+ *
+ * Bridge/router mode: forwards the receiver stream to a second UART
+ * by DMA straight out of a ring, and corrections back into the tx ring
+ */
+
+#ifndef UART_BRIDGE_H_
+#define UART_BRIDGE_H_
+
+#include "uart_RingBuffer.h"
+
+/* largest frame handed to the filter, longer frames are forwarded unfiltered */
+#define BRIDGE_FRAME_MAX 128
+
+/* frame filter: return 1 to forward the frame, 0 to drop it
+ * frame is a complete line including its '\n'
+ * It runs where Bridge_pump runs. Chained transfers (the default) start in
+ * Bridge_tx_complete, that is in the DMA complete interrupt: the filter must
+ * then be short and must not wait (no HAL timeouts, no Uart_sendstring).
+ * With deferred set, the filter and every transfer start stay in the main loop.
+ */
+typedef int (*bridge_filter)(const char *frame, int len);
+
+typedef struct
+{
+    ring_buffer         ring;           // copy of the receiver rx stream, filled by the ISR
+    UART_HandleTypeDef  *huart;         // port the stream is forwarded to (DMA tx)
+    bridge_filter       filter;         // optional, NULL forwards every byte
+    uint8_t             deferred;       // set after Bridge_init: no pump from the DMA interrupt
+
+    volatile uint8_t    busy;           // a DMA transfer is in flight
+    volatile uint16_t   inflight;       // its length
+    unsigned int        frame_left;     // bytes of an accepted frame still to send
+    unsigned int        scanned;        // bytes after tail already searched for '\n'
+
+    uint32_t            forwarded;      // bytes sent to huart
+    uint32_t            filtered;       // frames dropped by the filter
+    uint32_t            injected;       // bytes queued towards the receiver
+    uint32_t            inject_dropped; // bytes lost because the tx ring was full
+
+    char                frame[BRIDGE_FRAME_MAX];
+} UART_BRIDGE;
+
+
+/* Start forwarding the receiver stream to huart, filter may be NULL */
+void Bridge_init(UART_BRIDGE *b, UART_HandleTypeDef *huart, bridge_filter filter);
+
+/* Stop forwarding, the receiver stream is no longer copied */
+void Bridge_stop(UART_BRIDGE *b);
+
+/* Start the next DMA transfer if there is data and the channel is idle
+ * Call it from the main loop; unless deferred it is also chained from
+ * Bridge_tx_complete, in interrupt context
+ */
+void Bridge_pump(UART_BRIDGE *b);
+
+/* Call from HAL_UART_TxCpltCallback: if (huart == b.huart) Bridge_tx_complete(&b); */
+void Bridge_tx_complete(UART_BRIDGE *b);
+
+/* Queue bytes from the other port (e.g. RTCM corrections) towards the receiver
+ * Never blocks, returns the number of bytes queued
+ * USAGE: in HAL_UARTEx_RxEventCallback, Bridge_inject(&b, dma_rx, size);
+ */
+int Bridge_inject(UART_BRIDGE *b, const unsigned char *data, int len);
+
+#endif /* UART_BRIDGE_H_ */
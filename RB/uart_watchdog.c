@@ -0,0 +1,126 @@
+/*
+ * uart_watchdog.c
+ *
+ */
+
+#include "uart_watchdog.h"
+#include <string.h>
+
+/* the receiver is late once it missed half an epoch beyond its period */
+#define STALL_LIMIT(p)   ((p) + (p) / 2)
+
+/* how long each recovery step is given before the next one is tried */
+#define STEP_HOLD(p)     (2 * (p))
+
+
+static uint32_t line_errors(UART_WATCHDOG *wd)
+{
+    return wd->errors ? wd->errors() : 0;
+}
+
+static void escalate(UART_WATCHDOG *wd, wdg_level level, uint32_t now)
+{
+    wd->level      = level;
+    wd->level_tick = now;
+    wd->actions[level]++;
+
+    switch (level)
+    {
+        case WDG_FLUSH:      if (wd->flush)       wd->flush();       break;
+        case WDG_REINIT:     if (wd->reinit)      wd->reinit();      break;
+        case WDG_RECONFIG:   if (wd->send_config) wd->send_config(); break;
+        case WDG_POWERCYCLE: if (wd->power_cycle) wd->power_cycle(); break;
+        default: break;
+    }
+
+    // the action may have produced (or cleared) line errors, start counting again
+    wd->line_errors_base   = line_errors(wd);
+    wd->errors_since_epoch = 0;
+}
+
+
+void Watchdog_init(UART_WATCHDOG *wd, uint32_t now)
+{
+    memset(wd, 0, sizeof(UART_WATCHDOG));
+
+    wd->flush  = Uart_flush;
+    wd->reinit = Ringbuf_init;
+    wd->errors = Uart_errors;
+
+    wd->period_ms        = WDG_DEFAULT_PERIOD_MS;
+    wd->last_epoch_tick  = now;
+    wd->line_errors_base = line_errors(wd);
+}
+
+
+void Watchdog_epoch(UART_WATCHDOG *wd, uint32_t now)
+{
+    if (wd->level != WDG_OK)
+    {
+        // recovered, the gap we just had says nothing about the cadence
+        wd->last_recovery_ms = now - wd->fault_tick;
+        if (wd->last_recovery_ms > wd->max_recovery_ms) wd->max_recovery_ms = wd->last_recovery_ms;
+        wd->level = WDG_OK;
+    }
+    else if (wd->epochs_seen)
+    {
+        uint32_t interval = now - wd->last_epoch_tick;
+
+        // first interval sets the period, then a 1/4 weight moving average
+        if (wd->epochs_seen == 1) wd->period_ms = interval;
+        else wd->period_ms = (wd->period_ms * 3 + interval) / 4;
+
+        if (wd->period_ms < WDG_MIN_PERIOD_MS) wd->period_ms = WDG_MIN_PERIOD_MS;
+    }
+
+    if (wd->epochs_seen < 255) wd->epochs_seen++;
+
+    wd->last_epoch_tick    = now;
+    wd->line_errors_base   = line_errors(wd);
+    wd->errors_since_epoch = 0;
+}
+
+
+void Watchdog_error(UART_WATCHDOG *wd, uint32_t count)
+{
+    wd->errors_since_epoch += count;
+}
+
+
+wdg_level Watchdog_poll(UART_WATCHDOG *wd, uint32_t now)
+{
+    uint32_t errors = wd->errors_since_epoch + (line_errors(wd) - wd->line_errors_base);
+
+    if (wd->level == WDG_OK)
+    {
+        if ((now - wd->last_epoch_tick) > STALL_LIMIT(wd->period_ms))
+        {
+            wd->stalls++;
+        }
+        else if (errors >= WDG_ERROR_BURST)
+        {
+            wd->bursts++;
+        }
+        else
+        {
+            return WDG_OK;
+        }
+
+        wd->fault_tick = now;
+        escalate(wd, WDG_FLUSH, now);
+    }
+    else
+    {
+        uint32_t hold = STEP_HOLD(wd->period_ms);
+
+        // a power cycled receiver needs its boot time before it can talk again
+        if (wd->level == WDG_POWERCYCLE) hold += WDG_BOOT_MS;
+
+        if ((now - wd->level_tick) >= hold)
+        {
+            escalate(wd, (wd->level < WDG_POWERCYCLE) ? (wdg_level)(wd->level + 1) : WDG_POWERCYCLE, now);
+        }
+    }
+
+    return wd->level;
+}
@@ -0,0 +1,74 @@
+/*
+ * uart_watchdog.h
+ *
+ * Receiver stream watchdog: notices a receiver that went silent or
+ * started sending garbage and walks through the recovery steps
+ */
+
+#ifndef UART_WATCHDOG_H_
+#define UART_WATCHDOG_H_
+
+#include "uart_RingBuffer.h"
+
+#define WDG_DEFAULT_PERIOD_MS   1000    // expected epoch period before the first epochs are seen
+#define WDG_MIN_PERIOD_MS       50      // 20 Hz receivers
+#define WDG_ERROR_BURST         4       // errors between two epochs that count as a fault
+#define WDG_BOOT_MS             2000    // receiver start up time after a power cycle
+
+/* escalation steps, each one is tried when the previous one did not help */
+typedef enum
+{
+    WDG_OK = 0,
+    WDG_FLUSH,          // drop whatever is in the rx ring
+    WDG_REINIT,         // clear the UART error flags and re-arm the interrupts
+    WDG_RECONFIG,       // send the receiver configuration again
+    WDG_POWERCYCLE      // last resort: power cycle the receiver
+} wdg_level;
+
+typedef struct
+{
+    /* recovery actions, defaults use the ring buffer; hooks are user supplied (may be NULL) */
+    void     (*flush)(void);
+    void     (*reinit)(void);
+    void     (*send_config)(void);
+    void     (*power_cycle)(void);
+    uint32_t (*errors)(void);           // line error counter, Uart_errors by default
+
+    /* cadence */
+    uint32_t period_ms;                 // learned epoch period
+    uint32_t last_epoch_tick;
+    uint8_t  epochs_seen;
+
+    /* error burst detection */
+    uint32_t line_errors_base;          // line error count at the last epoch
+    uint32_t errors_since_epoch;        // line + reported decode errors
+
+    /* escalation */
+    wdg_level level;
+    uint32_t  fault_tick;               // when the fault was detected
+    uint32_t  level_tick;               // when the current level was entered
+
+    /* statistics */
+    uint32_t stalls;                    // faults caused by silence
+    uint32_t bursts;                    // faults caused by garbage
+    uint32_t actions[WDG_POWERCYCLE + 1];
+    uint32_t last_recovery_ms;          // fault detection -> first good epoch
+    uint32_t max_recovery_ms;
+} UART_WATCHDOG;
+
+
+/* Initialize the watchdog, now is the current tick in ms */
+void Watchdog_init(UART_WATCHDOG *wd, uint32_t now);
+
+/* Report a successfully decoded epoch (e.g. after populateGPSData) */
+void Watchdog_epoch(UART_WATCHDOG *wd, uint32_t now);
+
+/* Report sentences that failed the checksum or could not be decoded */
+void Watchdog_error(UART_WATCHDOG *wd, uint32_t count);
+
+/* Check the stream and escalate if needed, call it periodically (every few ms)
+ * Returns the current escalation level, WDG_OK while the stream is healthy
+ */
+wdg_level Watchdog_poll(UART_WATCHDOG *wd, uint32_t now);
+
+#endif /* UART_WATCHDOG_H_ */
@@ -0,0 +1,830 @@
+/*
+ * gnss_sim.c - Virtual GNSS receiver.
+ * Receiver side of a serial line: host bytes go through a small framer
+ * (NMEA lines, UBX frames) into the command handlers, receiver output is
+ * queued and drained at baud / 10 bytes per second, so a rate or sentence
+ * mask the line can not carry overflows the way it does on the real part.
+ * The receiver walks ACQUIRING -> TRACKING on the time to first fix of its
+ * start type, goes silent in STANDBY / BACKUP, and the truth position
+ * dead-reckons from the configured speed and course.
+ */
+
+#include "gnss_sim.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define EARTH_RADIUS_M      6371000.0
+#define MS_PER_KNOT         0.514444
+#define TOKEN_BURST_MS      250             // line credit kept while there is nothing to send
+#define CATCH_UP_EPOCHS     4               // further behind: skip epochs instead of replaying them
+#define SENTENCE_MAX        256
+
+// PMTK001 flags
+#define PMTK_INVALID        0
+#define PMTK_UNSUPPORTED    1
+#define PMTK_FAILED         2
+#define PMTK_OK             3
+
+static const uint32_t bauds[] = { 4800, 9600, 14400, 19200, 38400, 57600, 115200, 230400, 460800, 921600 };
+
+/* the sky: PRN, elevation, azimuth, C/N0 */
+static const uint16_t sky[GNSS_SIM_SATELLITES][4] =
+{
+    { 2, 67, 41, 45 },  { 5, 52, 298, 44 }, { 7, 40, 130, 42 }, { 9, 33, 210, 41 },
+    { 13, 28, 72, 39 }, { 15, 21, 325, 37 }, { 18, 17, 169, 35 }, { 20, 12, 254, 33 },
+    { 24, 9, 18, 30 },  { 26, 6, 105, 27 },  { 29, 4, 280, 24 },  { 30, 2, 190, 21 },
+};
+
+
+static int reached(uint32_t now, uint32_t tick)
+{
+    return (int32_t)(now - tick) >= 0;
+}
+
+static uint32_t next_random(GNSS_SIM *s)
+{
+    s->rng ^= s->rng << 13;
+    s->rng ^= s->rng >> 17;
+    s->rng ^= s->rng << 5;
+    return s->rng;
+}
+
+static int valid_baud(uint32_t baud)
+{
+    for (size_t i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++)
+    {
+        if (bauds[i] == baud) return 1;
+    }
+    return 0;
+}
+
+
+/*************************************** output ***************************************/
+
+static int enqueue(GNSS_SIM *s, const void *data, uint32_t len)
+{
+    if (GNSS_SIM_QUEUE - (s->tail - s->head) < len)
+    {
+        s->stats.overflow += len;
+        return -1;
+    }
+    for (uint32_t i = 0; i < len; i++)
+    {
+        s->queue[(s->tail + i) & (GNSS_SIM_QUEUE - 1)] = ((const uint8_t *)data)[i];
+    }
+    s->tail += len;
+    return 0;
+}
+
+/* "$<body>*<checksum>\r\n" */
+static void emit_nmea(GNSS_SIM *s, const char *body)
+{
+    char    sentence[SENTENCE_MAX + 8];
+    uint8_t sum = 0;
+    int     n;
+
+    for (const char *p = body; *p; p++) sum ^= (uint8_t)*p;
+    n = snprintf(sentence, sizeof(sentence), "$%s*%02X\r\n", body, sum);
+    if (n > 0 && n < (int)sizeof(sentence)) enqueue(s, sentence, (uint32_t)n);
+}
+
+static void emit_ubx(GNSS_SIM *s, uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len)
+{
+    uint8_t frame[6 + 100 + 2];
+    uint8_t a = 0, b = 0;
+
+    if (len > 100) return;
+
+    frame[0] = 0xB5;
+    frame[1] = 0x62;
+    frame[2] = cls;
+    frame[3] = id;
+    frame[4] = (uint8_t)len;
+    frame[5] = (uint8_t)(len >> 8);
+    memcpy(frame + 6, payload, len);
+    for (int i = 2; i < 6 + len; i++)
+    {
+        a = (uint8_t)(a + frame[i]);
+        b = (uint8_t)(b + a);
+    }
+    frame[6 + len] = a;
+    frame[7 + len] = b;
+    enqueue(s, frame, 8u + len);
+}
+
+static void pmtk_ack(GNSS_SIM *s, unsigned cmd, int flag)
+{
+    char body[32];
+
+    snprintf(body, sizeof(body), "PMTK001,%u,%d", cmd, flag);
+    emit_nmea(s, body);
+    if (flag == PMTK_OK) s->stats.acks++;
+    else s->stats.naks++;
+}
+
+static void ubx_ack(GNSS_SIM *s, uint8_t cls, uint8_t id, int ok)
+{
+    uint8_t payload[2] = { cls, id };
+
+    emit_ubx(s, 0x05, ok ? 0x01 : 0x00, payload, 2);
+    if (ok) s->stats.acks++;
+    else s->stats.naks++;
+}
+
+/*
+ * pace - Gives the line the bytes it could carry since the last call and
+ * writes that much of the queue.
+ *
+ */
+static void pace(GNSS_SIM *s, uint32_t now)
+{
+    uint64_t bits = (uint64_t)(now - s->last_refill) * s->baud + s->refill_rem;
+    uint32_t burst = s->baud / 10 * TOKEN_BURST_MS / 1000;
+
+    s->last_refill = now;
+    s->refill_rem  = (uint32_t)(bits % 10000);
+    bits /= 10000;                                      // 10 bits per byte, ms -> s
+    s->tokens = (uint32_t)(s->tokens + bits > burst ? burst : s->tokens + bits);
+
+    while (s->tokens && s->tail != s->head && s->cfg.write)
+    {
+        uint32_t at = s->head & (GNSS_SIM_QUEUE - 1);
+        uint32_t n = s->tail - s->head;
+        int      done;
+
+        if (n > GNSS_SIM_QUEUE - at) n = GNSS_SIM_QUEUE - at;
+        if (n > s->tokens) n = s->tokens;
+
+        done = s->cfg.write(s->cfg.ctx, &s->queue[at], (int)n);
+        if (done <= 0) break;
+
+        s->head         += (uint32_t)done;
+        s->tokens       -= (uint32_t)done;
+        s->stats.bytes  += (uint32_t)done;
+        if ((uint32_t)done < n) break;
+    }
+
+    if (s->pending_baud && reached(s->head, s->baud_tick))
+    {
+        s->baud         = s->pending_baud;
+        s->pending_baud = 0;
+        s->refill_rem   = 0;
+    }
+}
+
+
+/*************************************** receiver ***************************************/
+
+static void align_epochs(GNSS_SIM *s, uint32_t now)
+{
+    s->next_epoch = (now / s->rate_ms + 1) * s->rate_ms;
+}
+
+static uint32_t ttff(GNSS_SIM *s, gnss_sim_start start)
+{
+    uint32_t base = s->cfg.ttff_ms[start];
+    uint32_t spread = (uint32_t)((uint64_t)base * s->cfg.jitter_pct / 100);
+
+    return spread ? base - spread + next_random(s) % (2 * spread + 1) : base;
+}
+
+/* power on or restart: the receiver boots, says so and starts searching */
+static void power_on(GNSS_SIM *s, gnss_sim_start start, uint32_t now)
+{
+    s->state      = GNSS_SIM_ACQUIRING;
+    s->start_type = start;
+    s->start_tick = now;
+    s->fix_tick   = now + ttff(s, start);
+    s->lost       = 0;
+    s->wake_tick  = 0;
+    s->run_ms     = 0;
+    s->sleep_ms   = 0;
+    s->stats.starts++;
+
+    emit_nmea(s, "PMTK010,001");
+    align_epochs(s, now);
+}
+
+static void power_down(GNSS_SIM *s, gnss_sim_state state, uint32_t now)
+{
+    s->state    = state;
+    s->off_tick = now;
+    if (state == GNSS_SIM_BACKUP) s->run_ms = s->sleep_ms = 0;
+}
+
+/* advances the truth position by the time since the last move */
+static void move(GNSS_SIM *s, uint32_t now)
+{
+    double d, c = s->course * M_PI / 180.0;
+
+    if ((int32_t)(now - s->move_tick) <= 0) return;
+    d = s->knots * MS_PER_KNOT * (double)(now - s->move_tick) / 1000.0;
+    s->move_tick = now;
+
+    s->latitude  += d * cos(c) / EARTH_RADIUS_M * 180.0 / M_PI;
+    s->longitude += d * sin(c) / (EARTH_RADIUS_M * cos(s->latitude * M_PI / 180.0)) * 180.0 / M_PI;
+    if (s->longitude > 180.0) s->longitude -= 360.0;
+    if (s->longitude < -180.0) s->longitude += 360.0;
+}
+
+/* state changes due by now: first fix, periodic run / sleep phases, timed wake */
+static void advance(GNSS_SIM *s, uint32_t now)
+{
+    switch (s->state)
+    {
+        case GNSS_SIM_ACQUIRING:
+            if (!reached(now, s->fix_tick)) break;
+            s->state = GNSS_SIM_TRACKING;
+            if (!s->lost) s->stats.last_ttff_ms = now - s->start_tick;
+            s->lost = 0;
+            break;
+
+        case GNSS_SIM_STANDBY:
+            if (s->run_ms && reached(now, s->phase_tick))
+            {
+                s->state      = reached(now, s->fix_tick) ? GNSS_SIM_TRACKING : GNSS_SIM_ACQUIRING;
+                s->phase_tick = now + s->run_ms;
+            }
+            return;
+
+        case GNSS_SIM_BACKUP:
+            if (s->wake_tick && reached(now, s->wake_tick)) gnss_sim_wake(s, now);
+            return;
+
+        default:
+            break;
+    }
+
+    if (s->run_ms && reached(now, s->phase_tick))
+    {
+        power_down(s, GNSS_SIM_STANDBY, now);
+        s->phase_tick = now + s->sleep_ms;
+    }
+}
+
+
+/*************************************** sentences ***************************************/
+
+/* ddmm.mmmm,N / dddmm.mmmm,E */
+static void format_coord(char *out, size_t size, double deg, int lon)
+{
+    long long total = llround(fabs(deg) * 600000.0);    // 1/10000 minutes
+
+    snprintf(out, size, lon ? "%03lld%02lld.%04lld,%c" : "%02lld%02lld.%04lld,%c",
+             total / 600000, total / 10000 % 60, total % 10000,
+             lon ? (deg < 0 ? 'W' : 'E') : (deg < 0 ? 'S' : 'N'));
+}
+
+static void emit_epoch(GNSS_SIM *s, uint32_t tick)
+{
+    uint64_t  utc_ms = (uint64_t)s->cfg.utc_start * 1000 + tick;
+    time_t    sec = (time_t)(utc_ms / 1000);
+    int       fix = s->state == GNSS_SIM_TRACKING;
+    int       used = fix ? s->cfg.used : 0;
+    struct tm t;
+    char      hms[32], dmy[32], lat[32], lon[32], body[SENTENCE_MAX];
+    double    kmh = s->knots * 1.852;
+
+    gmtime_r(&sec, &t);
+    snprintf(hms, sizeof(hms), "%02d%02d%02d.%03u", t.tm_hour, t.tm_min, t.tm_sec, (unsigned)(utc_ms % 1000));
+    snprintf(dmy, sizeof(dmy), "%02d%02d%02d", t.tm_mday, t.tm_mon + 1, t.tm_year % 100);
+    format_coord(lat, sizeof(lat), s->latitude, 0);
+    format_coord(lon, sizeof(lon), s->longitude, 1);
+
+    s->epoch_count++;
+    s->stats.epochs++;
+    if (fix) s->stats.fixes++;
+
+#define DUE(out)    (s->rate[out] && s->epoch_count % s->rate[out] == 0)
+
+    if (DUE(GNSS_SIM_GLL))
+    {
+        if (fix) snprintf(body, sizeof(body), "GPGLL,%s,%s,%s,A,A", lat, lon, hms);
+        else snprintf(body, sizeof(body), "GPGLL,,,,,%s,V,N", hms);
+        emit_nmea(s, body);
+    }
+    if (DUE(GNSS_SIM_RMC))
+    {
+        if (fix) snprintf(body, sizeof(body), "GPRMC,%s,A,%s,%s,%.2f,%.2f,%s,,,A", hms, lat, lon, s->knots, s->course, dmy);
+        else snprintf(body, sizeof(body), "GPRMC,%s,V,,,,,,,%s,,,N", hms, dmy);
+        emit_nmea(s, body);
+    }
+    if (DUE(GNSS_SIM_VTG))
+    {
+        if (fix) snprintf(body, sizeof(body), "GPVTG,%.2f,T,,M,%.2f,N,%.2f,K,A", s->course, s->knots, kmh);
+        else snprintf(body, sizeof(body), "GPVTG,,T,,M,,N,,K,N");
+        emit_nmea(s, body);
+    }
+    if (DUE(GNSS_SIM_GGA))
+    {
+        if (fix) snprintf(body, sizeof(body), "GPGGA,%s,%s,%s,1,%02d,0.90,%.1f,M,0.0,M,,", hms, lat, lon, used, s->altitude);
+        else snprintf(body, sizeof(body), "GPGGA,%s,,,,,0,00,99.99,,M,,M,,", hms);
+        emit_nmea(s, body);
+    }
+    if (DUE(GNSS_SIM_GSA))
+    {
+        int n = snprintf(body, sizeof(body), "GPGSA,A,%d", fix ? 3 : 1);
+
+        for (int i = 0; i < GNSS_SIM_SATELLITES; i++)
+        {
+            n += i < used ? snprintf(body + n, sizeof(body) - (size_t)n, ",%02u", sky[i][0])
+                          : snprintf(body + n, sizeof(body) - (size_t)n, ",");
+        }
+        snprintf(body + n, sizeof(body) - (size_t)n, fix ? ",1.20,0.90,0.80" : ",99.99,99.99,99.99");
+        emit_nmea(s, body);
+    }
+    if (DUE(GNSS_SIM_GSV))
+    {
+        int pages = (GNSS_SIM_SATELLITES + 3) / 4;
+
+        for (int p = 0; p < pages; p++)
+        {
+            int n = snprintf(body, sizeof(body), "GPGSV,%d,%d,%02d", pages, p + 1, GNSS_SIM_SATELLITES);
+
+            for (int i = p * 4; i < p * 4 + 4 && i < GNSS_SIM_SATELLITES; i++)
+            {
+                if (s->state == GNSS_SIM_TRACKING)
+                    n += snprintf(body + n, sizeof(body) - (size_t)n, ",%02u,%02u,%03u,%02u",
+                                  sky[i][0], sky[i][1], sky[i][2], sky[i][3]);
+                else
+                    n += snprintf(body + n, sizeof(body) - (size_t)n, ",%02u,,,", sky[i][0]);
+            }
+            emit_nmea(s, body);
+        }
+    }
+    if (DUE(GNSS_SIM_NAV_PVT))
+    {
+        uint8_t pvt[92];
+        double  speed = s->knots * MS_PER_KNOT * 1000.0, c = s->course * M_PI / 180.0;
+        int32_t v[6] =
+        {
+            (int32_t)lround(s->longitude * 1e7), (int32_t)lround(s->latitude * 1e7),
+            (int32_t)lround(s->altitude * 1000.0), (int32_t)lround(s->altitude * 1000.0),
+            fix ? 2500 : 0x7FFFFFFF, fix ? 4000 : 0x7FFFFFFF,
+        };
+        int32_t vel[5] =
+        {
+            (int32_t)lround(speed * cos(c)), (int32_t)lround(speed * sin(c)), 0,
+            (int32_t)lround(speed), (int32_t)lround(s->course * 1e5),
+        };
+        uint32_t itow = (uint32_t)(((utc_ms / 1000 - 315964800 + 18) % 604800) * 1000 + utc_ms % 1000);
+        uint16_t year = (uint16_t)(t.tm_year + 1900);
+
+        memset(pvt, 0, sizeof(pvt));
+        memcpy(pvt + 0, &itow, 4);                      // little endian host
+        memcpy(pvt + 4, &year, 2);
+        pvt[6]  = (uint8_t)(t.tm_mon + 1);
+        pvt[7]  = (uint8_t)t.tm_mday;
+        pvt[8]  = (uint8_t)t.tm_hour;
+        pvt[9]  = (uint8_t)t.tm_min;
+        pvt[10] = (uint8_t)t.tm_sec;
+        pvt[11] = 0x07;                                 // date, time, fully resolved
+        pvt[20] = fix ? 3 : 0;
+        pvt[21] = fix ? 0x01 : 0x00;
+        pvt[23] = (uint8_t)used;
+        memcpy(pvt + 24, v, sizeof(v));
+        memcpy(pvt + 48, vel, sizeof(vel));
+        emit_ubx(s, 0x01, 0x07, pvt, sizeof(pvt));
+    }
+
+#undef DUE
+}
+
+
+/*************************************** commands ***************************************/
+
+static void set_defaults(GNSS_SIM *s)
+{
+    uint32_t outputs = s->cfg.outputs ? s->cfg.outputs : GNSS_SIM_DEFAULT_OUTPUTS;
+
+    for (int i = 0; i < GNSS_SIM_OUTPUTS; i++) s->rate[i] = (outputs >> i) & 1;
+}
+
+static void handle_pmtk(GNSS_SIM *s, const char *line, uint32_t now)
+{
+    unsigned cmd = (unsigned)strtoul(line + 5, NULL, 10);
+    long     arg[20];
+    int      args = 0;
+
+    for (const char *p = strchr(line, ','); p && args < 20; p = strchr(p + 1, ','))
+    {
+        arg[args++] = strtol(p + 1, NULL, 10);
+    }
+
+    switch (cmd)
+    {
+        case 101:                                       // restarts answer with the boot message only
+        case 102:
+        case 103:
+        case 104:
+            s->stats.commands++;
+            gnss_sim_restart(s, cmd == 101 ? GNSS_SIM_HOT : cmd == 102 ? GNSS_SIM_WARM : GNSS_SIM_COLD, now);
+            return;
+
+        case 161:
+            if (args < 1 || arg[0] != 0) break;
+            pmtk_ack(s, cmd, PMTK_OK);
+            power_down(s, GNSS_SIM_STANDBY, now);
+            s->stats.commands++;
+            return;
+
+        case 220:
+            if (args < 1 || arg[0] < 100 || arg[0] > 10000)
+            {
+                pmtk_ack(s, cmd, PMTK_FAILED);
+                return;
+            }
+            s->rate_ms = (uint32_t)arg[0];
+            align_epochs(s, now);
+            pmtk_ack(s, cmd, PMTK_OK);
+            s->stats.commands++;
+            return;
+
+        case 225:
+            if (args < 1) break;
+            if (arg[0] == 0)
+            {
+                s->run_ms = s->sleep_ms = 0;
+                if (s->state == GNSS_SIM_STANDBY) gnss_sim_wake(s, now);
+            }
+            else if (arg[0] == 2 && args >= 3 && arg[1] > 0 && arg[2] > 0)
+            {
+                s->run_ms     = (uint32_t)arg[1];
+                s->sleep_ms   = (uint32_t)arg[2];
+                s->phase_tick = now + s->run_ms;
+            }
+            else if (arg[0] == 4)
+            {
+                pmtk_ack(s, cmd, PMTK_OK);
+                power_down(s, GNSS_SIM_BACKUP, now);
+                s->stats.commands++;
+                return;
+            }
+            else
+            {
+                pmtk_ack(s, cmd, arg[0] == 2 ? PMTK_FAILED : PMTK_UNSUPPORTED);
+                return;
+            }
+            pmtk_ack(s, cmd, PMTK_OK);
+            s->stats.commands++;
+            return;
+
+        case 251:
+            if (args < 1 || (arg[0] != 0 && !valid_baud((uint32_t)arg[0])))
+            {
+                pmtk_ack(s, cmd, PMTK_FAILED);
+                return;
+            }
+            pmtk_ack(s, cmd, PMTK_OK);
+            s->pending_baud = arg[0] ? (uint32_t)arg[0] : s->cfg.baud;
+            s->baud_tick    = s->tail;
+            s->stats.commands++;
+            return;
+
+        case 314:
+            if (args >= 1 && arg[0] == -1)
+            {
+                set_defaults(s);
+            }
+            else if (args >= GNSS_SIM_NAV_PVT)
+            {
+                for (int i = 0; i < GNSS_SIM_NAV_PVT; i++)
+                {
+                    if (arg[i] < 0 || arg[i] > 5)
+                    {
+                        pmtk_ack(s, cmd, PMTK_FAILED);
+                        return;
+                    }
+                }
+                for (int i = 0; i < GNSS_SIM_NAV_PVT; i++) s->rate[i] = (uint8_t)arg[i];
+            }
+            else
+            {
+                break;
+            }
+            pmtk_ack(s, cmd, PMTK_OK);
+            s->stats.commands++;
+            return;
+
+        default:
+            pmtk_ack(s, cmd, PMTK_UNSUPPORTED);
+            return;
+    }
+    pmtk_ack(s, cmd, PMTK_INVALID);
+}
+
+/* NMEA message of a CFG-MSG class / id, -1 if not simulated */
+static int ubx_output(uint8_t cls, uint8_t id)
+{
+    static const int8_t nmea_id[6] = { GNSS_SIM_GGA, GNSS_SIM_GLL, GNSS_SIM_GSA, GNSS_SIM_GSV, GNSS_SIM_RMC, GNSS_SIM_VTG };
+
+    if (cls == 0xF0 && id < 6) return nmea_id[id];
+    if (cls == 0x01 && id == 0x07) return GNSS_SIM_NAV_PVT;
+    return -1;
+}
+
+static void handle_ubx(GNSS_SIM *s, const uint8_t *frame, uint32_t now)
+{
+    uint8_t        cls = frame[2], id = frame[3];
+    uint16_t       len = (uint16_t)(frame[4] | frame[5] << 8);
+    const uint8_t *p = frame + 6;
+    uint32_t       u32;
+    uint16_t       u16;
+    int            out;
+
+    if (cls == 0x06 && id == 0x08 && len == 6)              // CFG-RATE
+    {
+        memcpy(&u16, p, 2);
+        if (u16 < 50 || u16 > 10000)
+        {
+            ubx_ack(s, cls, id, 0);
+            return;
+        }
+        s->rate_ms = u16;
+        align_epochs(s, now);
+    }
+    else if (cls == 0x06 && id == 0x00 && len == 20)        // CFG-PRT
+    {
+        memcpy(&u32, p + 8, 4);
+        if (!valid_baud(u32))
+        {
+            ubx_ack(s, cls, id, 0);
+            return;
+        }
+        ubx_ack(s, cls, id, 1);
+        s->pending_baud = u32;
+        s->baud_tick    = s->tail;
+        s->stats.commands++;
+        return;
+    }
+    else if (cls == 0x06 && id == 0x01 && (len == 3 || len == 8))   // CFG-MSG, rate on this port (UART1)
+    {
+        if ((out = ubx_output(p[0], p[1])) < 0)
+        {
+            ubx_ack(s, cls, id, 0);
+            return;
+        }
+        s->rate[out] = len == 3 ? p[2] : p[3];
+    }
+    else if (cls == 0x06 && id == 0x04 && len == 4)         // CFG-RST: no ack, the receiver restarts
+    {
+        memcpy(&u16, p, 2);
+        s->stats.commands++;
+        gnss_sim_restart(s, u16 == 0 ? GNSS_SIM_HOT : u16 == 0xFFFF ? GNSS_SIM_COLD : GNSS_SIM_WARM, now);
+        return;
+    }
+    else if (cls == 0x02 && id == 0x41 && (len == 8 || len == 16))  // RXM-PMREQ: no ack
+    {
+        uint32_t duration, flags;
+
+        memcpy(&duration, p + (len == 16 ? 4 : 0), 4);
+        memcpy(&flags, p + (len == 16 ? 8 : 4), 4);
+        if (flags & 0x02)
+        {
+            power_down(s, GNSS_SIM_BACKUP, now);
+            s->wake_tick = duration ? now + duration : 0;
+            s->stats.commands++;
+        }
+        return;
+    }
+    else
+    {
+        if (cls == 0x06) ubx_ack(s, cls, id, 0);
+        return;
+    }
+    ubx_ack(s, cls, id, 1);
+    s->stats.commands++;
+}
+
+static int nmea_valid(const char *line, int len)
+{
+    const char *star = memchr(line, '*', (size_t)len);
+    uint8_t     sum = 0;
+    unsigned    given;
+
+    if (!star || star + 3 > line + len || sscanf(star + 1, "%2x", &given) != 1) return 0;
+    for (const char *p = line + 1; p < star; p++) sum ^= (uint8_t)*p;
+    return sum == given;
+}
+
+static int ubx_valid(const uint8_t *frame, int len)
+{
+    uint8_t a = 0, b = 0;
+
+    for (int i = 2; i < len - 2; i++)
+    {
+        a = (uint8_t)(a + frame[i]);
+        b = (uint8_t)(b + a);
+    }
+    return frame[len - 2] == a && frame[len - 1] == b;
+}
+
+/* one host byte through the framer */
+static void input_byte(GNSS_SIM *s, uint8_t c, uint32_t now)
+{
+    if (s->line_len == 0)
+    {
+        if (c == '$' || c == 0xB5) s->line[s->line_len++] = c;
+        return;
+    }
+
+    if (s->line[0] == 0xB5)
+    {
+        s->line[s->line_len++] = c;
+        if (s->line_len == 2 && c != 0x62)
+        {
+            s->line_len = 0;
+            return;
+        }
+        if (s->line_len == 6)
+        {
+            s->ubx_len = 8 + (s->line[4] | s->line[5] << 8);
+            if (s->ubx_len > GNSS_SIM_LINE_MAX)
+            {
+                s->stats.bad_commands++;
+                s->line_len = s->ubx_len = 0;
+            }
+        }
+        else if (s->ubx_len && s->line_len == s->ubx_len)
+        {
+            if (ubx_valid(s->line, s->ubx_len)) handle_ubx(s, s->line, now);
+            else s->stats.bad_commands++;
+            s->line_len = s->ubx_len = 0;
+        }
+        return;
+    }
+
+    if (c == '\r' || c == '\n')
+    {
+        s->line[s->line_len] = '\0';
+        if (!nmea_valid((const char *)s->line, s->line_len)) s->stats.bad_commands++;
+        else if (memcmp(s->line, "$PMTK", 5) == 0) handle_pmtk(s, (const char *)s->line, now);
+        s->line_len = 0;
+    }
+    else if (c == '$')
+    {
+        s->line_len = 1;                                // cut by a new sentence
+        s->stats.bad_commands++;
+    }
+    else if (s->line_len < GNSS_SIM_LINE_MAX - 1)
+    {
+        s->line[s->line_len++] = c;
+    }
+    else
+    {
+        s->line_len = 0;
+        s->stats.bad_commands++;
+    }
+}
+
+
+/*************************************** public ***************************************/
+
+/*
+ * gnss_sim_init - Powers the receiver on at now_ms with cfg (copied, zero
+ * fields take the GNSS_SIM_* defaults).
+ * @return  0, -1 if cfg is unusable.
+ *
+ */
+int gnss_sim_init(GNSS_SIM *sim, const GNSS_SIM_CONFIG *cfg, uint32_t now_ms)
+{
+    static const uint32_t default_ttff[GNSS_SIM_COLD + 1] =
+    {
+        GNSS_SIM_HOT_TTFF_MS, GNSS_SIM_WARM_TTFF_MS, GNSS_SIM_COLD_TTFF_MS
+    };
+
+    if (!sim || !cfg || (cfg->baud && !valid_baud(cfg->baud)) || cfg->start > GNSS_SIM_COLD) return -1;
+
+    memset(sim, 0, sizeof(GNSS_SIM));
+    sim->cfg = *cfg;
+    if (!sim->cfg.baud) sim->cfg.baud = GNSS_SIM_BAUD;
+    if (!sim->cfg.rate_ms) sim->cfg.rate_ms = GNSS_SIM_RATE_MS;
+    if (!sim->cfg.reacquire_ms) sim->cfg.reacquire_ms = GNSS_SIM_REACQUIRE_MS;
+    if (!sim->cfg.hot_window_ms) sim->cfg.hot_window_ms = GNSS_SIM_HOT_WINDOW_MS;
+    if (!sim->cfg.used || sim->cfg.used > GNSS_SIM_SATELLITES) sim->cfg.used = GNSS_SIM_USED;
+    if (!sim->cfg.utc_start) sim->cfg.utc_start = GNSS_SIM_UTC_START;
+    for (int i = 0; i <= GNSS_SIM_COLD; i++)
+    {
+        if (!sim->cfg.ttff_ms[i]) sim->cfg.ttff_ms[i] = default_ttff[i];
+    }
+
+    sim->baud        = sim->cfg.baud;
+    sim->rate_ms     = sim->cfg.rate_ms;
+    sim->rng         = sim->cfg.seed ? sim->cfg.seed : 0x9E3779B9u;
+    sim->latitude    = cfg->latitude;
+    sim->longitude   = cfg->longitude;
+    sim->altitude    = cfg->altitude;
+    sim->knots       = cfg->knots;
+    sim->course      = cfg->course;
+    sim->move_tick   = now_ms;
+    sim->last_refill = now_ms;
+    set_defaults(sim);
+
+    power_on(sim, cfg->start, now_ms);
+    return 0;
+}
+
+/*
+ * gnss_sim_input - Host bytes (PMTK sentences, UBX frames). Input that
+ * arrives in STANDBY or BACKUP wakes the receiver and is lost; the rest of
+ * the input that carried a standby / backup command is ignored.
+ *
+ */
+void gnss_sim_input(GNSS_SIM *sim, const uint8_t *data, int len, uint32_t now_ms)
+{
+    advance(sim, now_ms);                               // not the output: the writer may call in here
+
+    if (sim->state == GNSS_SIM_STANDBY || sim->state == GNSS_SIM_BACKUP)
+    {
+        if (len > 0) gnss_sim_wake(sim, now_ms);
+        return;
+    }
+    for (int i = 0; i < len && sim->state != GNSS_SIM_STANDBY && sim->state != GNSS_SIM_BACKUP; i++)
+    {
+        input_byte(sim, data[i], now_ms);
+    }
+}
+
+/*
+ * gnss_sim_poll - Runs the receiver up to now_ms: state changes, the
+ * navigation epochs due, and as much output as the line carries.
+ * @return  bytes still queued for the host.
+ *
+ */
+int gnss_sim_poll(GNSS_SIM *sim, uint32_t now_ms)
+{
+    advance(sim, now_ms);
+
+    if (reached(now_ms, sim->next_epoch + CATCH_UP_EPOCHS * sim->rate_ms)) align_epochs(sim, now_ms - sim->rate_ms);
+    while (reached(now_ms, sim->next_epoch))
+    {
+        move(sim, sim->next_epoch);
+        if (sim->state == GNSS_SIM_ACQUIRING || sim->state == GNSS_SIM_TRACKING) emit_epoch(sim, sim->next_epoch);
+        sim->next_epoch += sim->rate_ms;
+    }
+
+    pace(sim, now_ms);
+    return (int)(sim->tail - sim->head);
+}
+
+/*
+ * gnss_sim_wake - WAKEUP pin / any byte: out of STANDBY, or out of BACKUP
+ * with a hot start if it was off less than hot_window_ms, else warm.
+ *
+ */
+void gnss_sim_wake(GNSS_SIM *sim, uint32_t now_ms)
+{
+    if (sim->state == GNSS_SIM_STANDBY)
+    {
+        sim->state = reached(now_ms, sim->fix_tick) ? GNSS_SIM_TRACKING : GNSS_SIM_ACQUIRING;
+        if (sim->run_ms) sim->phase_tick = now_ms + sim->run_ms;
+    }
+    else if (sim->state == GNSS_SIM_BACKUP)
+    {
+        power_on(sim, now_ms - sim->off_tick < sim->cfg.hot_window_ms ? GNSS_SIM_HOT : GNSS_SIM_WARM, now_ms);
+    }
+}
+
+void gnss_sim_restart(GNSS_SIM *sim, gnss_sim_start start, uint32_t now_ms)
+{
+    power_on(sim, start, now_ms);
+}
+
+/*
+ * gnss_sim_outage - Sky blocked (tunnel, jamming) for duration_ms: no fix,
+ * back reacquire_ms after it ends. Ignored while the receiver is off.
+ *
+ */
+void gnss_sim_outage(GNSS_SIM *sim, uint32_t duration_ms, uint32_t now_ms)
+{
+    uint32_t back = now_ms + duration_ms + sim->cfg.reacquire_ms;
+
+    if (sim->state == GNSS_SIM_TRACKING)
+    {
+        sim->state    = GNSS_SIM_ACQUIRING;
+        sim->fix_tick = back;
+        sim->lost     = 1;
+    }
+    else if (sim->state == GNSS_SIM_ACQUIRING && reached(back, sim->fix_tick))
+    {
+        sim->fix_tick = back;                           // still searching: the first fix comes later
+    }
+}
+
+void gnss_sim_position(GNSS_SIM *sim, double latitude, double longitude, double altitude, uint32_t now_ms)
+{
+    sim->move_tick = now_ms;
+    sim->latitude  = latitude;
+    sim->longitude = longitude;
+    sim->altitude  = altitude;
+}
+
+void gnss_sim_motion(GNSS_SIM *sim, double knots, double course, uint32_t now_ms)
+{
+    move(sim, now_ms);
+    sim->knots  = knots;
+    sim->course = course;
+}
@@ -0,0 +1,158 @@
+/*
+ * gnss_sim.h
+ *
+ * Virtual GNSS receiver (Linux) for integration tests: an MTK / u-blox
+ * like module that talks NMEA and UBX at a paced baud rate, honours the
+ * PMTK and UBX configuration commands the library sends (rate, baud,
+ * sentence mask, standby / periodic / backup modes, restarts) with the
+ * acks a real receiver gives, and models cold / warm / hot time to first
+ * fix and loss of fix. Like gps_power, all timing comes from the caller
+ * (ms ticks), so it runs in process against a virtual clock or behind a
+ * pty in real time (gnss_sim_tool).
+ */
+
+#ifndef INC_GNSS_SIM_H_
+#define INC_GNSS_SIM_H_
+
+#include <stdint.h>
+
+#define GNSS_SIM_QUEUE          2048                // bytes waiting for the line (power of 2), more are dropped
+#define GNSS_SIM_LINE_MAX       128                 // longest command accepted
+#define GNSS_SIM_SATELLITES     12                  // in view
+
+/* defaults, used for the zero fields of GNSS_SIM_CONFIG */
+#define GNSS_SIM_BAUD           9600
+#define GNSS_SIM_RATE_MS        1000
+#define GNSS_SIM_HOT_TTFF_MS    1000
+#define GNSS_SIM_WARM_TTFF_MS   33000
+#define GNSS_SIM_COLD_TTFF_MS   35000
+#define GNSS_SIM_REACQUIRE_MS   1000                // fix back after an outage ends
+#define GNSS_SIM_HOT_WINDOW_MS  7200000             // off (backup) for less: hot start, else warm
+#define GNSS_SIM_USED           8                   // satellites in the solution
+#define GNSS_SIM_UTC_START      1704067200u         // 2024-01-01 00:00:00
+
+// outputs, the first six in PMTK314 order
+typedef enum
+{
+    GNSS_SIM_GLL = 0,
+    GNSS_SIM_RMC,
+    GNSS_SIM_VTG,
+    GNSS_SIM_GGA,
+    GNSS_SIM_GSA,
+    GNSS_SIM_GSV,
+    GNSS_SIM_NAV_PVT,                               // UBX NAV-PVT
+    GNSS_SIM_OUTPUTS
+} gnss_sim_output;
+
+#define GNSS_SIM_DEFAULT_OUTPUTS    ((1u << GNSS_SIM_RMC) | (1u << GNSS_SIM_VTG) | (1u << GNSS_SIM_GGA) | \
+                                     (1u << GNSS_SIM_GSA) | (1u << GNSS_SIM_GSV))
+
+typedef enum
+{
+    GNSS_SIM_HOT = 0,
+    GNSS_SIM_WARM,
+    GNSS_SIM_COLD
+} gnss_sim_start;
+
+typedef enum
+{
+    GNSS_SIM_ACQUIRING = 0,                         // powered, no fix yet (sentences without a fix)
+    GNSS_SIM_TRACKING,
+    GNSS_SIM_STANDBY,                               // PMTK161 or periodic sleep: silent, keeps its fix
+    GNSS_SIM_BACKUP                                 // PMTK225,4 / RXM-PMREQ: silent, RTC and ephemeris only
+} gnss_sim_state;
+
+// receiver bytes to the host, returns the bytes accepted
+typedef int (*gnss_sim_writer)(void *ctx, const uint8_t *data, int len);
+
+typedef struct
+{
+    uint32_t        baud;
+    uint32_t        rate_ms;                        // fix interval
+    uint32_t        outputs;                        // (1 << gnss_sim_output) bits, 0 = GNSS_SIM_DEFAULT_OUTPUTS
+    gnss_sim_start  start;                          // at power on
+    uint32_t        ttff_ms[GNSS_SIM_COLD + 1];     // per gnss_sim_start
+    uint8_t         jitter_pct;                     // random spread of the TTFF, +-
+    uint32_t        reacquire_ms;
+    uint32_t        hot_window_ms;
+    uint8_t         used;                           // satellites in the solution
+    uint32_t        utc_start;                      // UTC (unix seconds) at tick 0
+    uint32_t        seed;
+
+    double          latitude, longitude;            // degrees, initial position
+    double          altitude;                       // m above MSL
+    double          knots, course;                  // motion, course in degrees
+
+    gnss_sim_writer write;
+    void            *ctx;
+} GNSS_SIM_CONFIG;
+
+typedef struct
+{
+    uint32_t    epochs;                             // navigation epochs output
+    uint32_t    fixes;                              // of which with a fix
+    uint32_t    starts;
+    uint32_t    last_ttff_ms;                       // power on / restart to first fix
+    uint32_t    commands;                           // accepted PMTK / UBX commands
+    uint32_t    acks, naks;
+    uint32_t    bad_commands;                       // bad checksum or framing
+    uint32_t    overflow;                           // bytes dropped, the line was too slow
+    uint64_t    bytes;                              // written to the host
+} GNSS_SIM_STATS;
+
+typedef struct
+{
+    GNSS_SIM_CONFIG cfg;
+    uint32_t        baud, rate_ms;
+    uint32_t        pending_baud;                   // once the bytes queued up to the ack went out
+    uint32_t        baud_tick;                      // queue position of the end of the ack
+    uint8_t         rate[GNSS_SIM_OUTPUTS];         // output every n-th epoch, 0 = off
+
+    /* receiver */
+    gnss_sim_state  state;
+    gnss_sim_start  start_type;
+    uint32_t        start_tick;                     // power on / restart
+    uint32_t        fix_tick;                       // ACQUIRING: fix from then on
+    uint8_t         lost;                           // acquiring after an outage, not a start
+    uint32_t        off_tick;                       // entered STANDBY / BACKUP
+    uint32_t        wake_tick;                      // timed wake (RXM-PMREQ), 0 = none
+    uint32_t        run_ms, sleep_ms;               // periodic mode, 0 = off
+    uint32_t        phase_tick;                     // end of the current run / sleep phase
+    uint32_t        next_epoch;
+    uint32_t        epoch_count;
+    uint32_t        rng;
+
+    /* truth */
+    double          latitude, longitude, altitude;
+    double          knots, course;
+    uint32_t        move_tick;
+
+    /* host -> receiver */
+    uint8_t         line[GNSS_SIM_LINE_MAX];
+    int             line_len;
+    int             ubx_len;                        // expected UBX frame length, 0 = NMEA / idle
+
+    /* receiver -> host, paced at baud */
+    uint8_t         queue[GNSS_SIM_QUEUE];
+    uint32_t        head, tail;
+    uint32_t        tokens;                         // bytes the line can take now
+    uint32_t        refill_rem;
+    uint32_t        last_refill;
+
+    GNSS_SIM_STATS  stats;
+} GNSS_SIM;
+
+
+// Public function declarations
+int  gnss_sim_init(GNSS_SIM *sim, const GNSS_SIM_CONFIG *cfg, uint32_t now_ms);
+void gnss_sim_input(GNSS_SIM *sim, const uint8_t *data, int len, uint32_t now_ms);
+int  gnss_sim_poll(GNSS_SIM *sim, uint32_t now_ms);
+
+/* scripting: pins and events a test drives besides the serial line */
+void gnss_sim_wake(GNSS_SIM *sim, uint32_t now_ms);
+void gnss_sim_restart(GNSS_SIM *sim, gnss_sim_start start, uint32_t now_ms);
+void gnss_sim_outage(GNSS_SIM *sim, uint32_t duration_ms, uint32_t now_ms);
+void gnss_sim_position(GNSS_SIM *sim, double latitude, double longitude, double altitude, uint32_t now_ms);
+void gnss_sim_motion(GNSS_SIM *sim, double knots, double course, uint32_t now_ms);
+
+#endif /* INC_GNSS_SIM_H_ */
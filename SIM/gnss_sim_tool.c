@@ -0,0 +1,294 @@
+/*
+ * gnss_sim_tool.c - Virtual receiver behind a pseudo terminal.
+ *
+ *   gnsssim [options]
+ *
+ *   -b baud             initial baud rate (default 9600)
+ *   -r ms               fix interval (default 1000)
+ *   -s hot|warm|cold    start at power on (default cold)
+ *   -p lat,lon[,alt]    position, degrees and m
+ *   -v knots,course     motion
+ *   -j pct              TTFF spread, +- percent
+ *   -u                  UBX NAV-PVT output on as well
+ *   -l path             symlink to the pty (e.g. /tmp/ttyGPS)
+ *   -x script           timed events, see below
+ *   -t s                stop after s seconds (default: on SIGINT)
+ *
+ * The host opens the pty like a serial port. Its termios speed has to
+ * match the receiver's baud rate (including after a PMTK251 / CFG-PRT),
+ * else both directions turn into noise, as on a real line.
+ *
+ * Script lines: "<ms since start> <event> [args]", '#' starts a comment:
+ *   pos <lat> <lon> [alt]       move <knots> <course>
+ *   outage <ms>                 restart hot|warm|cold
+ *   wake                        (WAKEUP pin)
+ */
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+
+#include "gnss_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#define POLL_MS     2
+
+typedef struct
+{
+    uint32_t    at_ms;
+    char        event[16];
+    double      a, b, c;
+    char        word[16];
+} SCRIPT_EVENT;
+
+static volatile sig_atomic_t running = 1;
+static int                   master = -1, slave = -1;
+static GNSS_SIM              sim;
+static uint64_t              noise;             // bytes garbled by a baud mismatch
+
+
+static void stop(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+static uint32_t now_ms(const struct timespec *t0)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint32_t)((t.tv_sec - t0->tv_sec) * 1000 + (t.tv_nsec - t0->tv_nsec) / 1000000);
+}
+
+static speed_t speed_of(uint32_t baud)
+{
+    switch (baud)
+    {
+        case 4800:   return B4800;
+        case 9600:   return B9600;
+        case 19200:  return B19200;
+        case 38400:  return B38400;
+        case 57600:  return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        default:     return B0;
+    }
+}
+
+/* the host's line speed matches the receiver's */
+static int line_ok(void)
+{
+    struct termios tio;
+    speed_t        want = speed_of(sim.baud);
+
+    if (want == B0 || tcgetattr(slave, &tio) != 0) return 1;      // no termios constant: not checked
+    return cfgetospeed(&tio) == want;
+}
+
+static int write_pty(void *ctx, const uint8_t *data, int len)
+{
+    uint8_t garbled[512];
+    ssize_t n;
+
+    (void)ctx;
+    if (!line_ok())
+    {
+        if (len > (int)sizeof(garbled)) len = (int)sizeof(garbled);
+        for (int i = 0; i < len; i++) garbled[i] = (uint8_t)((data[i] ^ 0x5A) | 0x80);
+        data   = garbled;
+        noise += (uint64_t)len;
+    }
+
+    n = write(master, data, (size_t)len);
+    if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    return (int)n;
+}
+
+static int load_script(const char *path, SCRIPT_EVENT **events, int *count)
+{
+    FILE *f = fopen(path, "r");
+    char  line[256];
+    int   cap = 0;
+
+    if (!f) return -1;
+
+    *events = NULL;
+    *count  = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        SCRIPT_EVENT e;
+        char        *hash = strchr(line, '#');
+
+        if (hash) *hash = '\0';
+        memset(&e, 0, sizeof(e));
+        if (sscanf(line, "%u %15s", &e.at_ms, e.event) != 2) continue;
+
+        const char *args = strstr(line, e.event) + strlen(e.event);
+        if (sscanf(args, "%lf %lf %lf", &e.a, &e.b, &e.c) < 1) sscanf(args, "%15s", e.word);
+
+        if (*count == cap)
+        {
+            SCRIPT_EVENT *p = realloc(*events, (size_t)(cap ? cap * 2 : 16) * sizeof(SCRIPT_EVENT));
+
+            if (!p)
+            {
+                fclose(f);
+                return -1;
+            }
+            *events = p;
+            cap     = cap ? cap * 2 : 16;
+        }
+        (*events)[(*count)++] = e;
+    }
+    fclose(f);
+    return 0;
+}
+
+static gnss_sim_start parse_start(const char *word)
+{
+    if (strcmp(word, "hot") == 0) return GNSS_SIM_HOT;
+    if (strcmp(word, "warm") == 0) return GNSS_SIM_WARM;
+    return GNSS_SIM_COLD;
+}
+
+static void run_event(const SCRIPT_EVENT *e, uint32_t now)
+{
+    if (strcmp(e->event, "pos") == 0) gnss_sim_position(&sim, e->a, e->b, e->c, now);
+    else if (strcmp(e->event, "move") == 0) gnss_sim_motion(&sim, e->a, e->b, now);
+    else if (strcmp(e->event, "outage") == 0) gnss_sim_outage(&sim, (uint32_t)e->a, now);
+    else if (strcmp(e->event, "restart") == 0) gnss_sim_restart(&sim, parse_start(e->word), now);
+    else if (strcmp(e->event, "wake") == 0) gnss_sim_wake(&sim, now);
+    else fprintf(stderr, "gnsssim: unknown event '%s' ignored\n", e->event);
+}
+
+/* master side of a raw pty at the receiver's speed, the slave kept open so the master never sees a hang up */
+static int open_pty(uint32_t baud, const char *link)
+{
+    struct termios tio;
+    const char    *name;
+
+    if ((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0) return -1;
+    if (grantpt(master) != 0 || unlockpt(master) != 0 || !(name = ptsname(master))) return -1;
+    if ((slave = open(name, O_RDWR | O_NOCTTY)) < 0) return -1;
+
+    if (tcgetattr(slave, &tio) != 0) return -1;
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, speed_of(baud));
+    cfsetospeed(&tio, speed_of(baud));
+    if (tcsetattr(slave, TCSANOW, &tio) != 0) return -1;
+    if (fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK) != 0) return -1;
+
+    if (link)
+    {
+        unlink(link);
+        if (symlink(name, link) != 0) return -1;
+    }
+    printf("%s\n", link ? link : name);
+    fflush(stdout);
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: gnsssim [-b baud] [-r ms] [-s hot|warm|cold] [-p lat,lon[,alt]] [-v knots,course]\n"
+                    "               [-j pct] [-u] [-l link] [-x script] [-t s]\n");
+}
+
+int main(int argc, char **argv)
+{
+    GNSS_SIM_CONFIG cfg;
+    SCRIPT_EVENT   *events = NULL;
+    int             event_count = 0, next_event = 0, opt;
+    const char     *link = NULL, *script = NULL;
+    uint32_t        duration_ms = 0;
+    struct timespec t0;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.start = GNSS_SIM_COLD;
+
+    while ((opt = getopt(argc, argv, "b:r:s:p:v:j:ul:x:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b': cfg.baud       = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'r': cfg.rate_ms    = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 's': cfg.start      = parse_start(optarg); break;
+            case 'p': sscanf(optarg, "%lf,%lf,%lf", &cfg.latitude, &cfg.longitude, &cfg.altitude); break;
+            case 'v': sscanf(optarg, "%lf,%lf", &cfg.knots, &cfg.course); break;
+            case 'j': cfg.jitter_pct = (uint8_t)atoi(optarg); break;
+            case 'u': cfg.outputs    = GNSS_SIM_DEFAULT_OUTPUTS | (1u << GNSS_SIM_NAV_PVT); break;
+            case 'l': link           = optarg; break;
+            case 'x': script         = optarg; break;
+            case 't': duration_ms    = (uint32_t)strtoul(optarg, NULL, 10) * 1000; break;
+            default:  usage(); return 2;
+        }
+    }
+    if (script && load_script(script, &events, &event_count) != 0)
+    {
+        perror(script);
+        return 1;
+    }
+
+    cfg.write = write_pty;
+    cfg.seed  = (uint32_t)getpid();
+    if (gnss_sim_init(&sim, &cfg, 0) != 0)
+    {
+        usage();
+        return 2;
+    }
+    if (open_pty(sim.baud, link) != 0)
+    {
+        perror("gnsssim: pty");
+        return 1;
+    }
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    while (running)
+    {
+        struct pollfd pfd = { master, POLLIN, 0 };
+        uint8_t       buf[512];
+        uint32_t      now = now_ms(&t0);
+
+        if (duration_ms && now >= duration_ms) break;
+        while (next_event < event_count && events[next_event].at_ms <= now) run_event(&events[next_event++], now);
+
+        if (poll(&pfd, 1, POLL_MS) > 0 && (pfd.revents & POLLIN))
+        {
+            ssize_t n = read(master, buf, sizeof(buf));
+
+            if (n > 0)
+            {
+                if (line_ok()) gnss_sim_input(&sim, buf, (int)n, now_ms(&t0));
+                else noise += (uint64_t)n;
+            }
+        }
+        gnss_sim_poll(&sim, now_ms(&t0));
+    }
+
+    fprintf(stderr, "%u epochs (%u with a fix), %u starts, last TTFF %u ms\n",
+            sim.stats.epochs, sim.stats.fixes, sim.stats.starts, sim.stats.last_ttff_ms);
+    fprintf(stderr, "%u commands, %u acks, %u naks, %u bad; %llu bytes out, %u dropped, %llu garbled\n",
+            sim.stats.commands, sim.stats.acks, sim.stats.naks, sim.stats.bad_commands,
+            (unsigned long long)sim.stats.bytes, sim.stats.overflow, (unsigned long long)noise);
+
+    if (link) unlink(link);
+    close(slave);
+    close(master);
+    free(events);
+    return 0;
+}
@@ -0,0 +1,271 @@
+/*
+ * power_test.c - gps_power against the virtual receiver.
+ *
+ *   power_test
+ *
+ * The duty cycling policy (NMEA/gps_power) drives gnss_sim in process on
+ * a virtual clock: its PMTK commands go to gnss_sim_input, its wake hook
+ * is the WAKEUP pin, and the receiver's RMC / GGA are decoded and fed
+ * back with powerFix. One trip, each phase checked for the command acks
+ * and the receiver states the mode asks for:
+ *   1. driving: continuous, tracking at 1 Hz
+ *   2. parked: PMTK225,2 acked, the receiver cycles run / standby and
+ *      still reports in its run phases
+ *   3. moving off while the receiver sleeps out a period: woken,
+ *      PMTK225,0 and PMTK220 acked, tracking at 1 Hz
+ *   4. parked long: periodic again, then PMTK225,4 acked, the receiver is
+ *      in backup and silent
+ *   5. a fix requested from backup: the receiver is woken (hot start),
+ *      PMTK225,0 acked, the fix is in before the deadline, back to backup
+ *   6. driving again: woken, PMTK225,0 and PMTK220 acked, tracking at 1 Hz
+ * Every command sent must be acked, none refused.
+ */
+
+#include "gnss_sim.h"
+#include "gps_power.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STEP_MS     50
+#define KNOTS       20.0
+#define LINE_MAX    128
+
+static GNSS_SIM         sim;
+static POWER_MANAGER    pm;
+static uint32_t         now;
+
+/* host side of the line */
+static char             line[LINE_MAX];
+static int              line_len;
+static GPSSTRUCT        gps;
+static NMEA_HISTORY     gga_hist, rmc_hist;
+static uint32_t         fixes, rx_bytes, last_fix_tick;
+
+/* commands */
+static uint32_t         sent[2], acked[2], refused;         // [0] PMTK225, [1] PMTK220
+static long             last_225 = -1;                      // first argument of the last PMTK225 sent
+
+/* transitions seen */
+static uint32_t         moves[GNSS_SIM_BACKUP + 1][GNSS_SIM_BACKUP + 1];
+static gnss_sim_state   sim_state;
+
+
+/* notes a receiver state change; called wherever one can happen */
+static void watch(void)
+{
+    if (sim.state != sim_state) moves[sim_state][sim.state]++;
+    sim_state = sim.state;
+}
+
+static void send_command(const char *sentence)
+{
+    if (strncmp(sentence, "$PMTK225,", 9) == 0)
+    {
+        sent[0]++;
+        last_225 = strtol(sentence + 9, NULL, 10);
+    }
+    if (strncmp(sentence, "$PMTK220,", 9) == 0) sent[1]++;
+    gnss_sim_input(&sim, (const uint8_t *)sentence, (int)strlen(sentence), now);
+    watch();
+}
+
+static void wake_pin(void)
+{
+    gnss_sim_wake(&sim, now);
+    watch();
+}
+
+static void host_line(void)
+{
+    unsigned cmd;
+    int      flag;
+
+    line[line_len] = '\0';
+    if (sscanf(line, "$PMTK001,%u,%d", &cmd, &flag) == 2)
+    {
+        if (flag != 3) refused++;
+        else if (cmd == 225) acked[0]++;
+        else if (cmd == 220) acked[1]++;
+    }
+    else if (line_len > 7 && memcmp(line + 3, "RMC,", 4) == 0)
+    {
+        decodeRMCIncremental(line, &gps.rmcstruct, &rmc_hist);
+    }
+    else if (line_len > 7 && memcmp(line + 3, "GGA,", 4) == 0)
+    {
+        decodeGGAIncremental(line, &gps.ggastruct, &gga_hist);
+        watch();
+        if (gps.ggastruct.is_fix_valid)
+        {
+            fixes++;
+            last_fix_tick = now;
+        }
+        powerFix(&pm, &gps, now);
+    }
+}
+
+/* receiver -> host: split into lines */
+static int host_rx(void *ctx, const uint8_t *data, int len)
+{
+    (void)ctx;
+    rx_bytes += (uint32_t)len;
+    for (int i = 0; i < len; i++)
+    {
+        char c = (char)data[i];
+
+        if (c == '$') line_len = 0;
+        if (c == '\r' || c == '\n')
+        {
+            if (line_len) host_line();
+            line_len = 0;
+        }
+        else if (line_len < LINE_MAX - 1)
+        {
+            line[line_len++] = c;
+        }
+    }
+    return len;
+}
+
+/* runs both sides up to until_ms */
+static void run(uint32_t until_ms)
+{
+    uint32_t next_poll = now;
+
+    while ((int32_t)(until_ms - now) > 0)
+    {
+        now += STEP_MS;
+        gnss_sim_poll(&sim, now);
+        watch();
+        if ((int32_t)(now - next_poll) >= 0) next_poll = now + powerPoll(&pm, now);
+    }
+}
+
+static void drive(double knots, uint8_t moving)
+{
+    gnss_sim_motion(&sim, knots, 90.0, now);
+    powerMotion(&pm, moving, now);
+}
+
+static int report(const char *name, int ok, const char *detail)
+{
+    printf("%-38s %s  (%s)\n", name, ok ? "ok" : "FAILED", detail);
+    return ok;
+}
+
+int main(void)
+{
+    static const char *states[] = { "acquiring", "tracking", "standby", "backup" };
+    GNSS_SIM_CONFIG cfg;
+    char            detail[160];
+    int             ok = 1, phase_ok;
+    uint32_t        f0, b0, s0[2], a0[2], parked;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.start     = GNSS_SIM_HOT;
+    cfg.latitude  = 48.1;
+    cfg.longitude = 11.5;
+    cfg.altitude  = 520.0;
+    cfg.knots     = KNOTS;
+    cfg.course    = 90.0;
+    cfg.seed      = 1;
+    cfg.write     = host_rx;
+
+    initGPS(&gps);
+    initHistory(&gga_hist);
+    initHistory(&rmc_hist);
+    if (gnss_sim_init(&sim, &cfg, now) != 0) return 2;
+    initPower(&pm, now);
+    pm.send   = send_command;
+    pm.wake   = wake_pin;
+    sim_state = sim.state;
+
+    /* 1: driving */
+    drive(KNOTS, 1);
+    run(120000);
+    phase_ok = pm.mode == POWER_CONTINUOUS && sim.state == GNSS_SIM_TRACKING && fixes >= 115;
+    snprintf(detail, sizeof(detail), "%u fixes in 120 s, receiver %s", fixes, states[sim.state]);
+    ok &= report("1 driving: continuous", phase_ok, detail);
+
+    /* 2: parked, periodic standby */
+    drive(0.0, 0);
+    parked = now;
+    memcpy(s0, sent, sizeof(s0));
+    memcpy(a0, acked, sizeof(a0));
+    run(parked + pm.park_ms + 5000);
+    int lowrate = pm.mode == POWER_LOWRATE && last_225 == 2 && sent[0] == s0[0] + 1 && acked[0] == a0[0] + 1;
+
+    memset(moves, 0, sizeof(moves));
+    f0 = fixes;
+    run(now + 60000);
+    phase_ok = lowrate && pm.mode == POWER_LOWRATE && moves[GNSS_SIM_TRACKING][GNSS_SIM_STANDBY] >= 5 &&
+               moves[GNSS_SIM_STANDBY][GNSS_SIM_TRACKING] >= 5 && fixes - f0 >= 6 && fixes - f0 <= 60 * pm.run_ms / pm.lowrate_ms;
+    snprintf(detail, sizeof(detail), "PMTK225,2 %s, %u runs and %u fixes in 60 s", acked[0] > a0[0] ? "acked" : "NOT acked",
+             moves[GNSS_SIM_STANDBY][GNSS_SIM_TRACKING], fixes - f0);
+    ok &= report("2 parked: periodic standby", phase_ok, detail);
+
+    /* 3: moving off in a standby phase */
+    while (sim.state != GNSS_SIM_STANDBY) run(now + STEP_MS);
+    memcpy(a0, acked, sizeof(a0));
+    drive(KNOTS, 1);
+    run(now + 5000);
+    f0 = fixes;
+    run(now + 30000);
+    phase_ok = pm.mode == POWER_CONTINUOUS && sim.state == GNSS_SIM_TRACKING && last_225 == 0 && acked[0] == a0[0] + 1 &&
+               acked[1] == a0[1] + 1 && fixes - f0 >= 29;
+    snprintf(detail, sizeof(detail), "PMTK225,0 %s, PMTK220 %s, %u fixes in 30 s", acked[0] > a0[0] ? "acked" : "NOT acked",
+             acked[1] > a0[1] ? "acked" : "NOT acked", fixes - f0);
+    ok &= report("3 moving off asleep: continuous", phase_ok, detail);
+
+    /* 4: parked long, backup */
+    drive(0.0, 0);
+    parked = now;
+    memcpy(s0, sent, sizeof(s0));
+    memcpy(a0, acked, sizeof(a0));
+    run(parked + pm.backup_ms + 15000);
+    b0 = rx_bytes;
+    f0 = fixes;
+    run(now + 60000);
+    phase_ok = pm.mode == POWER_BACKUP && sim.state == GNSS_SIM_BACKUP && last_225 == 4 && sent[0] == s0[0] + 2 &&
+               acked[0] == a0[0] + 2 && rx_bytes == b0 && fixes == f0;
+    snprintf(detail, sizeof(detail), "PMTK225,4 %s, receiver %s, %u bytes in 60 s", acked[0] > a0[0] ? "acked" : "NOT acked",
+             states[sim.state], rx_bytes - b0);
+    ok &= report("4 parked long: backup", phase_ok, detail);
+
+    /* 5: a fix wanted in 5 min */
+    uint32_t deadline = now + 300000, wakes = pm.wakes;
+
+    memset(moves, 0, sizeof(moves));
+    memcpy(a0, acked, sizeof(a0));
+    f0 = fixes;
+    powerRequestFix(&pm, deadline);
+    run(deadline + 30000);
+    phase_ok = pm.mode == POWER_BACKUP && sim.state == GNSS_SIM_BACKUP && pm.wakes == wakes + 1 && pm.missed == 0 &&
+               moves[GNSS_SIM_BACKUP][GNSS_SIM_ACQUIRING] == 1 && moves[GNSS_SIM_ACQUIRING][GNSS_SIM_TRACKING] == 1 &&
+               moves[GNSS_SIM_TRACKING][GNSS_SIM_BACKUP] == 1 && fixes > f0 && (int32_t)(deadline - last_fix_tick) >= 0 &&
+               acked[0] == a0[0] + 2;
+    snprintf(detail, sizeof(detail), "fix %.1f s before the deadline, TTFF %u ms, %u PMTK225 acked",
+             (double)(int32_t)(deadline - last_fix_tick) / 1000, sim.stats.last_ttff_ms, acked[0] - a0[0]);
+    ok &= report("5 fix from backup: woken in time", phase_ok, detail);
+
+    /* 6: driving again */
+    memcpy(s0, sent, sizeof(s0));
+    memcpy(a0, acked, sizeof(a0));
+    drive(KNOTS, 1);
+    run(now + 5000);
+    f0 = fixes;
+    run(now + 60000);
+    phase_ok = pm.mode == POWER_CONTINUOUS && sim.state == GNSS_SIM_TRACKING && last_225 == 0 && acked[0] == a0[0] + 1 &&
+               acked[1] == a0[1] + 1 && fixes - f0 >= 58;
+    snprintf(detail, sizeof(detail), "PMTK225,0 %s, PMTK220 %s, %u fixes in 60 s", acked[0] > a0[0] ? "acked" : "NOT acked",
+             acked[1] > a0[1] ? "acked" : "NOT acked", fixes - f0);
+    ok &= report("6 driving again: continuous", phase_ok, detail);
+
+    phase_ok = sent[0] == acked[0] && sent[1] == acked[1] && refused == 0 && sim.stats.bad_commands == 0;
+    snprintf(detail, sizeof(detail), "PMTK225 %u/%u, PMTK220 %u/%u acked, %u refused", acked[0], sent[0], acked[1], sent[1], refused);
+    ok &= report("every command acked", phase_ok, detail);
+
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}